@@ -21,6 +21,8 @@
  */
 #pragma once
 
+#include <atomic>
+#include <thread>
 #include <boost/multi_index_container.hpp>
 
 #include "dnsname.hh"
@@ -122,10 +124,35 @@ template <typename S, typename T> uint64_t pruneLockedCollectionsVector(std::vec
   return totErased;
 }
 
-template <typename S, typename C, typename T> uint64_t pruneMutexCollectionsVector(C& container, std::vector<T>& maps, uint64_t maxCached, uint64_t cacheSize)
+// calls func(idx) for every idx in [0, count), spreading the calls over 'workers' threads, the calling one included
+template <typename F> void runOnShards(size_t count, size_t workers, const F& func)
+{
+  std::atomic<size_t> next{0};
+  auto worker = [&next, count, &func]() {
+    for (size_t idx = next++; idx < count; idx = next++) {
+      func(idx);
+    }
+  };
+
+  workers = std::min(workers, count);
+  std::vector<std::thread> threads;
+  for (size_t idx = 1; idx < workers; idx++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+// the maximum number of entries removed from a shard while trimming before the lock is released, so that lookups are not kept waiting
+static const uint64_t s_pruneEntriesPerLock = 1000;
+
+// the shards are processed in parallel when 'workers' is larger than 1, container.preRemoval() should therefore only touch the shard it is passed
+template <typename S, typename C, typename T> uint64_t pruneMutexCollectionsVector(C& container, std::vector<T>& maps, uint64_t maxCached, uint64_t cacheSize, size_t workers = 1)
 {
   time_t now = time(nullptr);
-  uint64_t totErased = 0;
+  std::atomic<uint64_t> totErased{0};
   uint64_t toTrim = 0;
   uint64_t lookAt = 0;
 
@@ -143,7 +170,11 @@ template <typename S, typename C, typename T> uint64_t pruneMutexCollectionsVect
     return 0;
   }
 
-  for (auto& content : maps) {
+  runOnShards(maps_size, workers, [&](size_t idx) {
+    if (toTrim && totErased >= toTrim) {
+      return;
+    }
+    auto& content = maps[idx];
     auto mc = content.lock();
     mc->invalidate();
     auto& sidx = boost::multi_index::get<S>(mc->d_map);
@@ -165,36 +196,45 @@ template <typename S, typename C, typename T> uint64_t pruneMutexCollectionsVect
         break;
     }
     totErased += erased;
-    if (toTrim && totErased >= toTrim)
-      break;
-  }
+  });
 
   if (totErased >= toTrim) { // done
     return totErased;
   }
 
-  toTrim -= totErased;
+  std::atomic<uint64_t> remaining{toTrim - totErased};
 
-  while (true) {
-    size_t pershard = toTrim / maps_size + 1;
-    for (auto& content : maps) {
+  while (remaining > 0) {
+    const uint64_t pershard = std::min(remaining / maps_size + 1, s_pruneEntriesPerLock);
+    std::atomic<uint64_t> removedInPass{0};
+    runOnShards(maps_size, workers, [&](size_t idx) {
+      auto& content = maps[idx];
       auto mc = content.lock();
       mc->invalidate();
       auto& sidx = boost::multi_index::get<S>(mc->d_map);
       size_t removed = 0;
       for (auto i = sidx.begin(); i != sidx.end() && removed < pershard; removed++) {
+        uint64_t current = remaining.load();
+        do {
+          if (current == 0) {
+            return;
+          }
+        } while (!remaining.compare_exchange_weak(current, current - 1));
+
         container.preRemoval(*mc, *i);
         i = sidx.erase(i);
         --content.d_entriesCount;
         totErased++;
-        toTrim--;
-        if (toTrim == 0) {
-          return totErased;
-        }
+        removedInPass++;
       }
+    });
+
+    if (removedInPass == 0) {
+      // every shard is empty
+      break;
     }
   }
-  // Not reached
+
   return totErased;
 }
 
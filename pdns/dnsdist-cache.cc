@@ -79,11 +79,16 @@ bool DNSDistPacketCache::cachedValueMatches(const CacheValue& cachedValue, uint1
   return true;
 }
 
-void DNSDistPacketCache::insertLocked(CacheShard& shard, std::unordered_map<uint32_t,CacheValue>& map, uint32_t key, CacheValue& newValue)
+bool DNSDistPacketCache::insertLocked(CacheShard& shard, std::unordered_map<uint32_t,CacheValue>& map, uint32_t key, CacheValue& newValue)
 {
   /* check again now that we hold the lock to prevent a race */
   if (map.size() >= (d_maxEntries / d_shardCount)) {
-    return;
+    return false;
+  }
+
+  if (isRefreshEnabled()) {
+    /* any pending refresh for this key is now either done or irrelevant */
+    shard.d_pendingRefreshes.lock()->erase(key);
   }
 
   std::unordered_map<uint32_t,CacheValue>::iterator it;
@@ -92,7 +97,7 @@ void DNSDistPacketCache::insertLocked(CacheShard& shard, std::unordered_map<uint
 
   if (result) {
     ++shard.d_entriesCount;
-    return;
+    return true;
   }
 
   /* in case of collision, don't override the existing entry
@@ -102,21 +107,27 @@ void DNSDistPacketCache::insertLocked(CacheShard& shard, std::unordered_map<uint
 
   if (!wasExpired && !cachedValueMatches(value, newValue.queryFlags, newValue.qname, newValue.qtype, newValue.qclass, newValue.receivedOverUDP, newValue.dnssecOK, newValue.subnet)) {
     d_insertCollisions++;
-    return;
+    return false;
   }
 
   /* if the existing entry had a longer TTD, keep it */
   if (newValue.validity <= value.validity) {
-    return;
+    return true;
   }
 
   value = newValue;
+  return true;
+}
+
+bool DNSDistPacketCache::insert(uint32_t key, const boost::optional<Netmask>& subnet, uint16_t queryFlags, bool dnssecOK, const DNSName& qname, uint16_t qtype, uint16_t qclass, const PacketBuffer& response, bool receivedOverUDP, uint8_t rcode, boost::optional<uint32_t> tempFailureTTL, const DNSPacketSummary* summary)
+{
+  return insertValue(key, subnet, queryFlags, dnssecOK, qname, qtype, qclass, response, receivedOverUDP, rcode, tempFailureTTL, summary, boost::none);
 }
 
-void DNSDistPacketCache::insert(uint32_t key, const boost::optional<Netmask>& subnet, uint16_t queryFlags, bool dnssecOK, const DNSName& qname, uint16_t qtype, uint16_t qclass, const PacketBuffer& response, bool receivedOverUDP, uint8_t rcode, boost::optional<uint32_t> tempFailureTTL)
+bool DNSDistPacketCache::insertValue(uint32_t key, const boost::optional<Netmask>& subnet, uint16_t queryFlags, bool dnssecOK, const DNSName& qname, uint16_t qtype, uint16_t qclass, const PacketBuffer& response, bool receivedOverUDP, uint8_t rcode, boost::optional<uint32_t> tempFailureTTL, const DNSPacketSummary* summary, const boost::optional<uint32_t>& noECSKey)
 {
   if (response.size() < sizeof(dnsheader)) {
-    return;
+    return false;
   }
 
   uint32_t minTTL;
@@ -124,16 +135,22 @@ void DNSDistPacketCache::insert(uint32_t key, const boost::optional<Netmask>& su
   if (rcode == RCode::ServFail || rcode == RCode::Refused) {
     minTTL = tempFailureTTL == boost::none ? d_tempFailureTTL : *tempFailureTTL;
     if (minTTL == 0) {
-      return;
+      return false;
     }
   }
   else {
     bool seenAuthSOA = false;
-    minTTL = getMinTTL(reinterpret_cast<const char*>(response.data()), response.size(), &seenAuthSOA);
+    if (summary != nullptr) {
+      minTTL = summary->minTTL;
+      seenAuthSOA = summary->seenAuthSOA;
+    }
+    else {
+      minTTL = getMinTTL(reinterpret_cast<const char*>(response.data()), response.size(), &seenAuthSOA);
+    }
 
     /* no TTL found, we don't want to cache this */
     if (minTTL == std::numeric_limits<uint32_t>::max()) {
-      return;
+      return false;
     }
 
     if (rcode == RCode::NXDomain || (rcode == RCode::NoError && seenAuthSOA)) {
@@ -145,14 +162,14 @@ void DNSDistPacketCache::insert(uint32_t key, const boost::optional<Netmask>& su
 
     if (minTTL < d_minTTL) {
       d_ttlTooShorts++;
-      return;
+      return false;
     }
   }
 
   uint32_t shardIndex = getShardIndex(key);
 
   if (d_shards.at(shardIndex).d_entriesCount >= (d_maxEntries / d_shardCount)) {
-    return;
+    return false;
   }
 
   const time_t now = time(nullptr);
@@ -169,6 +186,10 @@ void DNSDistPacketCache::insert(uint32_t key, const boost::optional<Netmask>& su
   newValue.dnssecOK = dnssecOK;
   newValue.value = std::string(response.begin(), response.end());
   newValue.subnet = subnet;
+  if (noECSKey) {
+    newValue.noECSKey = *noECSKey;
+    newValue.scoped = true;
+  }
 
   auto& shard = d_shards.at(shardIndex);
 
@@ -177,21 +198,37 @@ void DNSDistPacketCache::insert(uint32_t key, const boost::optional<Netmask>& su
 
     if (!w.owns_lock()) {
       d_deferredInserts++;
-      return;
+      return false;
     }
-    insertLocked(shard, *w, key, newValue);
+    return insertLocked(shard, *w, key, newValue);
   }
   else {
     auto w = shard.d_map.write_lock();
 
-    insertLocked(shard, *w, key, newValue);
+    return insertLocked(shard, *w, key, newValue);
   }
 }
 
-bool DNSDistPacketCache::get(DNSQuestion& dq, uint16_t queryId, uint32_t* keyOut, boost::optional<Netmask>& subnet, bool dnssecOK, bool receivedOverUDP, uint32_t allowExpired, bool skipAging)
+bool DNSDistPacketCache::claimRefresh(CacheShard& shard, uint32_t key, time_t now)
 {
-  const auto& dnsQName = dq.qname->getStorage();
-  uint32_t key = getKey(dnsQName, dq.qname->wirelength(), dq.getData(), receivedOverUDP);
+  auto pending = shard.d_pendingRefreshes.lock();
+  auto [it, inserted] = pending->insert({key, now});
+  if (!inserted) {
+    if ((now - it->second) < s_refreshClaimDuration) {
+      /* a refresh is already in progress */
+      return false;
+    }
+    /* the previous refresh query was most likely lost, try again */
+    it->second = now;
+  }
+
+  ++d_refreshes;
+  return true;
+}
+
+bool DNSDistPacketCache::get(DNSQuestion& dq, uint16_t queryId, uint32_t* keyOut, boost::optional<Netmask>& subnet, bool dnssecOK, bool receivedOverUDP, uint32_t allowExpired, bool skipAging, bool refreshAllowed)
+{
+  uint32_t key = getKey(dq.qname->getStorage(), dq.qname->wirelength(), dq.getData(), receivedOverUDP);
 
   if (keyOut) {
     *keyOut = key;
@@ -201,10 +238,17 @@ bool DNSDistPacketCache::get(DNSQuestion& dq, uint16_t queryId, uint32_t* keyOut
     getClientSubnet(dq.getData(), dq.qname->wirelength(), subnet);
   }
 
+  return getByKey(dq, queryId, key, subnet, dnssecOK, receivedOverUDP, allowExpired, skipAging, refreshAllowed, nullptr);
+}
+
+bool DNSDistPacketCache::getByKey(DNSQuestion& dq, uint16_t queryId, uint32_t key, const boost::optional<Netmask>& subnet, bool dnssecOK, bool receivedOverUDP, uint32_t allowExpired, bool skipAging, bool refreshAllowed, bool* unusable)
+{
+  const auto& dnsQName = dq.qname->getStorage();
   uint32_t shardIndex = getShardIndex(key);
   time_t now = time(nullptr);
   time_t age;
   bool stale = false;
+  bool refreshNeeded = false;
   auto& response = dq.getMutableData();
   auto& shard = d_shards.at(shardIndex);
   {
@@ -216,6 +260,9 @@ bool DNSDistPacketCache::get(DNSQuestion& dq, uint16_t queryId, uint32_t* keyOut
 
     std::unordered_map<uint32_t,CacheValue>::const_iterator it = map->find(key);
     if (it == map->end()) {
+      if (unusable) {
+        *unusable = true;
+      }
       d_misses++;
       return false;
     }
@@ -223,12 +270,23 @@ bool DNSDistPacketCache::get(DNSQuestion& dq, uint16_t queryId, uint32_t* keyOut
     const CacheValue& value = it->second;
     if (value.validity <= now) {
       if ((now - value.validity) >= static_cast<time_t>(allowExpired)) {
-        d_misses++;
-        return false;
-      }
-      else {
-        stale = true;
+        /* serve-stale-while-revalidate */
+        if (!refreshAllowed || (now - value.validity) >= static_cast<time_t>(d_staleWhileRevalidateTTL)) {
+          if (unusable) {
+            *unusable = true;
+          }
+          d_misses++;
+          return false;
+        }
+        refreshNeeded = true;
       }
+      stale = true;
+    }
+    else if (refreshAllowed && d_prefetchPercentage > 0) {
+      /* prefetch entries that are about to expire */
+      const uint64_t remaining = value.validity - now;
+      const uint64_t ttl = value.validity - value.added;
+      refreshNeeded = (remaining * 100) <= (ttl * d_prefetchPercentage);
     }
 
     if (value.len < sizeof(dnsheader)) {
@@ -237,25 +295,37 @@ bool DNSDistPacketCache::get(DNSQuestion& dq, uint16_t queryId, uint32_t* keyOut
 
     /* check for collision */
     if (!cachedValueMatches(value, *(getFlagsFromDNSHeader(dq.getHeader())), *dq.qname, dq.qtype, dq.qclass, receivedOverUDP, dnssecOK, subnet)) {
+      if (unusable) {
+        *unusable = true;
+      }
       d_lookupCollisions++;
       return false;
     }
 
+    const size_t dnsQNameLen = dnsQName.length();
+    if (value.len > sizeof(dnsheader) && value.len < (sizeof(dnsheader) + dnsQNameLen)) {
+      return false;
+    }
+
+    /* only claim the refresh once we know the cached answer is going to be used */
+    if (refreshNeeded && claimRefresh(shard, key, now)) {
+      /* we need a copy of the query before it is overwritten by the response */
+      dq.cacheRefreshQuery = std::make_unique<PacketBuffer>(response);
+    }
+
     response.resize(value.len);
     memcpy(&response.at(0), &queryId, sizeof(queryId));
     memcpy(&response.at(sizeof(queryId)), &value.value.at(sizeof(queryId)), sizeof(dnsheader) - sizeof(queryId));
 
     if (value.len == sizeof(dnsheader)) {
       /* DNS header only, our work here is done */
+      if (stale) {
+        d_staleHits++;
+      }
       d_hits++;
       return true;
     }
 
-    const size_t dnsQNameLen = dnsQName.length();
-    if (value.len < (sizeof(dnsheader) + dnsQNameLen)) {
-      return false;
-    }
-
     memcpy(&response.at(sizeof(dnsheader)), dnsQName.c_str(), dnsQNameLen);
     if (value.len > (sizeof(dnsheader) + dnsQNameLen)) {
       memcpy(&response.at(sizeof(dnsheader) + dnsQNameLen), &value.value.at(sizeof(dnsheader) + dnsQNameLen), value.len - (sizeof(dnsheader) + dnsQNameLen));
@@ -279,10 +349,109 @@ bool DNSDistPacketCache::get(DNSQuestion& dq, uint16_t queryId, uint32_t* keyOut
     }
   }
 
+  if (stale) {
+    d_staleHits++;
+  }
   d_hits++;
   return true;
 }
 
+uint32_t DNSDistPacketCache::getScopedKey(uint32_t noECSKey, const Netmask& scope)
+{
+  const Netmask normalized = scope.getNormalized();
+  const auto& network = normalized.getNetwork();
+  const uint8_t bits = normalized.getBits();
+  uint32_t result = burtle(&bits, sizeof(bits), noECSKey);
+  if (network.isIPv4()) {
+    result = burtle(reinterpret_cast<const unsigned char*>(&network.sin4.sin_addr.s_addr), sizeof(network.sin4.sin_addr.s_addr), result);
+  }
+  else {
+    result = burtle(reinterpret_cast<const unsigned char*>(&network.sin6.sin6_addr.s6_addr), sizeof(network.sin6.sin6_addr.s6_addr), result);
+  }
+  return result;
+}
+
+bool DNSDistPacketCache::insertScoped(uint32_t noECSKey, const Netmask& scope, uint16_t queryFlags, bool dnssecOK, const DNSName& qname, uint16_t qtype, uint16_t qclass, const PacketBuffer& response, bool receivedOverUDP, uint8_t rcode, boost::optional<uint32_t> tempFailureTTL, const DNSPacketSummary* summary)
+{
+  const Netmask normalized = scope.getNormalized();
+  if (!insertValue(getScopedKey(noECSKey, normalized), normalized, queryFlags, dnssecOK, qname, qtype, qclass, response, receivedOverUDP, rcode, tempFailureTTL, summary, noECSKey)) {
+    return false;
+  }
+
+  auto& shard = d_shards.at(getShardIndex(noECSKey));
+  auto index = shard.d_ecsIndex.write_lock();
+  (*index)[noECSKey].insert(normalized);
+  return true;
+}
+
+bool DNSDistPacketCache::getScoped(DNSQuestion& dq, uint16_t queryId, uint32_t noECSKey, const Netmask& source, bool dnssecOK, bool receivedOverUDP, uint32_t allowExpired)
+{
+  auto& shard = d_shards.at(getShardIndex(noECSKey));
+
+  /* the most specific scope covering the client might be gone (expired, expunged) while a less specific one is still valid,
+     so remove the stale scopes from the index as we go */
+  for (size_t attempt = 0; attempt < s_maxScopedLookupAttempts; attempt++) {
+    Netmask scope;
+    {
+      auto index = shard.d_ecsIndex.try_read_lock();
+      if (!index.owns_lock()) {
+        d_deferredLookups++;
+        return false;
+      }
+
+      const auto it = index->find(noECSKey);
+      if (it == index->end()) {
+        return false;
+      }
+
+      const auto* best = it->second.lookup(source);
+      if (best == nullptr) {
+        return false;
+      }
+      scope = best->first;
+    }
+
+    bool unusable = false;
+    if (getByKey(dq, queryId, getScopedKey(noECSKey, scope), scope, dnssecOK, receivedOverUDP, allowExpired, false, false, &unusable)) {
+      d_scopedHits++;
+      return true;
+    }
+
+    if (!unusable) {
+      return false;
+    }
+
+    auto index = shard.d_ecsIndex.write_lock();
+    auto it = index->find(noECSKey);
+    if (it != index->end()) {
+      it->second.erase(scope);
+      if (it->second.empty()) {
+        index->erase(it);
+      }
+    }
+  }
+
+  return false;
+}
+
+/* remove the scopes of entries that have just been removed from the cache from the ECS index,
+   so that the cost is proportional to the number of removed entries and not to the size of the index.
+   Scopes that become stale in another way (replaced after a collision) are removed during lookups */
+void DNSDistPacketCache::removeFromECSIndex(const std::vector<std::pair<uint32_t, Netmask>>& scopes)
+{
+  for (const auto& [noECSKey, scope] : scopes) {
+    auto index = d_shards.at(getShardIndex(noECSKey)).d_ecsIndex.write_lock();
+    auto it = index->find(noECSKey);
+    if (it == index->end()) {
+      continue;
+    }
+    it->second.erase(scope);
+    if (it->second.empty()) {
+      index->erase(it);
+    }
+  }
+}
+
 /* Remove expired entries, until the cache has at most
    upTo entries in it.
    If the cache has more than one shard, we will try hard
@@ -293,8 +462,21 @@ size_t DNSDistPacketCache::purgeExpired(size_t upTo, const time_t now)
   const size_t maxPerShard = upTo / d_shardCount;
 
   size_t removed = 0;
+  std::vector<std::pair<uint32_t, Netmask>> removedScopes;
 
   for (auto& shard : d_shards) {
+    if (isRefreshEnabled()) {
+      auto pending = shard.d_pendingRefreshes.lock();
+      for (auto it = pending->begin(); it != pending->end(); ) {
+        if ((now - it->second) >= s_refreshClaimDuration) {
+          it = pending->erase(it);
+        }
+        else {
+          ++it;
+        }
+      }
+    }
+
     auto map = shard.d_map.write_lock();
     if (map->size() <= maxPerShard) {
       continue;
@@ -306,6 +488,9 @@ size_t DNSDistPacketCache::purgeExpired(size_t upTo, const time_t now)
       const CacheValue& value = it->second;
 
       if (value.validity <= now) {
+        if (value.scoped) {
+          removedScopes.emplace_back(value.noECSKey, *value.subnet);
+        }
         it = map->erase(it);
         --toRemove;
         --shard.d_entriesCount;
@@ -316,6 +501,10 @@ size_t DNSDistPacketCache::purgeExpired(size_t upTo, const time_t now)
     }
   }
 
+  if (!removedScopes.empty()) {
+    removeFromECSIndex(removedScopes);
+  }
+
   return removed;
 }
 
@@ -329,6 +518,7 @@ size_t DNSDistPacketCache::expunge(size_t upTo)
   const size_t maxPerShard = upTo / d_shardCount;
 
   size_t removed = 0;
+  std::vector<std::pair<uint32_t, Netmask>> removedScopes;
 
   for (auto& shard : d_shards) {
     auto map = shard.d_map.write_lock();
@@ -344,23 +534,42 @@ size_t DNSDistPacketCache::expunge(size_t upTo)
 
     if (map->size() >= toRemove) {
       std::advance(endIt, toRemove);
+      if (d_ecsScopeSharing) {
+        for (auto it = beginIt; it != endIt; ++it) {
+          if (it->second.scoped) {
+            removedScopes.emplace_back(it->second.noECSKey, *it->second.subnet);
+          }
+        }
+      }
       map->erase(beginIt, endIt);
       shard.d_entriesCount -= toRemove;
       removed += toRemove;
     }
     else {
+      if (d_ecsScopeSharing) {
+        for (const auto& entry : *map) {
+          if (entry.second.scoped) {
+            removedScopes.emplace_back(entry.second.noECSKey, *entry.second.subnet);
+          }
+        }
+      }
       removed += map->size();
       map->clear();
       shard.d_entriesCount = 0;
     }
   }
 
+  if (!removedScopes.empty()) {
+    removeFromECSIndex(removedScopes);
+  }
+
   return removed;
 }
 
 size_t DNSDistPacketCache::expungeByName(const DNSName& name, uint16_t qtype, bool suffixMatch)
 {
   size_t removed = 0;
+  std::vector<std::pair<uint32_t, Netmask>> removedScopes;
 
   for (auto& shard : d_shards) {
     auto map = shard.d_map.write_lock();
@@ -369,6 +578,9 @@ size_t DNSDistPacketCache::expungeByName(const DNSName& name, uint16_t qtype, bo
       const CacheValue& value = it->second;
 
       if ((value.qname == name || (suffixMatch && value.qname.isPartOf(name))) && (qtype == QType::ANY || qtype == value.qtype)) {
+        if (value.scoped) {
+          removedScopes.emplace_back(value.noECSKey, *value.subnet);
+        }
         it = map->erase(it);
         --shard.d_entriesCount;
         ++removed;
@@ -378,6 +590,10 @@ size_t DNSDistPacketCache::expungeByName(const DNSName& name, uint16_t qtype, bo
     }
   }
 
+  if (!removedScopes.empty()) {
+    removeFromECSIndex(removedScopes);
+  }
+
   return removed;
 }
 
@@ -438,6 +654,20 @@ string DNSDistPacketCache::toString()
   return std::to_string(getSize()) + "/" + std::to_string(d_maxEntries);
 }
 
+uint64_t DNSDistPacketCache::getECSIndexSize()
+{
+  uint64_t count = 0;
+
+  for (auto& shard : d_shards) {
+    auto index = shard.d_ecsIndex.read_lock();
+    for (const auto& entry : *index) {
+      count += entry.second.size();
+    }
+  }
+
+  return count;
+}
+
 uint64_t DNSDistPacketCache::getEntriesCount()
 {
   return getSize();
@@ -484,3 +714,307 @@ void DNSDistPacketCache::setSkippedOptions(const std::unordered_set<uint16_t>& o
 {
   d_optionsToSkip = optionsToSkip;
 }
+
+/* Snapshot format: a header (magic and version) followed by the entries, each one being made of:
+   key (4), added (8), validity (8), qtype (2), qclass (2), query flags (2), response length (2),
+   flags (1), qname length (1), then the subnet if any (family (1), bits (1), address (4 or 16)),
+   the qname in wire format and finally the response.
+   Integers are stored in network byte order. */
+static const std::string s_snapshotMagic{"DNSDIST-PC-SNAPSHOT"};
+static const uint8_t s_snapshotVersion{2};
+static const size_t s_snapshotEntryFixedSize{30};
+static const size_t s_snapshotBufferSize{1024*1024};
+static const uint8_t s_snapshotFlagReceivedOverUDP{1 << 0};
+static const uint8_t s_snapshotFlagDNSSECOK{1 << 1};
+static const uint8_t s_snapshotFlagHasSubnet{1 << 2};
+static const uint8_t s_snapshotFlagScoped{1 << 3};
+
+static void snapshotAppendUInt16(std::string& out, uint16_t value)
+{
+  value = htons(value);
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void snapshotAppendUInt32(std::string& out, uint32_t value)
+{
+  value = htonl(value);
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void snapshotAppendUInt64(std::string& out, uint64_t value)
+{
+  snapshotAppendUInt32(out, static_cast<uint32_t>(value >> 32));
+  snapshotAppendUInt32(out, static_cast<uint32_t>(value & 0xffffffff));
+}
+
+static uint16_t snapshotGetUInt16(const uint8_t* data)
+{
+  uint16_t value;
+  memcpy(&value, data, sizeof(value));
+  return ntohs(value);
+}
+
+static uint32_t snapshotGetUInt32(const uint8_t* data)
+{
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return ntohl(value);
+}
+
+static uint64_t snapshotGetUInt64(const uint8_t* data)
+{
+  return (static_cast<uint64_t>(snapshotGetUInt32(data)) << 32) | snapshotGetUInt32(data + 4);
+}
+
+uint64_t DNSDistPacketCache::saveSnapshot(const std::string& fileName)
+{
+  std::string tempFileName = fileName + ".XXXXXX";
+  int fd = mkstemp(&tempFileName.at(0));
+  if (fd < 0) {
+    throw std::runtime_error("Unable to create a temporary file to save the packet cache snapshot to '" + fileName + "': " + stringerror());
+  }
+
+  auto fp = std::unique_ptr<FILE, int(*)(FILE*)>(fdopen(fd, "w"), fclose);
+  if (fp == nullptr) {
+    int err = errno;
+    close(fd);
+    unlink(tempFileName.c_str());
+    throw std::runtime_error("Unable to open a temporary file to save the packet cache snapshot to '" + fileName + "': " + stringerror(err));
+  }
+  setvbuf(fp.get(), nullptr, _IOFBF, s_snapshotBufferSize);
+
+  uint64_t count = 0;
+  bool success = true;
+  std::string buffer;
+  buffer.reserve(s_snapshotEntryFixedSize + 2 + 16 + 4 + 256 + std::numeric_limits<uint16_t>::max());
+  buffer.append(s_snapshotMagic);
+  buffer.append(1, static_cast<char>(s_snapshotVersion));
+  success = fwrite(buffer.data(), buffer.size(), 1, fp.get()) == 1;
+
+  for (auto& shard : d_shards) {
+    if (!success) {
+      break;
+    }
+
+    auto map = shard.d_map.read_lock();
+
+    for (const auto& entry : *map) {
+      const CacheValue& value = entry.second;
+      const auto& qname = value.qname.getStorage();
+      if (value.value.size() != value.len || qname.size() > std::numeric_limits<uint8_t>::max()) {
+        continue;
+      }
+
+      uint8_t flags = 0;
+      if (value.receivedOverUDP) {
+        flags |= s_snapshotFlagReceivedOverUDP;
+      }
+      if (value.dnssecOK) {
+        flags |= s_snapshotFlagDNSSECOK;
+      }
+      if (value.subnet) {
+        flags |= s_snapshotFlagHasSubnet;
+        /* scoped entries are only reachable via the ECS index, which is rebuilt from their no-ECS key on load */
+        if (value.scoped) {
+          flags |= s_snapshotFlagScoped;
+        }
+      }
+
+      buffer.clear();
+      snapshotAppendUInt32(buffer, entry.first);
+      snapshotAppendUInt64(buffer, static_cast<uint64_t>(value.added));
+      snapshotAppendUInt64(buffer, static_cast<uint64_t>(value.validity));
+      snapshotAppendUInt16(buffer, value.qtype);
+      snapshotAppendUInt16(buffer, value.qclass);
+      snapshotAppendUInt16(buffer, value.queryFlags);
+      snapshotAppendUInt16(buffer, value.len);
+      buffer.append(1, static_cast<char>(flags));
+      buffer.append(1, static_cast<char>(qname.size()));
+
+      if (value.subnet) {
+        const auto& network = value.subnet->getNetwork();
+        buffer.append(1, static_cast<char>(network.isIPv4() ? 4 : 6));
+        buffer.append(1, static_cast<char>(value.subnet->getBits()));
+        if (network.isIPv4()) {
+          buffer.append(reinterpret_cast<const char*>(&network.sin4.sin_addr.s_addr), sizeof(network.sin4.sin_addr.s_addr));
+        }
+        else {
+          buffer.append(reinterpret_cast<const char*>(&network.sin6.sin6_addr.s6_addr), sizeof(network.sin6.sin6_addr.s6_addr));
+        }
+        if (value.scoped) {
+          snapshotAppendUInt32(buffer, value.noECSKey);
+        }
+      }
+
+      buffer.append(qname.data(), qname.size());
+      buffer.append(value.value);
+
+      if (fwrite(buffer.data(), buffer.size(), 1, fp.get()) != 1) {
+        success = false;
+        break;
+      }
+      ++count;
+    }
+  }
+
+  if (success) {
+    success = fflush(fp.get()) == 0 && fsync(fileno(fp.get())) == 0;
+  }
+
+  int err = errno;
+  if (fclose(fp.release()) != 0) {
+    err = errno;
+    success = false;
+  }
+
+  if (!success || rename(tempFileName.c_str(), fileName.c_str()) != 0) {
+    if (success) {
+      err = errno;
+    }
+    unlink(tempFileName.c_str());
+    throw std::runtime_error("Error while saving the packet cache snapshot to '" + fileName + "': " + stringerror(err));
+  }
+
+  return count;
+}
+
+uint64_t DNSDistPacketCache::loadSnapshot(const std::string& fileName)
+{
+  auto fp = std::unique_ptr<FILE, int(*)(FILE*)>(fopen(fileName.c_str(), "r"), fclose);
+  if (fp == nullptr) {
+    throw std::runtime_error("Unable to open the packet cache snapshot '" + fileName + "': " + stringerror());
+  }
+  setvbuf(fp.get(), nullptr, _IOFBF, s_snapshotBufferSize);
+
+  std::string header(s_snapshotMagic.size() + 1, '\0');
+  if (fread(&header.at(0), header.size(), 1, fp.get()) != 1 || header.compare(0, s_snapshotMagic.size(), s_snapshotMagic) != 0) {
+    throw std::runtime_error("'" + fileName + "' is not a valid packet cache snapshot");
+  }
+  if (static_cast<uint8_t>(header.at(s_snapshotMagic.size())) != s_snapshotVersion) {
+    throw std::runtime_error("Unsupported version " + std::to_string(static_cast<uint8_t>(header.at(s_snapshotMagic.size()))) + " of the packet cache snapshot '" + fileName + "'");
+  }
+
+  const time_t now = time(nullptr);
+  const size_t maxPerShard = d_maxEntries / d_shardCount;
+  uint64_t count = 0;
+  std::array<uint8_t, s_snapshotEntryFixedSize> fixed;
+  std::array<uint8_t, 18> subnetData;
+  std::string qname;
+
+  for (;;) {
+    size_t got = fread(fixed.data(), 1, fixed.size(), fp.get());
+    if (got == 0 && feof(fp.get())) {
+      break;
+    }
+    if (got != fixed.size()) {
+      throw std::runtime_error("Truncated entry in the packet cache snapshot '" + fileName + "' after " + std::to_string(count) + " entries");
+    }
+
+    uint32_t key = snapshotGetUInt32(&fixed.at(0));
+    CacheValue newValue;
+    newValue.added = static_cast<time_t>(snapshotGetUInt64(&fixed.at(4)));
+    newValue.validity = static_cast<time_t>(snapshotGetUInt64(&fixed.at(12)));
+    newValue.qtype = snapshotGetUInt16(&fixed.at(20));
+    newValue.qclass = snapshotGetUInt16(&fixed.at(22));
+    newValue.queryFlags = snapshotGetUInt16(&fixed.at(24));
+    newValue.len = snapshotGetUInt16(&fixed.at(26));
+    const uint8_t flags = fixed.at(28);
+    const uint8_t qnameLen = fixed.at(29);
+    newValue.receivedOverUDP = flags & s_snapshotFlagReceivedOverUDP;
+    newValue.dnssecOK = flags & s_snapshotFlagDNSSECOK;
+
+    if (flags & s_snapshotFlagHasSubnet) {
+      if (fread(subnetData.data(), 2, 1, fp.get()) != 1) {
+        throw std::runtime_error("Truncated entry in the packet cache snapshot '" + fileName + "' after " + std::to_string(count) + " entries");
+      }
+      const uint8_t family = subnetData.at(0);
+      const uint8_t bits = subnetData.at(1);
+      if (family != 4 && family != 6) {
+        throw std::runtime_error("Invalid subnet family in the packet cache snapshot '" + fileName + "' after " + std::to_string(count) + " entries");
+      }
+      const size_t addrLen = family == 4 ? 4 : 16;
+      if (fread(&subnetData.at(2), addrLen, 1, fp.get()) != 1) {
+        throw std::runtime_error("Truncated entry in the packet cache snapshot '" + fileName + "' after " + std::to_string(count) + " entries");
+      }
+      newValue.subnet = Netmask(makeComboAddressFromRaw(family, reinterpret_cast<const char*>(&subnetData.at(2)), addrLen), bits);
+
+      if (flags & s_snapshotFlagScoped) {
+        if (fread(subnetData.data(), 4, 1, fp.get()) != 1) {
+          throw std::runtime_error("Truncated entry in the packet cache snapshot '" + fileName + "' after " + std::to_string(count) + " entries");
+        }
+        newValue.noECSKey = snapshotGetUInt32(subnetData.data());
+        newValue.scoped = true;
+      }
+    }
+
+    qname.resize(qnameLen);
+    newValue.value.resize(newValue.len);
+    if ((qnameLen > 0 && fread(&qname.at(0), qnameLen, 1, fp.get()) != 1) ||
+        (newValue.len > 0 && fread(&newValue.value.at(0), newValue.len, 1, fp.get()) != 1)) {
+      throw std::runtime_error("Truncated entry in the packet cache snapshot '" + fileName + "' after " + std::to_string(count) + " entries");
+    }
+
+    if (newValue.validity <= now || newValue.len < sizeof(dnsheader)) {
+      continue;
+    }
+
+    try {
+      newValue.qname = DNSName(qname.data(), qname.size(), 0, false);
+    }
+    catch (const std::exception& e) {
+      throw std::runtime_error("Invalid name in the packet cache snapshot '" + fileName + "' after " + std::to_string(count) + " entries: " + e.what());
+    }
+
+    auto& shard = d_shards.at(getShardIndex(key));
+    if (shard.d_entriesCount >= maxPerShard) {
+      continue;
+    }
+
+    {
+      auto map = shard.d_map.write_lock();
+      if (!insertLocked(shard, *map, key, newValue)) {
+        continue;
+      }
+    }
+    ++count;
+
+    if (newValue.scoped) {
+      auto index = d_shards.at(getShardIndex(newValue.noECSKey)).d_ecsIndex.write_lock();
+      (*index)[newValue.noECSKey].insert(*newValue.subnet);
+    }
+  }
+
+  return count;
+}
+
+namespace dnsdist
+{
+namespace PacketCacheSnapshots
+{
+  static LockGuarded<std::vector<std::pair<std::shared_ptr<DNSDistPacketCache>, std::string>>> s_snapshots;
+
+  void add(const std::shared_ptr<DNSDistPacketCache>& cache, const std::string& fileName)
+  {
+    s_snapshots.lock()->emplace_back(cache, fileName);
+  }
+
+  bool empty()
+  {
+    return s_snapshots.lock()->empty();
+  }
+
+  void saveAll()
+  {
+    auto snapshots = s_snapshots.lock();
+    for (const auto& [cache, fileName] : *snapshots) {
+      try {
+        auto count = cache->saveSnapshot(fileName);
+        infolog("Saved %d entries of the packet cache to %s", count, fileName);
+      }
+      catch (const std::exception& e) {
+        errlog("Error saving the packet cache snapshot to %s: %s", fileName, e.what());
+      }
+    }
+  }
+}
+}
@@ -31,14 +31,25 @@
 #include "ednsoptions.hh"
 
 struct DNSQuestion;
+struct DNSPacketSummary;
 
 class DNSDistPacketCache : boost::noncopyable
 {
 public:
   DNSDistPacketCache(size_t maxEntries, uint32_t maxTTL=86400, uint32_t minTTL=0, uint32_t tempFailureTTL=60, uint32_t maxNegativeTTL=3600, uint32_t staleTTL=60, bool dontAge=false, uint32_t shards=1, bool deferrableInsertLock=true, bool parseECS=false);
 
-  void insert(uint32_t key, const boost::optional<Netmask>& subnet, uint16_t queryFlags, bool dnssecOK, const DNSName& qname, uint16_t qtype, uint16_t qclass, const PacketBuffer& response, bool receivedOverUDP, uint8_t rcode, boost::optional<uint32_t> tempFailureTTL);
-  bool get(DNSQuestion& dq, uint16_t queryId, uint32_t* keyOut, boost::optional<Netmask>& subnet, bool dnssecOK, bool receivedOverUDP, uint32_t allowExpired = 0, bool skipAging = false);
+  /* returns true if the response has been stored, or if an existing equivalent entry with a longer TTL is present.
+     If the caller already walked the response via getDNSPacketSummary(), passing the summary saves another walk to find the lowest TTL */
+  bool insert(uint32_t key, const boost::optional<Netmask>& subnet, uint16_t queryFlags, bool dnssecOK, const DNSName& qname, uint16_t qtype, uint16_t qclass, const PacketBuffer& response, bool receivedOverUDP, uint8_t rcode, boost::optional<uint32_t> tempFailureTTL, const DNSPacketSummary* summary = nullptr);
+  /* if refreshAllowed is set and the entry is about to expire (prefetch) or has recently expired (stale-while-revalidate),
+     the first caller gets a copy of the query in dq.cacheRefreshQuery and is expected to send it to a backend so that
+     the entry gets refreshed, while the cached answer is still returned */
+  bool get(DNSQuestion& dq, uint16_t queryId, uint32_t* keyOut, boost::optional<Netmask>& subnet, bool dnssecOK, bool receivedOverUDP, uint32_t allowExpired = 0, bool skipAging = false, bool refreshAllowed = false);
+  /* ECS scope sharing: an answer to a query to which we added an ECS option is stored once for the scope returned by the
+     backend, indexed by the key of the query before the ECS option was added, and then used for every client whose
+     source netmask is covered by that scope, instead of being stored once per client subnet */
+  bool insertScoped(uint32_t noECSKey, const Netmask& scope, uint16_t queryFlags, bool dnssecOK, const DNSName& qname, uint16_t qtype, uint16_t qclass, const PacketBuffer& response, bool receivedOverUDP, uint8_t rcode, boost::optional<uint32_t> tempFailureTTL, const DNSPacketSummary* summary = nullptr);
+  bool getScoped(DNSQuestion& dq, uint16_t queryId, uint32_t noECSKey, const Netmask& source, bool dnssecOK, bool receivedOverUDP, uint32_t allowExpired = 0);
   size_t purgeExpired(size_t upTo, const time_t now);
   size_t expunge(size_t upTo=0);
   size_t expungeByName(const DNSName& name, uint16_t qtype=QType::ANY, bool suffixMatch=false);
@@ -53,8 +64,18 @@ public:
   uint64_t getInsertCollisions() const { return d_insertCollisions; }
   uint64_t getMaxEntries() const { return d_maxEntries; }
   uint64_t getTTLTooShorts() const { return d_ttlTooShorts; }
+  uint64_t getStaleHits() const { return d_staleHits; }
+  uint64_t getRefreshes() const { return d_refreshes; }
+  uint64_t getScopedHits() const { return d_scopedHits; }
   uint64_t getEntriesCount();
+  /* number of scopes in the ECS index */
+  uint64_t getECSIndexSize();
   uint64_t dump(int fd);
+  /* save all entries in a compact binary format, atomically replacing the existing file if any,
+     and return the number of saved entries */
+  uint64_t saveSnapshot(const std::string& fileName);
+  /* restore the unexpired entries from a file created by saveSnapshot(), returning the number of loaded entries */
+  uint64_t loadSnapshot(const std::string& fileName);
   void setSkippedOptions(const std::unordered_set<uint16_t>& optionsToSkip);
 
   bool isECSParsingEnabled() const { return d_parseECS; }
@@ -68,12 +89,43 @@ public:
     d_keepStaleData = keep;
   }
 
+  uint8_t getPrefetchPercentage() const
+  {
+    return d_prefetchPercentage;
+  }
+  void setPrefetchPercentage(uint8_t percentage)
+  {
+    d_prefetchPercentage = std::min(percentage, static_cast<uint8_t>(100));
+  }
+
+  uint32_t getStaleWhileRevalidateTTL() const
+  {
+    return d_staleWhileRevalidateTTL;
+  }
+  void setStaleWhileRevalidateTTL(uint32_t ttl)
+  {
+    d_staleWhileRevalidateTTL = ttl;
+  }
+
+  bool isRefreshEnabled() const
+  {
+    return d_prefetchPercentage > 0 || d_staleWhileRevalidateTTL > 0;
+  }
 
   void setECSParsingEnabled(bool enabled)
   {
     d_parseECS = enabled;
   }
 
+  bool isECSScopeSharingEnabled() const
+  {
+    return d_ecsScopeSharing;
+  }
+  void setECSScopeSharingEnabled(bool enabled)
+  {
+    d_ecsScopeSharing = enabled;
+  }
+
   uint32_t getKey(const DNSName::string_t& qname, size_t qnameWireLength, const PacketBuffer& packet, bool receivedOverUDP);
 
   static uint32_t getMinTTL(const char* packet, uint16_t length, bool* seenNoDataSOA);
@@ -92,9 +144,12 @@ private:
     uint16_t queryFlags{0};
     time_t added{0};
     time_t validity{0};
+    /* for ECS scope sharing, the key of the query without ECS, used to find this entry in the ECS index */
+    uint32_t noECSKey{0};
     uint16_t len{0};
     bool receivedOverUDP{false};
     bool dnssecOK{false};
+    bool scoped{false};
   };
 
   class CacheShard
@@ -113,12 +168,28 @@ private:
     }
 
     SharedLockGuarded<std::unordered_map<uint32_t,CacheValue>> d_map;
+    /* for ECS scope sharing, the scopes for which we have an entry, indexed by the key of the query without ECS.
+       The corresponding entries themselves are stored in d_map (of the shard matching their own key) */
+    SharedLockGuarded<std::unordered_map<uint32_t,NetmaskTree<bool>>> d_ecsIndex;
+    /* keys for which a refresh query has been sent, and when */
+    LockGuarded<std::unordered_map<uint32_t,time_t>> d_pendingRefreshes;
     std::atomic<uint64_t> d_entriesCount{0};
   };
 
   bool cachedValueMatches(const CacheValue& cachedValue, uint16_t queryFlags, const DNSName& qname, uint16_t qtype, uint16_t qclass, bool receivedOverUDP, bool dnssecOK, const boost::optional<Netmask>& subnet) const;
   uint32_t getShardIndex(uint32_t key) const;
-  void insertLocked(CacheShard& shard, std::unordered_map<uint32_t,CacheValue>& map, uint32_t key, CacheValue& newValue);
+  bool insertLocked(CacheShard& shard, std::unordered_map<uint32_t,CacheValue>& map, uint32_t key, CacheValue& newValue);
+  /* unusable, if not null, is set to true when the entry is missing, too old to be used or does not match (collision) */
+  bool getByKey(DNSQuestion& dq, uint16_t queryId, uint32_t key, const boost::optional<Netmask>& subnet, bool dnssecOK, bool receivedOverUDP, uint32_t allowExpired, bool skipAging, bool refreshAllowed, bool* unusable);
+  static uint32_t getScopedKey(uint32_t noECSKey, const Netmask& scope);
+  bool insertValue(uint32_t key, const boost::optional<Netmask>& subnet, uint16_t queryFlags, bool dnssecOK, const DNSName& qname, uint16_t qtype, uint16_t qclass, const PacketBuffer& response, bool receivedOverUDP, uint8_t rcode, boost::optional<uint32_t> tempFailureTTL, const DNSPacketSummary* summary, const boost::optional<uint32_t>& noECSKey);
+  void removeFromECSIndex(const std::vector<std::pair<uint32_t, Netmask>>& scopes);
+  bool claimRefresh(CacheShard& shard, uint32_t key, time_t now);
+
+  /* how long we wait for the response to a refresh query before allowing a new one to be sent */
+  static const time_t s_refreshClaimDuration{5};
+  /* how many stale scopes we are willing to remove from the index during a single lookup */
+  static const size_t s_maxScopedLookupAttempts{3};
 
   std::vector<CacheShard> d_shards;
   std::unordered_set<uint16_t> d_optionsToSkip{EDNSOptionCode::COOKIE};
@@ -130,6 +201,9 @@ private:
   pdns::stat_t d_insertCollisions{0};
   pdns::stat_t d_lookupCollisions{0};
   pdns::stat_t d_ttlTooShorts{0};
+  pdns::stat_t d_staleHits{0};
+  pdns::stat_t d_refreshes{0};
+  pdns::stat_t d_scopedHits{0};
 
   size_t d_maxEntries;
   uint32_t d_shardCount;
@@ -138,8 +212,23 @@ private:
   uint32_t d_maxNegativeTTL;
   uint32_t d_minTTL;
   uint32_t d_staleTTL;
+  uint32_t d_staleWhileRevalidateTTL{0};
+  uint8_t d_prefetchPercentage{0};
   bool d_dontAge;
   bool d_deferrableInsertLock;
   bool d_parseECS;
   bool d_keepStaleData{false};
+  bool d_ecsScopeSharing{false};
 };
+
+namespace dnsdist
+{
+/* packet caches whose content should be saved to a snapshot file when we exit,
+   to be restored on the next start */
+namespace PacketCacheSnapshots
+{
+  void add(const std::shared_ptr<DNSDistPacketCache>& cache, const std::string& fileName);
+  bool empty();
+  void saveAll();
+}
+}
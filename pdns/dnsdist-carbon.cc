@@ -103,6 +103,8 @@ void carbonDumpThread()
             str<<base<<"tcpnewconnections" << ' '<< state->tcpNewConnections.load() << " " << now << "\r\n";
             str<<base<<"tcpreusedconnections" << ' '<< state->tcpReusedConnections.load() << " " << now << "\r\n";
             str<<base<<"tlsresumptions" << ' '<< state->tlsResumptions.load() << " " << now << "\r\n";
+            str<<base<<"tlsktlssendconnections" << ' '<< state->tlsKTLSSendConnections.load() << " " << now << "\r\n";
+            str<<base<<"tlsktlsrecvconnections" << ' '<< state->tlsKTLSRecvConnections.load() << " " << now << "\r\n";
             str<<base<<"tcpavgqueriesperconnection" << ' '<< state->tcpAvgQueriesPerConnection.load() << " " << now << "\r\n";
             str<<base<<"tcpavgconnectionduration" << ' '<< state->tcpAvgConnectionDuration.load() << " " << now << "\r\n";
           }
@@ -141,6 +143,10 @@ void carbonDumpThread()
             str<<base<<"tlsresumptions" << ' ' << front->tlsResumptions.load() << " " << now << "\r\n";
             str<<base<<"tlsunknownticketkeys" << ' ' << front->tlsUnknownTicketKey.load() << " " << now << "\r\n";
             str<<base<<"tlsinactiveticketkeys" << ' ' << front->tlsInactiveTicketKey.load() << " " << now << "\r\n";
+            str<<base<<"tlsnewsessionshandshakecputime" << ' ' << front->tlsNewSessionsHandshakeCPUTime.load() << " " << now << "\r\n";
+            str<<base<<"tlsresumptionshandshakecputime" << ' ' << front->tlsResumptionsHandshakeCPUTime.load() << " " << now << "\r\n";
+            str<<base<<"tlsktlssendconnections" << ' ' << front->tlsKTLSSendConnections.load() << " " << now << "\r\n";
+            str<<base<<"tlsktlsrecvconnections" << ' ' << front->tlsKTLSRecvConnections.load() << " " << now << "\r\n";
             const TLSErrorCounters* errorCounters = nullptr;
             if (front->tlsFrontend != nullptr) {
               errorCounters = &front->tlsFrontend->d_tlsCounters;
@@ -182,6 +188,8 @@ void carbonDumpThread()
               str<<base<<"cache-lookup-collisions" << " " << cache->getLookupCollisions() << " " << now << "\r\n";
               str<<base<<"cache-insert-collisions" << " " << cache->getInsertCollisions() << " " << now << "\r\n";
               str<<base<<"cache-ttl-too-shorts" << " " << cache->getTTLTooShorts() << " " << now << "\r\n";
+              str<<base<<"cache-stale-hits" << " " << cache->getStaleHits() << " " << now << "\r\n";
+              str<<base<<"cache-refreshes" << " " << cache->getRefreshes() << " " << now << "\r\n";
             }
           }
 
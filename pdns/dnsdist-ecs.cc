@@ -128,14 +128,82 @@ int rewriteResponseWithoutEDNS(const PacketBuffer& initialPacket, PacketBuffer&
   return 0;
 }
 
-static bool addOrReplaceEDNSOption(std::vector<std::pair<uint16_t, std::string>>& options, uint16_t optionCode, bool& optionAdded, bool overrideExisting, const string& newOptionContent)
+/* skip a possibly compressed name without decoding it, returns false if the name goes past the end of the packet */
+static bool skipNameInPlace(const PacketBuffer& packet, size_t& pos)
+{
+  while (pos < packet.size()) {
+    const uint8_t labelLen = packet[pos];
+    if (labelLen == 0) {
+      pos++;
+      return true;
+    }
+    if ((labelLen & 0xc0) == 0xc0) {
+      /* compression pointer, the name ends there */
+      pos += 2;
+      return pos <= packet.size();
+    }
+    if ((labelLen & 0xc0) != 0) {
+      return false;
+    }
+    pos += 1 + labelLen;
+  }
+  return false;
+}
+
+/* walk the records of the packet in place, looking for an OPT RR in the additional section.
+   optStart is set to the position of the OPT RR, or to 0 if there is none, and recordsEnd
+   to the end of the last record, so that any trailing data can be discarded */
+static bool locateOptRRInPlace(const PacketBuffer& packet, size_t& optStart, size_t& recordsEnd)
+{
+  const auto dh = reinterpret_cast<const struct dnsheader*>(packet.data());
+  const size_t qdcount = ntohs(dh->qdcount);
+  const size_t additionalStart = ntohs(dh->ancount) + ntohs(dh->nscount);
+  const size_t recordsCount = additionalStart + ntohs(dh->arcount);
+  size_t pos = sizeof(dnsheader);
+  optStart = 0;
+
+  for (size_t idx = 0; idx < qdcount; idx++) {
+    if (!skipNameInPlace(packet, pos)) {
+      return false;
+    }
+    pos += DNS_TYPE_SIZE + DNS_CLASS_SIZE;
+    if (pos > packet.size()) {
+      return false;
+    }
+  }
+
+  for (size_t idx = 0; idx < recordsCount; idx++) {
+    const size_t recordStart = pos;
+    if (!skipNameInPlace(packet, pos)) {
+      return false;
+    }
+    if ((pos + DNS_TYPE_SIZE + DNS_CLASS_SIZE + DNS_TTL_SIZE + DNS_RDLENGTH_SIZE) > packet.size()) {
+      return false;
+    }
+    const uint16_t qtype = packet[pos] * 256 + packet[pos + 1];
+    pos += DNS_TYPE_SIZE + DNS_CLASS_SIZE + DNS_TTL_SIZE;
+    const uint16_t rdLen = packet[pos] * 256 + packet[pos + 1];
+    pos += DNS_RDLENGTH_SIZE + rdLen;
+    if (pos > packet.size()) {
+      return false;
+    }
+    if (idx >= additionalStart && qtype == QType::OPT && optStart == 0) {
+      optStart = recordStart;
+    }
+  }
+
+  recordsEnd = pos;
+  return true;
+}
+
+static void addOrReplaceEDNSOption(std::vector<std::pair<uint16_t, std::string>>& options, uint16_t optionCode, bool& optionAdded, bool overrideExisting, const string& newOptionContent)
 {
   for (auto it = options.begin(); it != options.end(); ) {
     if (it->first == optionCode) {
       optionAdded = false;
 
       if (!overrideExisting) {
-        return false;
+        return;
       }
 
       it = options.erase(it);
@@ -146,22 +214,14 @@ static bool addOrReplaceEDNSOption(std::vector<std::pair<uint16_t, std::string>>
   }
 
   options.emplace_back(optionCode, std::string(&newOptionContent.at(EDNS_OPTION_CODE_SIZE + EDNS_OPTION_LENGTH_SIZE), newOptionContent.size() - (EDNS_OPTION_CODE_SIZE + EDNS_OPTION_LENGTH_SIZE)));
-  return true;
 }
 
-bool slowRewriteEDNSOptionInQueryWithRecords(const PacketBuffer& initialPacket, PacketBuffer& newContent, bool& ednsAdded, uint16_t optionToReplace, bool& optionAdded, bool overrideExisting, const string& newOptionContent)
+/* rebuild the whole query, decompressing and compressing again the owner names of the records, to add or replace an EDNS option.
+   Used when the OPT RR is followed by other records, whose compression pointers would be broken by resizing the OPT RR in place */
+static void rebuildQueryWithEDNSOption(const PacketBuffer& initialPacket, PacketBuffer& newContent, bool& ednsAdded, uint16_t optionToReplace, bool& optionAdded, bool overrideExisting, const string& newOptionContent)
 {
-  assert(initialPacket.size() >= sizeof(dnsheader));
   const struct dnsheader* dh = reinterpret_cast<const struct dnsheader*>(initialPacket.data());
 
-  if (ntohs(dh->qdcount) == 0) {
-    return false;
-  }
-
-  if (ntohs(dh->ancount) == 0 && ntohs(dh->nscount) == 0 && ntohs(dh->arcount) == 0) {
-    throw std::runtime_error(std::string(__PRETTY_FUNCTION__) + " should not be called for queries that have no records");
-  }
-
   optionAdded = false;
   ednsAdded = true;
 
@@ -194,14 +254,10 @@ bool slowRewriteEDNSOptionInQueryWithRecords(const PacketBuffer& initialPacket,
   pw.getHeader()->rcode=dh->rcode;
 
   /* consume remaining qd if any */
-  if (qdcount > 1) {
-    for(idx = 1; idx < qdcount; idx++) {
-      rrname = pr.getName();
-      rrtype = pr.get16BitInt();
-      rrclass = pr.get16BitInt();
-      (void) rrtype;
-      (void) rrclass;
-    }
+  for (idx = 1; idx < qdcount; idx++) {
+    rrname = pr.getName();
+    rrtype = pr.get16BitInt();
+    rrclass = pr.get16BitInt();
   }
 
   /* copy AN and NS */
@@ -223,7 +279,7 @@ bool slowRewriteEDNSOptionInQueryWithRecords(const PacketBuffer& initialPacket,
     pw.xfrBlob(blob);
   }
 
-  /* consume AR, looking for OPT */
+  /* copy AR, looking for OPT */
   for (idx = 0; idx < arcount; idx++) {
     rrname = pr.getName();
     pr.getDnsrecordheader(ah);
@@ -232,8 +288,8 @@ bool slowRewriteEDNSOptionInQueryWithRecords(const PacketBuffer& initialPacket,
       pw.startRecord(rrname, ah.d_type, ah.d_ttl, ah.d_class, DNSResourceRecord::ADDITIONAL, true);
       pr.xfrBlob(blob);
       pw.xfrBlob(blob);
-    } else {
-
+    }
+    else {
       ednsAdded = false;
       pr.xfrBlob(blob);
 
@@ -257,7 +313,125 @@ bool slowRewriteEDNSOptionInQueryWithRecords(const PacketBuffer& initialPacket,
   }
 
   pw.commit();
+}
+
+/* Add or replace an EDNS option in a query that might contain records in any section, editing the packet in place
+   instead of rebuilding it: the existing option(s) with that code, if any, are removed, the new one is appended to the
+   existing OPT RR and the RDLENGTH is fixed, or a new OPT RR is added at the end of the packet and ARCOUNT is updated.
+   If the OPT RR is not the last record, the query is rebuilt instead since resizing the OPT RR would break the compression
+   pointers of the records following it.
+   The packet is left untouched if the result would not fit into maximumSize. */
+bool rewriteEDNSOptionInQuery(PacketBuffer& packet, size_t maximumSize, bool& ednsAdded, uint16_t optionToReplace, bool& optionAdded, bool overrideExisting, const string& newOptionContent)
+{
+  if (packet.size() < sizeof(dnsheader)) {
+    return false;
+  }
+
+  if (ntohs(reinterpret_cast<const struct dnsheader*>(packet.data())->qdcount) == 0) {
+    return false;
+  }
+
+  optionAdded = false;
+  ednsAdded = false;
 
+  size_t optStart = 0;
+  size_t recordsEnd = 0;
+  if (!locateOptRRInPlace(packet, optStart, recordsEnd)) {
+    return false;
+  }
+
+  if (optStart == 0) {
+    /* no OPT RR yet, we need to add one at the end */
+    if (recordsEnd > maximumSize || (maximumSize - recordsEnd) < (optRecordMinimumSize + newOptionContent.size())) {
+      return false;
+    }
+    packet.resize(recordsEnd);
+    if (!generateOptRR(newOptionContent, packet, maximumSize, g_EdnsUDPPayloadSize, 0, false)) {
+      return false;
+    }
+    auto dh = reinterpret_cast<struct dnsheader*>(packet.data());
+    dh->arcount = htons(ntohs(dh->arcount) + 1);
+    ednsAdded = true;
+    optionAdded = true;
+    return true;
+  }
+
+  if (packet[optStart] != 0) {
+    /* the owner name of an OPT RR has to be the root */
+    return false;
+  }
+
+  const size_t rdLenPosition = optStart + /* root */ 1 + DNS_TYPE_SIZE + DNS_CLASS_SIZE + DNS_TTL_SIZE;
+  const size_t optionsStart = rdLenPosition + DNS_RDLENGTH_SIZE;
+  const size_t optionsEnd = optionsStart + packet[rdLenPosition] * 256 + packet[rdLenPosition + 1];
+
+  if (optionsEnd != recordsEnd) {
+    PacketBuffer newContent;
+    newContent.reserve(packet.size() + newOptionContent.size());
+    bool newEDNSAdded = false;
+    bool newOptionAdded = false;
+    try {
+      rebuildQueryWithEDNSOption(packet, newContent, newEDNSAdded, optionToReplace, newOptionAdded, overrideExisting, newOptionContent);
+    }
+    catch (...) {
+      return false;
+    }
+    if (newContent.size() > maximumSize) {
+      return false;
+    }
+    packet = std::move(newContent);
+    ednsAdded = newEDNSAdded;
+    optionAdded = newOptionAdded;
+    return true;
+  }
+
+  /* first pass: validate the existing options and compute the size of the ones we are going to remove */
+  size_t existingSize = 0;
+  for (size_t pos = optionsStart; (pos + EDNS_OPTION_CODE_SIZE + EDNS_OPTION_LENGTH_SIZE) <= optionsEnd; ) {
+    const uint16_t optionCode = packet[pos] * 256 + packet[pos + 1];
+    const size_t optionSize = EDNS_OPTION_CODE_SIZE + EDNS_OPTION_LENGTH_SIZE + packet[pos + 2] * 256 + packet[pos + 3];
+    if ((pos + optionSize) > optionsEnd) {
+      return false;
+    }
+    if (optionCode == optionToReplace) {
+      existingSize += optionSize;
+    }
+    pos += optionSize;
+  }
+
+  if (existingSize > 0 && !overrideExisting) {
+    packet.resize(recordsEnd);
+    return true;
+  }
+
+  const size_t newRDLen = (optionsEnd - optionsStart) - existingSize + newOptionContent.size();
+  const size_t newSize = recordsEnd - existingSize + newOptionContent.size();
+  if (newRDLen > std::numeric_limits<uint16_t>::max() || newSize > maximumSize) {
+    return false;
+  }
+
+  packet.resize(recordsEnd);
+
+  /* second pass: remove the existing options, moving what follows over them */
+  size_t newOptionsEnd = optionsEnd;
+  if (existingSize > 0) {
+    for (size_t pos = optionsStart; (pos + EDNS_OPTION_CODE_SIZE + EDNS_OPTION_LENGTH_SIZE) <= newOptionsEnd; ) {
+      const uint16_t optionCode = packet[pos] * 256 + packet[pos + 1];
+      const size_t optionSize = EDNS_OPTION_CODE_SIZE + EDNS_OPTION_LENGTH_SIZE + packet[pos + 2] * 256 + packet[pos + 3];
+      if (optionCode == optionToReplace) {
+        packet.erase(packet.begin() + pos, packet.begin() + pos + optionSize);
+        newOptionsEnd -= optionSize;
+        continue;
+      }
+      pos += optionSize;
+    }
+  }
+
+  packet.insert(packet.begin() + newOptionsEnd, newOptionContent.begin(), newOptionContent.end());
+  packet[rdLenPosition] = newRDLen / 256;
+  packet[rdLenPosition + 1] = newRDLen % 256;
+
+  optionAdded = existingSize == 0;
   return true;
 }
 
@@ -428,13 +602,29 @@ int getEDNSOptionsStart(const PacketBuffer& packet, const size_t offset, uint16_
   return 0;
 }
 
+/* this is called for every query on ECS-enabled pools, so we write the option directly instead of going through
+   Netmask, makeEDNSSubnetOptsString() and generateEDNSOption(), which all allocate. The result is the same. */
 void generateECSOption(const ComboAddress& source, string& res, uint16_t ECSPrefixLength)
 {
-  Netmask sourceNetmask(source, ECSPrefixLength);
-  EDNSSubnetOpts ecsOpts;
-  ecsOpts.source = sourceNetmask;
-  string payload = makeEDNSSubnetOptsString(ecsOpts);
-  generateEDNSOption(EDNSOptionCode::ECS, payload, res);
+  const bool isV4 = source.isIPv4();
+  const uint8_t sourceMask = std::min(static_cast<uint8_t>(ECSPrefixLength), static_cast<uint8_t>(isV4 ? 32 : 128));
+  const size_t addressBytes = (sourceMask + 7) / 8;
+  const uint16_t payloadLen = /* family */ 2 + /* source prefix-length */ 1 + /* scope prefix-length */ 1 + addressBytes;
+
+  ComboAddress network(source);
+  network.truncate(sourceMask);
+  const auto* address = isV4 ? reinterpret_cast<const char*>(&network.sin4.sin_addr.s_addr) : reinterpret_cast<const char*>(&network.sin6.sin6_addr.s6_addr);
+
+  res.reserve(res.size() + EDNS_OPTION_CODE_SIZE + EDNS_OPTION_LENGTH_SIZE + payloadLen);
+  res.push_back(static_cast<char>(EDNSOptionCode::ECS / 256));
+  res.push_back(static_cast<char>(EDNSOptionCode::ECS % 256));
+  res.push_back(static_cast<char>(payloadLen / 256));
+  res.push_back(static_cast<char>(payloadLen % 256));
+  res.push_back(0);
+  res.push_back(isV4 ? 1 : 2);
+  res.push_back(static_cast<char>(sourceMask));
+  res.push_back(0);
+  res.append(address, addressBytes);
 }
 
 bool generateOptRR(const std::string& optRData, PacketBuffer& res, size_t maximumSize, uint16_t udpPayloadSize, uint8_t ednsrcode, bool dnssecOK)
@@ -585,21 +775,7 @@ bool handleEDNSClientSubnet(PacketBuffer& packet, const size_t maximumSize, cons
   const struct dnsheader* dh = reinterpret_cast<const struct dnsheader*>(packet.data());
 
   if (ntohs(dh->ancount) != 0 || ntohs(dh->nscount) != 0 || (ntohs(dh->arcount) != 0 && ntohs(dh->arcount) != 1)) {
-    PacketBuffer newContent;
-    newContent.reserve(packet.size());
-
-    if (!slowRewriteEDNSOptionInQueryWithRecords(packet, newContent, ednsAdded, EDNSOptionCode::ECS, ecsAdded, overrideExisting, newECSOption)) {
-      return false;
-    }
-
-    if (newContent.size() > maximumSize) {
-      ednsAdded = false;
-      ecsAdded = false;
-      return false;
-    }
-
-    packet = std::move(newContent);
-    return true;
+    return rewriteEDNSOptionInQuery(packet, maximumSize, ednsAdded, EDNSOptionCode::ECS, ecsAdded, overrideExisting, newECSOption);
   }
 
   uint16_t optRDPosition = 0;
@@ -966,20 +1142,32 @@ bool addEDNSToQueryTurnedResponse(DNSQuestion& dq)
   uint8_t* optRDLen = &packet.at(optRDPosition);
   uint8_t* optPtr = (optRDLen - (/* root */ 1 + DNS_TYPE_SIZE + DNS_CLASS_SIZE + EDNS_EXTENDED_RCODE_SIZE + EDNS_VERSION_SIZE + /* Z */ 2));
 
-  const uint8_t* zPtr = optPtr + /* root */ 1 + DNS_TYPE_SIZE + DNS_CLASS_SIZE + EDNS_EXTENDED_RCODE_SIZE + EDNS_VERSION_SIZE;
+  uint8_t* zPtr = optPtr + /* root */ 1 + DNS_TYPE_SIZE + DNS_CLASS_SIZE + EDNS_EXTENDED_RCODE_SIZE + EDNS_VERSION_SIZE;
   uint16_t z = 0x100 * (*zPtr) + *(zPtr + 1);
   bool dnssecOK = z & EDNS_HEADER_FLAG_DO;
 
+  if (g_addEDNSToSelfGeneratedResponses) {
+    /* the existing OPT record is the only record in the additional section, so we can turn it into the one
+       we would have generated in place: payload size, extended rcode, version and flags, no options.
+       Everything that follows it is removed (any SIG or TSIG would be useless anyway) */
+    uint8_t* classPtr = optPtr + /* root */ 1 + DNS_TYPE_SIZE;
+    classPtr[0] = g_PayloadSizeSelfGenAnswers / 256;
+    classPtr[1] = g_PayloadSizeSelfGenAnswers % 256;
+    uint8_t* extRCodePtr = classPtr + DNS_CLASS_SIZE;
+    extRCodePtr[0] = dq.ednsRCode;
+    extRCodePtr[1] = 0; /* version */
+    zPtr[0] = dnssecOK ? (EDNS_HEADER_FLAG_DO / 256) : 0;
+    zPtr[1] = 0;
+    optRDLen[0] = 0;
+    optRDLen[1] = 0;
+    packet.resize(optRDPosition + DNS_RDLENGTH_SIZE);
+    return true;
+  }
+
   /* remove the existing OPT record, and everything else that follows (any SIG or TSIG would be useless anyway) */
   packet.resize(packet.size() - existingOptLen);
   dq.getHeader()->arcount = 0;
 
-  if (g_addEDNSToSelfGeneratedResponses) {
-    /* now we need to add a new OPT record */
-    return addEDNS(packet, dq.getMaximumSize(), dnssecOK, g_PayloadSizeSelfGenAnswers, dq.ednsRCode);
-  }
-
-  /* otherwise we are just fine */
   return true;
 }
 
@@ -33,6 +33,11 @@ struct DOHUnit;
 class DNSCryptQuery;
 class DNSDistPacketCache;
 
+namespace dnsdist
+{
+class QueryCoalescer;
+}
+
 using QTag = std::unordered_map<string, string>;
 
 struct StopWatch
@@ -99,7 +104,7 @@ struct IDState
     sentTime(true), tempFailureTTL(boost::none) { origDest.sin4.sin_family = 0; }
   IDState(const IDState& orig) = delete;
   IDState(IDState&& rhs) :
-    subnet(rhs.subnet), origRemote(rhs.origRemote), origDest(rhs.origDest), hopRemote(rhs.hopRemote), hopLocal(rhs.hopLocal), qname(std::move(rhs.qname)), sentTime(rhs.sentTime), packetCache(std::move(rhs.packetCache)), dnsCryptQuery(std::move(rhs.dnsCryptQuery)), qTag(std::move(rhs.qTag)), tempFailureTTL(rhs.tempFailureTTL), cs(rhs.cs), du(std::move(rhs.du)), cacheKey(rhs.cacheKey), cacheKeyNoECS(rhs.cacheKeyNoECS), cacheKeyUDP(rhs.cacheKeyUDP), origFD(rhs.origFD), backendFD(rhs.backendFD), delayMsec(rhs.delayMsec), qtype(rhs.qtype), qclass(rhs.qclass), origID(rhs.origID), origFlags(rhs.origFlags), cacheFlags(rhs.cacheFlags), protocol(rhs.protocol), ednsAdded(rhs.ednsAdded), ecsAdded(rhs.ecsAdded), skipCache(rhs.skipCache), destHarvested(rhs.destHarvested), dnssecOK(rhs.dnssecOK), useZeroScope(rhs.useZeroScope)
+    subnet(rhs.subnet), origRemote(rhs.origRemote), origDest(rhs.origDest), hopRemote(rhs.hopRemote), hopLocal(rhs.hopLocal), qname(std::move(rhs.qname)), sentTime(rhs.sentTime), packetCache(std::move(rhs.packetCache)), coalescer(std::move(rhs.coalescer)), dnsCryptQuery(std::move(rhs.dnsCryptQuery)), qTag(std::move(rhs.qTag)), tempFailureTTL(rhs.tempFailureTTL), cs(rhs.cs), du(std::move(rhs.du)), cacheKey(rhs.cacheKey), cacheKeyNoECS(rhs.cacheKeyNoECS), cacheKeyUDP(rhs.cacheKeyUDP), coalescingToken(rhs.coalescingToken), origFD(rhs.origFD), backendFD(rhs.backendFD), delayMsec(rhs.delayMsec), stageLatencySentUsec(rhs.stageLatencySentUsec), qtype(rhs.qtype), qclass(rhs.qclass), origID(rhs.origID), origFlags(rhs.origFlags), cacheFlags(rhs.cacheFlags), protocol(rhs.protocol), ednsAdded(rhs.ednsAdded), ecsAdded(rhs.ecsAdded), skipCache(rhs.skipCache), destHarvested(rhs.destHarvested), dnssecOK(rhs.dnssecOK), useZeroScope(rhs.useZeroScope), cacheRefresh(rhs.cacheRefresh), stageLatencySampled(rhs.stageLatencySampled)
   {
     if (rhs.isInUse()) {
       throw std::runtime_error("Trying to move an in-use IDState");
@@ -132,6 +137,8 @@ struct IDState
     sentTime = rhs.sentTime;
     dnsCryptQuery = std::move(rhs.dnsCryptQuery);
     packetCache = std::move(rhs.packetCache);
+    coalescer = std::move(rhs.coalescer);
+    coalescingToken = rhs.coalescingToken;
     qTag = std::move(rhs.qTag);
     tempFailureTTL = std::move(rhs.tempFailureTTL);
     cs = rhs.cs;
@@ -160,6 +167,9 @@ struct IDState
     destHarvested = rhs.destHarvested;
     dnssecOK = rhs.dnssecOK;
     useZeroScope = rhs.useZeroScope;
+    cacheRefresh = rhs.cacheRefresh;
+    stageLatencySampled = rhs.stageLatencySampled;
+    stageLatencySentUsec = rhs.stageLatencySentUsec;
 
     return *this;
   }
@@ -238,6 +248,7 @@ struct IDState
   DNSName qname; // 24
   StopWatch sentTime; // 16
   std::shared_ptr<DNSDistPacketCache> packetCache{nullptr}; // 16
+  std::shared_ptr<dnsdist::QueryCoalescer> coalescer{nullptr}; // set when identical queries are waiting for the response to this one // 16
   std::unique_ptr<DNSCryptQuery> dnsCryptQuery{nullptr}; // 8
   std::unique_ptr<QTag> qTag{nullptr}; // 8
   boost::optional<uint32_t> tempFailureTTL; // 8
@@ -249,9 +260,11 @@ struct IDState
   uint32_t cacheKeyNoECS{0}; // 4
   // DoH-only */
   uint32_t cacheKeyUDP{0}; // 4
+  uint64_t coalescingToken{0}; // 8
   int origFD{-1}; // 4
   int backendFD{-1}; // 4
   int delayMsec{0};
+  uint32_t stageLatencySentUsec{0}; // time elapsed between the reception of a sampled query and its sending to the backend, in microseconds // 4
 #ifdef __SANITIZE_THREAD__
   std::atomic<uint16_t> age{0};
 #else
@@ -271,4 +284,6 @@ struct IDState
   bool destHarvested{false}; // if true, origDest holds the original dest addr, otherwise the listening addr
   bool dnssecOK{false};
   bool useZeroScope{false};
+  bool cacheRefresh{false}; // if true, this query was sent to refresh a cache entry and nobody is waiting for the response
+  bool stageLatencySampled{false}; // if true, the time spent in each processing stage of this query is recorded
 };
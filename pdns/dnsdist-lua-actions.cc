@@ -26,6 +26,9 @@
 #include "dnsdist-lua.hh"
 #include "dnsdist-lua-ffi.hh"
 #include "dnsdist-protobuf.hh"
+#include "dnsdist-proxy-protocol.hh"
+#include "dnsdist-rrl.hh"
+#include "dnsdist-stage-latency.hh"
 #include "dnsdist-kvs.hh"
 #include "dnsdist-svc.hh"
 
@@ -487,9 +490,11 @@ public:
 
   DNSAction::Action operator()(DNSQuestion* dq, std::string* ruleresult) const override
   {
+    dnsdist::StageLatency::Timer stageTimer(dq->stageLatencySampled);
     auto lock = g_lua.lock();
     try {
       auto ret = d_func(dq);
+      stageTimer.record(dnsdist::StageLatency::Stage::Lua);
       if (ruleresult) {
         if (boost::optional<std::string> rule = std::get<1>(ret)) {
           *ruleresult = *rule;
@@ -524,9 +529,11 @@ public:
   {}
   DNSResponseAction::Action operator()(DNSResponse* dr, std::string* ruleresult) const override
   {
+    dnsdist::StageLatency::Timer stageTimer(dr->stageLatencySampled);
     auto lock = g_lua.lock();
     try {
       auto ret = d_func(dr);
+      stageTimer.record(dnsdist::StageLatency::Stage::Lua);
       if (ruleresult) {
         if (boost::optional<std::string> rule = std::get<1>(ret)) {
           *ruleresult = *rule;
@@ -565,9 +572,11 @@ public:
   DNSAction::Action operator()(DNSQuestion* dq, std::string* ruleresult) const override
   {
     dnsdist_ffi_dnsquestion_t dqffi(dq);
+    dnsdist::StageLatency::Timer stageTimer(dq->stageLatencySampled);
     try {
       auto lock = g_lua.lock();
       auto ret = d_func(&dqffi);
+      stageTimer.record(dnsdist::StageLatency::Stage::Lua);
       if (ruleresult) {
         if (dqffi.result) {
           *ruleresult = *dqffi.result;
@@ -621,7 +630,9 @@ public:
       }
 
       dnsdist_ffi_dnsquestion_t dqffi(dq);
+      dnsdist::StageLatency::Timer stageTimer(dq->stageLatencySampled);
       auto ret = state.d_func(&dqffi);
+      stageTimer.record(dnsdist::StageLatency::Stage::Lua);
       if (ruleresult) {
         if (dqffi.result) {
           *ruleresult = *dqffi.result;
@@ -675,9 +686,11 @@ public:
   DNSResponseAction::Action operator()(DNSResponse* dr, std::string* ruleresult) const override
   {
     dnsdist_ffi_dnsresponse_t drffi(dr);
+    dnsdist::StageLatency::Timer stageTimer(dr->stageLatencySampled);
     try {
       auto lock = g_lua.lock();
       auto ret = d_func(&drffi);
+      stageTimer.record(dnsdist::StageLatency::Stage::Lua);
       if (ruleresult) {
         if (drffi.result) {
           *ruleresult = *drffi.result;
@@ -731,7 +744,9 @@ public:
       }
 
       dnsdist_ffi_dnsresponse_t drffi(dr);
+      dnsdist::StageLatency::Timer stageTimer(dr->stageLatencySampled);
       auto ret = state.d_func(&drffi);
+      stageTimer.record(dnsdist::StageLatency::Stage::Lua);
       if (ruleresult) {
         if (drffi.result) {
           *ruleresult = *drffi.result;
@@ -939,18 +954,11 @@ public:
     if (dq->getHeader()->arcount) {
       bool ednsAdded = false;
       bool optionAdded = false;
-      PacketBuffer newContent;
-      newContent.reserve(dq->getData().size());
 
-      if (!slowRewriteEDNSOptionInQueryWithRecords(dq->getData(), newContent, ednsAdded, d_code, optionAdded, true, optRData)) {
+      if (!rewriteEDNSOptionInQuery(dq->getMutableData(), dq->getMaximumSize(), ednsAdded, d_code, optionAdded, true, optRData)) {
         return Action::None;
       }
 
-      if (newContent.size() > dq->getMaximumSize()) {
-        return Action::None;
-      }
-
-      dq->getMutableData() = std::move(newContent);
       if (!dq->ednsAdded && ednsAdded) {
         dq->ednsAdded = true;
       }
@@ -992,18 +1000,11 @@ public:
     if (dq->getHeader()->arcount) {
       bool ednsAdded = false;
       bool optionAdded = false;
-      PacketBuffer newContent;
-      newContent.reserve(dq->getData().size());
 
-      if (!slowRewriteEDNSOptionInQueryWithRecords(dq->getData(), newContent, ednsAdded, d_code, optionAdded, true, optRData)) {
+      if (!rewriteEDNSOptionInQuery(dq->getMutableData(), dq->getMaximumSize(), ednsAdded, d_code, optionAdded, true, optRData)) {
         return Action::None;
       }
 
-      if (newContent.size() > dq->getMaximumSize()) {
-        return Action::None;
-      }
-
-      dq->getMutableData() = std::move(newContent);
       if (!dq->ednsAdded && ednsAdded) {
         dq->ednsAdded = true;
       }
@@ -1770,6 +1771,50 @@ private:
   std::set<QType> d_qtypes{};
 };
 
+class ResponseRateLimitAction : public DNSResponseAction, public boost::noncopyable
+{
+public:
+  ResponseRateLimitAction(const dnsdist::ResponseRateLimiter::Config& config): d_rrl(config)
+  {
+  }
+
+  DNSResponseAction::Action operator()(DNSResponse* dr, std::string* ruleresult) const override
+  {
+    /* the source address of a TCP (or DoT, DoH) client cannot be spoofed, and this is where slipped clients are expected to retry */
+    if (dr->overTCP()) {
+      return DNSResponseAction::Action::None;
+    }
+
+    dnsdist::ResponseRateLimiter::Category category;
+    DNSName zone;
+    if (!dnsdist::ResponseRateLimiter::categorize(dr->getData(), category, zone)) {
+      return DNSResponseAction::Action::None;
+    }
+
+    auto verdict = d_rrl.check(*dr->remote, zone.empty() ? *dr->qname : zone, category, time(nullptr));
+    if (verdict == dnsdist::ResponseRateLimiter::Verdict::Allow) {
+      return DNSResponseAction::Action::None;
+    }
+
+    if (verdict == dnsdist::ResponseRateLimiter::Verdict::Drop) {
+      return DNSResponseAction::Action::Drop;
+    }
+
+    truncateTC(dr->getMutableData(), dr->getMaximumSize(), dr->qname->wirelength());
+    dr->getHeader()->tc = true;
+    dr->getHeader()->aa = false;
+    return DNSResponseAction::Action::HeaderModify;
+  }
+
+  std::string toString() const override
+  {
+    return d_rrl.toString();
+  }
+
+private:
+  mutable dnsdist::ResponseRateLimiter d_rrl;
+};
+
 class ContinueAction : public DNSAction
 {
 public:
@@ -1961,6 +2006,7 @@ public:
 
   DNSAction::Action operator()(DNSQuestion* dq, std::string* ruleresult) const override
   {
+    dq->proxyProtocolRawValues.reset();
     if (!dq->proxyProtocolValues) {
       dq->proxyProtocolValues = make_unique<std::vector<ProxyProtocolValue>>();
     }
@@ -1989,11 +2035,7 @@ public:
 
   DNSAction::Action operator()(DNSQuestion* dq, std::string* ruleresult) const override
   {
-    if (!dq->proxyProtocolValues) {
-      dq->proxyProtocolValues = make_unique<std::vector<ProxyProtocolValue>>();
-    }
-
-    dq->proxyProtocolValues->push_back({ d_value, d_type });
+    getMutableProxyProtocolValues(*dq).push_back({ d_value, d_type });
 
     return Action::None;
   }
@@ -2284,6 +2326,46 @@ void setupLuaActions(LuaContext& luaCtx)
       return std::shared_ptr<DNSResponseAction>(new ClearRecordTypesResponseAction(qtypes));
     });
 
+  luaCtx.writeFunction("ResponseRateLimitAction", [](boost::optional<LuaAssociativeTable<uint64_t>> vars) {
+      dnsdist::ResponseRateLimiter::Config config;
+      if (vars) {
+        if (vars->count("responsesPerSecond")) {
+          config.d_responsesPerSecond = (*vars)["responsesPerSecond"];
+        }
+        if (vars->count("nodataPerSecond")) {
+          config.d_nodataPerSecond = (*vars)["nodataPerSecond"];
+        }
+        if (vars->count("nxdomainsPerSecond")) {
+          config.d_nxdomainsPerSecond = (*vars)["nxdomainsPerSecond"];
+        }
+        if (vars->count("referralsPerSecond")) {
+          config.d_referralsPerSecond = (*vars)["referralsPerSecond"];
+        }
+        if (vars->count("errorsPerSecond")) {
+          config.d_errorsPerSecond = (*vars)["errorsPerSecond"];
+        }
+        if (vars->count("window")) {
+          config.d_window = (*vars)["window"];
+        }
+        if (vars->count("slip")) {
+          config.d_slip = (*vars)["slip"];
+        }
+        if (vars->count("ipv4PrefixLength")) {
+          config.d_ipv4PrefixLength = std::min((*vars)["ipv4PrefixLength"], static_cast<uint64_t>(32));
+        }
+        if (vars->count("ipv6PrefixLength")) {
+          config.d_ipv6PrefixLength = std::min((*vars)["ipv6PrefixLength"], static_cast<uint64_t>(128));
+        }
+        if (vars->count("maxEntries")) {
+          config.d_maxEntries = (*vars)["maxEntries"];
+        }
+        if (vars->count("shards")) {
+          config.d_shards = (*vars)["shards"];
+        }
+      }
+      return std::shared_ptr<DNSResponseAction>(new ResponseRateLimitAction(config));
+    });
+
   luaCtx.writeFunction("RCodeAction", [](uint8_t rcode, boost::optional<responseParams_t> vars) {
       auto ret = std::shared_ptr<DNSAction>(new RCodeAction(rcode));
       auto rca = std::dynamic_pointer_cast<RCodeAction>(ret);
@@ -22,6 +22,7 @@
 #include "dnsdist.hh"
 #include "dnsdist-ecs.hh"
 #include "dnsdist-lua.hh"
+#include "dnsdist-proxy-protocol.hh"
 #include "dnsparser.hh"
 
 void setupLuaBindingsDNSQuestion(LuaContext& luaCtx)
@@ -116,6 +117,7 @@ void setupLuaBindingsDNSQuestion(LuaContext& luaCtx)
     });
 
   luaCtx.registerFunction<void(DNSQuestion::*)(LuaArray<std::string>)>("setProxyProtocolValues", [](DNSQuestion& dq, const LuaArray<std::string>& values) {
+    dq.proxyProtocolRawValues.reset();
     if (!dq.proxyProtocolValues) {
       dq.proxyProtocolValues = make_unique<std::vector<ProxyProtocolValue>>();
     }
@@ -130,23 +132,15 @@ void setupLuaBindingsDNSQuestion(LuaContext& luaCtx)
 
   luaCtx.registerFunction<void(DNSQuestion::*)(uint64_t, std::string)>("addProxyProtocolValue", [](DNSQuestion& dq, uint64_t type, std::string value) {
     checkParameterBound("addProxyProtocolValue", type, std::numeric_limits<uint8_t>::max());
-    if (!dq.proxyProtocolValues) {
-      dq.proxyProtocolValues = make_unique<std::vector<ProxyProtocolValue>>();
-    }
-
-    dq.proxyProtocolValues->push_back({value, static_cast<uint8_t>(type)});
+    getMutableProxyProtocolValues(dq).push_back({value, static_cast<uint8_t>(type)});
   });
 
   luaCtx.registerFunction<LuaArray<std::string>(DNSQuestion::*)()>("getProxyProtocolValues", [](const DNSQuestion& dq) {
     LuaArray<std::string> result;
-    if (!dq.proxyProtocolValues) {
-      return result;
-    }
-
-    result.resize(dq.proxyProtocolValues->size());
-    for (const auto& value : *dq.proxyProtocolValues) {
-      result.push_back({ value.type, value.content });
-    }
+    visitProxyProtocolValues(dq, [&result](const ProxyProtocolValueView& value) {
+      result.push_back({ value.type, std::string(value.content) });
+      return true;
+    });
 
     return result;
   });
@@ -97,6 +97,40 @@ void setupLuaBindings(LuaContext& luaCtx, bool client)
     });
   luaCtx.registerFunction("getECS", &ServerPool::getECS);
   luaCtx.registerFunction("setECS", &ServerPool::setECS);
+  luaCtx.registerFunction<void(std::shared_ptr<ServerPool>::*)(bool, boost::optional<LuaAssociativeTable<uint64_t>>)>("setQueryCoalescing", [](std::shared_ptr<ServerPool> pool, bool enabled, boost::optional<LuaAssociativeTable<uint64_t>> vars) {
+      if (!pool) {
+        return;
+      }
+      if (!enabled) {
+        pool->coalescer = nullptr;
+        return;
+      }
+      dnsdist::QueryCoalescer::Config config;
+      if (vars) {
+        if (vars->count("maxFollowers")) {
+          config.d_maxFollowers = (*vars)["maxFollowers"];
+        }
+        if (vars->count("timeout")) {
+          config.d_timeout = std::min((*vars)["timeout"], static_cast<uint64_t>(std::numeric_limits<uint16_t>::max()));
+        }
+        if (vars->count("shards")) {
+          config.d_shards = (*vars)["shards"];
+        }
+      }
+      pool->coalescer = std::make_shared<dnsdist::QueryCoalescer>(config);
+    });
+  luaCtx.registerFunction<LuaAssociativeTable<uint64_t>(std::shared_ptr<ServerPool>::*)()const>("getQueryCoalescingStats", [](const std::shared_ptr<ServerPool> pool) {
+      LuaAssociativeTable<uint64_t> result;
+      if (pool && pool->coalescer) {
+        const auto stats = pool->coalescer->getStats();
+        result["leaders"] = stats.d_leaders;
+        result["followers"] = stats.d_followers;
+        result["bypassed"] = stats.d_bypassed;
+        result["unanswered"] = stats.d_unanswered;
+        result["in-flight"] = pool->coalescer->getEntriesCount();
+      }
+      return result;
+    });
 
 #ifndef DISABLE_DOWNSTREAM_BINDINGS
   /* DownstreamState */
@@ -24,6 +24,7 @@
 #include "dnsdist-dynblocks.hh"
 #include "dnsdist-nghttp2.hh"
 #include "dnsdist-rings.hh"
+#include "dnsdist-stage-latency.hh"
 #include "dnsdist-tcp.hh"
 
 #include "statnode.hh"
@@ -603,6 +604,33 @@ void setupLuaInspection(LuaContext& luaCtx)
       }
     });
 
+  luaCtx.writeFunction("showStageLatency", [] {
+      setLuaNoSideEffect();
+      ostringstream ret;
+      const auto& bounds = dnsdist::StageLatency::s_bucketBounds;
+      ret << (boost::format("%-17s %-12s %-12s") % "Stage" % "Count" % "Avg usec");
+      for (const auto& bound : bounds) {
+        ret << (boost::format(" %-10s") % ("<=" + std::to_string(bound)));
+      }
+      ret << (boost::format(" %-10s") % (">" + std::to_string(bounds.back()))) << endl;
+
+      for (size_t idx = 0; idx < static_cast<size_t>(dnsdist::StageLatency::Stage::Count); idx++) {
+        const auto stage = static_cast<dnsdist::StageLatency::Stage>(idx);
+        const auto& histogram = dnsdist::StageLatency::getHistogram(stage);
+        const uint64_t count = histogram.d_count.load();
+        ret << (boost::format("%-17s %-12d %-12.2f") % dnsdist::StageLatency::getStageName(stage) % count % (count > 0 ? (1.0 * histogram.d_sumUsec.load() / count) : 0.0));
+        for (const auto& bucket : histogram.d_buckets) {
+          ret << (boost::format(" %-10d") % bucket.load());
+        }
+        ret << endl;
+      }
+
+      if (dnsdist::StageLatency::getSamplingRate() == 0) {
+        ret << "Sampling is disabled, see setStageLatencySampling()" << endl;
+      }
+      g_outputBuffer = ret.str();
+    });
+
   luaCtx.writeFunction("showTCPStats", [] {
       setLuaNoSideEffect();
       ostringstream ret;
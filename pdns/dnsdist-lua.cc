@@ -47,6 +47,7 @@
 #include "dnsdist-rings.hh"
 #include "dnsdist-secpoll.hh"
 #include "dnsdist-session-cache.hh"
+#include "dnsdist-stage-latency.hh"
 #include "dnsdist-tcp-downstream.hh"
 #include "dnsdist-web.hh"
 
@@ -200,6 +201,10 @@ static void parseTLSConfig(TLSConfig& config, const std::string& context, boost:
     config.d_ticketsKeyRotationDelay = boost::get<int>((*vars)["ticketsKeysRotationDelay"]);
   }
 
+  if (vars->count("ticketKeyFileCheckInterval")) {
+    config.d_ticketsKeyFileCheckInterval = boost::get<int>((*vars)["ticketKeyFileCheckInterval"]);
+  }
+
   if (vars->count("numberOfTicketsKeys")) {
     config.d_numberOfTicketsKeys = boost::get<int>((*vars)["numberOfTicketsKeys"]);
   }
@@ -252,6 +257,10 @@ static void parseTLSConfig(TLSConfig& config, const std::string& context, boost:
   if (vars->count("tlsAsyncMode")) {
     config.d_asyncMode = boost::get<bool>((*vars).at("tlsAsyncMode"));
   }
+
+  if (vars->count("ktls")) {
+    config.d_ktls = boost::get<bool>((*vars).at("ktls"));
+  }
 }
 
 #endif // defined(HAVE_DNS_OVER_TLS) || defined(HAVE_DNS_OVER_HTTPS)
@@ -542,6 +551,9 @@ static void setupLuaConfig(LuaContext& luaCtx, bool client, bool configCheck)
                          if (vars.count("enableRenegotiation")) {
                            config.d_tlsParams.d_enableRenegotiation = boost::get<bool>(vars.at("enableRenegotiation"));
                          }
+                         if (vars.count("ktls")) {
+                           config.d_tlsParams.d_ktls = boost::get<bool>(vars.at("ktls"));
+                         }
                          if (vars.count("subjectName")) {
                            config.d_tlsSubjectName = boost::get<string>(vars.at("subjectName"));
                          }
@@ -885,6 +897,7 @@ static void setupLuaConfig(LuaContext& luaCtx, bool client, bool configCheck)
       g_tlslocals.clear();
       g_rings.clear();
 #endif /* 0 */
+    dnsdist::PacketCacheSnapshots::saveAll();
     _exit(0);
   });
 
@@ -1716,6 +1729,11 @@ static void setupLuaConfig(LuaContext& luaCtx, bool client, bool configCheck)
     g_staleCacheEntriesTTL = ttl;
   });
 
+  luaCtx.writeFunction("setStageLatencySampling", [](uint64_t rate) {
+    checkParameterBound("setStageLatencySampling", rate, std::numeric_limits<uint32_t>::max());
+    dnsdist::StageLatency::setSamplingRate(rate);
+  });
+
   luaCtx.writeFunction("showBinds", []() {
     setLuaNoSideEffect();
     try {
@@ -2167,6 +2185,26 @@ static void setupLuaConfig(LuaContext& luaCtx, bool client, bool configCheck)
 #if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE)
     setLuaSideEffect();
     g_udpVectorSize = vSize;
+#else
+      errlog("recvmmsg() support is not available!");
+      g_outputBuffer = "recvmmsg support is not available!\n";
+#endif
+  });
+
+  luaCtx.writeFunction("setUDPBatchFFIFunction", [](const std::string& code) {
+    if (g_configurationDone) {
+      errlog("setUDPBatchFFIFunction() cannot be used at runtime!");
+      g_outputBuffer = "setUDPBatchFFIFunction() cannot be used at runtime!\n";
+      return;
+    }
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE)
+#ifdef LUAJIT_VERSION
+    setLuaSideEffect();
+    dnsdist::FFIBatchFilter::setFunctionCode(code);
+#else
+      errlog("setUDPBatchFFIFunction() requires LuaJIT!");
+      g_outputBuffer = "setUDPBatchFFIFunction() requires LuaJIT!\n";
+#endif /* LUAJIT_VERSION */
 #else
       errlog("recvmmsg() support is not available!");
       g_outputBuffer = "recvmmsg support is not available!\n";
@@ -2762,6 +2800,22 @@ static void setupLuaConfig(LuaContext& luaCtx, bool client, bool configCheck)
   });
 #endif /* HAVE_LIBSSL && HAVE_OCSP_BASIC_SIGN*/
 
+#ifdef HAVE_LIBSSL
+  luaCtx.writeFunction("rotateTicketsKeyFile", [client, configCheck](const std::string& keyFile, boost::optional<uint64_t> maxKeys) {
+    if (client || configCheck) {
+      return;
+    }
+
+    try {
+      OpenSSLTLSTicketKeysRing::rotateTicketsKeyFile(keyFile, maxKeys ? *maxKeys : 5);
+    }
+    catch (const std::exception& e) {
+      errlog("Error rotating the tickets key file %s: %s", keyFile, e.what());
+      g_outputBuffer = "Error rotating the tickets key file " + keyFile + ": " + e.what() + "\n";
+    }
+  });
+#endif /* HAVE_LIBSSL */
+
   luaCtx.writeFunction("addCapabilitiesToRetain", [](LuaTypeOrArrayOf<std::string> caps) {
     setLuaSideEffect();
     if (g_configurationDone) {
@@ -2838,7 +2892,7 @@ vector<std::function<void(void)>> setupLua(LuaContext& luaCtx, bool client, bool
   setupLuaBindingsDNSCrypt(luaCtx, client);
   setupLuaBindingsDNSQuestion(luaCtx);
   setupLuaBindingsKVS(luaCtx, client);
-  setupLuaBindingsPacketCache(luaCtx, client);
+  setupLuaBindingsPacketCache(luaCtx, client, configCheck);
   setupLuaBindingsProtoBuf(luaCtx, client, configCheck);
   setupLuaInspection(luaCtx);
   setupLuaRules(luaCtx);
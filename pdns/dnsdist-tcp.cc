@@ -840,15 +840,24 @@ void IncomingTCPConnectionState::handleIO(std::shared_ptr<IncomingTCPConnectionS
     try {
       if (state->d_state == IncomingTCPConnectionState::State::doingHandshake) {
         DEBUGLOG("doing handshake");
+#if defined(_POSIX_THREAD_CPUTIME) && defined(CLOCK_THREAD_CPUTIME_ID)
+        CPUTime handshakeCPUTime;
+        handshakeCPUTime.start();
         iostate = state->d_handler.tryHandshake();
+        state->d_handshakeCPUTime += handshakeCPUTime.ndiff();
+#else
+        iostate = state->d_handler.tryHandshake();
+#endif
         if (iostate == IOState::Done) {
           DEBUGLOG("handshake done");
           if (state->d_handler.isTLS()) {
             if (!state->d_handler.hasTLSSessionBeenResumed()) {
               ++state->d_ci.cs->tlsNewSessions;
+              state->d_ci.cs->tlsNewSessionsHandshakeCPUTime += state->d_handshakeCPUTime / 1000;
             }
             else {
               ++state->d_ci.cs->tlsResumptions;
+              state->d_ci.cs->tlsResumptionsHandshakeCPUTime += state->d_handshakeCPUTime / 1000;
             }
             if (state->d_handler.getResumedFromInactiveTicketKey()) {
               ++state->d_ci.cs->tlsInactiveTicketKey;
@@ -856,6 +865,12 @@ void IncomingTCPConnectionState::handleIO(std::shared_ptr<IncomingTCPConnectionS
             if (state->d_handler.getUnknownTicketKey()) {
               ++state->d_ci.cs->tlsUnknownTicketKey;
             }
+            if (state->d_handler.isKTLSSendEnabled()) {
+              ++state->d_ci.cs->tlsKTLSSendConnections;
+            }
+            if (state->d_handler.isKTLSRecvEnabled()) {
+              ++state->d_ci.cs->tlsKTLSRecvConnections;
+            }
           }
 
           state->d_handshakeDoneTime = now;
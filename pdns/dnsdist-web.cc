@@ -35,6 +35,7 @@
 #include "dnsdist-dynblocks.hh"
 #include "dnsdist-healthchecks.hh"
 #include "dnsdist-prometheus.hh"
+#include "dnsdist-stage-latency.hh"
 #include "dnsdist-web.hh"
 #include "dolog.hh"
 #include "gettime.hh"
@@ -485,6 +486,24 @@ static void handlePrometheus(const YaHTTP::Request& req, YaHTTP::Response& resp)
   output << "dnsdist_latency_sum " << g_stats.latencySum << "\n";
   output << "dnsdist_latency_count " << g_stats.latencyCount << "\n";
 
+  // Per-stage latency histograms of the sampled queries
+  output << "# HELP dnsdist_stage_latency Histogram of the time spent by sampled queries in each processing stage (in microseconds)\n";
+  output << "# TYPE dnsdist_stage_latency histogram\n";
+  for (size_t idx = 0; idx < static_cast<size_t>(dnsdist::StageLatency::Stage::Count); idx++) {
+    const auto stage = static_cast<dnsdist::StageLatency::Stage>(idx);
+    const auto& name = dnsdist::StageLatency::getStageName(stage);
+    const auto& histogram = dnsdist::StageLatency::getHistogram(stage);
+    uint64_t stage_amounts = 0;
+    for (size_t bucket = 0; bucket < dnsdist::StageLatency::s_bucketBounds.size(); bucket++) {
+      stage_amounts += histogram.d_buckets.at(bucket).load();
+      output << "dnsdist_stage_latency_bucket{stage=\"" << name << "\",le=\"" << dnsdist::StageLatency::s_bucketBounds.at(bucket) << "\"} " << stage_amounts << "\n";
+    }
+    stage_amounts += histogram.d_buckets.back().load();
+    output << "dnsdist_stage_latency_bucket{stage=\"" << name << "\",le=\"+Inf\"} " << stage_amounts << "\n";
+    output << "dnsdist_stage_latency_sum{stage=\"" << name << "\"} " << histogram.d_sumUsec.load() << "\n";
+    output << "dnsdist_stage_latency_count{stage=\"" << name << "\"} " << histogram.d_count.load() << "\n";
+  }
+
   auto states = g_dstates.getLocal();
   const string statesbase = "dnsdist_server_";
 
@@ -532,6 +551,10 @@ static void handlePrometheus(const YaHTTP::Request& req, YaHTTP::Response& resp)
   output << "# TYPE " << statesbase << "tcpavgconnduration "          << "gauge"                                                             << "\n";
   output << "# HELP " << statesbase << "tlsresumptions "              << "The number of times a TLS session has been resumed"                << "\n";
   output << "# TYPE " << statesbase << "tlsersumptions "              << "counter"                                                           << "\n";
+  output << "# HELP " << statesbase << "tlsktlssendconnections "      << "The number of TLS connections whose encryption was offloaded to the kernel" << "\n";
+  output << "# TYPE " << statesbase << "tlsktlssendconnections "      << "counter"                                                           << "\n";
+  output << "# HELP " << statesbase << "tlsktlsrecvconnections "      << "The number of TLS connections whose decryption was offloaded to the kernel" << "\n";
+  output << "# TYPE " << statesbase << "tlsktlsrecvconnections "      << "counter"                                                           << "\n";
 
   for (const auto& state : *states) {
     string serverName;
@@ -571,6 +594,8 @@ static void handlePrometheus(const YaHTTP::Request& req, YaHTTP::Response& resp)
     output << statesbase << "tcpavgqueriesperconn"         << label << " " << state->tcpAvgQueriesPerConnection  << "\n";
     output << statesbase << "tcpavgconnduration"           << label << " " << state->tcpAvgConnectionDuration    << "\n";
     output << statesbase << "tlsresumptions"               << label << " " << state->tlsResumptions              << "\n";
+    output << statesbase << "tlsktlssendconnections"       << label << " " << state->tlsKTLSSendConnections      << "\n";
+    output << statesbase << "tlsktlsrecvconnections"       << label << " " << state->tlsKTLSRecvConnections      << "\n";
   }
 
   const string frontsbase = "dnsdist_frontend_";
@@ -606,6 +631,14 @@ static void handlePrometheus(const YaHTTP::Request& req, YaHTTP::Response& resp)
   output << "# TYPE " << frontsbase << "tlsunknownticketkeys " << "counter" << "\n";
   output << "# HELP " << frontsbase << "tlsinactiveticketkeys " << "Amount of TLS sessions resumed from an inactive key" << "\n";
   output << "# TYPE " << frontsbase << "tlsinactiveticketkeys " << "counter" << "\n";
+  output << "# HELP " << frontsbase << "tlsnewsessionshandshakecputime " << "CPU time spent doing the handshake of new TLS sessions, in microseconds" << "\n";
+  output << "# TYPE " << frontsbase << "tlsnewsessionshandshakecputime " << "counter" << "\n";
+  output << "# HELP " << frontsbase << "tlsresumptionshandshakecputime " << "CPU time spent doing the handshake of resumed TLS sessions, in microseconds" << "\n";
+  output << "# TYPE " << frontsbase << "tlsresumptionshandshakecputime " << "counter" << "\n";
+  output << "# HELP " << frontsbase << "tlsktlssendconnections " << "Amount of TLS connections whose encryption was offloaded to the kernel" << "\n";
+  output << "# TYPE " << frontsbase << "tlsktlssendconnections " << "counter" << "\n";
+  output << "# HELP " << frontsbase << "tlsktlsrecvconnections " << "Amount of TLS connections whose decryption was offloaded to the kernel" << "\n";
+  output << "# TYPE " << frontsbase << "tlsktlsrecvconnections " << "counter" << "\n";
 
   output << "# HELP " << frontsbase << "tlshandshakefailures " << "Amount of TLS handshake failures" << "\n";
   output << "# TYPE " << frontsbase << "tlshandshakefailures " << "counter" << "\n";
@@ -644,6 +677,10 @@ static void handlePrometheus(const YaHTTP::Request& req, YaHTTP::Response& resp)
         output << frontsbase << "tlsresumptions" << label << front->tlsResumptions.load() << "\n";
         output << frontsbase << "tlsunknownticketkeys" << label << front->tlsUnknownTicketKey.load() << "\n";
         output << frontsbase << "tlsinactiveticketkeys" << label << front->tlsInactiveTicketKey.load() << "\n";
+        output << frontsbase << "tlsnewsessionshandshakecputime" << label << front->tlsNewSessionsHandshakeCPUTime.load() << "\n";
+        output << frontsbase << "tlsresumptionshandshakecputime" << label << front->tlsResumptionsHandshakeCPUTime.load() << "\n";
+        output << frontsbase << "tlsktlssendconnections" << label << front->tlsKTLSSendConnections.load() << "\n";
+        output << frontsbase << "tlsktlsrecvconnections" << label << front->tlsKTLSRecvConnections.load() << "\n";
 
         output << frontsbase << "tlsqueries{frontend=\"" << frontName << "\",proto=\"" << proto << "\",thread=\"" << threadNumber << "\",tls=\"tls10\"} " << front->tls10queries.load() << "\n";
         output << frontsbase << "tlsqueries{frontend=\"" << frontName << "\",proto=\"" << proto << "\",thread=\"" << threadNumber << "\",tls=\"tls11\"} " << front->tls11queries.load() << "\n";
@@ -757,6 +794,16 @@ static void handlePrometheus(const YaHTTP::Request& req, YaHTTP::Response& resp)
   output << "# TYPE dnsdist_pool_cache_insert_collisions " << "counter" << "\n";
   output << "# HELP dnsdist_pool_cache_ttl_too_shorts " << "Number of insertions into that cache skipped because the TTL of the answer was not long enough" << "\n";
   output << "# TYPE dnsdist_pool_cache_ttl_too_shorts " << "counter" << "\n";
+  output << "# HELP dnsdist_pool_cache_stale_hits " << "Number of hits from that cache served from an expired entry" << "\n";
+  output << "# TYPE dnsdist_pool_cache_stale_hits " << "counter" << "\n";
+  output << "# HELP dnsdist_pool_cache_refreshes " << "Number of queries sent to refresh an entry of that cache in the background" << "\n";
+  output << "# TYPE dnsdist_pool_cache_refreshes " << "counter" << "\n";
+  output << "# HELP dnsdist_pool_coalesced_queries " << "Number of queries answered with the response to an identical query already in flight to a backend of that pool" << "\n";
+  output << "# TYPE dnsdist_pool_coalesced_queries " << "counter" << "\n";
+  output << "# HELP dnsdist_pool_coalescing_bypassed " << "Number of queries forwarded despite an identical one already in flight to a backend of that pool, because of a collision or of the maximum number of followers" << "\n";
+  output << "# TYPE dnsdist_pool_coalescing_bypassed " << "counter" << "\n";
+  output << "# HELP dnsdist_pool_coalescing_unanswered " << "Number of coalesced queries that did not get a response because the one they were waiting for timed out or was dropped" << "\n";
+  output << "# TYPE dnsdist_pool_coalescing_unanswered " << "counter" << "\n";
 
   for (const auto& entry : *localPools) {
     string poolName = entry.first;
@@ -781,6 +828,15 @@ static void handlePrometheus(const YaHTTP::Request& req, YaHTTP::Response& resp)
       output << cachebase << "cache_lookup_collisions" <<label << " " << cache->getLookupCollisions() << "\n";
       output << cachebase << "cache_insert_collisions" <<label << " " << cache->getInsertCollisions() << "\n";
       output << cachebase << "cache_ttl_too_shorts"    <<label << " " << cache->getTTLTooShorts()     << "\n";
+      output << cachebase << "cache_stale_hits"        <<label << " " << cache->getStaleHits()        << "\n";
+      output << cachebase << "cache_refreshes"         <<label << " " << cache->getRefreshes()        << "\n";
+    }
+
+    if (pool->coalescer != nullptr) {
+      const auto stats = pool->coalescer->getStats();
+      output << cachebase << "coalesced_queries"     << label << " " << stats.d_followers  << "\n";
+      output << cachebase << "coalescing_bypassed"   << label << " " << stats.d_bypassed   << "\n";
+      output << cachebase << "coalescing_unanswered" << label << " " << stats.d_unanswered << "\n";
     }
   }
 
@@ -968,6 +1024,8 @@ static void addServerToJSON(Json::array& servers, int id, const std::shared_ptr<
     {"tcpAvgQueriesPerConnection", (double)a->tcpAvgQueriesPerConnection},
     {"tcpAvgConnectionDuration", (double)a->tcpAvgConnectionDuration},
     {"tlsResumptions", (double)a->tlsResumptions},
+    {"tlsKTLSSendConnections", (double)a->tlsKTLSSendConnections},
+    {"tlsKTLSRecvConnections", (double)a->tlsKTLSRecvConnections},
     {"dropRate", (double)a->dropRate}
   };
 
@@ -1017,6 +1075,10 @@ static void handleStats(const YaHTTP::Request& req, YaHTTP::Response& resp)
       { "tlsResumptions", (double) front->tlsResumptions },
       { "tlsUnknownTicketKey", (double) front->tlsUnknownTicketKey },
       { "tlsInactiveTicketKey", (double) front->tlsInactiveTicketKey },
+      { "tlsNewSessionsHandshakeCPUTime", (double) front->tlsNewSessionsHandshakeCPUTime },
+      { "tlsResumptionsHandshakeCPUTime", (double) front->tlsResumptionsHandshakeCPUTime },
+      { "tlsKTLSSendConnections", (double) front->tlsKTLSSendConnections },
+      { "tlsKTLSRecvConnections", (double) front->tlsKTLSRecvConnections },
       { "tls10Queries", (double) front->tls10queries },
       { "tls11Queries", (double) front->tls11queries },
       { "tls12Queries", (double) front->tls12queries },
@@ -1095,7 +1157,9 @@ static void handleStats(const YaHTTP::Request& req, YaHTTP::Response& resp)
       { "cacheDeferredLookups", (double) (cache ? cache->getDeferredLookups() : 0) },
       { "cacheLookupCollisions", (double) (cache ? cache->getLookupCollisions() : 0) },
       { "cacheInsertCollisions", (double) (cache ? cache->getInsertCollisions() : 0) },
-      { "cacheTTLTooShorts", (double) (cache ? cache->getTTLTooShorts() : 0) }
+      { "cacheTTLTooShorts", (double) (cache ? cache->getTTLTooShorts() : 0) },
+      { "cacheStaleHits", (double) (cache ? cache->getStaleHits() : 0) },
+      { "cacheRefreshes", (double) (cache ? cache->getRefreshes() : 0) }
     };
     pools.push_back(entry);
   }
@@ -1193,7 +1257,9 @@ static void handlePoolStats(const YaHTTP::Request& req, YaHTTP::Response& resp)
     { "cacheDeferredLookups", (double) (cache ? cache->getDeferredLookups() : 0) },
     { "cacheLookupCollisions", (double) (cache ? cache->getLookupCollisions() : 0) },
     { "cacheInsertCollisions", (double) (cache ? cache->getInsertCollisions() : 0) },
-    { "cacheTTLTooShorts", (double) (cache ? cache->getTTLTooShorts() : 0) }
+    { "cacheTTLTooShorts", (double) (cache ? cache->getTTLTooShorts() : 0) },
+    { "cacheStaleHits", (double) (cache ? cache->getStaleHits() : 0) },
+    { "cacheRefreshes", (double) (cache ? cache->getRefreshes() : 0) }
   };
 
   Json::array servers;
@@ -53,11 +53,13 @@
 #include "dnsdist-ecs.hh"
 #include "dnsdist-healthchecks.hh"
 #include "dnsdist-lua.hh"
+#include "dnsdist-lua-ffi.hh"
 #include "dnsdist-nghttp2.hh"
 #include "dnsdist-proxy-protocol.hh"
 #include "dnsdist-random.hh"
 #include "dnsdist-rings.hh"
 #include "dnsdist-secpoll.hh"
+#include "dnsdist-stage-latency.hh"
 #include "dnsdist-tcp.hh"
 #include "dnsdist-web.hh"
 #include "dnsdist-xpf.hh"
@@ -152,7 +154,7 @@ std::set<std::string> g_capabilitiesToRetain;
 static size_t const s_initialUDPPacketBufferSize = s_maxPacketCacheEntrySize + DNSCRYPT_MAX_RESPONSE_PADDING_AND_MAC_SIZE;
 static_assert(s_initialUDPPacketBufferSize <= UINT16_MAX, "Packet size should fit in a uint16_t");
 
-static void truncateTC(PacketBuffer& packet, size_t maximumSize, unsigned int qnameWireLength)
+void truncateTC(PacketBuffer& packet, size_t maximumSize, unsigned int qnameWireLength)
 {
   try
   {
@@ -307,7 +309,8 @@ static bool fixUpQueryTurnedResponse(DNSQuestion& dq, const uint16_t origFlags)
   return addEDNSToQueryTurnedResponse(dq);
 }
 
-static bool fixUpResponse(PacketBuffer& response, const DNSName& qname, uint16_t origFlags, bool ednsAdded, bool ecsAdded, bool* zeroScope)
+/* the summary is updated if the OPT RR is altered */
+static bool fixUpResponse(PacketBuffer& response, const DNSName& qname, uint16_t origFlags, bool ednsAdded, bool ecsAdded, boost::optional<uint8_t>* ecsScope, DNSPacketSummary& summary)
 {
   if (response.size() < sizeof(dnsheader)) {
     return false;
@@ -328,21 +331,31 @@ static bool fixUpResponse(PacketBuffer& response, const DNSName& qname, uint16_t
   }
 
   if (ednsAdded || ecsAdded) {
-    uint16_t optStart;
-    size_t optLen = 0;
-    bool last = false;
+    uint16_t optStart = summary.optStart;
+    size_t optLen = summary.optLen;
+    bool last = summary.lastIsOPT;
+    int res = summary.hasOPT ? 0 : ENOENT;
 
-    int res = locateEDNSOptRR(response, &optStart, &optLen, &last);
+    if (!summary.hasOPT && !summary.complete) {
+      /* the scan stopped before finding the OPT RR, let the stricter parser have a go at it */
+      res = locateEDNSOptRR(response, &optStart, &optLen, &last);
+    }
 
     if (res == 0) {
-      if (zeroScope) { // this finds if an EDNS Client Subnet scope was set, and if it is 0
-        size_t optContentStart = 0;
-        uint16_t optContentLen = 0;
-        /* we need at least 4 bytes after the option length (family: 2, source prefix-length: 1, scope prefix-length: 1) */
-        if (isEDNSOptionInOpt(response, optStart, optLen, EDNSOptionCode::ECS, &optContentStart, &optContentLen) && optContentLen >= 4) {
-          /* see if the EDNS Client Subnet SCOPE PREFIX-LENGTH byte in position 3 is set to 0, which is the only thing
-             we care about. */
-          *zeroScope = response.at(optContentStart + 3) == 0;
+      if (ecsScope) { // this finds if an EDNS Client Subnet scope was set, and its value
+        if (summary.hasOPT) {
+          if (summary.hasECSScope) {
+            *ecsScope = summary.ecsScope;
+          }
+        }
+        else {
+          size_t optContentStart = 0;
+          uint16_t optContentLen = 0;
+          /* we need at least 4 bytes after the option length (family: 2, source prefix-length: 1, scope prefix-length: 1) */
+          if (isEDNSOptionInOpt(response, optStart, optLen, EDNSOptionCode::ECS, &optContentStart, &optContentLen) && optContentLen >= 4) {
+            /* the EDNS Client Subnet SCOPE PREFIX-LENGTH byte is in position 3 */
+            *ecsScope = response.at(optContentStart + 3);
+          }
         }
       }
 
@@ -356,12 +369,19 @@ static bool fixUpResponse(PacketBuffer& response, const DNSName& qname, uint16_t
           uint16_t arcount = ntohs(dh->arcount);
           arcount--;
           dh->arcount = htons(arcount);
+          if (summary.hasOPT) {
+            /* the OPT RR was the last record so the TTL-related fields are still valid */
+            summary.hasOPT = false;
+            summary.hasECSScope = false;
+            --summary.additionals;
+          }
         }
         else {
           /* Removing an intermediary RR could lead to compression error */
           PacketBuffer rewrittenResponse;
           if (rewriteResponseWithoutEDNS(response, rewrittenResponse) == 0) {
             response = std::move(rewrittenResponse);
+            getDNSPacketSummary(reinterpret_cast<const char*>(response.data()), response.size(), summary);
           }
           else {
             warnlog("Error rewriting content");
@@ -377,12 +397,17 @@ static bool fixUpResponse(PacketBuffer& response, const DNSName& qname, uint16_t
           size_t existingOptLen = optLen;
           removeEDNSOptionFromOPT(reinterpret_cast<char*>(&response.at(optStart)), &optLen, EDNSOptionCode::ECS);
           response.resize(response.size() - (existingOptLen - optLen));
+          if (summary.hasOPT) {
+            summary.optLen = optLen;
+            summary.hasECSScope = false;
+          }
         }
         else {
           PacketBuffer rewrittenResponse;
           /* Removing an intermediary RR could lead to compression error */
           if (rewriteResponseWithoutEDNSOption(response, EDNSOptionCode::ECS, rewrittenResponse) == 0) {
             response = std::move(rewrittenResponse);
+            getDNSPacketSummary(reinterpret_cast<const char*>(response.data()), response.size(), summary);
           }
           else {
             warnlog("Error rewriting content");
@@ -449,14 +474,23 @@ static bool applyRulesToResponse(LocalStateHolder<vector<DNSDistResponseRuleActi
 // so that answers received over UDP for DoH are still cached with UDP answers.
 bool processResponse(PacketBuffer& response, LocalStateHolder<vector<DNSDistResponseRuleAction> >& localRespRuleActions, DNSResponse& dr, bool muted, bool receivedOverUDP)
 {
-  if (!applyRulesToResponse(localRespRuleActions, dr)) {
+  dnsdist::StageLatency::Timer stageTimer(dr.stageLatencySampled);
+  const bool passed = applyRulesToResponse(localRespRuleActions, dr);
+  stageTimer.record(dnsdist::StageLatency::Stage::ResponseRules);
+  if (!passed) {
     return false;
   }
 
-  bool zeroScope = false;
-  if (!fixUpResponse(response, *dr.qname, dr.origFlags, dr.ednsAdded, dr.ecsAdded, dr.useZeroScope ? &zeroScope : nullptr)) {
+  /* walk the response once, after the response rules since they might have altered it, and share the result
+     between the EDNS fix-up and the cache insertion */
+  DNSPacketSummary summary;
+  getDNSPacketSummary(reinterpret_cast<const char*>(response.data()), response.size(), summary);
+
+  boost::optional<uint8_t> ecsScope{boost::none};
+  if (!fixUpResponse(response, *dr.qname, dr.origFlags, dr.ednsAdded, dr.ecsAdded, dr.useZeroScope ? &ecsScope : nullptr, summary)) {
     return false;
   }
+  bool zeroScope = ecsScope && *ecsScope == 0;
 
   if (dr.packetCache && !dr.skipCache && response.size() <= s_maxPacketCacheEntrySize) {
     if (!dr.useZeroScope) {
@@ -470,6 +504,7 @@ bool processResponse(PacketBuffer& response, LocalStateHolder<vector<DNSDistResp
       */
       zeroScope = false;
     }
+    bool scoped = false;
     uint32_t cacheKey = dr.cacheKey;
     if (dr.protocol == dnsdist::Protocol::DoH && receivedOverUDP) {
       cacheKey = dr.cacheKeyUDP;
@@ -478,8 +513,19 @@ bool processResponse(PacketBuffer& response, LocalStateHolder<vector<DNSDistResp
       // if zeroScope, pass the pre-ECS hash-key and do not pass the subnet to the cache
       cacheKey = dr.cacheKeyNoECS;
     }
+    else if (ecsScope && dr.subnet && dr.packetCache->isECSScopeSharingEnabled()) {
+      // same conditions than zeroScope, but we store the answer once for the returned scope instead of once per client subnet
+      scoped = true;
+    }
 
-    dr.packetCache->insert(cacheKey, zeroScope ? boost::none : dr.subnet, dr.cacheFlags, dr.dnssecOK, *dr.qname, dr.qtype, dr.qclass, response, receivedOverUDP, dr.getHeader()->rcode, dr.tempFailureTTL);
+    if (scoped) {
+      /* a scope longer than the source prefix length is only valid for the source network (RFC 7871 section 7.3.1) */
+      const Netmask scope(dr.subnet->getNetwork(), std::min(*ecsScope, dr.subnet->getBits()));
+      dr.packetCache->insertScoped(dr.cacheKeyNoECS, scope, dr.cacheFlags, dr.dnssecOK, *dr.qname, dr.qtype, dr.qclass, response, receivedOverUDP, dr.getHeader()->rcode, dr.tempFailureTTL, &summary);
+    }
+    else {
+      dr.packetCache->insert(cacheKey, zeroScope ? boost::none : dr.subnet, dr.cacheFlags, dr.dnssecOK, *dr.qname, dr.qtype, dr.qclass, response, receivedOverUDP, dr.getHeader()->rcode, dr.tempFailureTTL, &summary);
+    }
   }
 
 #ifdef HAVE_DNSCRYPT
@@ -560,6 +606,36 @@ void handleResponseSent(const IDState& ids, double udiff, const ComboAddress& cl
   }
 }
 
+/* send a copy of the response to the queries that were coalesced with this one, or forget about them if the response is dropped */
+static void handleCoalescedQueries(IDState& ids, const PacketBuffer& response, bool drop, const DownstreamState& dss, const dnsheader& cleartextDH)
+{
+  auto coalescer = std::move(ids.coalescer);
+  if (drop) {
+    coalescer->abandon(ids.cacheKey, ids.coalescingToken);
+    return;
+  }
+
+  const auto followers = coalescer->release(ids.cacheKey, ids.coalescingToken);
+  PacketBuffer copy;
+  for (const auto& follower : followers) {
+    if (follower.d_cs == nullptr || follower.d_cs->muted) {
+      continue;
+    }
+
+    copy = response;
+    dnsdist::QueryCoalescer::prepareResponseForFollower(copy, follower);
+    sendUDPResponse(follower.d_fd, copy, 0, follower.d_local, follower.d_remote);
+    ++g_stats.responses;
+    ++follower.d_cs->responses;
+
+    StopWatch sw(true);
+    sw.set(follower.d_queryTime);
+    double udiff = sw.udiff();
+    handleResponseSent(ids, udiff, follower.d_remote, dss.d_config.remote, copy.size(), cleartextDH, dss.getProtocol());
+    doLatencyStats(udiff);
+  }
+}
+
 // listens on a dedicated socket, lobs answers from downstream servers to original requestors
 void responderThread(std::shared_ptr<DownstreamState> dss)
 {
@@ -662,13 +738,32 @@ void responderThread(std::shared_ptr<DownstreamState> dss)
           continue;
         }
 
+        if (ids->stageLatencySampled && !ids->cacheRefresh) {
+          dnsdist::StageLatency::record(dnsdist::StageLatency::Stage::Backend, ids->sentTime.udiff() - ids->stageLatencySentUsec);
+        }
+
         DNSResponse dr = makeDNSResponseFromIDState(*ids, response);
         if (dh->tc && g_truncateTC) {
           truncateTC(response, dr.getMaximumSize(), qnameWireLength);
         }
         memcpy(&cleartextDH, dr.getHeader(), sizeof(cleartextDH));
 
+        if (ids->cacheRefresh) {
+          /* background refresh of a cache entry, we only need to insert the response into the cache.
+             A failure must not replace the (possibly stale) entry we are still serving, so only
+             NoError and NXDomain answers are considered. The response rules still run, as they
+             might alter what gets cached, but nothing is sent */
+          if (cleartextDH.rcode == RCode::NoError || cleartextDH.rcode == RCode::NXDomain) {
+            processResponse(response, localRespRuleActions, dr, true, true);
+          }
+          dss->releaseState(queryId);
+          continue;
+        }
+
         if (!processResponse(response, localRespRuleActions, dr, ids->cs && ids->cs->muted, true)) {
+          if (ids->coalescer) {
+            handleCoalescedQueries(*ids, response, true, *dss, cleartextDH);
+          }
           dss->releaseState(queryId);
           continue;
         }
@@ -684,6 +779,10 @@ void responderThread(std::shared_ptr<DownstreamState> dss)
           sendUDPResponse(origFD, response, dr.delayMsec, ids->hopLocal, ids->hopRemote);
         }
 
+        if (ids->coalescer) {
+          handleCoalescedQueries(*ids, response, false, *dss, cleartextDH);
+        }
+
         double udiff = ids->sentTime.udiff();
         vinfolog("Got answer from %s, relayed to %s, took %f usec", dss->d_config.remote.toStringWithPort(), ids->origRemote.toStringWithPort(), udiff);
 
@@ -1137,8 +1236,12 @@ static bool prepareOutgoingResponse(LocalHolders& holders, ClientState& cs, DNSQ
   dr.uniqueId = dq.uniqueId;
   dr.qTag = std::move(dq.qTag);
   dr.delayMsec = dq.delayMsec;
+  dr.stageLatencySampled = dq.stageLatencySampled;
 
-  if (!applyRulesToResponse(cacheHit ? holders.cacheHitRespRuleactions : holders.selfAnsweredRespRuleactions, dr)) {
+  dnsdist::StageLatency::Timer stageTimer(dr.stageLatencySampled);
+  const bool passed = applyRulesToResponse(cacheHit ? holders.cacheHitRespRuleactions : holders.selfAnsweredRespRuleactions, dr);
+  stageTimer.record(dnsdist::StageLatency::Stage::ResponseRules);
+  if (!passed) {
     return false;
   }
 
@@ -1184,7 +1287,11 @@ ProcessQueryResult processQuery(DNSQuestion& dq, ClientState& cs, LocalHolders&
     struct timespec now;
     gettime(&now);
 
-    if (!applyRulesToQuery(holders, dq, now)) {
+    dq.stageLatencySampled = dnsdist::StageLatency::shouldSample();
+    dnsdist::StageLatency::Timer stageTimer(dq.stageLatencySampled);
+    const bool passed = applyRulesToQuery(holders, dq, now);
+    stageTimer.record(dnsdist::StageLatency::Stage::Rules);
+    if (!passed) {
       return ProcessQueryResult::Drop;
     }
 
@@ -1205,7 +1312,9 @@ ProcessQueryResult processQuery(DNSQuestion& dq, ClientState& cs, LocalHolders&
     dq.packetCache = serverPool->packetCache;
     const auto& policy = poolPolicy != nullptr ? *poolPolicy : *(holders.policy);
     const auto servers = serverPool->getServers();
+    stageTimer.reset();
     selectedBackend = policy.getSelectedBackend(*servers, dq);
+    stageTimer.record(dnsdist::StageLatency::Stage::ServerSelection);
 
     uint32_t allowExpired = selectedBackend ? 0 : g_staleCacheEntriesTTL;
 
@@ -1218,7 +1327,10 @@ ProcessQueryResult processQuery(DNSQuestion& dq, ClientState& cs, LocalHolders&
       // we need ECS parsing (parseECS) to be true so we can be sure that the initial incoming query did not have an existing
       // ECS option, which would make it unsuitable for the zero-scope feature.
       if (dq.packetCache && !dq.skipCache && (!selectedBackend || !selectedBackend->d_config.disableZeroScope) && dq.packetCache->isECSParsingEnabled()) {
-        if (dq.packetCache->get(dq, dq.getHeader()->id, &dq.cacheKeyNoECS, dq.subnet, dq.dnssecOK, !dq.overTCP(), allowExpired)) {
+        stageTimer.reset();
+        const bool hit = dq.packetCache->get(dq, dq.getHeader()->id, &dq.cacheKeyNoECS, dq.subnet, dq.dnssecOK, !dq.overTCP(), allowExpired);
+        stageTimer.record(dnsdist::StageLatency::Stage::CacheLookup);
+        if (hit) {
 
           if (!prepareOutgoingResponse(holders, cs, dq, true)) {
             return ProcessQueryResult::Drop;
@@ -1230,6 +1342,18 @@ ProcessQueryResult processQuery(DNSQuestion& dq, ClientState& cs, LocalHolders&
         if (!dq.subnet) {
           /* there was no existing ECS on the query, enable the zero-scope feature */
           dq.useZeroScope = true;
+
+          if (dq.packetCache->isECSScopeSharingEnabled()) {
+            /* look for an answer whose scope covers the subnet we are about to send */
+            const Netmask source(dq.ecsSet ? dq.ecs.getNetwork() : *dq.remote, dq.ecsSet ? dq.ecs.getBits() : dq.ecsPrefixLength);
+            if (dq.packetCache->getScoped(dq, dq.getHeader()->id, dq.cacheKeyNoECS, source, dq.dnssecOK, !dq.overTCP(), allowExpired)) {
+              if (!prepareOutgoingResponse(holders, cs, dq, true)) {
+                return ProcessQueryResult::Drop;
+              }
+
+              return ProcessQueryResult::SendAnswer;
+            }
+          }
         }
       }
 
@@ -1240,7 +1364,12 @@ ProcessQueryResult processQuery(DNSQuestion& dq, ClientState& cs, LocalHolders&
     }
 
     if (dq.packetCache && !dq.skipCache) {
-      if (dq.packetCache->get(dq, dq.getHeader()->id, &dq.cacheKey, dq.subnet, dq.dnssecOK, !dq.overTCP(), allowExpired)) {
+      /* refreshing cache entries in the background is only supported for queries received and forwarded over UDP for now */
+      const bool refreshAllowed = selectedBackend && !selectedBackend->isTCPOnly() && (dq.protocol == dnsdist::Protocol::DoUDP || dq.protocol == dnsdist::Protocol::DNSCryptUDP) && dq.packetCache->isRefreshEnabled();
+      stageTimer.reset();
+      const bool hit = dq.packetCache->get(dq, dq.getHeader()->id, &dq.cacheKey, dq.subnet, dq.dnssecOK, !dq.overTCP(), allowExpired, false, refreshAllowed);
+      stageTimer.record(dnsdist::StageLatency::Stage::CacheLookup);
+      if (hit) {
 
         restoreFlags(dq.getHeader(), dq.origFlags);
 
@@ -1267,6 +1396,11 @@ ProcessQueryResult processQuery(DNSQuestion& dq, ClientState& cs, LocalHolders&
       }
 
       ++g_stats.cacheMisses;
+
+      /* the response is going to be sent as-is to the followers, which is not possible with DNSCrypt */
+      if (serverPool->coalescer && dq.protocol == dnsdist::Protocol::DoUDP) {
+        dq.coalescer = serverPool->coalescer;
+      }
     }
 
     if (!selectedBackend) {
@@ -1415,7 +1549,75 @@ private:
   uint16_t d_payloadSize{0};
 };
 
-static void processUDPQuery(ClientState& cs, LocalHolders& holders, const struct msghdr* msgh, const ComboAddress& remote, ComboAddress& dest, PacketBuffer& query, struct mmsghdr* responsesVect, unsigned int* queuedResponses, struct iovec* respIOV, cmsgbuf_aligned* respCBuf)
+/* send a copy of a query whose answer has been served from the cache, so that the cache entry gets refreshed */
+static void sendCacheRefreshQuery(ClientState& cs, DNSQuestion& dq, std::shared_ptr<DownstreamState>& ss, DNSName&& qname)
+{
+  auto query = std::move(dq.cacheRefreshQuery);
+  auto dh = reinterpret_cast<struct dnsheader*>(query->data());
+  /* save the DNS flags as sent to the backend so we can cache the answer with the right flags later */
+  dq.cacheFlags = *getFlagsFromDNSHeader(dh);
+
+  std::string proxyProtocolPayload;
+  if (ss->d_config.useProxyProtocol) {
+    proxyProtocolPayload = getProxyProtocolPayload(dq);
+  }
+
+  unsigned int idOffset = 0;
+  int64_t generation;
+  IDState* ids = ss->getIDState(idOffset, generation);
+
+  ids->cs = &cs;
+  ids->origFD = -1;
+  ids->origID = dh->id;
+  setIDStateFromDNSQuestion(*ids, dq, std::move(qname));
+  ids->cacheRefresh = true;
+  /* nobody is waiting for this response so there is nothing to encrypt */
+  ids->dnsCryptQuery = nullptr;
+
+  dh->id = idOffset;
+
+  if (!proxyProtocolPayload.empty()) {
+    addProxyProtocol(*query, proxyProtocolPayload);
+  }
+
+  int fd = ss->pickSocketForSending();
+  ids->backendFD = fd;
+  ssize_t ret = udpClientSendRequestToBackend(ss, fd, *query);
+
+  if (ret < 0) {
+    ++ss->sendErrors;
+    ++g_stats.downstreamSendErrors;
+  }
+
+  ss->incQueriesCount();
+  vinfolog("Refreshing cache entry for %s|%s via %s", ids->qname.toLogString(), QType(ids->qtype).toString(), ss->getName());
+}
+
+/* apply the verdict decided by the batch FFI function for this query, bypassing the rules, the cache and the backends */
+static ProcessQueryResult processFFIBatchVerdict(DNSQuestion& dq, ClientState& cs, LocalHolders& holders, DNSAction::Action verdict)
+{
+  struct timespec now;
+  gettime(&now);
+  g_rings.insertQuery(now, *dq.remote, *dq.qname, dq.qtype, dq.getData().size(), *dq.getHeader(), dq.getProtocol());
+
+  std::string ruleresult;
+  bool drop = false;
+  processRulesResult(verdict, dq, ruleresult, drop);
+  if (drop || !dq.getHeader()->qr) {
+    return ProcessQueryResult::Drop;
+  }
+
+  fixUpQueryTurnedResponse(dq, dq.origFlags);
+  if (!prepareOutgoingResponse(holders, cs, dq, false)) {
+    return ProcessQueryResult::Drop;
+  }
+
+  ++g_stats.selfAnswered;
+  ++cs.responses;
+  return ProcessQueryResult::SendAnswer;
+}
+
+static void processUDPQuery(ClientState& cs, LocalHolders& holders, const struct msghdr* msgh, const ComboAddress& remote, ComboAddress& dest, PacketBuffer& query, struct mmsghdr* responsesVect, unsigned int* queuedResponses, struct iovec* respIOV, cmsgbuf_aligned* respCBuf, DNSAction::Action batchVerdict = DNSAction::Action::None)
 {
   assert(responsesVect == nullptr || (queuedResponses != nullptr && respIOV != nullptr && respCBuf != nullptr));
   uint16_t queryId = 0;
@@ -1430,8 +1632,8 @@ static void processUDPQuery(ClientState& cs, LocalHolders& holders, const struct
     /* dest might have been updated, if we managed to harvest the destination address */
     proxiedDestination = dest;
 
-    std::vector<ProxyProtocolValue> proxyProtocolValues;
-    if (expectProxyProtocol && !handleProxyProtocol(remote, false, *holders.acl, query, proxiedRemote, proxiedDestination, proxyProtocolValues)) {
+    std::string proxyProtocolRawValues;
+    if (expectProxyProtocol && !handleProxyProtocol(remote, false, *holders.acl, query, proxiedRemote, proxiedDestination, proxyProtocolRawValues)) {
       return;
     }
 
@@ -1470,13 +1672,13 @@ static void processUDPQuery(ClientState& cs, LocalHolders& holders, const struct
     DNSName qname(reinterpret_cast<const char*>(query.data()), query.size(), sizeof(dnsheader), false, &qtype, &qclass, &qnameWireLength);
     DNSQuestion dq(&qname, qtype, qclass, proxiedDestination.sin4.sin_family != 0 ? &proxiedDestination : &cs.local, &proxiedRemote, query, dnsCryptQuery ? dnsdist::Protocol::DNSCryptUDP : dnsdist::Protocol::DoUDP, &queryRealTime);
     dq.dnsCryptQuery = std::move(dnsCryptQuery);
-    if (!proxyProtocolValues.empty()) {
-      dq.proxyProtocolValues = make_unique<std::vector<ProxyProtocolValue>>(std::move(proxyProtocolValues));
+    if (!proxyProtocolRawValues.empty()) {
+      dq.proxyProtocolRawValues = make_unique<std::string>(std::move(proxyProtocolRawValues));
     }
     dq.hopRemote = &remote;
     dq.hopLocal = &dest;
     std::shared_ptr<DownstreamState> ss{nullptr};
-    auto result = processQuery(dq, cs, holders, ss);
+    auto result = batchVerdict == DNSAction::Action::None ? processQuery(dq, cs, holders, ss) : processFFIBatchVerdict(dq, cs, holders, batchVerdict);
 
     if (result == ProcessQueryResult::Drop) {
       return;
@@ -1485,6 +1687,10 @@ static void processUDPQuery(ClientState& cs, LocalHolders& holders, const struct
     // the buffer might have been invalidated by now (resized)
     struct dnsheader* dh = dq.getHeader();
     if (result == ProcessQueryResult::SendAnswer) {
+      if (dq.cacheRefreshQuery && ss) {
+        sendCacheRefreshQuery(cs, dq, ss, std::move(qname));
+      }
+
 #ifndef DISABLE_RECVMMSG
 #if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE)
       if (dq.delayMsec == 0 && responsesVect != nullptr) {
@@ -1529,6 +1735,25 @@ static void processUDPQuery(ClientState& cs, LocalHolders& holders, const struct
       return;
     }
 
+    uint64_t coalescingToken = 0;
+    if (dq.coalescer) {
+      dnsdist::QueryCoalescer::Follower follower;
+      follower.d_remote = remote;
+      follower.d_local = dest;
+      follower.d_cs = &cs;
+      follower.d_fd = cs.udpFD;
+      follower.d_id = dh->id;
+      follower.d_queryTime = queryRealTime;
+      const auto coalescing = dq.coalescer->addQuery(dq.cacheKey, qname, dq.qtype, dq.qclass, dq.cacheFlags, dq.dnssecOK, dq.subnet, follower, queryRealTime.tv_sec, coalescingToken);
+      if (coalescing == dnsdist::QueryCoalescer::Result::Follower) {
+        /* the response to an identical query already in flight will be sent to this client as well */
+        return;
+      }
+      if (coalescing == dnsdist::QueryCoalescer::Result::Bypass) {
+        dq.coalescer = nullptr;
+      }
+    }
+
     unsigned int idOffset = 0;
     int64_t generation;
     IDState* ids = ss->getIDState(idOffset, generation);
@@ -1537,6 +1762,10 @@ static void processUDPQuery(ClientState& cs, LocalHolders& holders, const struct
     ids->origFD = cs.udpFD;
     ids->origID = dh->id;
     setIDStateFromDNSQuestion(*ids, dq, std::move(qname));
+    if (dq.coalescer) {
+      ids->coalescer = std::move(dq.coalescer);
+      ids->coalescingToken = coalescingToken;
+    }
 
     if (dest.sin4.sin_family != 0) {
       ids->origDest = dest;
@@ -1554,6 +1783,9 @@ static void processUDPQuery(ClientState& cs, LocalHolders& holders, const struct
 
     int fd = ss->pickSocketForSending();
     ids->backendFD = fd;
+    if (ids->stageLatencySampled) {
+      ids->stageLatencySentUsec = static_cast<uint32_t>(ids->sentTime.udiff());
+    }
     ssize_t ret = udpClientSendRequestToBackend(ss, fd, query);
 
     if(ret < 0) {
@@ -1586,6 +1818,11 @@ static void MultipleMessagesUDPClientThread(ClientState* cs, LocalHolders& holde
   auto recvData = std::make_unique<MMReceiver[]>(vectSize);
   auto msgVec = std::make_unique<struct mmsghdr[]>(vectSize);
   auto outMsgVec = std::make_unique<struct mmsghdr[]>(vectSize);
+  /* DNSCrypt queries are encrypted, there is nothing the batch function could look at */
+  std::unique_ptr<dnsdist::FFIBatchFilter> batchFilter{nullptr};
+  if (dnsdist::FFIBatchFilter::isEnabled() && !cs->dnscryptCtx) {
+    batchFilter = std::make_unique<dnsdist::FFIBatchFilter>(vectSize);
+  }
 
   /* the actual buffer is larger because:
      - we may have to add EDNS and/or ECS
@@ -1624,6 +1861,27 @@ static void MultipleMessagesUDPClientThread(ClientState* cs, LocalHolders& holde
 
     unsigned int msgsToSend = 0;
 
+    if (batchFilter) {
+      /* let the batch function look at all the queries we received in one call,
+         skipping the ones that will be rejected anyway and the ones carrying a proxy protocol
+         payload since the source address is not known yet */
+      batchFilter->setCount(msgsGot);
+      for (int msgIdx = 0; msgIdx < msgsGot; msgIdx++) {
+        const struct msghdr* msgh = &msgVec[msgIdx].msg_hdr;
+        unsigned int got = msgVec[msgIdx].msg_len;
+        const ComboAddress& remote = recvData[msgIdx].remote;
+
+        if (static_cast<size_t>(got) < sizeof(struct dnsheader) || (msgh->msg_flags & MSG_TRUNC) || expectProxyProtocolFrom(remote)) {
+          batchFilter->fill(msgIdx, nullptr, remote);
+          continue;
+        }
+
+        recvData[msgIdx].packet.resize(got);
+        batchFilter->fill(msgIdx, &recvData[msgIdx].packet, remote);
+      }
+      batchFilter->run();
+    }
+
     /* process the received messages */
     for (int msgIdx = 0; msgIdx < msgsGot; msgIdx++) {
       const struct msghdr* msgh = &msgVec[msgIdx].msg_hdr;
@@ -1636,7 +1894,7 @@ static void MultipleMessagesUDPClientThread(ClientState* cs, LocalHolders& holde
       }
 
       recvData[msgIdx].packet.resize(got);
-      processUDPQuery(*cs, holders, msgh, remote, recvData[msgIdx].dest, recvData[msgIdx].packet, outMsgVec.get(), &msgsToSend, &recvData[msgIdx].iov, &recvData[msgIdx].cbuf);
+      processUDPQuery(*cs, holders, msgh, remote, recvData[msgIdx].dest, recvData[msgIdx].packet, outMsgVec.get(), &msgsToSend, &recvData[msgIdx].iov, &recvData[msgIdx].cbuf, batchFilter ? batchFilter->getVerdict(msgIdx) : DNSAction::Action::None);
     }
 
     /* immediate (not delayed or sent to a backend) responses (mostly from a rule, dynamic block
@@ -1725,6 +1983,10 @@ boost::optional<uint64_t> g_maxTCPClientThreads{boost::none};
 pdns::stat16_t g_cacheCleaningDelay{60};
 pdns::stat16_t g_cacheCleaningPercentage{100};
 
+/* set from the SIGTERM handler when at least one packet cache needs to be
+   saved to a snapshot file before exiting, acted upon by the maintenance thread */
+static volatile sig_atomic_t s_exitRequested{0};
+
 static void maintThread()
 {
   setThreadName("dnsdist/main");
@@ -1735,6 +1997,11 @@ static void maintThread()
   for (;;) {
     sleep(interval);
 
+    if (s_exitRequested) {
+      dnsdist::PacketCacheSnapshots::saveAll();
+      _exit(EXIT_SUCCESS);
+    }
+
     {
       auto lua = g_lua.lock();
       auto f = lua->readVariable<boost::optional<std::function<void()> > >("maintenance");
@@ -1753,6 +2020,17 @@ static void maintThread()
       }
     }
 
+    {
+      /* forget about the coalesced queries whose leader did not get a response in time */
+      const time_t now = time(nullptr);
+      auto localPools = g_pools.getLocal();
+      for (const auto& entry : *localPools) {
+        if (entry.second->coalescer) {
+          entry.second->coalescer->purgeExpired(now);
+        }
+      }
+    }
+
     counter++;
     if (counter >= g_cacheCleaningDelay) {
       /* keep track, for each cache, of whether we should keep
@@ -2163,12 +2441,18 @@ static void cleanupLuaObjects()
 
 static void sighandler(int sig)
 {
+  dnsdist::PacketCacheSnapshots::saveAll();
   cleanupLuaObjects();
   exit(EXIT_SUCCESS);
 }
+#else
+static void snapshotSighandler(int sig)
+{
+  s_exitRequested = 1;
+}
 #endif
 
-int main(int argc, char** argv)
+int dnsdistMain(int argc, char** argv)
 {
   try {
     size_t udpBindsCount = 0;
@@ -2466,6 +2750,13 @@ int main(int argc, char** argv)
 
     g_configurationDone = true;
 
+#ifndef COVERAGE
+    if (!dnsdist::PacketCacheSnapshots::empty()) {
+      /* we can't save the snapshots from the signal handler itself, so let the maintenance thread do it */
+      signal(SIGTERM, snapshotSighandler);
+    }
+#endif
+
     g_rings.init();
 
     for(auto& frontend : g_frontends) {
@@ -2664,6 +2955,7 @@ int main(int argc, char** argv)
       healththread.detach();
       doConsole();
     }
+    dnsdist::PacketCacheSnapshots::saveAll();
 #ifdef COVERAGE
     cleanupLuaObjects();
     exit(EXIT_SUCCESS);
@@ -36,6 +36,7 @@
 #include "circular_buffer.hh"
 #include "dnscrypt.hh"
 #include "dnsdist-cache.hh"
+#include "dnsdist-coalescing.hh"
 #include "dnsdist-dynbpf.hh"
 #include "dnsdist-lbpolicies.hh"
 #include "dnsdist-protocols.hh"
@@ -146,6 +147,8 @@ public:
   std::string poolname;
   mutable std::shared_ptr<std::map<uint16_t, EDNSOptionView> > ednsOptions;
   std::shared_ptr<DNSDistPacketCache> packetCache{nullptr};
+  /* set when this query missed the cache of a pool coalescing identical queries */
+  std::shared_ptr<dnsdist::QueryCoalescer> coalescer{nullptr};
   const DNSName* qname{nullptr};
   const ComboAddress* local{nullptr};
   const ComboAddress* remote{nullptr};
@@ -156,7 +159,12 @@ public:
   const ComboAddress* hopRemote{nullptr};
   std::unique_ptr<QTag> qTag{nullptr};
   std::unique_ptr<std::vector<ProxyProtocolValue>> proxyProtocolValues{nullptr};
+  /* TLV values of the incoming proxy protocol header, in wire format. Only set when proxyProtocolValues is not,
+     use the helpers from dnsdist-proxy-protocol.hh instead of accessing these two fields directly */
+  std::unique_ptr<std::string> proxyProtocolRawValues{nullptr};
   std::unique_ptr<DNSCryptQuery> dnsCryptQuery{nullptr};
+  /* copy of the query, set when the cached answer we are sending should be refreshed in the background */
+  std::unique_ptr<PacketBuffer> cacheRefreshQuery{nullptr};
   const struct timespec* queryTime{nullptr};
   struct DOHUnit* du{nullptr};
   int delayMsec{0};
@@ -181,6 +189,7 @@ public:
   bool ednsAdded{false};
   bool useZeroScope{false};
   bool dnssecOK{false};
+  bool stageLatencySampled{false};
 };
 
 struct DNSResponse : DNSQuestion
@@ -590,6 +599,10 @@ struct ClientState
   stat_t tlsResumptions{0}; // A TLS session has been resumed, either via session id or via a TLS ticket
   stat_t tlsUnknownTicketKey{0}; // A TLS ticket has been presented but we don't have the associated key (might have expired)
   stat_t tlsInactiveTicketKey{0}; // A TLS ticket has been successfully resumed but the key is no longer active, we should issue a new one
+  stat_t tlsNewSessionsHandshakeCPUTime{0}; // CPU time spent doing the handshake of new TLS sessions, in microseconds (DoT only)
+  stat_t tlsResumptionsHandshakeCPUTime{0}; // CPU time spent doing the handshake of resumed TLS sessions, in microseconds (DoT only)
+  stat_t tlsKTLSSendConnections{0}; // TLS connections for which the encryption of outgoing records has been offloaded to the kernel (DoT only)
+  stat_t tlsKTLSRecvConnections{0}; // TLS connections for which the decryption of incoming records has been offloaded to the kernel (DoT only)
   stat_t tls10queries{0};   // valid DNS queries received via TLSv1.0
   stat_t tls11queries{0};   // valid DNS queries received via TLSv1.1
   stat_t tls12queries{0};   // valid DNS queries received via TLSv1.2
@@ -784,6 +797,8 @@ struct DownstreamState: public std::enable_shared_from_this<DownstreamState>
   stat_t tcpReusedConnections{0};
   stat_t tcpNewConnections{0};
   stat_t tlsResumptions{0};
+  stat_t tlsKTLSSendConnections{0};
+  stat_t tlsKTLSRecvConnections{0};
   pdns::stat_t_trait<double> tcpAvgQueriesPerConnection{0.0};
   /* in ms */
   pdns::stat_t_trait<double> tcpAvgConnectionDuration{0.0};
@@ -990,6 +1005,7 @@ struct ServerPool
   }
 
   std::shared_ptr<DNSDistPacketCache> packetCache{nullptr};
+  std::shared_ptr<dnsdist::QueryCoalescer> coalescer{nullptr};
   std::shared_ptr<ServerPolicy> policy{nullptr};
 
   size_t poolLoad();
@@ -1102,6 +1118,8 @@ void resetLuaSideEffect(); // reset to indeterminate state
 bool responseContentMatches(const PacketBuffer& response, const DNSName& qname, const uint16_t qtype, const uint16_t qclass, const ComboAddress& remote, unsigned int& qnameWireLength);
 bool processResponse(PacketBuffer& response, LocalStateHolder<vector<DNSDistResponseRuleAction> >& localRespRuleActions, DNSResponse& dr, bool muted, bool receivedOverUDP);
 bool processRulesResult(const DNSAction::Action& action, DNSQuestion& dq, std::string& ruleresult, bool& drop);
+/* remove everything but the question section (and the OPT record, if any and if g_addEDNSToSelfGeneratedResponses is set) */
+void truncateTC(PacketBuffer& packet, size_t maximumSize, unsigned int qnameWireLength);
 
 bool checkQueryHeaders(const struct dnsheader* dh);
 
@@ -1129,3 +1147,6 @@ void setIDStateFromDNSQuestion(IDState& ids, DNSQuestion& dq, DNSName&& qname);
 ssize_t udpClientSendRequestToBackend(const std::shared_ptr<DownstreamState>& ss, const int sd, const PacketBuffer& request, bool healthCheck = false);
 void handleResponseSent(const IDState& ids, double udiff, const ComboAddress& client, const ComboAddress& backend, unsigned int size, const dnsheader& cleartextDH, dnsdist::Protocol protocol);
 
+/* the actual main() of dnsdist, which lives in its own file so that other programs, like the load-test harness, can link everything else */
+int dnsdistMain(int argc, char** argv);
+
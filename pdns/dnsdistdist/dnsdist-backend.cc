@@ -325,6 +325,10 @@ void DownstreamState::handleTimeout(IDState& ids)
   handleDOHTimeout(DOHUnitUniquePtr(oldDU, DOHUnit::release));
   oldDU = nullptr;
   ids.age = 0;
+  if (ids.coalescer) {
+    ids.coalescer->abandon(ids.cacheKey, ids.coalescingToken);
+    ids.coalescer = nullptr;
+  }
   reuseds++;
   --outstanding;
   ++g_stats.downstreamTimeouts; // this is an 'actively' discovered timeout
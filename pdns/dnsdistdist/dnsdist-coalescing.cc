@@ -0,0 +1,150 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "dnsdist-coalescing.hh"
+#include "dns.hh"
+
+namespace dnsdist
+{
+QueryCoalescer::QueryCoalescer(const Config& config): d_config(config), d_shards(std::max(config.d_shards, static_cast<size_t>(1)))
+{
+}
+
+QueryCoalescer::Result QueryCoalescer::addQuery(uint32_t key, const DNSName& qname, uint16_t qtype, uint16_t qclass, uint16_t queryFlags, bool dnssecOK, const boost::optional<Netmask>& subnet, const Follower& follower, time_t now, uint64_t& token)
+{
+  auto shard = d_shards.at(key % d_shards.size()).lock();
+  auto it = shard->d_entries.find(key);
+  if (it != shard->d_entries.end()) {
+    auto& entry = it->second;
+    if (now - entry.d_created < static_cast<time_t>(d_config.d_timeout)) {
+      if (entry.d_qtype != qtype || entry.d_qclass != qclass || entry.d_queryFlags != queryFlags || entry.d_dnssecOK != dnssecOK || entry.d_subnet != subnet || entry.d_qname != qname || entry.d_followers.size() >= d_config.d_maxFollowers) {
+        ++shard->d_stats.d_bypassed;
+        return Result::Bypass;
+      }
+
+      entry.d_followers.push_back(follower);
+      entry.d_followers.back().d_qname = qname;
+      ++shard->d_stats.d_followers;
+      return Result::Follower;
+    }
+
+    /* the leader has not been released in time, its followers are lost and we take its place */
+    shard->d_stats.d_unanswered += entry.d_followers.size();
+    shard->d_entries.erase(it);
+  }
+
+  Entry entry;
+  entry.d_qname = qname;
+  entry.d_subnet = subnet;
+  entry.d_created = now;
+  entry.d_token = shard->d_nextToken++;
+  entry.d_qtype = qtype;
+  entry.d_qclass = qclass;
+  entry.d_queryFlags = queryFlags;
+  entry.d_dnssecOK = dnssecOK;
+  token = entry.d_token;
+  shard->d_entries.emplace(key, std::move(entry));
+  ++shard->d_stats.d_leaders;
+  return Result::Leader;
+}
+
+std::vector<QueryCoalescer::Follower> QueryCoalescer::release(uint32_t key, uint64_t token)
+{
+  std::vector<Follower> followers;
+  auto shard = d_shards.at(key % d_shards.size()).lock();
+  auto it = shard->d_entries.find(key);
+  if (it == shard->d_entries.end() || it->second.d_token != token) {
+    return followers;
+  }
+
+  followers = std::move(it->second.d_followers);
+  shard->d_entries.erase(it);
+  return followers;
+}
+
+void QueryCoalescer::prepareResponseForFollower(PacketBuffer& response, const Follower& follower)
+{
+  if (response.size() < sizeof(dnsheader)) {
+    return;
+  }
+
+  auto dh = reinterpret_cast<struct dnsheader*>(response.data());
+  dh->id = follower.d_id;
+  /* restore the case of the qname as sent by this client */
+  const auto& qname = follower.d_qname.getStorage();
+  if (dh->qdcount != 0 && response.size() >= sizeof(dnsheader) + qname.size()) {
+    memcpy(&response.at(sizeof(dnsheader)), qname.data(), qname.size());
+  }
+}
+
+void QueryCoalescer::abandon(uint32_t key, uint64_t token)
+{
+  auto shard = d_shards.at(key % d_shards.size()).lock();
+  auto it = shard->d_entries.find(key);
+  if (it == shard->d_entries.end() || it->second.d_token != token) {
+    return;
+  }
+
+  shard->d_stats.d_unanswered += it->second.d_followers.size();
+  shard->d_entries.erase(it);
+}
+
+size_t QueryCoalescer::purgeExpired(time_t now)
+{
+  size_t removed = 0;
+  for (auto& lockedShard : d_shards) {
+    auto shard = lockedShard.lock();
+    for (auto it = shard->d_entries.begin(); it != shard->d_entries.end(); ) {
+      if (now - it->second.d_created >= static_cast<time_t>(d_config.d_timeout)) {
+        shard->d_stats.d_unanswered += it->second.d_followers.size();
+        it = shard->d_entries.erase(it);
+        ++removed;
+      }
+      else {
+        ++it;
+      }
+    }
+  }
+  return removed;
+}
+
+QueryCoalescer::Stats QueryCoalescer::getStats() const
+{
+  Stats result;
+  for (auto& lockedShard : d_shards) {
+    auto shard = lockedShard.lock();
+    result.d_leaders += shard->d_stats.d_leaders;
+    result.d_followers += shard->d_stats.d_followers;
+    result.d_bypassed += shard->d_stats.d_bypassed;
+    result.d_unanswered += shard->d_stats.d_unanswered;
+  }
+  return result;
+}
+
+size_t QueryCoalescer::getEntriesCount() const
+{
+  size_t count = 0;
+  for (auto& lockedShard : d_shards) {
+    count += lockedShard.lock()->d_entries.size();
+  }
+  return count;
+}
+}
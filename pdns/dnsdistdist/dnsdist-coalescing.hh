@@ -0,0 +1,126 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "dnsname.hh"
+#include "iputils.hh"
+#include "lock.hh"
+#include "noinitvector.hh"
+
+struct ClientState;
+
+namespace dnsdist
+{
+/* Coalescing of identical queries missing the packet cache of a pool at the same time: the first one
+   (the 'leader') is sent to a backend, and the ones received while it is in flight (the 'followers')
+   are answered with a copy of the leader's response instead of being forwarded as well.
+   Queries are identified by their packet cache key, and the qname, qtype, qclass, flags, DO bit and
+   client subnet (ECS, when the packet cache parses it instead of including it in the key) are checked
+   as well, so that an answer scoped to a subnet is never sent to a client in another one. A leader whose response never comes is forgotten after
+   'timeout' seconds, along with its followers, which will have to retry. */
+class QueryCoalescer
+{
+public:
+  struct Config
+  {
+    /* maximum number of queries waiting for a given leader, additional queries are forwarded to the backend */
+    size_t d_maxFollowers{64};
+    /* in seconds */
+    uint16_t d_timeout{2};
+    size_t d_shards{16};
+  };
+
+  /* what we need to send the leader's response to a follower */
+  struct Follower
+  {
+    DNSName d_qname; // as sent by the client, which might differ in case from the leader's one
+    ComboAddress d_remote;
+    ComboAddress d_local; // sin4.sin_family set to 0 if the destination address was not harvested
+    struct timespec d_queryTime{0, 0}; // real time at which the query was received, for the latency
+    const ClientState* d_cs{nullptr};
+    int d_fd{-1};
+    uint16_t d_id{0}; // network byte order
+  };
+
+  struct Stats
+  {
+    uint64_t d_leaders{0};
+    uint64_t d_followers{0};
+    uint64_t d_bypassed{0};
+    /* followers that did not get an answer because the response to their leader never came or was dropped */
+    uint64_t d_unanswered{0};
+  };
+
+  enum class Result : uint8_t { Leader, Follower, Bypass };
+
+  QueryCoalescer(const Config& config);
+
+  /* Leader: the query should be sent to the backend, and 'token' passed to release() once its response has been received,
+     Follower: the query has been attached to the one in flight, nothing else to do,
+     Bypass: the query should be sent to the backend without further ado (collision, or too many followers already).
+     The qname of the follower is taken from 'qname', 'follower.d_qname' is ignored. */
+  Result addQuery(uint32_t key, const DNSName& qname, uint16_t qtype, uint16_t qclass, uint16_t queryFlags, bool dnssecOK, const boost::optional<Netmask>& subnet, const Follower& follower, time_t now, uint64_t& token);
+  /* remove the entry of a leader and return its followers, if the entry has not been replaced in the meantime */
+  std::vector<Follower> release(uint32_t key, uint64_t token);
+  /* turn a copy of the leader's response, as processed by the response rules, into the response to a follower:
+     only the ID and the case of the qname are changed, the rules are not run again for each follower */
+  static void prepareResponseForFollower(PacketBuffer& response, const Follower& follower);
+  /* remove the entry of a leader whose response will not be sent, if it has not been replaced in the meantime */
+  void abandon(uint32_t key, uint64_t token);
+  /* remove the entries whose leader has been waiting for more than 'timeout' seconds, returns the number of entries removed */
+  size_t purgeExpired(time_t now);
+
+  Stats getStats() const;
+  size_t getEntriesCount() const;
+  const Config& getConfig() const
+  {
+    return d_config;
+  }
+
+private:
+  struct Entry
+  {
+    DNSName d_qname;
+    boost::optional<Netmask> d_subnet;
+    std::vector<Follower> d_followers;
+    time_t d_created{0};
+    uint64_t d_token{0};
+    uint16_t d_qtype{0};
+    uint16_t d_qclass{0};
+    uint16_t d_queryFlags{0};
+    bool d_dnssecOK{false};
+  };
+
+  struct Shard
+  {
+    std::unordered_map<uint32_t, Entry> d_entries;
+    Stats d_stats;
+    uint64_t d_nextToken{1};
+  };
+
+  const Config d_config;
+  mutable std::vector<LockGuarded<Shard>> d_shards;
+};
+}
@@ -16,6 +16,7 @@ DNSResponse makeDNSResponseFromIDState(IDState& ids, PacketBuffer& data)
   dr.cacheKeyNoECS = ids.cacheKeyNoECS;
   dr.cacheKeyUDP = ids.cacheKeyUDP;
   dr.dnssecOK = ids.dnssecOK;
+  dr.stageLatencySampled = ids.stageLatencySampled;
   dr.tempFailureTTL = ids.tempFailureTTL;
   dr.qTag = std::move(ids.qTag);
   dr.subnet = std::move(ids.subnet);
@@ -50,11 +51,15 @@ void setIDStateFromDNSQuestion(IDState& ids, DNSQuestion& dq, DNSName&& qname)
   ids.subnet = dq.subnet;
   ids.skipCache = dq.skipCache;
   ids.packetCache = dq.packetCache;
+  ids.coalescer = nullptr;
+  ids.coalescingToken = 0;
   ids.ednsAdded = dq.ednsAdded;
   ids.ecsAdded = dq.ecsAdded;
   ids.useZeroScope = dq.useZeroScope;
   ids.qTag = std::move(dq.qTag);
   ids.dnssecOK = dq.dnssecOK;
+  ids.stageLatencySampled = dq.stageLatencySampled;
+  ids.stageLatencySentUsec = 0;
   ids.uniqueId = std::move(dq.uniqueId);
 
   if (dq.hopRemote) {
@@ -72,4 +77,5 @@ void setIDStateFromDNSQuestion(IDState& ids, DNSQuestion& dq, DNSName&& qname)
   }
 
   ids.dnsCryptQuery = std::move(dq.dnsCryptQuery);
+  ids.cacheRefresh = false;
 }
@@ -0,0 +1,500 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* In-process load-test harness: loads a regular dnsdist configuration (rules, pools,
+   packet caches, load-balancing policies), then replays queries from a pcap file or
+   drawn from a Zipf distribution of names through processQuery() and processResponse()
+   on several threads, without any network I/O. Queries that would be sent to a backend
+   get a synthetic answer. Backends are never contacted and are considered up unless
+   they have been explicitly marked down. */
+
+#include <getopt.h>
+#include <iomanip>
+#include <random>
+#include <thread>
+
+#include "dnsdist.hh"
+#include "dnsdist-lua.hh"
+#include "dnsdist-random.hh"
+#include "dnsdist-rings.hh"
+#include "dnspcap.hh"
+#include "dnswriter.hh"
+#include "dolog.hh"
+
+#ifdef HAVE_LIBSODIUM
+#include <sodium.h>
+#endif /* HAVE_LIBSODIUM */
+
+namespace
+{
+/* latency histogram in nanoseconds, with 8 sub-buckets per power of two, so about 12% precision */
+class LatencyHistogram
+{
+public:
+  void add(uint64_t nsec)
+  {
+    ++d_buckets.at(getBucket(nsec));
+    ++d_count;
+    d_sum += nsec;
+    d_max = std::max(d_max, nsec);
+  }
+
+  void merge(const LatencyHistogram& rhs)
+  {
+    for (size_t idx = 0; idx < d_buckets.size(); idx++) {
+      d_buckets.at(idx) += rhs.d_buckets.at(idx);
+    }
+    d_count += rhs.d_count;
+    d_sum += rhs.d_sum;
+    d_max = std::max(d_max, rhs.d_max);
+  }
+
+  uint64_t getCount() const
+  {
+    return d_count;
+  }
+
+  uint64_t getMax() const
+  {
+    return d_max;
+  }
+
+  double getMean() const
+  {
+    return d_count > 0 ? static_cast<double>(d_sum) / d_count : 0.0;
+  }
+
+  /* returns the upper bound of the bucket holding the requested percentile */
+  uint64_t getPercentile(double percentile) const
+  {
+    const uint64_t target = std::ceil(d_count * percentile / 100.0);
+    uint64_t seen = 0;
+    for (size_t idx = 0; idx < d_buckets.size(); idx++) {
+      seen += d_buckets.at(idx);
+      if (seen >= target && seen > 0) {
+        return std::min(getBucketUpperBound(idx), d_max);
+      }
+    }
+    return d_max;
+  }
+
+private:
+  static const size_t s_subBucketsBits = 3;
+  static const size_t s_subBuckets = 1 << s_subBucketsBits;
+
+  static size_t getBucket(uint64_t value)
+  {
+    if (value < s_subBuckets) {
+      return value;
+    }
+    const size_t exponent = 63 - __builtin_clzll(value);
+    const size_t sub = (value >> (exponent - s_subBucketsBits)) & (s_subBuckets - 1);
+    return (exponent - s_subBucketsBits + 1) * s_subBuckets + sub;
+  }
+
+  static uint64_t getBucketUpperBound(size_t bucket)
+  {
+    if (bucket < s_subBuckets) {
+      return bucket;
+    }
+    const size_t exponent = (bucket / s_subBuckets) + s_subBucketsBits - 1;
+    const uint64_t sub = bucket % s_subBuckets;
+    return ((s_subBuckets + sub + 1) << (exponent - s_subBucketsBits)) - 1;
+  }
+
+  std::array<uint64_t, (64 - s_subBucketsBits + 1) * s_subBuckets> d_buckets{};
+  uint64_t d_count{0};
+  uint64_t d_sum{0};
+  uint64_t d_max{0};
+};
+
+struct LoadTestQuery
+{
+  PacketBuffer d_packet;
+  ComboAddress d_source;
+};
+
+struct LoadTestResults
+{
+  void merge(const LoadTestResults& rhs)
+  {
+    d_query.merge(rhs.d_query);
+    d_response.merge(rhs.d_response);
+    d_total.merge(rhs.d_total);
+    d_answered += rhs.d_answered;
+    d_forwarded += rhs.d_forwarded;
+    d_dropped += rhs.d_dropped;
+    d_invalid += rhs.d_invalid;
+  }
+
+  /* rules, cache lookup and load-balancing */
+  LatencyHistogram d_query;
+  /* response rules, cache insertion, rings */
+  LatencyHistogram d_response;
+  LatencyHistogram d_total;
+  uint64_t d_answered{0};
+  uint64_t d_forwarded{0};
+  uint64_t d_dropped{0};
+  uint64_t d_invalid{0};
+  double d_elapsedSec{0};
+};
+
+struct LoadTestOptions
+{
+  std::string d_config;
+  std::string d_pcap;
+  uint64_t d_queries{1000000};
+  size_t d_threads{1};
+  size_t d_domains{100000};
+  double d_zipfExponent{1.0};
+  size_t d_clients{1000};
+  uint32_t d_ttl{3600};
+};
+}
+
+static uint64_t nsecSince(const struct timespec& start)
+{
+  struct timespec now;
+  gettime(&now);
+  return (now.tv_sec - start.tv_sec) * 1000000000ULL + now.tv_nsec - start.tv_nsec;
+}
+
+static std::vector<LoadTestQuery> loadQueriesFromPcap(const std::string& fname)
+{
+  std::vector<LoadTestQuery> queries;
+  PcapPacketReader pr(fname);
+
+  while (pr.getUDPPacket()) {
+    if (pr.d_len < sizeof(dnsheader) || ntohs(pr.d_udp->uh_dport) != 53) {
+      continue;
+    }
+    const auto* dh = reinterpret_cast<const dnsheader*>(pr.d_payload);
+    if (dh->qr || dh->qdcount == 0) {
+      continue;
+    }
+    queries.push_back({PacketBuffer(pr.d_payload, pr.d_payload + pr.d_len), pr.getSource()});
+  }
+
+  return queries;
+}
+
+static std::vector<LoadTestQuery> generateZipfQueries(const LoadTestOptions& options, size_t count, uint64_t seed)
+{
+  std::vector<double> cdf(options.d_domains);
+  double total = 0;
+  for (size_t rank = 0; rank < cdf.size(); rank++) {
+    total += 1.0 / std::pow(rank + 1, options.d_zipfExponent);
+    cdf.at(rank) = total;
+  }
+
+  std::mt19937_64 gen(seed);
+  std::uniform_real_distribution<double> nameDist(0, total);
+  std::uniform_int_distribution<size_t> clientDist(0, std::max(options.d_clients, static_cast<size_t>(1)) - 1);
+  std::vector<LoadTestQuery> queries;
+  queries.reserve(count);
+
+  for (size_t idx = 0; idx < count; idx++) {
+    const size_t rank = std::lower_bound(cdf.begin(), cdf.end(), nameDist(gen)) - cdf.begin();
+    const DNSName qname(std::to_string(rank) + ".loadtest.example.");
+    LoadTestQuery query;
+    GenericDNSPacketWriter<PacketBuffer> pw(query.d_packet, qname, QType::A, QClass::IN, 0);
+    pw.getHeader()->rd = 1;
+    pw.getHeader()->id = htons(static_cast<uint16_t>(idx));
+    pw.commit();
+    const size_t client = clientDist(gen);
+    query.d_source = ComboAddress("10.0.0.0", 53000);
+    query.d_source.sin4.sin_addr.s_addr = htonl(ntohl(query.d_source.sin4.sin_addr.s_addr) + client);
+    queries.push_back(std::move(query));
+  }
+
+  return queries;
+}
+
+/* what a backend would answer: the question section, plus a record for A and AAAA queries */
+static void makeBackendResponse(const DNSQuestion& dq, uint32_t ttl, PacketBuffer& response)
+{
+  response.clear();
+  GenericDNSPacketWriter<PacketBuffer> pw(response, *dq.qname, dq.qtype, dq.qclass, 0);
+  pw.getHeader()->id = dq.getHeader()->id;
+  pw.getHeader()->rd = dq.getHeader()->rd;
+  pw.getHeader()->cd = dq.getHeader()->cd;
+  pw.getHeader()->qr = 1;
+  pw.getHeader()->ra = 1;
+
+  if (dq.qtype == QType::A) {
+    pw.startRecord(*dq.qname, QType::A, ttl);
+    pw.xfrCAWithoutPort(4, ComboAddress("192.0.2.1"));
+  }
+  else if (dq.qtype == QType::AAAA) {
+    pw.startRecord(*dq.qname, QType::AAAA, ttl);
+    pw.xfrCAWithoutPort(6, ComboAddress("2001:db8::1"));
+  }
+  pw.commit();
+}
+
+static void runQueries(ClientState& cs, const std::vector<LoadTestQuery>& queries, uint64_t count, size_t offset, uint32_t ttl, LoadTestResults& results)
+{
+  LocalHolders holders;
+  auto localRespRuleActions = g_respruleactions.getLocal();
+  PacketBuffer query;
+  PacketBuffer response;
+
+  struct timespec runStart;
+  gettime(&runStart);
+
+  for (uint64_t counter = 0; counter < count; counter++) {
+    const auto& entry = queries.at((offset + counter) % queries.size());
+    query = entry.d_packet;
+
+    struct timespec queryRealTime;
+    gettime(&queryRealTime, true);
+    struct timespec queryStart;
+    gettime(&queryStart);
+
+    try {
+      uint16_t qtype, qclass;
+      unsigned int qnameWireLength = 0;
+      DNSName qname(reinterpret_cast<const char*>(query.data()), query.size(), sizeof(dnsheader), false, &qtype, &qclass, &qnameWireLength);
+      DNSQuestion dq(&qname, qtype, qclass, &cs.local, &entry.d_source, query, dnsdist::Protocol::DoUDP, &queryRealTime);
+      dq.hopRemote = &entry.d_source;
+      dq.hopLocal = &cs.local;
+
+      std::shared_ptr<DownstreamState> ss{nullptr};
+      auto result = processQuery(dq, cs, holders, ss);
+      const uint64_t queryNsec = nsecSince(queryStart);
+      results.d_query.add(queryNsec);
+
+      if (result == ProcessQueryResult::Drop) {
+        ++results.d_dropped;
+        continue;
+      }
+      if (result == ProcessQueryResult::SendAnswer) {
+        ++results.d_answered;
+        results.d_total.add(queryNsec);
+        continue;
+      }
+      if (ss == nullptr) {
+        ++results.d_dropped;
+        continue;
+      }
+
+      ++results.d_forwarded;
+      makeBackendResponse(dq, ttl, response);
+      IDState ids;
+      ids.cs = &cs;
+      ids.origID = dq.getHeader()->id;
+      setIDStateFromDNSQuestion(ids, dq, std::move(qname));
+
+      struct timespec responseStart;
+      gettime(&responseStart);
+      DNSResponse dr = makeDNSResponseFromIDState(ids, response);
+      dnsheader cleartextDH;
+      memcpy(&cleartextDH, dr.getHeader(), sizeof(cleartextDH));
+      if (processResponse(response, localRespRuleActions, dr, false, true)) {
+        handleResponseSent(ids, 0, *dr.remote, ss->d_config.remote, response.size(), cleartextDH, ss->getProtocol());
+      }
+      const uint64_t responseNsec = nsecSince(responseStart);
+      results.d_response.add(responseNsec);
+      /* the time spent crafting the backend answer is not accounted for */
+      results.d_total.add(queryNsec + responseNsec);
+    }
+    catch (const std::exception& e) {
+      ++results.d_invalid;
+    }
+  }
+
+  results.d_elapsedSec = nsecSince(runStart) / 1000000000.0;
+}
+
+static void printHistogram(const std::string& name, const LatencyHistogram& histogram)
+{
+  cout << std::left << std::setw(10) << name << std::right
+       << std::setw(12) << histogram.getCount()
+       << std::setw(10) << std::fixed << std::setprecision(0) << histogram.getMean()
+       << std::setw(10) << histogram.getPercentile(50)
+       << std::setw(10) << histogram.getPercentile(90)
+       << std::setw(10) << histogram.getPercentile(99)
+       << std::setw(10) << histogram.getPercentile(99.9)
+       << std::setw(12) << histogram.getMax() << endl;
+}
+
+static void usage()
+{
+  cout << "Syntax: dnsdist-loadtest [OPTION]..." << endl;
+  cout << "Replay queries through the dnsdist rules, caches and load-balancing policies of a configuration, without any network I/O" << endl;
+  cout << endl;
+  cout << "-C,--config file      Load the configuration from 'file'" << endl;
+  cout << "-c,--clients num      Number of distinct client addresses for generated queries (default 1000)" << endl;
+  cout << "-d,--domains num      Number of distinct names for generated queries (default 100000)" << endl;
+  cout << "-h,--help             Display this helpful message" << endl;
+  cout << "-n,--queries num      Number of queries to process, over all threads (default 1000000)" << endl;
+  cout << "-p,--pcap file        Replay the UDP queries from 'file' instead of generating them" << endl;
+  cout << "-t,--threads num      Number of threads processing queries (default 1)" << endl;
+  cout << "-T,--ttl num          TTL of the records in the synthetic backend answers (default 3600)" << endl;
+  cout << "-v,--verbose          Enable verbose mode" << endl;
+  cout << "-z,--zipf exponent    Exponent of the Zipf distribution of generated names (default 1.0)" << endl;
+}
+
+int main(int argc, char** argv)
+{
+  try {
+    LoadTestOptions options;
+    struct option longopts[] = {
+      {"clients", required_argument, 0, 'c'},
+      {"config", required_argument, 0, 'C'},
+      {"domains", required_argument, 0, 'd'},
+      {"help", no_argument, 0, 'h'},
+      {"pcap", required_argument, 0, 'p'},
+      {"queries", required_argument, 0, 'n'},
+      {"threads", required_argument, 0, 't'},
+      {"ttl", required_argument, 0, 'T'},
+      {"verbose", no_argument, 0, 'v'},
+      {"zipf", required_argument, 0, 'z'},
+      {0, 0, 0, 0}
+    };
+    int longindex = 0;
+    for (;;) {
+      int c = getopt_long(argc, argv, "c:C:d:hn:p:t:T:vz:", longopts, &longindex);
+      if (c == -1) {
+        break;
+      }
+      switch (c) {
+      case 'c':
+        options.d_clients = std::stoul(optarg);
+        break;
+      case 'C':
+        options.d_config = optarg;
+        break;
+      case 'd':
+        options.d_domains = std::max(std::stoul(optarg), 1UL);
+        break;
+      case 'h':
+        usage();
+        exit(EXIT_SUCCESS);
+      case 'n':
+        options.d_queries = std::stoull(optarg);
+        break;
+      case 'p':
+        options.d_pcap = optarg;
+        break;
+      case 't':
+        options.d_threads = std::max(std::stoul(optarg), 1UL);
+        break;
+      case 'T':
+        options.d_ttl = static_cast<uint32_t>(std::stoul(optarg));
+        break;
+      case 'v':
+        g_verbose = true;
+        break;
+      case 'z':
+        options.d_zipfExponent = std::stod(optarg);
+        break;
+      default:
+        usage();
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    if (options.d_config.empty()) {
+      cerr << "A configuration file is required" << endl;
+      usage();
+      exit(EXIT_FAILURE);
+    }
+
+#ifdef HAVE_LIBSODIUM
+    if (sodium_init() == -1) {
+      cerr << "Unable to initialize crypto library" << endl;
+      exit(EXIT_FAILURE);
+    }
+#endif
+    dnsdist::initRandom();
+    g_hashperturb = dnsdist::getRandomValue(0xffffffff);
+    g_syslog = false;
+
+    ServerPolicy leastOutstandingPol{"leastOutstanding", leastOutstanding, false};
+    g_policy.setState(leastOutstandingPol);
+
+    /* in check-config mode no socket is opened and no thread is started, which is exactly what we want */
+    setupLua(*(g_lua.lock()), false, true, options.d_config);
+    g_configurationDone = true;
+    g_rings.init();
+
+    /* no health-checks are done, so consider the backends up unless they have been explicitly disabled */
+    for (auto& backend : *g_dstates.getLocal()) {
+      backend->setUpStatus(true);
+    }
+
+    std::vector<std::vector<LoadTestQuery>> queriesPerThread(options.d_threads);
+    const uint64_t queriesPerThreadCount = options.d_queries / options.d_threads;
+    if (!options.d_pcap.empty()) {
+      auto queries = loadQueriesFromPcap(options.d_pcap);
+      if (queries.empty()) {
+        cerr << "No query found in '" << options.d_pcap << "'" << endl;
+        exit(EXIT_FAILURE);
+      }
+      cout << "Loaded " << queries.size() << " queries from '" << options.d_pcap << "'" << endl;
+      /* every thread replays the whole capture, starting from a different point */
+      for (auto& threadQueries : queriesPerThread) {
+        threadQueries = queries;
+      }
+    }
+    else {
+      for (size_t idx = 0; idx < queriesPerThread.size(); idx++) {
+        queriesPerThread.at(idx) = generateZipfQueries(options, std::max(queriesPerThreadCount, static_cast<uint64_t>(1)), idx);
+      }
+    }
+
+    ClientState cs(ComboAddress("127.0.0.1", 53), false, false, 0, "", {});
+    std::vector<LoadTestResults> results(options.d_threads);
+    std::vector<std::thread> threads;
+    threads.reserve(options.d_threads);
+    for (size_t idx = 0; idx < options.d_threads; idx++) {
+      const size_t offset = idx * (queriesPerThread.at(idx).size() / options.d_threads);
+      threads.emplace_back(runQueries, std::ref(cs), std::cref(queriesPerThread.at(idx)), queriesPerThreadCount, offset, options.d_ttl, std::ref(results.at(idx)));
+    }
+
+    LoadTestResults total;
+    for (size_t idx = 0; idx < threads.size(); idx++) {
+      threads.at(idx).join();
+      total.merge(results.at(idx));
+      total.d_elapsedSec = std::max(total.d_elapsedSec, results.at(idx).d_elapsedSec);
+    }
+
+    const uint64_t processed = total.d_answered + total.d_forwarded + total.d_dropped + total.d_invalid;
+    cout << "Processed " << processed << " queries on " << options.d_threads << " thread(s) in " << std::setprecision(3) << total.d_elapsedSec << "s: " << std::setprecision(0) << (total.d_elapsedSec > 0 ? processed / total.d_elapsedSec : 0) << " qps" << endl;
+    cout << "Answered without a backend (cache hits, self-answered): " << total.d_answered << ", forwarded: " << total.d_forwarded << ", dropped: " << total.d_dropped << ", invalid: " << total.d_invalid << endl;
+    cout << endl;
+    cout << std::left << std::setw(10) << "stage (ns)" << std::right << std::setw(12) << "count" << std::setw(10) << "mean" << std::setw(10) << "p50" << std::setw(10) << "p90" << std::setw(10) << "p99" << std::setw(10) << "p99.9" << std::setw(12) << "max" << endl;
+    printHistogram("query", total.d_query);
+    printHistogram("response", total.d_response);
+    printHistogram("total", total.d_total);
+
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& e) {
+    cerr << "Fatal error: " << e.what() << endl;
+  }
+  catch (const PDNSException& e) {
+    cerr << "Fatal error: " << e.reason << endl;
+  }
+  return EXIT_FAILURE;
+}
@@ -30,10 +30,10 @@
 
 #include <boost/lexical_cast.hpp>
 
-void setupLuaBindingsPacketCache(LuaContext& luaCtx, bool client)
+void setupLuaBindingsPacketCache(LuaContext& luaCtx, bool client, bool configCheck)
 {
   /* PacketCache */
-  luaCtx.writeFunction("newPacketCache", [client](size_t maxEntries, boost::optional<LuaAssociativeTable<boost::variant<bool, size_t, LuaArray<uint16_t>>>> vars) {
+  luaCtx.writeFunction("newPacketCache", [client, configCheck](size_t maxEntries, boost::optional<LuaAssociativeTable<boost::variant<bool, size_t, std::string, LuaArray<uint16_t>>>> vars) {
 
       bool keepStaleData = false;
       size_t maxTTL = 86400;
@@ -45,6 +45,10 @@ void setupLuaBindingsPacketCache(LuaContext& luaCtx, bool client)
       bool dontAge = false;
       bool deferrableInsertLock = true;
       bool ecsParsing = false;
+      bool ecsScopeSharing = false;
+      size_t prefetchPercentage = 0;
+      size_t staleWhileRevalidateTTL = 0;
+      std::string snapshotFile;
       std::unordered_set<uint16_t> optionsToSkip{EDNSOptionCode::COOKIE};
 
       if (vars) {
@@ -57,6 +61,10 @@ void setupLuaBindingsPacketCache(LuaContext& luaCtx, bool client)
           dontAge = boost::get<bool>((*vars)["dontAge"]);
         }
 
+        if (vars->count("ecsScopeSharing")) {
+          ecsScopeSharing = boost::get<bool>((*vars)["ecsScopeSharing"]);
+        }
+
         if (vars->count("keepStaleData")) {
           keepStaleData = boost::get<bool>((*vars)["keepStaleData"]);
         }
@@ -81,10 +89,25 @@ void setupLuaBindingsPacketCache(LuaContext& luaCtx, bool client)
           ecsParsing = boost::get<bool>((*vars)["parseECS"]);
         }
 
+        if (vars->count("prefetchPercentage")) {
+          prefetchPercentage = boost::get<size_t>((*vars)["prefetchPercentage"]);
+          if (prefetchPercentage > 100) {
+            throw std::runtime_error("The prefetchPercentage value of a packet cache should be between 0 and 100, not " + std::to_string(prefetchPercentage));
+          }
+        }
+
+        if (vars->count("snapshotFile")) {
+          snapshotFile = boost::get<std::string>((*vars)["snapshotFile"]);
+        }
+
         if (vars->count("staleTTL")) {
           staleTTL = boost::get<size_t>((*vars)["staleTTL"]);
         }
 
+        if (vars->count("staleWhileRevalidateTTL")) {
+          staleWhileRevalidateTTL = boost::get<size_t>((*vars)["staleWhileRevalidateTTL"]);
+        }
+
         if (vars->count("temporaryFailureTTL")) {
           tempFailTTL = boost::get<size_t>((*vars)["temporaryFailureTTL"]);
         }
@@ -101,6 +124,12 @@ void setupLuaBindingsPacketCache(LuaContext& luaCtx, bool client)
         }
       }
 
+      if (ecsScopeSharing && !ecsParsing) {
+        warnlog("The 'ecsScopeSharing' option of a packet cache requires 'parseECS' to be set, disabling it");
+        g_outputBuffer += "The 'ecsScopeSharing' option of a packet cache requires 'parseECS' to be set, disabling it\n";
+        ecsScopeSharing = false;
+      }
+
       if (maxEntries < numberOfShards) {
         warnlog("The number of entries (%d) in the packet cache is smaller than the number of shards (%d), decreasing the number of shards to %d", maxEntries, numberOfShards, maxEntries);
         g_outputBuffer += "The number of entries (" + std::to_string(maxEntries) + " in the packet cache is smaller than the number of shards (" + std::to_string(numberOfShards) + "), decreasing the number of shards to " + std::to_string(maxEntries);
@@ -115,7 +144,24 @@ void setupLuaBindingsPacketCache(LuaContext& luaCtx, bool client)
       auto res = std::make_shared<DNSDistPacketCache>(maxEntries, maxTTL, minTTL, tempFailTTL, maxNegativeTTL, staleTTL, dontAge, numberOfShards, deferrableInsertLock, ecsParsing);
 
       res->setKeepStaleData(keepStaleData);
+      res->setPrefetchPercentage(prefetchPercentage);
+      res->setStaleWhileRevalidateTTL(staleWhileRevalidateTTL);
       res->setSkippedOptions(optionsToSkip);
+      res->setECSScopeSharingEnabled(ecsScopeSharing);
+
+      if (!snapshotFile.empty() && !client && !configCheck) {
+        struct stat st;
+        if (stat(snapshotFile.c_str(), &st) == 0) {
+          try {
+            auto count = res->loadSnapshot(snapshotFile);
+            infolog("Loaded %d entries into the packet cache from %s", count, snapshotFile);
+          }
+          catch (const std::exception& e) {
+            warnlog("Error loading the packet cache snapshot from %s: %s", snapshotFile, e.what());
+          }
+        }
+        dnsdist::PacketCacheSnapshots::add(res, snapshotFile);
+      }
 
       return res;
     });
@@ -173,6 +219,9 @@ void setupLuaBindingsPacketCache(LuaContext& luaCtx, bool client)
         g_outputBuffer+="Lookup Collisions: " + std::to_string(cache->getLookupCollisions()) + "\n";
         g_outputBuffer+="Insert Collisions: " + std::to_string(cache->getInsertCollisions()) + "\n";
         g_outputBuffer+="TTL Too Shorts: " + std::to_string(cache->getTTLTooShorts()) + "\n";
+        g_outputBuffer+="Stale hits: " + std::to_string(cache->getStaleHits()) + "\n";
+        g_outputBuffer+="Refreshes: " + std::to_string(cache->getRefreshes()) + "\n";
+        g_outputBuffer+="Scoped hits: " + std::to_string(cache->getScopedHits()) + "\n";
       }
     });
   luaCtx.registerFunction<LuaAssociativeTable<uint64_t>(std::shared_ptr<DNSDistPacketCache>::*)()const>("getStats", [](const std::shared_ptr<DNSDistPacketCache>& cache) {
@@ -187,9 +236,24 @@ void setupLuaBindingsPacketCache(LuaContext& luaCtx, bool client)
         stats["lookupCollisions"] = cache->getLookupCollisions();
         stats["insertCollisions"] = cache->getInsertCollisions();
         stats["ttlTooShorts"] = cache->getTTLTooShorts();
+        stats["staleHits"] = cache->getStaleHits();
+        stats["refreshes"] = cache->getRefreshes();
+        stats["scopedHits"] = cache->getScopedHits();
       }
       return stats;
     });
+  luaCtx.registerFunction<uint64_t(std::shared_ptr<DNSDistPacketCache>::*)(const std::string& fname)>("saveSnapshot", [](std::shared_ptr<DNSDistPacketCache>& cache, const std::string& fname) {
+      if (cache) {
+        return cache->saveSnapshot(fname);
+      }
+      return static_cast<uint64_t>(0);
+    });
+  luaCtx.registerFunction<uint64_t(std::shared_ptr<DNSDistPacketCache>::*)(const std::string& fname)>("loadSnapshot", [](std::shared_ptr<DNSDistPacketCache>& cache, const std::string& fname) {
+      if (cache) {
+        return cache->loadSnapshot(fname);
+      }
+      return static_cast<uint64_t>(0);
+    });
   luaCtx.registerFunction<void(std::shared_ptr<DNSDistPacketCache>::*)(const std::string& fname)const>("dump", [](const std::shared_ptr<DNSDistPacketCache>& cache, const std::string& fname) {
       if (cache) {
 
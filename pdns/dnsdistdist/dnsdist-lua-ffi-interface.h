@@ -151,3 +151,33 @@ typedef struct dnsdist_ffi_proxy_protocol_value {
 
 size_t dnsdist_ffi_generate_proxy_protocol_payload(size_t addrSize, const void* srcAddr, const void* dstAddr, uint16_t srcPort, uint16_t dstPort, bool tcp, size_t valuesCount, const dnsdist_ffi_proxy_protocol_value_t* values, void* out, size_t outSize) __attribute__ ((visibility ("default")));
 size_t dnsdist_ffi_dnsquestion_generate_proxy_protocol_payload(const dnsdist_ffi_dnsquestion_t* dq, const size_t valuesCount, const dnsdist_ffi_proxy_protocol_value_t* values, void* out, const size_t outSize);
+
+/* batch of UDP queries received via recvmmsg(), see setUDPBatchFFIFunction() */
+typedef struct dnsdist_ffi_batch_t dnsdist_ffi_batch_t;
+
+typedef struct dnsdist_ffi_batch_query {
+  const char* qname;       /* wire format, pointing into the query. NULL (and size set to 0) if the query could not be parsed */
+  const char* source;      /* raw source address, 4 bytes for IPv4 and 16 bytes for IPv6 */
+  uint16_t qnameSize;
+  uint16_t qtype;
+  uint16_t qclass;
+  uint16_t id;             /* host byte order */
+  uint16_t flags;          /* second 16-bit word of the DNS header (QR, opcode, AA, TC, RD, RA, AD, CD, rcode), host byte order */
+  uint16_t size;           /* size of the whole query */
+  uint16_t sourcePort;
+  uint8_t sourceSize;
+} dnsdist_ffi_batch_query_t;
+
+typedef enum {
+  dnsdist_ffi_batch_verdict_none = 0,     /* regular processing */
+  dnsdist_ffi_batch_verdict_drop = 1,
+  dnsdist_ffi_batch_verdict_refused = 2,
+  dnsdist_ffi_batch_verdict_nxdomain = 3,
+  dnsdist_ffi_batch_verdict_servfail = 4,
+  dnsdist_ffi_batch_verdict_truncate = 5,
+} dnsdist_ffi_batch_verdict;
+
+size_t dnsdist_ffi_batch_get_count(const dnsdist_ffi_batch_t* batch) __attribute__ ((visibility ("default")));
+const dnsdist_ffi_batch_query_t* dnsdist_ffi_batch_get_queries(const dnsdist_ffi_batch_t* batch) __attribute__ ((visibility ("default")));
+/* one entry per query, initially set to dnsdist_ffi_batch_verdict_none */
+uint8_t* dnsdist_ffi_batch_get_verdicts(dnsdist_ffi_batch_t* batch) __attribute__ ((visibility ("default")));
@@ -656,6 +656,144 @@ void setupLuaFFIPerThreadContext(LuaContext& luaCtx)
 #endif
 }
 
+size_t dnsdist_ffi_batch_get_count(const dnsdist_ffi_batch_t* batch)
+{
+  return batch->count;
+}
+
+const dnsdist_ffi_batch_query_t* dnsdist_ffi_batch_get_queries(const dnsdist_ffi_batch_t* batch)
+{
+  return batch->queries.data();
+}
+
+uint8_t* dnsdist_ffi_batch_get_verdicts(dnsdist_ffi_batch_t* batch)
+{
+  return batch->verdicts.data();
+}
+
+namespace dnsdist
+{
+std::string FFIBatchFilter::s_code;
+
+void FFIBatchFilter::setFunctionCode(const std::string& code)
+{
+  s_code = code;
+}
+
+bool FFIBatchFilter::isEnabled()
+{
+  return !s_code.empty();
+}
+
+FFIBatchFilter::FFIBatchFilter(size_t maxBatchSize)
+{
+  d_batch.queries.resize(maxBatchSize);
+  d_batch.verdicts.resize(maxBatchSize);
+
+  setupLuaFFIPerThreadContext(d_luaContext);
+  try {
+    d_func = d_luaContext.executeCode<func_t>(s_code);
+  }
+  catch (const std::exception& e) {
+    warnlog("Error loading the UDP batch FFI function: %s", e.what());
+  }
+}
+
+void FFIBatchFilter::setCount(size_t count)
+{
+  d_batch.count = std::min(count, d_batch.queries.size());
+  memset(d_batch.verdicts.data(), dnsdist_ffi_batch_verdict_none, d_batch.count);
+}
+
+void FFIBatchFilter::fill(size_t idx, const PacketBuffer* query, const ComboAddress& remote)
+{
+  auto& entry = d_batch.queries.at(idx);
+  memset(&entry, 0, sizeof(entry));
+
+  if (query == nullptr || query->size() < sizeof(dnsheader) || query->size() > std::numeric_limits<uint16_t>::max()) {
+    return;
+  }
+
+  const auto dh = reinterpret_cast<const struct dnsheader*>(query->data());
+  if (ntohs(dh->qdcount) != 1) {
+    return;
+  }
+
+  /* there is no compression in the question section of a query, so we only need to look for the root label */
+  size_t pos = sizeof(dnsheader);
+  while (pos < query->size() && query->at(pos) != 0) {
+    if ((query->at(pos) & 0xc0) != 0) {
+      return;
+    }
+    pos += 1 + query->at(pos);
+  }
+  pos++;
+  if ((pos + DNS_TYPE_SIZE + DNS_CLASS_SIZE) > query->size()) {
+    return;
+  }
+
+  entry.qname = reinterpret_cast<const char*>(query->data()) + sizeof(dnsheader);
+  entry.qnameSize = pos - sizeof(dnsheader);
+  entry.qtype = query->at(pos) * 256 + query->at(pos + 1);
+  entry.qclass = query->at(pos + 2) * 256 + query->at(pos + 3);
+  entry.id = ntohs(dh->id);
+  uint16_t flags;
+  memcpy(&flags, query->data() + sizeof(uint16_t), sizeof(flags));
+  entry.flags = ntohs(flags);
+  entry.size = query->size();
+  if (remote.isIPv4()) {
+    entry.source = reinterpret_cast<const char*>(&remote.sin4.sin_addr.s_addr);
+    entry.sourceSize = sizeof(remote.sin4.sin_addr.s_addr);
+  }
+  else {
+    entry.source = reinterpret_cast<const char*>(&remote.sin6.sin6_addr.s6_addr);
+    entry.sourceSize = sizeof(remote.sin6.sin6_addr.s6_addr);
+  }
+  entry.sourcePort = ntohs(remote.sin4.sin_port);
+}
+
+void FFIBatchFilter::run()
+{
+  if (!d_func || d_batch.count == 0) {
+    return;
+  }
+
+  try {
+    d_func(&d_batch);
+  }
+  catch (const std::exception& e) {
+    warnlog("UDP batch FFI function failed inside Lua: %s", e.what());
+    setCount(d_batch.count);
+  }
+  catch (...) {
+    warnlog("UDP batch FFI function failed inside Lua: [unknown exception]");
+    setCount(d_batch.count);
+  }
+}
+
+DNSAction::Action FFIBatchFilter::getVerdict(size_t idx) const
+{
+  if (idx >= d_batch.count || d_batch.queries.at(idx).qname == nullptr) {
+    return DNSAction::Action::None;
+  }
+
+  switch (d_batch.verdicts.at(idx)) {
+  case dnsdist_ffi_batch_verdict_drop:
+    return DNSAction::Action::Drop;
+  case dnsdist_ffi_batch_verdict_refused:
+    return DNSAction::Action::Refused;
+  case dnsdist_ffi_batch_verdict_nxdomain:
+    return DNSAction::Action::Nxdomain;
+  case dnsdist_ffi_batch_verdict_servfail:
+    return DNSAction::Action::ServFail;
+  case dnsdist_ffi_batch_verdict_truncate:
+    return DNSAction::Action::Truncate;
+  default:
+    return DNSAction::Action::None;
+  }
+}
+}
+
 size_t dnsdist_ffi_generate_proxy_protocol_payload(const size_t addrSize, const void* srcAddr, const void* dstAddr, const uint16_t srcPort, const uint16_t dstPort, const bool tcp, const size_t valuesCount, const dnsdist_ffi_proxy_protocol_value* values, void* out, const size_t outSize)
 {
   try {
@@ -128,5 +128,55 @@ struct dnsdist_ffi_servers_list_t
   const ServerPolicy::NumberedServerVector& servers;
 };
 
+// dnsdist_ffi_batch_t is a lightuserdata
+template<>
+struct LuaContext::Pusher<dnsdist_ffi_batch_t*> {
+    static const int minSize = 1;
+    static const int maxSize = 1;
+
+    static PushedObject push(lua_State* state, dnsdist_ffi_batch_t* ptr) noexcept {
+        lua_pushlightuserdata(state, ptr);
+        return PushedObject{state, 1};
+    }
+};
+
+struct dnsdist_ffi_batch_t
+{
+  std::vector<dnsdist_ffi_batch_query_t> queries;
+  std::vector<uint8_t> verdicts;
+  size_t count{0};
+};
+
 const std::string& getLuaFFIWrappers();
 void setupLuaFFIPerThreadContext(LuaContext& luaCtx);
+
+namespace dnsdist
+{
+/* Calls the Lua FFI function set via setUDPBatchFFIFunction() once for all the queries received by a single
+   recvmmsg() call, in a per-thread Lua context, instead of once per query. The function gets the pre-extracted
+   fields of every query in a flat array, and returns a verdict for each of them. */
+class FFIBatchFilter
+{
+public:
+  typedef std::function<void(dnsdist_ffi_batch_t* batch)> func_t;
+
+  FFIBatchFilter(size_t maxBatchSize);
+
+  /* not thread-safe, to be called at configuration time */
+  static void setFunctionCode(const std::string& code);
+  static bool isEnabled();
+
+  void setCount(size_t count);
+  /* fill the entry for the query at that position, or leave it empty (and the verdict to none) if query is null */
+  void fill(size_t idx, const PacketBuffer* query, const ComboAddress& remote);
+  void run();
+  DNSAction::Action getVerdict(size_t idx) const;
+
+private:
+  static std::string s_code;
+
+  LuaContext d_luaContext;
+  func_t d_func;
+  dnsdist_ffi_batch_t d_batch;
+};
+}
@@ -29,9 +29,30 @@ bool g_applyACLToProxiedClients = false;
 
 std::string getProxyProtocolPayload(const DNSQuestion& dq)
 {
+  if (!dq.proxyProtocolValues && dq.proxyProtocolRawValues) {
+    /* the values have not been altered, no need to parse and serialize them again */
+    return makeProxyHeaderWithRawValues(dq.overTCP(), *dq.remote, *dq.local, *dq.proxyProtocolRawValues);
+  }
+
   return makeProxyHeader(dq.overTCP(), *dq.remote, *dq.local, dq.proxyProtocolValues ? *dq.proxyProtocolValues : std::vector<ProxyProtocolValue>());
 }
 
+std::vector<ProxyProtocolValue>& getMutableProxyProtocolValues(DNSQuestion& dq)
+{
+  if (!dq.proxyProtocolValues) {
+    dq.proxyProtocolValues = make_unique<std::vector<ProxyProtocolValue>>();
+    if (dq.proxyProtocolRawValues) {
+      visitProxyProtocolValues(dq.proxyProtocolRawValues->data(), dq.proxyProtocolRawValues->size(), [&dq](const ProxyProtocolValueView& value) {
+        dq.proxyProtocolValues->push_back({std::string(value.content), value.type});
+        return true;
+      });
+    }
+  }
+
+  dq.proxyProtocolRawValues.reset();
+  return *dq.proxyProtocolValues;
+}
+
 bool addProxyProtocol(DNSQuestion& dq, const std::string& payload)
 {
   if (!dq.hasRoomFor(payload.size())) {
@@ -74,12 +95,8 @@ bool expectProxyProtocolFrom(const ComboAddress& remote)
   return g_proxyProtocolACL.match(remote);
 }
 
-bool handleProxyProtocol(const ComboAddress& remote, bool isTCP, const NetmaskGroup& acl, PacketBuffer& query, ComboAddress& realRemote, ComboAddress& realDestination, std::vector<ProxyProtocolValue>& values)
+static bool checkProxyProtocolHeaderSize(const ComboAddress& remote, bool isTCP, const PacketBuffer& query, ssize_t used)
 {
-  bool tcp;
-  bool proxyProto;
-
-  ssize_t used = parseProxyHeader(query, proxyProto, realRemote, realDestination, tcp, values);
   if (used <= 0) {
     ++g_stats.proxyProtocolInvalid;
     vinfolog("Ignoring invalid proxy protocol (%d, %d) query over %s from %s", query.size(), used, (isTCP ? "TCP" : "UDP"), remote.toStringWithPort());
@@ -91,6 +108,11 @@ bool handleProxyProtocol(const ComboAddress& remote, bool isTCP, const NetmaskGr
     return false;
   }
 
+  return true;
+}
+
+static bool handleProxiedQuery(bool isTCP, bool proxyProto, const NetmaskGroup& acl, PacketBuffer& query, size_t used, const ComboAddress& realRemote)
+{
   query.erase(query.begin(), query.begin() + used);
 
   /* on TCP we have not read the actual query yet */
@@ -109,3 +131,34 @@ bool handleProxyProtocol(const ComboAddress& remote, bool isTCP, const NetmaskGr
 
   return true;
 }
+
+bool handleProxyProtocol(const ComboAddress& remote, bool isTCP, const NetmaskGroup& acl, PacketBuffer& query, ComboAddress& realRemote, ComboAddress& realDestination, std::vector<ProxyProtocolValue>& values)
+{
+  bool tcp;
+  bool proxyProto;
+
+  ssize_t used = parseProxyHeader(query, proxyProto, realRemote, realDestination, tcp, values);
+  if (!checkProxyProtocolHeaderSize(remote, isTCP, query, used)) {
+    return false;
+  }
+
+  return handleProxiedQuery(isTCP, proxyProto, acl, query, used, realRemote);
+}
+
+bool handleProxyProtocol(const ComboAddress& remote, bool isTCP, const NetmaskGroup& acl, PacketBuffer& query, ComboAddress& realRemote, ComboAddress& realDestination, std::string& rawValues)
+{
+  bool tcp;
+  bool proxyProto;
+  size_t valuesOffset = 0;
+
+  ssize_t used = parseProxyHeader(query, proxyProto, realRemote, realDestination, tcp, valuesOffset);
+  if (!checkProxyProtocolHeaderSize(remote, isTCP, query, used)) {
+    return false;
+  }
+
+  if (static_cast<size_t>(used) > valuesOffset) {
+    rawValues.assign(reinterpret_cast<const char*>(query.data()) + valuesOffset, used - valuesOffset);
+  }
+
+  return handleProxiedQuery(isTCP, proxyProto, acl, query, used, realRemote);
+}
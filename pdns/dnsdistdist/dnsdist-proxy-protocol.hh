@@ -29,6 +29,24 @@ extern bool g_applyACLToProxiedClients;
 
 std::string getProxyProtocolPayload(const DNSQuestion& dq);
 
+/* calls visitor(const ProxyProtocolValueView&) for every proxy protocol value of the query, stopping as soon as it returns false */
+template<typename Visitor> void visitProxyProtocolValues(const DNSQuestion& dq, Visitor visitor)
+{
+  if (dq.proxyProtocolValues) {
+    for (const auto& value : *dq.proxyProtocolValues) {
+      if (!visitor(ProxyProtocolValueView{value.content, value.type})) {
+        return;
+      }
+    }
+  }
+  else if (dq.proxyProtocolRawValues) {
+    visitProxyProtocolValues(dq.proxyProtocolRawValues->data(), dq.proxyProtocolRawValues->size(), visitor);
+  }
+}
+
+/* parses the values received in wire format, if any, so that they can be altered */
+std::vector<ProxyProtocolValue>& getMutableProxyProtocolValues(DNSQuestion& dq);
+
 bool addProxyProtocol(DNSQuestion& dq, size_t* proxyProtocolPayloadSize = nullptr);
 bool addProxyProtocol(DNSQuestion& dq, const std::string& payload);
 bool addProxyProtocol(PacketBuffer& buffer, const std::string& payload);
@@ -36,3 +54,5 @@ bool addProxyProtocol(PacketBuffer& buffer, bool tcp, const ComboAddress& source
 
 bool expectProxyProtocolFrom(const ComboAddress& remote);
 bool handleProxyProtocol(const ComboAddress& remote, bool isTCP, const NetmaskGroup& acl, PacketBuffer& query, ComboAddress& realRemote, ComboAddress& realDestination, std::vector<ProxyProtocolValue>& values);
+/* same as above but the TLV values, if any, are copied in wire format into rawValues instead of being parsed */
+bool handleProxyProtocol(const ComboAddress& remote, bool isTCP, const NetmaskGroup& acl, PacketBuffer& query, ComboAddress& realRemote, ComboAddress& realDestination, std::string& rawValues);
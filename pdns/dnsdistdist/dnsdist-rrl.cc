@@ -0,0 +1,228 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "dnsdist-rrl.hh"
+#include "dns.hh"
+#include "misc.hh"
+
+namespace dnsdist
+{
+/* number of slots we look at for a given key before reusing the least recently updated one */
+static const size_t s_maxProbes = 4;
+
+ResponseRateLimiter::ResponseRateLimiter(const Config& config): d_config(config), d_shards(std::max(config.d_shards, static_cast<size_t>(1)))
+{
+  d_entriesPerShard = std::max(d_config.d_maxEntries / d_shards.size(), s_maxProbes);
+  for (auto& shard : d_shards) {
+    shard.lock()->d_entries.resize(d_entriesPerShard);
+  }
+}
+
+uint32_t ResponseRateLimiter::getRate(Category category) const
+{
+  switch (category) {
+  case Category::Answer:
+    return d_config.d_responsesPerSecond;
+  case Category::NoData:
+    return d_config.d_nodataPerSecond;
+  case Category::NXDomain:
+    return d_config.d_nxdomainsPerSecond;
+  case Category::Referral:
+    return d_config.d_referralsPerSecond;
+  case Category::Error:
+    return d_config.d_errorsPerSecond;
+  }
+  return 0;
+}
+
+ResponseRateLimiter::Verdict ResponseRateLimiter::check(const ComboAddress& client, const DNSName& name, Category category, time_t now)
+{
+  const int64_t rate = getRate(category);
+  if (rate == 0) {
+    return Verdict::Allow;
+  }
+
+  ComboAddress prefix(client);
+  prefix.truncate(prefix.isIPv4() ? d_config.d_ipv4PrefixLength : d_config.d_ipv6PrefixLength);
+  const auto raw = prefix.toByteString();
+
+  uint32_t hash = burtle(reinterpret_cast<const unsigned char*>(raw.data()), raw.size(), static_cast<uint32_t>(category));
+  /* errors are accounted per client, regardless of the name */
+  if (category != Category::Error) {
+    hash = static_cast<uint32_t>(name.hash(hash));
+  }
+  /* the shard is picked from the low bits, the slot from the high ones, and we keep
+     the full hash plus the category so that the key is never zero */
+  const uint64_t key = (static_cast<uint64_t>(hash) << 8) | (static_cast<uint64_t>(category) + 1);
+  auto& lockedShard = d_shards.at(hash % d_shards.size());
+  const size_t start = (hash / d_shards.size()) % d_entriesPerShard;
+
+  auto shard = lockedShard.lock();
+  Entry* entry = nullptr;
+  Entry* oldest = nullptr;
+  for (size_t probe = 0; probe < s_maxProbes; probe++) {
+    auto& candidate = shard->d_entries[(start + probe) % d_entriesPerShard];
+    if (candidate.d_key == key) {
+      entry = &candidate;
+      break;
+    }
+    if (oldest == nullptr || candidate.d_lastUpdate < oldest->d_lastUpdate) {
+      oldest = &candidate;
+    }
+  }
+
+  if (entry == nullptr) {
+    entry = oldest;
+    if (entry->d_key != 0 && now - entry->d_lastUpdate < static_cast<time_t>(d_config.d_window)) {
+      /* we are reusing a bucket that still held some information */
+      ++shard->d_stats.d_evictions;
+    }
+    entry->d_key = key;
+    entry->d_balance = rate;
+    entry->d_lastUpdate = now;
+    entry->d_slipCounter = 0;
+  }
+  else if (now > entry->d_lastUpdate) {
+    const int64_t elapsed = now - entry->d_lastUpdate;
+    entry->d_balance = std::min(rate, entry->d_balance + elapsed * rate);
+    entry->d_lastUpdate = now;
+  }
+
+  const int64_t maxDebt = -rate * static_cast<int64_t>(d_config.d_window);
+  if (entry->d_balance > maxDebt) {
+    entry->d_balance--;
+  }
+
+  if (entry->d_balance >= 0) {
+    ++shard->d_stats.d_allowed;
+    return Verdict::Allow;
+  }
+
+  entry->d_slipCounter++;
+  if (d_config.d_slip > 0 && (entry->d_slipCounter % d_config.d_slip) == 0) {
+    ++shard->d_stats.d_slipped;
+    return Verdict::Slip;
+  }
+
+  ++shard->d_stats.d_dropped;
+  return Verdict::Drop;
+}
+
+bool ResponseRateLimiter::categorize(const PacketBuffer& response, Category& category, DNSName& zone)
+{
+  if (response.size() < sizeof(dnsheader)) {
+    return false;
+  }
+
+  const auto dh = reinterpret_cast<const struct dnsheader*>(response.data());
+  if (dh->rcode != RCode::NoError && dh->rcode != RCode::NXDomain) {
+    category = Category::Error;
+    return true;
+  }
+
+  if (dh->rcode == RCode::NoError && dh->ancount != 0) {
+    category = Category::Answer;
+    return true;
+  }
+
+  category = dh->rcode == RCode::NXDomain ? Category::NXDomain : Category::NoData;
+  const uint16_t qdcount = ntohs(dh->qdcount);
+  const uint16_t nscount = ntohs(dh->nscount);
+  if (nscount == 0) {
+    return true;
+  }
+
+  try {
+    const auto packet = reinterpret_cast<const char*>(response.data());
+    const size_t length = response.size();
+    size_t pos = sizeof(dnsheader);
+    for (uint16_t idx = 0; idx < qdcount; idx++) {
+      unsigned int consumed = 0;
+      DNSName(packet, length, pos, true, nullptr, nullptr, &consumed);
+      pos += consumed + DNS_TYPE_SIZE + DNS_CLASS_SIZE;
+    }
+
+    DNSName nsOwner;
+    for (uint16_t idx = 0; idx < nscount && pos < length; idx++) {
+      unsigned int consumed = 0;
+      uint16_t qtype = 0;
+      DNSName owner(packet, length, pos, true, &qtype, nullptr, &consumed);
+      pos += consumed + DNS_TYPE_SIZE + DNS_CLASS_SIZE + DNS_TTL_SIZE;
+      if (pos + DNS_RDLENGTH_SIZE > length) {
+        return false;
+      }
+      const uint16_t rdlength = static_cast<uint8_t>(packet[pos]) * 256 + static_cast<uint8_t>(packet[pos + 1]);
+      pos += DNS_RDLENGTH_SIZE + rdlength;
+
+      if (qtype == QType::SOA) {
+        zone = std::move(owner);
+        return true;
+      }
+      if (qtype == QType::NS && nsOwner.empty()) {
+        nsOwner = std::move(owner);
+      }
+    }
+
+    if (category == Category::NoData && !nsOwner.empty() && !dh->aa) {
+      category = Category::Referral;
+      zone = std::move(nsOwner);
+    }
+  }
+  catch (const std::exception& e) {
+    return false;
+  }
+
+  return true;
+}
+
+ResponseRateLimiter::Stats ResponseRateLimiter::getStats() const
+{
+  Stats result;
+  for (auto& lockedShard : d_shards) {
+    auto shard = lockedShard.lock();
+    result.d_allowed += shard->d_stats.d_allowed;
+    result.d_dropped += shard->d_stats.d_dropped;
+    result.d_slipped += shard->d_stats.d_slipped;
+    result.d_evictions += shard->d_stats.d_evictions;
+  }
+  return result;
+}
+
+size_t ResponseRateLimiter::getEntriesCount() const
+{
+  size_t count = 0;
+  for (auto& lockedShard : d_shards) {
+    auto shard = lockedShard.lock();
+    for (const auto& entry : shard->d_entries) {
+      if (entry.d_key != 0) {
+        count++;
+      }
+    }
+  }
+  return count;
+}
+
+std::string ResponseRateLimiter::toString() const
+{
+  const auto stats = getStats();
+  return "rate limit responses to " + std::to_string(d_config.d_responsesPerSecond) + "/s (nodata " + std::to_string(d_config.d_nodataPerSecond) + "/s, nxdomain " + std::to_string(d_config.d_nxdomainsPerSecond) + "/s, referrals " + std::to_string(d_config.d_referralsPerSecond) + "/s, errors " + std::to_string(d_config.d_errorsPerSecond) + "/s) per /" + std::to_string(d_config.d_ipv4PrefixLength) + " and /" + std::to_string(d_config.d_ipv6PrefixLength) + ", slip " + std::to_string(d_config.d_slip) + " (" + std::to_string(stats.d_dropped) + " dropped, " + std::to_string(stats.d_slipped) + " slipped)";
+}
+}
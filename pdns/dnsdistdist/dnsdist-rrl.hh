@@ -0,0 +1,113 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <vector>
+
+#include "dnsname.hh"
+#include "iputils.hh"
+#include "lock.hh"
+#include "noinitvector.hh"
+
+namespace dnsdist
+{
+/* Response Rate Limiting, as described in https://kb.isc.org/docs/aa-00994 and implemented by most
+   authoritative servers: responses are accounted in token buckets keyed by the client's prefix, the
+   category of the response and the name it is about (the qname for positive answers, the zone the SOA
+   or NS records in the authority section belong to for negative answers and referrals, so that random
+   subdomains are accounted together). Once a bucket is empty, responses are dropped, except for one in
+   every 'slip' that is sent truncated so that legitimate clients can retry over TCP.
+   The buckets are stored in a fixed number of fixed-size shards, so the memory usage is bounded no matter
+   how many (possibly spoofed) sources we see: when a shard is full, the least recently updated bucket among
+   the candidates is reused. */
+class ResponseRateLimiter
+{
+public:
+  enum class Category : uint8_t { Answer, NoData, NXDomain, Referral, Error };
+  enum class Verdict : uint8_t { Allow, Drop, Slip };
+
+  struct Config
+  {
+    /* per second, 0 means no limit for that category */
+    uint32_t d_responsesPerSecond{5};
+    uint32_t d_nodataPerSecond{5};
+    uint32_t d_nxdomainsPerSecond{5};
+    uint32_t d_referralsPerSecond{5};
+    uint32_t d_errorsPerSecond{5};
+    /* how long, in seconds, a client exceeding the rate stays limited after it stops */
+    uint32_t d_window{15};
+    /* send a truncated response for one in every 'slip' limited responses instead of dropping it, 0 to always drop */
+    uint16_t d_slip{2};
+    uint8_t d_ipv4PrefixLength{24};
+    uint8_t d_ipv6PrefixLength{56};
+    size_t d_maxEntries{65536};
+    size_t d_shards{16};
+  };
+
+  struct Stats
+  {
+    uint64_t d_allowed{0};
+    uint64_t d_dropped{0};
+    uint64_t d_slipped{0};
+    uint64_t d_evictions{0};
+  };
+
+  ResponseRateLimiter(const Config& config);
+
+  Verdict check(const ComboAddress& client, const DNSName& name, Category category, time_t now);
+
+  /* figure out the category of the response, and for negative answers and referrals the name of the zone
+     the response is about, from the authority section. Returns false if the response could not be parsed. */
+  static bool categorize(const PacketBuffer& response, Category& category, DNSName& zone);
+
+  Stats getStats() const;
+  size_t getEntriesCount() const;
+  const Config& getConfig() const
+  {
+    return d_config;
+  }
+
+  std::string toString() const;
+
+private:
+  struct Entry
+  {
+    uint64_t d_key{0};
+    time_t d_lastUpdate{0};
+    /* available responses, can go negative (down to -rate * window) when the client keeps going once limited */
+    int64_t d_balance{0};
+    uint32_t d_slipCounter{0};
+  };
+
+  struct Shard
+  {
+    std::vector<Entry> d_entries;
+    Stats d_stats;
+  };
+
+  uint32_t getRate(Category category) const;
+
+  const Config d_config;
+  mutable std::vector<LockGuarded<Shard>> d_shards;
+  size_t d_entriesPerShard{0};
+};
+}
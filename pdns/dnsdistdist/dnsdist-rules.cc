@@ -22,5 +22,162 @@
 
 #include "dnsdist-rules.hh"
 
+MaxQPSIPRule::MaxQPSIPRule(unsigned int qps, unsigned int burst, unsigned int ipv4trunc, unsigned int ipv6trunc, unsigned int expiration, unsigned int cleanupDelay, unsigned int scanFraction, size_t shardsCount):
+  d_shards(std::max(shardsCount, static_cast<size_t>(1))), d_qps(qps), d_burst(burst), d_ipv4trunc(ipv4trunc), d_ipv6trunc(ipv6trunc), d_cleanupDelay(cleanupDelay), d_expiration(expiration), d_scanFraction(std::max(scanFraction, 1U))
+{
+  /* a rate of 0 means that the burst is never refilled, a day is close enough */
+  const int64_t maxInterval = 86400LL * 1000 * 1000 * 1000;
+  d_interval = d_qps > 0 ? (1000LL * 1000 * 1000) / d_qps : maxInterval;
+  if (d_burst == 0) {
+    d_tolerance = -1;
+  }
+  else if ((d_burst - 1) > std::numeric_limits<int64_t>::max() / d_interval) {
+    d_tolerance = std::numeric_limits<int64_t>::max();
+  }
+  else {
+    d_tolerance = (d_burst - 1) * d_interval;
+  }
+
+  struct timespec now;
+  gettime(&now, true);
+  d_nextCleanup = now.tv_sec + d_cleanupDelay;
+}
+
+static int64_t timespecToNs(const struct timespec& ts)
+{
+  return static_cast<int64_t>(ts.tv_sec) * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+void MaxQPSIPRule::clear()
+{
+  for (auto& shard : d_shards) {
+    shard.d_entries.write_lock()->clear();
+  }
+}
+
+size_t MaxQPSIPRule::cleanup(const struct timespec& cutOff, size_t* scannedCount) const
+{
+  const int64_t cutOffNs = timespecToNs(cutOff);
+  size_t lookedAt = 0;
+  size_t removed = 0;
+  std::vector<ComboAddress> toRemove;
+
+  for (auto& shard : d_shards) {
+    /* we only hold the lock of a single shard at a time, so the other ones are not affected */
+    auto entries = shard.d_entries.write_lock();
+    if (entries->empty()) {
+      continue;
+    }
+
+    const size_t toLook = entries->size() / d_scanFraction + 1;
+    const size_t bucketsCount = entries->bucket_count();
+    size_t lookedAtInShard = 0;
+    for (size_t scannedBuckets = 0; scannedBuckets < bucketsCount && lookedAtInShard < toLook; scannedBuckets++) {
+      const size_t bucket = shard.d_cleanupCursor % bucketsCount;
+      shard.d_cleanupCursor = bucket + 1;
+
+      for (auto entry = entries->cbegin(bucket); entry != entries->cend(bucket); ++entry) {
+        lookedAtInShard++;
+        if (entry->second.d_lastSeen.load(std::memory_order_relaxed) <= cutOffNs) {
+          toRemove.push_back(entry->first);
+        }
+      }
+
+      /* erasing does not invalidate the other buckets, nor trigger a rehash */
+      for (const auto& key : toRemove) {
+        entries->erase(key);
+      }
+      removed += toRemove.size();
+      toRemove.clear();
+    }
+
+    lookedAt += lookedAtInShard;
+  }
+
+  if (scannedCount != nullptr) {
+    *scannedCount = lookedAt;
+  }
+
+  return removed;
+}
+
+void MaxQPSIPRule::cleanupIfNeeded(const struct timespec& now) const
+{
+  if (d_cleanupDelay == 0) {
+    return;
+  }
+
+  auto nextCleanup = d_nextCleanup.load();
+  if (now.tv_sec < nextCleanup) {
+    return;
+  }
+
+  /* only one thread gets to do the cleanup, the other ones go on with their queries */
+  if (!d_nextCleanup.compare_exchange_strong(nextCleanup, now.tv_sec + d_cleanupDelay)) {
+    return;
+  }
+
+  /* the limiters don't use realtime, be careful! */
+  struct timespec cutOff;
+  gettime(&cutOff, false);
+  cutOff.tv_sec -= d_expiration;
+
+  cleanup(cutOff);
+}
+
+bool MaxQPSIPRule::checkAndUpdate(const Entry& entry, int64_t now) const
+{
+  entry.d_lastSeen.store(now, std::memory_order_relaxed);
+
+  auto tat = entry.d_tat.load(std::memory_order_relaxed);
+  while (true) {
+    const auto base = std::max(tat, now);
+    if (base - now > d_tolerance) {
+      return false;
+    }
+
+    if (entry.d_tat.compare_exchange_weak(tat, base + d_interval, std::memory_order_relaxed)) {
+      return true;
+    }
+  }
+}
+
+bool MaxQPSIPRule::matches(const DNSQuestion* dq) const
+{
+  cleanupIfNeeded(*dq->queryTime);
+
+  ComboAddress zeroport(*dq->remote);
+  zeroport.sin4.sin_port = 0;
+  zeroport.truncate(zeroport.sin4.sin_family == AF_INET ? d_ipv4trunc : d_ipv6trunc);
+
+  struct timespec now;
+  gettime(&now);
+  const int64_t nowNs = timespecToNs(now);
+
+  auto& shard = d_shards.at(ComboAddress::addressOnlyHash()(zeroport) % d_shards.size());
+  {
+    /* existing clients only need the lock in shared mode */
+    auto entries = shard.d_entries.read_lock();
+    auto entry = entries->find(zeroport);
+    if (entry != entries->end()) {
+      return !checkAndUpdate(entry->second, nowNs);
+    }
+  }
+
+  auto entries = shard.d_entries.write_lock();
+  /* default-constructed entries have a full burst */
+  const auto& entry = (*entries)[zeroport];
+  return !checkAndUpdate(entry, nowNs);
+}
+
+size_t MaxQPSIPRule::getEntriesCount() const
+{
+  size_t count = 0;
+  for (auto& shard : d_shards) {
+    count += shard.d_entries.read_lock()->size();
+  }
+  return count;
+}
+
 std::atomic<uint64_t> LuaFFIPerThreadRule::s_functionsCounter = 0;
 thread_local std::map<uint64_t, LuaFFIPerThreadRule::PerThreadState> LuaFFIPerThreadRule::t_perThreadStates;
@@ -21,131 +21,64 @@
  */
 #pragma once
 
-#include <boost/multi_index_container.hpp>
-#include <boost/multi_index/ordered_index.hpp>
-#include <boost/multi_index/sequenced_index.hpp>
-#include <boost/multi_index/key_extractors.hpp>
+#include <unordered_map>
 
-#include "cachecleaner.hh"
 #include "dnsdist.hh"
 #include "dnsdist-ecs.hh"
 #include "dnsdist-kvs.hh"
 #include "dnsdist-lua-ffi.hh"
+#include "dnsdist-proxy-protocol.hh"
+#include "dnsdist-stage-latency.hh"
 #include "dolog.hh"
 #include "dnsparser.hh"
 
 class MaxQPSIPRule : public DNSRule
 {
 public:
-  MaxQPSIPRule(unsigned int qps, unsigned int burst, unsigned int ipv4trunc=32, unsigned int ipv6trunc=64, unsigned int expiration=300, unsigned int cleanupDelay=60, unsigned int scanFraction=10):
-    d_qps(qps), d_burst(burst), d_ipv4trunc(ipv4trunc), d_ipv6trunc(ipv6trunc), d_cleanupDelay(cleanupDelay), d_expiration(expiration), d_scanFraction(scanFraction)
-  {
-    gettime(&d_lastCleanup, true);
-  }
-
-  void clear()
-  {
-    d_limits.lock()->clear();
-  }
-
-  size_t cleanup(const struct timespec& cutOff, size_t* scannedCount=nullptr) const
-  {
-    auto limits = d_limits.lock();
-    size_t toLook = limits->size() / d_scanFraction + 1;
-    size_t lookedAt = 0;
-
-    size_t removed = 0;
-    auto& sequence = limits->get<SequencedTag>();
-    for (auto entry = sequence.begin(); entry != sequence.end() && lookedAt < toLook; lookedAt++) {
-      if (entry->d_limiter.seenSince(cutOff)) {
-        /* entries are ordered from least recently seen to more recently
-           seen, as soon as we see one that has not expired yet, we are
-           done */
-        lookedAt++;
-        break;
-      }
-
-      entry = sequence.erase(entry);
-      removed++;
-    }
-
-    if (scannedCount != nullptr) {
-      *scannedCount = lookedAt;
-    }
-
-    return removed;
-  }
-
-  void cleanupIfNeeded(const struct timespec& now) const
-  {
-    if (d_cleanupDelay > 0) {
-      struct timespec cutOff = d_lastCleanup;
-      cutOff.tv_sec += d_cleanupDelay;
-
-      if (cutOff < now) {
-        /* the QPS Limiter doesn't use realtime, be careful! */
-        gettime(&cutOff, false);
-        cutOff.tv_sec -= d_expiration;
-
-        cleanup(cutOff);
-
-        d_lastCleanup = now;
-      }
-    }
-  }
+  MaxQPSIPRule(unsigned int qps, unsigned int burst, unsigned int ipv4trunc=32, unsigned int ipv6trunc=64, unsigned int expiration=300, unsigned int cleanupDelay=60, unsigned int scanFraction=10, size_t shardsCount=10);
 
-  bool matches(const DNSQuestion* dq) const override
-  {
-    cleanupIfNeeded(*dq->queryTime);
+  void clear();
 
-    ComboAddress zeroport(*dq->remote);
-    zeroport.sin4.sin_port=0;
-    zeroport.truncate(zeroport.sin4.sin_family == AF_INET ? d_ipv4trunc : d_ipv6trunc);
-    {
-      auto limits = d_limits.lock();
-      auto iter = limits->find(zeroport);
-      if (iter == limits->end()) {
-        Entry e(zeroport, QPSLimiter(d_qps, d_burst));
-        iter = limits->insert(e).first;
-      }
+  /* remove the entries that have not been seen since cutOff, looking at no more than 1/scanFraction
+     of the entries of each shard, starting where the previous scan of that shard stopped */
+  size_t cleanup(const struct timespec& cutOff, size_t* scannedCount=nullptr) const;
+  void cleanupIfNeeded(const struct timespec& now) const;
 
-      moveCacheItemToBack<SequencedTag>(*limits, iter);
-      return !iter->d_limiter.check(d_qps, d_burst);
-    }
-  }
+  bool matches(const DNSQuestion* dq) const override;
 
   string toString() const override
   {
     return "IP (/"+std::to_string(d_ipv4trunc)+", /"+std::to_string(d_ipv6trunc)+") match for QPS over " + std::to_string(d_qps) + " burst "+ std::to_string(d_burst);
   }
 
-  size_t getEntriesCount() const
-  {
-    return d_limits.lock()->size();
-  }
+  size_t getEntriesCount() const;
 
 private:
-  struct OrderedTag {};
-  struct SequencedTag {};
+  /* This is a GCRA (Generic Cell Rate Algorithm) limiter, which behaves like a token bucket holding up to 'burst'
+     tokens refilled at 'qps' tokens per second, but whose state fits in a single integer so it can be updated
+     with a compare-and-swap while only holding the shard lock in shared mode. */
   struct Entry
   {
-    Entry(const ComboAddress& addr, BasicQPSLimiter&& limiter): d_limiter(limiter), d_addr(addr)
-    {
-    }
-    mutable BasicQPSLimiter d_limiter;
-    ComboAddress d_addr;
+    /* theoretical arrival time of the next query, in nanoseconds */
+    mutable std::atomic<int64_t> d_tat{0};
+    mutable std::atomic<int64_t> d_lastSeen{0};
+  };
+
+  using entries_t = std::unordered_map<ComboAddress, Entry, ComboAddress::addressOnlyHash, ComboAddress::addressOnlyEqual>;
+
+  struct alignas(CPU_LEVEL1_DCACHE_LINESIZE) Shard
+  {
+    SharedLockGuarded<entries_t> d_entries;
+    /* index of the next bucket to scan, only accessed with the lock held in exclusive mode */
+    size_t d_cleanupCursor{0};
   };
 
-  typedef multi_index_container<
-    Entry,
-    indexed_by <
-      ordered_unique<tag<OrderedTag>, member<Entry,ComboAddress,&Entry::d_addr>, ComboAddress::addressOnlyLessThan >,
-      sequenced<tag<SequencedTag> >
-      >
-  > qpsContainer_t;
+  bool checkAndUpdate(const Entry& entry, int64_t now) const;
 
-  mutable LockGuarded<qpsContainer_t> d_limits;
-  mutable struct timespec d_lastCleanup;
+  mutable std::vector<Shard> d_shards;
+  mutable std::atomic<time_t> d_nextCleanup{0};
+  int64_t d_interval{0};
+  int64_t d_tolerance{0};
   unsigned int d_qps, d_burst, d_ipv4trunc, d_ipv6trunc, d_cleanupDelay, d_expiration;
   unsigned int d_scanFraction{10};
 };
@@ -1177,9 +1110,12 @@ public:
 
   bool matches(const DNSQuestion* dq) const override
   {
+    dnsdist::StageLatency::Timer stageTimer(dq->stageLatencySampled);
     try {
       auto lock = g_lua.lock();
-      return d_func(dq);
+      const bool result = d_func(dq);
+      stageTimer.record(dnsdist::StageLatency::Stage::Lua);
+      return result;
     } catch (const std::exception &e) {
       warnlog("LuaRule failed inside Lua: %s", e.what());
     } catch (...) {
@@ -1206,9 +1142,12 @@ public:
   bool matches(const DNSQuestion* dq) const override
   {
     dnsdist_ffi_dnsquestion_t dqffi(const_cast<DNSQuestion*>(dq));
+    dnsdist::StageLatency::Timer stageTimer(dq->stageLatencySampled);
     try {
       auto lock = g_lua.lock();
-      return d_func(&dqffi);
+      const bool result = d_func(&dqffi);
+      stageTimer.record(dnsdist::StageLatency::Stage::Lua);
+      return result;
     } catch (const std::exception &e) {
       warnlog("LuaFFIRule failed inside Lua: %s", e.what());
     } catch (...) {
@@ -1252,7 +1191,10 @@ public:
       }
 
       dnsdist_ffi_dnsquestion_t dqffi(const_cast<DNSQuestion*>(dq));
-      return state.d_func(&dqffi);
+      dnsdist::StageLatency::Timer stageTimer(dq->stageLatencySampled);
+      const bool result = state.d_func(&dqffi);
+      stageTimer.record(dnsdist::StageLatency::Stage::Lua);
+      return result;
     }
     catch (const std::exception &e) {
       warnlog("LuaFFIPerthreadRule failed inside Lua: %s", e.what());
@@ -1290,17 +1232,15 @@ public:
 
   bool matches(const DNSQuestion* dq) const override
   {
-    if (!dq->proxyProtocolValues) {
-      return false;
-    }
-
-    for (const auto& entry : *dq->proxyProtocolValues) {
+    bool found = false;
+    visitProxyProtocolValues(*dq, [this, &found](const ProxyProtocolValueView& entry) {
       if (entry.type == d_type && (!d_value || entry.content == *d_value)) {
-        return true;
+        found = true;
       }
-    }
+      return !found;
+    });
 
-    return false;
+    return found;
   }
 
   string toString() const override
@@ -0,0 +1,67 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <algorithm>
+
+#include "dnsdist-stage-latency.hh"
+
+namespace dnsdist
+{
+std::atomic<uint32_t> StageLatency::s_samplingRate{0};
+std::array<StageLatency::Histogram, static_cast<size_t>(StageLatency::Stage::Count)> StageLatency::s_histograms;
+
+void StageLatency::record(Stage stage, uint64_t usec)
+{
+  auto& histogram = s_histograms.at(static_cast<size_t>(stage));
+  const auto bucket = std::lower_bound(s_bucketBounds.begin(), s_bucketBounds.end(), usec) - s_bucketBounds.begin();
+  histogram.d_buckets.at(bucket).fetch_add(1, std::memory_order_relaxed);
+  histogram.d_sumUsec.fetch_add(usec, std::memory_order_relaxed);
+  histogram.d_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+const StageLatency::Histogram& StageLatency::getHistogram(Stage stage)
+{
+  return s_histograms.at(static_cast<size_t>(stage));
+}
+
+const std::string& StageLatency::getStageName(Stage stage)
+{
+  static const std::array<std::string, static_cast<size_t>(Stage::Count)> names{
+    "rules",
+    "lua",
+    "cache-lookup",
+    "server-selection",
+    "backend",
+    "response-rules"};
+  return names.at(static_cast<size_t>(stage));
+}
+
+void StageLatency::clear()
+{
+  for (auto& histogram : s_histograms) {
+    for (auto& bucket : histogram.d_buckets) {
+      bucket.store(0);
+    }
+    histogram.d_sumUsec.store(0);
+    histogram.d_count.store(0);
+  }
+}
+}
@@ -0,0 +1,126 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <string>
+
+#include "gettime.hh"
+
+namespace dnsdist
+{
+/* Time spent by sampled queries in the different stages of their processing, aggregated into one histogram per stage.
+   Sampling is disabled by default, and a query that is not sampled only costs a thread-local counter increment. */
+class StageLatency
+{
+public:
+  enum class Stage : uint8_t
+  {
+    Rules,           // query rules and actions, including Lua
+    Lua,             // Lua and Lua FFI rules and actions, query and response
+    CacheLookup,     // packet cache lookups
+    ServerSelection, // load-balancing policy
+    Backend,         // from the moment the query is sent to the backend until the response is received (UDP only)
+    ResponseRules,   // response rules and actions, including Lua
+    Count
+  };
+
+  /* upper bounds of the histogram buckets, in microseconds, the last bucket holding everything above the last bound */
+  static constexpr std::array<uint64_t, 10> s_bucketBounds{1, 10, 50, 100, 500, 1000, 5000, 10000, 100000, 1000000};
+
+  struct Histogram
+  {
+    std::array<std::atomic<uint64_t>, s_bucketBounds.size() + 1> d_buckets{};
+    std::atomic<uint64_t> d_sumUsec{0};
+    std::atomic<uint64_t> d_count{0};
+  };
+
+  /* sample one query out of every 'rate', 0 disables the sampling */
+  static void setSamplingRate(uint32_t rate)
+  {
+    s_samplingRate.store(rate);
+  }
+
+  static uint32_t getSamplingRate()
+  {
+    return s_samplingRate.load(std::memory_order_relaxed);
+  }
+
+  static bool shouldSample()
+  {
+    static thread_local uint32_t t_counter{0};
+    const auto rate = getSamplingRate();
+    if (rate == 0) {
+      return false;
+    }
+    if (++t_counter < rate) {
+      return false;
+    }
+    t_counter = 0;
+    return true;
+  }
+
+  static void record(Stage stage, uint64_t usec);
+  static const Histogram& getHistogram(Stage stage);
+  static const std::string& getStageName(Stage stage);
+  static void clear();
+
+  /* measures the time elapsed since its creation, or since the last call to record(), only for sampled queries */
+  class Timer
+  {
+  public:
+    Timer(bool enabled): d_enabled(enabled)
+    {
+      if (d_enabled) {
+        gettime(&d_start);
+      }
+    }
+
+    void reset()
+    {
+      if (d_enabled) {
+        gettime(&d_start);
+      }
+    }
+
+    void record(Stage stage)
+    {
+      if (!d_enabled) {
+        return;
+      }
+      struct timespec now;
+      gettime(&now);
+      StageLatency::record(stage, (now.tv_sec - d_start.tv_sec) * 1000000 + (now.tv_nsec - d_start.tv_nsec) / 1000);
+      d_start = now;
+    }
+
+  private:
+    struct timespec d_start{0, 0};
+    const bool d_enabled;
+  };
+
+private:
+  static std::atomic<uint32_t> s_samplingRate;
+  static std::array<Histogram, static_cast<size_t>(Stage::Count)> s_histograms;
+};
+}
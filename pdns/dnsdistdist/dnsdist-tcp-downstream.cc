@@ -18,6 +18,12 @@ ConnectionToBackend::~ConnectionToBackend()
       if (d_handler->hasTLSSessionBeenResumed()) {
         ++d_ds->tlsResumptions;
       }
+      if (d_handler->isKTLSSendEnabled()) {
+        ++d_ds->tlsKTLSSendConnections;
+      }
+      if (d_handler->isKTLSRecvEnabled()) {
+        ++d_ds->tlsKTLSRecvConnections;
+      }
       try {
         auto sessions = d_handler->getTLSSessions();
         if (!sessions.empty()) {
@@ -43,6 +49,12 @@ bool ConnectionToBackend::reconnect()
       if (d_handler->hasTLSSessionBeenResumed()) {
         ++d_ds->tlsResumptions;
       }
+      if (d_handler->isKTLSSendEnabled()) {
+        ++d_ds->tlsKTLSSendConnections;
+      }
+      if (d_handler->isKTLSRecvEnabled()) {
+        ++d_ds->tlsKTLSRecvConnections;
+      }
       try {
         auto sessions = d_handler->getTLSSessions();
         if (!sessions.empty()) {
@@ -166,6 +166,8 @@ static void handleTimeout(std::shared_ptr<IncomingTCPConnectionState>& state, bo
   std::unique_ptr<IOStateHandler> d_ioState{nullptr};
   std::unique_ptr<std::vector<ProxyProtocolValue>> d_proxyProtocolValues{nullptr};
   TCPClientThreadData& d_threadData;
+  /* CPU time spent in the TLS handshake so far, in nanoseconds */
+  uint64_t d_handshakeCPUTime{0};
   size_t d_currentPos{0};
   size_t d_proxyProtocolNeed{0};
   size_t d_queriesCount{0};
@@ -126,6 +126,13 @@ public:
 
   void handleTicketsKeyRotation()
   {
+    if (d_ticketsKeyFileWatcher) {
+      /* the keys are managed outside of this process, possibly shared with other ones,
+         so we only reload them when the file changes */
+      d_ticketsKeyFileWatcher->reloadIfChanged(time(nullptr), [this](const std::string& file) { loadTicketsKeys(file); });
+      return;
+    }
+
     if (d_ticketsKeyRotationDelay == 0) {
       return;
     }
@@ -154,6 +161,7 @@ public:
 
   std::map<int, std::string> d_ocspResponses;
   std::unique_ptr<OpenSSLTLSTicketKeysRing> d_ticketKeys{nullptr};
+  std::unique_ptr<TLSTicketsKeyFileWatcher> d_ticketsKeyFileWatcher{nullptr};
   std::unique_ptr<FILE, int(*)(FILE*)> d_keyLogFile{nullptr, fclose};
   ClientState* d_cs{nullptr};
   time_t d_ticketsKeyRotationDelay{0};
@@ -1453,6 +1461,9 @@ static void setupTLSContext(DOHAcceptContext& acceptCtx,
   }
   else {
     acceptCtx.loadTicketsKeys(tlsConfig.d_ticketKeyFile);
+    if (tlsConfig.d_ticketsKeyFileCheckInterval > 0) {
+      acceptCtx.d_ticketsKeyFileWatcher = std::make_unique<TLSTicketsKeyFileWatcher>(tlsConfig.d_ticketKeyFile, tlsConfig.d_ticketsKeyFileCheckInterval);
+    }
   }
 
   auto nativeCtx = acceptCtx.get();
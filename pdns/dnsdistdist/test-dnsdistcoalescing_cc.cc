@@ -0,0 +1,158 @@
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#include <boost/test/unit_test.hpp>
+
+#include "dnsdist-coalescing.hh"
+#include "dnswriter.hh"
+#include "qtype.hh"
+
+BOOST_AUTO_TEST_SUITE(dnsdistcoalescing_cc)
+
+static dnsdist::QueryCoalescer::Follower makeFollower(const std::string& remote, uint16_t id)
+{
+  dnsdist::QueryCoalescer::Follower follower;
+  follower.d_remote = ComboAddress(remote);
+  follower.d_fd = 42;
+  follower.d_id = htons(id);
+  return follower;
+}
+
+BOOST_AUTO_TEST_CASE(test_CoalescingBasic)
+{
+  dnsdist::QueryCoalescer::Config config;
+  config.d_maxFollowers = 2;
+  dnsdist::QueryCoalescer coalescer(config);
+
+  const DNSName name("coalescing.powerdns.com.");
+  const uint32_t key = 0xdeadbeef;
+  const uint16_t flags = 0x0100;
+  const time_t now = 1000;
+  uint64_t leaderToken = 0;
+  uint64_t token = 0;
+
+  BOOST_CHECK(coalescer.addQuery(key, name, QType::A, QClass::IN, flags, false, boost::none, makeFollower("192.0.2.1:53", 1), now, leaderToken) == dnsdist::QueryCoalescer::Result::Leader);
+  BOOST_CHECK_EQUAL(coalescer.getEntriesCount(), 1U);
+
+  /* the case of the qname is restored for each follower */
+  BOOST_CHECK(coalescer.addQuery(key, DNSName("Coalescing.PowerDNS.com."), QType::A, QClass::IN, flags, false, boost::none, makeFollower("192.0.2.2:53", 2), now, token) == dnsdist::QueryCoalescer::Result::Follower);
+  /* same key but not the same query: collision */
+  BOOST_CHECK(coalescer.addQuery(key, name, QType::AAAA, QClass::IN, flags, false, boost::none, makeFollower("192.0.2.3:53", 3), now, token) == dnsdist::QueryCoalescer::Result::Bypass);
+  BOOST_CHECK(coalescer.addQuery(key, name, QType::A, QClass::IN, flags, true, boost::none, makeFollower("192.0.2.3:53", 3), now, token) == dnsdist::QueryCoalescer::Result::Bypass);
+  BOOST_CHECK(coalescer.addQuery(key, name, QType::A, QClass::IN, flags, false, boost::none, makeFollower("192.0.2.4:53", 4), now, token) == dnsdist::QueryCoalescer::Result::Follower);
+  /* too many followers */
+  BOOST_CHECK(coalescer.addQuery(key, name, QType::A, QClass::IN, flags, false, boost::none, makeFollower("192.0.2.5:53", 5), now, token) == dnsdist::QueryCoalescer::Result::Bypass);
+
+  /* a stale token does not release anything */
+  BOOST_CHECK(coalescer.release(key, leaderToken + 1).empty());
+
+  const auto followers = coalescer.release(key, leaderToken);
+  BOOST_REQUIRE_EQUAL(followers.size(), 2U);
+  BOOST_CHECK(followers.at(0).d_remote == ComboAddress("192.0.2.2:53"));
+  BOOST_CHECK_EQUAL(followers.at(0).d_id, htons(2));
+  BOOST_CHECK_EQUAL(followers.at(0).d_qname.toString(), "Coalescing.PowerDNS.com.");
+  BOOST_CHECK(followers.at(1).d_remote == ComboAddress("192.0.2.4:53"));
+  BOOST_CHECK_EQUAL(coalescer.getEntriesCount(), 0U);
+
+  /* once released, the next query is a leader again */
+  BOOST_CHECK(coalescer.addQuery(key, name, QType::A, QClass::IN, flags, false, boost::none, makeFollower("192.0.2.6:53", 6), now, token) == dnsdist::QueryCoalescer::Result::Leader);
+  BOOST_CHECK(token != leaderToken);
+
+  const auto stats = coalescer.getStats();
+  BOOST_CHECK_EQUAL(stats.d_leaders, 2U);
+  BOOST_CHECK_EQUAL(stats.d_followers, 2U);
+  BOOST_CHECK_EQUAL(stats.d_bypassed, 3U);
+  BOOST_CHECK_EQUAL(stats.d_unanswered, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_CoalescingECS)
+{
+  dnsdist::QueryCoalescer::Config config;
+  dnsdist::QueryCoalescer coalescer(config);
+
+  const DNSName name("coalescing.powerdns.com.");
+  const time_t now = 1000;
+  const boost::optional<Netmask> subnet(Netmask("192.0.2.0/24"));
+  uint64_t leaderToken = 0;
+  uint64_t token = 0;
+
+  BOOST_CHECK(coalescer.addQuery(1, name, QType::A, QClass::IN, 0, false, subnet, makeFollower("192.0.2.1:53", 1), now, leaderToken) == dnsdist::QueryCoalescer::Result::Leader);
+  /* the same subnet */
+  BOOST_CHECK(coalescer.addQuery(1, name, QType::A, QClass::IN, 0, false, Netmask("192.0.2.0/24"), makeFollower("192.0.2.2:53", 2), now, token) == dnsdist::QueryCoalescer::Result::Follower);
+  /* the answer might be scoped to the leader's subnet, so queries from another subnet, or without ECS, are not coalesced */
+  BOOST_CHECK(coalescer.addQuery(1, name, QType::A, QClass::IN, 0, false, Netmask("198.51.100.0/24"), makeFollower("198.51.100.1:53", 3), now, token) == dnsdist::QueryCoalescer::Result::Bypass);
+  BOOST_CHECK(coalescer.addQuery(1, name, QType::A, QClass::IN, 0, false, boost::none, makeFollower("192.0.2.4:53", 4), now, token) == dnsdist::QueryCoalescer::Result::Bypass);
+
+  const auto followers = coalescer.release(1, leaderToken);
+  BOOST_REQUIRE_EQUAL(followers.size(), 1U);
+  BOOST_CHECK(followers.at(0).d_remote == ComboAddress("192.0.2.2:53"));
+}
+
+BOOST_AUTO_TEST_CASE(test_CoalescingFollowerResponse)
+{
+  const DNSName name("coalescing.powerdns.com.");
+  PacketBuffer response;
+  GenericDNSPacketWriter<PacketBuffer> pw(response, name, QType::A, QClass::IN, 0);
+  pw.getHeader()->qr = 1;
+  pw.getHeader()->id = htons(1);
+  pw.startRecord(name, QType::A, 3600, QClass::IN, DNSResourceRecord::ANSWER);
+  pw.xfrIP(ComboAddress("192.0.2.254").sin4.sin_addr.s_addr);
+  pw.commit();
+
+  /* the response as processed by the response rules of the leader is sent as-is, only the ID and qname case are the follower's */
+  auto follower = makeFollower("192.0.2.2:53", 2);
+  follower.d_qname = DNSName("Coalescing.PowerDNS.com.");
+  PacketBuffer copy(response);
+  dnsdist::QueryCoalescer::prepareResponseForFollower(copy, follower);
+
+  BOOST_REQUIRE_EQUAL(copy.size(), response.size());
+  BOOST_CHECK_EQUAL(reinterpret_cast<const dnsheader*>(copy.data())->id, htons(2));
+  const auto& qname = follower.d_qname.getStorage();
+  BOOST_CHECK(memcmp(&copy.at(sizeof(dnsheader)), qname.data(), qname.size()) == 0);
+  BOOST_CHECK(memcmp(&copy.at(2), &response.at(2), sizeof(dnsheader) - 2) == 0);
+  BOOST_CHECK(std::equal(copy.begin() + sizeof(dnsheader) + qname.size(), copy.end(), response.begin() + sizeof(dnsheader) + qname.size()));
+
+  /* a truncated response is left alone */
+  PacketBuffer truncated(response.begin(), response.begin() + sizeof(dnsheader) - 1);
+  dnsdist::QueryCoalescer::prepareResponseForFollower(truncated, follower);
+  BOOST_CHECK(std::equal(truncated.begin(), truncated.end(), response.begin()));
+}
+
+BOOST_AUTO_TEST_CASE(test_CoalescingTimeout)
+{
+  dnsdist::QueryCoalescer::Config config;
+  config.d_timeout = 2;
+  dnsdist::QueryCoalescer coalescer(config);
+
+  const DNSName name("coalescing.powerdns.com.");
+  time_t now = 1000;
+  uint64_t firstToken = 0;
+  uint64_t token = 0;
+
+  BOOST_CHECK(coalescer.addQuery(1, name, QType::A, QClass::IN, 0, false, boost::none, makeFollower("192.0.2.1:53", 1), now, firstToken) == dnsdist::QueryCoalescer::Result::Leader);
+  BOOST_CHECK(coalescer.addQuery(1, name, QType::A, QClass::IN, 0, false, boost::none, makeFollower("192.0.2.2:53", 2), now, token) == dnsdist::QueryCoalescer::Result::Follower);
+
+  /* the leader did not get a response in time, the next query takes its place */
+  now += config.d_timeout;
+  uint64_t secondToken = 0;
+  BOOST_CHECK(coalescer.addQuery(1, name, QType::A, QClass::IN, 0, false, boost::none, makeFollower("192.0.2.3:53", 3), now, secondToken) == dnsdist::QueryCoalescer::Result::Leader);
+  BOOST_CHECK(coalescer.release(1, firstToken).empty());
+  BOOST_CHECK_EQUAL(coalescer.getStats().d_unanswered, 1U);
+
+  BOOST_CHECK(coalescer.addQuery(1, name, QType::A, QClass::IN, 0, false, boost::none, makeFollower("192.0.2.4:53", 4), now, token) == dnsdist::QueryCoalescer::Result::Follower);
+  BOOST_CHECK_EQUAL(coalescer.purgeExpired(now + config.d_timeout - 1), 0U);
+  BOOST_CHECK_EQUAL(coalescer.purgeExpired(now + config.d_timeout), 1U);
+  BOOST_CHECK_EQUAL(coalescer.getEntriesCount(), 0U);
+  BOOST_CHECK_EQUAL(coalescer.getStats().d_unanswered, 2U);
+
+  /* abandoning a leader drops its followers */
+  BOOST_CHECK(coalescer.addQuery(2, name, QType::A, QClass::IN, 0, false, boost::none, makeFollower("192.0.2.5:53", 5), now, token) == dnsdist::QueryCoalescer::Result::Leader);
+  uint64_t unused = 0;
+  BOOST_CHECK(coalescer.addQuery(2, name, QType::A, QClass::IN, 0, false, boost::none, makeFollower("192.0.2.6:53", 6), now, unused) == dnsdist::QueryCoalescer::Result::Follower);
+  coalescer.abandon(2, token);
+  BOOST_CHECK_EQUAL(coalescer.getEntriesCount(), 0U);
+  BOOST_CHECK_EQUAL(coalescer.getStats().d_unanswered, 3U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,213 @@
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#include <boost/test/unit_test.hpp>
+
+#include "dnsdist-rrl.hh"
+#include "dnswriter.hh"
+
+BOOST_AUTO_TEST_SUITE(dnsdistrrl_cc)
+
+BOOST_AUTO_TEST_CASE(test_RRLBasic)
+{
+  dnsdist::ResponseRateLimiter::Config config;
+  config.d_responsesPerSecond = 10;
+  config.d_window = 5;
+  config.d_slip = 2;
+  dnsdist::ResponseRateLimiter rrl(config);
+
+  const ComboAddress client("192.0.2.1");
+  const ComboAddress sameSubnet("192.0.2.254");
+  const ComboAddress otherClient("198.51.100.1");
+  const DNSName name("rrl.powerdns.com.");
+  time_t now = 1000;
+
+  for (size_t idx = 0; idx < config.d_responsesPerSecond; idx++) {
+    BOOST_CHECK(rrl.check(client, name, dnsdist::ResponseRateLimiter::Category::Answer, now) == dnsdist::ResponseRateLimiter::Verdict::Allow);
+  }
+
+  /* the bucket is now empty, and shared by the whole /24, one in two responses slips */
+  BOOST_CHECK(rrl.check(sameSubnet, name, dnsdist::ResponseRateLimiter::Category::Answer, now) == dnsdist::ResponseRateLimiter::Verdict::Drop);
+  BOOST_CHECK(rrl.check(client, name, dnsdist::ResponseRateLimiter::Category::Answer, now) == dnsdist::ResponseRateLimiter::Verdict::Slip);
+  BOOST_CHECK(rrl.check(client, name, dnsdist::ResponseRateLimiter::Category::Answer, now) == dnsdist::ResponseRateLimiter::Verdict::Drop);
+
+  /* other clients, other names and other categories are not affected */
+  BOOST_CHECK(rrl.check(otherClient, name, dnsdist::ResponseRateLimiter::Category::Answer, now) == dnsdist::ResponseRateLimiter::Verdict::Allow);
+  BOOST_CHECK(rrl.check(client, DNSName("other.powerdns.com."), dnsdist::ResponseRateLimiter::Category::Answer, now) == dnsdist::ResponseRateLimiter::Verdict::Allow);
+  BOOST_CHECK(rrl.check(client, name, dnsdist::ResponseRateLimiter::Category::NXDomain, now) == dnsdist::ResponseRateLimiter::Verdict::Allow);
+
+  /* names are case-insensitive */
+  BOOST_CHECK(rrl.check(client, DNSName("RRL.PowerDNS.com."), dnsdist::ResponseRateLimiter::Category::Answer, now) != dnsdist::ResponseRateLimiter::Verdict::Allow);
+
+  /* the limited responses have been taken from the next second's budget, so we need to wait
+     two seconds to get a full second worth of responses again */
+  now += 2;
+  for (size_t idx = 0; idx < config.d_responsesPerSecond; idx++) {
+    BOOST_CHECK(rrl.check(client, name, dnsdist::ResponseRateLimiter::Category::Answer, now) == dnsdist::ResponseRateLimiter::Verdict::Allow);
+  }
+  BOOST_CHECK(rrl.check(client, name, dnsdist::ResponseRateLimiter::Category::Answer, now) != dnsdist::ResponseRateLimiter::Verdict::Allow);
+
+  const auto stats = rrl.getStats();
+  BOOST_CHECK_EQUAL(stats.d_allowed, 2 * config.d_responsesPerSecond + 3);
+  BOOST_CHECK_EQUAL(stats.d_slipped + stats.d_dropped, 5U);
+  BOOST_CHECK_EQUAL(stats.d_slipped, 2U);
+  BOOST_CHECK_EQUAL(stats.d_evictions, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_RRLWindow)
+{
+  dnsdist::ResponseRateLimiter::Config config;
+  config.d_errorsPerSecond = 2;
+  config.d_window = 3;
+  config.d_slip = 0;
+  dnsdist::ResponseRateLimiter rrl(config);
+
+  const ComboAddress client("2001:db8::1");
+  time_t now = 1000;
+
+  /* a client that keeps going once limited accumulates a debt, up to rate * window */
+  for (size_t idx = 0; idx < 100; idx++) {
+    auto verdict = rrl.check(client, DNSName("error.powerdns.com."), dnsdist::ResponseRateLimiter::Category::Error, now);
+    BOOST_CHECK(verdict == (idx < config.d_errorsPerSecond ? dnsdist::ResponseRateLimiter::Verdict::Allow : dnsdist::ResponseRateLimiter::Verdict::Drop));
+  }
+
+  /* errors are accounted per client, regardless of the name, and slip is disabled */
+  BOOST_CHECK(rrl.check(ComboAddress("2001:db8::42"), DNSName("other.powerdns.com."), dnsdist::ResponseRateLimiter::Category::Error, now) == dnsdist::ResponseRateLimiter::Verdict::Drop);
+
+  /* paying back the debt takes 'window' seconds */
+  BOOST_CHECK(rrl.check(client, DNSName(), dnsdist::ResponseRateLimiter::Category::Error, now + config.d_window - 1) == dnsdist::ResponseRateLimiter::Verdict::Drop);
+  BOOST_CHECK(rrl.check(client, DNSName(), dnsdist::ResponseRateLimiter::Category::Error, now + 2 * config.d_window) == dnsdist::ResponseRateLimiter::Verdict::Allow);
+
+  /* a rate of 0 disables the limiting for that category */
+  config.d_responsesPerSecond = 0;
+  dnsdist::ResponseRateLimiter unlimited(config);
+  for (size_t idx = 0; idx < 100; idx++) {
+    BOOST_CHECK(unlimited.check(client, DNSName("powerdns.com."), dnsdist::ResponseRateLimiter::Category::Answer, now) == dnsdist::ResponseRateLimiter::Verdict::Allow);
+  }
+  BOOST_CHECK_EQUAL(unlimited.getEntriesCount(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_RRLBoundedMemory)
+{
+  dnsdist::ResponseRateLimiter::Config config;
+  config.d_responsesPerSecond = 1;
+  config.d_maxEntries = 1024;
+  config.d_shards = 4;
+  dnsdist::ResponseRateLimiter rrl(config);
+
+  /* a flood of spoofed sources does not grow the table past its initial size */
+  const DNSName name("flood.powerdns.com.");
+  for (uint32_t idx = 0; idx < 100000; idx++) {
+    ComboAddress source("10.0.0.0");
+    source.sin4.sin_addr.s_addr = htonl(0x0a000000 | (idx << 8));
+    rrl.check(source, name, dnsdist::ResponseRateLimiter::Category::Answer, 1000);
+  }
+
+  BOOST_CHECK_LE(rrl.getEntriesCount(), config.d_maxEntries);
+  BOOST_CHECK_GT(rrl.getStats().d_evictions, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_RRLCategorize)
+{
+  const DNSName qname("www.rrl.powerdns.com.");
+  const DNSName zone("rrl.powerdns.com.");
+  dnsdist::ResponseRateLimiter::Category category;
+
+  {
+    /* positive answer */
+    PacketBuffer response;
+    GenericDNSPacketWriter<PacketBuffer> pw(response, qname, QType::A, QClass::IN, 0);
+    pw.getHeader()->qr = 1;
+    pw.startRecord(qname, QType::A, 60, QClass::IN, DNSResourceRecord::ANSWER);
+    pw.xfr32BitInt(0x01020304);
+    pw.commit();
+
+    DNSName found;
+    BOOST_REQUIRE(dnsdist::ResponseRateLimiter::categorize(response, category, found));
+    BOOST_CHECK(category == dnsdist::ResponseRateLimiter::Category::Answer);
+    BOOST_CHECK(found.empty());
+  }
+
+  {
+    /* NXDomain, accounted against the zone of the SOA */
+    PacketBuffer response;
+    GenericDNSPacketWriter<PacketBuffer> pw(response, qname, QType::A, QClass::IN, 0);
+    pw.getHeader()->qr = 1;
+    pw.getHeader()->aa = 1;
+    pw.getHeader()->rcode = RCode::NXDomain;
+    pw.startRecord(zone, QType::SOA, 60, QClass::IN, DNSResourceRecord::AUTHORITY);
+    pw.xfrName(DNSName("ns.powerdns.com."), true);
+    pw.xfrName(DNSName("hostmaster.powerdns.com."), true);
+    pw.xfr32BitInt(1);
+    pw.xfr32BitInt(2);
+    pw.xfr32BitInt(3);
+    pw.xfr32BitInt(4);
+    pw.xfr32BitInt(5);
+    pw.commit();
+
+    DNSName found;
+    BOOST_REQUIRE(dnsdist::ResponseRateLimiter::categorize(response, category, found));
+    BOOST_CHECK(category == dnsdist::ResponseRateLimiter::Category::NXDomain);
+    BOOST_CHECK_EQUAL(found, zone);
+  }
+
+  {
+    /* referral */
+    PacketBuffer response;
+    GenericDNSPacketWriter<PacketBuffer> pw(response, qname, QType::A, QClass::IN, 0);
+    pw.getHeader()->qr = 1;
+    pw.startRecord(zone, QType::NS, 60, QClass::IN, DNSResourceRecord::AUTHORITY);
+    pw.xfrName(DNSName("ns.rrl.powerdns.com."), true);
+    pw.commit();
+
+    DNSName found;
+    BOOST_REQUIRE(dnsdist::ResponseRateLimiter::categorize(response, category, found));
+    BOOST_CHECK(category == dnsdist::ResponseRateLimiter::Category::Referral);
+    BOOST_CHECK_EQUAL(found, zone);
+  }
+
+  {
+    /* NoData without an authority section */
+    PacketBuffer response;
+    GenericDNSPacketWriter<PacketBuffer> pw(response, qname, QType::A, QClass::IN, 0);
+    pw.getHeader()->qr = 1;
+    pw.commit();
+
+    DNSName found;
+    BOOST_REQUIRE(dnsdist::ResponseRateLimiter::categorize(response, category, found));
+    BOOST_CHECK(category == dnsdist::ResponseRateLimiter::Category::NoData);
+    BOOST_CHECK(found.empty());
+  }
+
+  {
+    /* error */
+    PacketBuffer response;
+    GenericDNSPacketWriter<PacketBuffer> pw(response, qname, QType::A, QClass::IN, 0);
+    pw.getHeader()->qr = 1;
+    pw.getHeader()->rcode = RCode::Refused;
+    pw.commit();
+
+    DNSName found;
+    BOOST_REQUIRE(dnsdist::ResponseRateLimiter::categorize(response, category, found));
+    BOOST_CHECK(category == dnsdist::ResponseRateLimiter::Category::Error);
+  }
+
+  {
+    /* truncated authority section */
+    PacketBuffer response;
+    GenericDNSPacketWriter<PacketBuffer> pw(response, qname, QType::A, QClass::IN, 0);
+    pw.getHeader()->qr = 1;
+    pw.getHeader()->rcode = RCode::NXDomain;
+    pw.startRecord(zone, QType::SOA, 60, QClass::IN, DNSResourceRecord::AUTHORITY);
+    pw.xfrName(DNSName("ns.powerdns.com."), true);
+    pw.commit();
+    /* cut in the middle of the fixed part of the record, after the (compressed) owner name */
+    response.resize(sizeof(dnsheader) + qname.wirelength() + DNS_TYPE_SIZE + DNS_CLASS_SIZE + 2 + DNS_TYPE_SIZE + 1);
+
+    DNSName found;
+    BOOST_CHECK(!dnsdist::ResponseRateLimiter::categorize(response, category, found));
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
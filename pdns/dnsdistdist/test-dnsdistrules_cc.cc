@@ -105,8 +105,9 @@ BOOST_AUTO_TEST_CASE(test_MaxQPSIPRule) {
   size_t scanned = 0;
   auto removed = rule.cleanup(notExpiredTime, &scanned);
   BOOST_CHECK_EQUAL(removed, 0U);
-  /* the first entry should still have been valid, we should not have scanned more */
-  BOOST_CHECK_EQUAL(scanned, 1U);
+  /* we should have scanned roughly 1/scanFraction of the entries of each shard, and no more */
+  BOOST_CHECK_GE(scanned, total / scanFraction);
+  BOOST_CHECK_LE(scanned, (total / scanFraction) + 1000U);
   BOOST_CHECK_EQUAL(rule.getEntriesCount(), total);
 
   /* make sure all entries are _not_ valid anymore */
@@ -114,11 +115,17 @@ BOOST_AUTO_TEST_CASE(test_MaxQPSIPRule) {
   expiredTime.tv_sec += 1;
 
   removed = rule.cleanup(expiredTime, &scanned);
-  BOOST_CHECK_EQUAL(removed, (total / scanFraction) + 1);
-  /* we should not have scanned more than scanFraction */
+  BOOST_CHECK_GE(removed, total / scanFraction);
+  /* every entry we looked at had expired */
   BOOST_CHECK_EQUAL(scanned, removed);
   BOOST_CHECK_EQUAL(rule.getEntriesCount(), total - removed);
 
+  /* the next scans pick up where the previous one stopped, so a few more passes get rid of all of them */
+  for (size_t pass = 0; pass < scanFraction * 10 && rule.getEntriesCount() > 0; pass++) {
+    rule.cleanup(expiredTime, &scanned);
+  }
+  BOOST_CHECK_EQUAL(rule.getEntriesCount(), 0U);
+
   rule.clear();
   BOOST_CHECK_EQUAL(rule.getEntriesCount(), 0U);
   removed = rule.cleanup(expiredTime, &scanned);
@@ -126,6 +133,65 @@ BOOST_AUTO_TEST_CASE(test_MaxQPSIPRule) {
   BOOST_CHECK_EQUAL(scanned, 0U);
 }
 
+BOOST_AUTO_TEST_CASE(test_MaxQPSIPRuleBurst) {
+  const unsigned int maxQPS = 1;
+  const unsigned int maxBurst = 5;
+  MaxQPSIPRule rule(maxQPS, maxBurst, 24, 64);
+
+  auto dq = getDQ();
+  /* a whole burst is allowed right away, then we are limited to maxQPS */
+  for (size_t idx = 0; idx < maxBurst; idx++) {
+    BOOST_CHECK_EQUAL(rule.matches(&dq), false);
+  }
+  BOOST_CHECK_EQUAL(rule.matches(&dq), true);
+
+  /* another client is not affected */
+  ComboAddress rem("192.0.3.1:42");
+  dq.remote = &rem;
+  BOOST_CHECK_EQUAL(rule.matches(&dq), false);
+  BOOST_CHECK_EQUAL(rule.getEntriesCount(), 2U);
+
+  /* a burst of 0 never lets anything through */
+  MaxQPSIPRule noBurst(maxQPS, 0);
+  BOOST_CHECK_EQUAL(noBurst.matches(&dq), true);
+}
+
+static void maxQPSIPRuleWorker(const MaxQPSIPRule& rule, size_t workerID, size_t queriesCount, size_t sourcesCount)
+{
+  auto dq = getDQ();
+  ComboAddress rem("192.0.2.1:42");
+  dq.remote = &rem;
+  for (size_t idx = 0; idx < queriesCount; idx++) {
+    rem.sin4.sin_addr.s_addr = htonl(0x0a000000 | ((workerID * queriesCount + idx) % sourcesCount));
+    rule.matches(&dq);
+  }
+}
+
+/* not run by default, use --run_test=dnsdistluarules_cc/test_MaxQPSIPRuleScaling --log_level=message */
+BOOST_AUTO_TEST_CASE(test_MaxQPSIPRuleScaling, * boost::unit_test::disabled()) {
+  const size_t queriesPerThread = 1000000;
+  const size_t sourcesCount = 10000;
+
+  for (size_t threadsCount = 1; threadsCount <= 32; threadsCount *= 2) {
+    MaxQPSIPRule rule(1000, 1000);
+    std::vector<std::thread> threads;
+    threads.reserve(threadsCount);
+
+    DTime dt;
+    dt.set();
+    for (size_t idx = 0; idx < threadsCount; idx++) {
+      threads.emplace_back(maxQPSIPRuleWorker, std::cref(rule), idx, queriesPerThread, sourcesCount);
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    auto elapsed = dt.udiff();
+
+    BOOST_CHECK_EQUAL(rule.getEntriesCount(), sourcesCount);
+    BOOST_TEST_MESSAGE(threadsCount << " thread(s): " << (threadsCount * queriesPerThread) / (elapsed / 1000000.0) << " qps");
+  }
+}
+
 BOOST_AUTO_TEST_CASE(test_poolOutstandingRule) {
   auto dq = getDQ();
 
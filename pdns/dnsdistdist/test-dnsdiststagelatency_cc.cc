@@ -0,0 +1,81 @@
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#include <boost/test/unit_test.hpp>
+
+#include "dnsdist-stage-latency.hh"
+
+BOOST_AUTO_TEST_SUITE(dnsdiststagelatency_cc)
+
+BOOST_AUTO_TEST_CASE(test_Sampling)
+{
+  dnsdist::StageLatency::setSamplingRate(0);
+  for (size_t idx = 0; idx < 100; idx++) {
+    BOOST_CHECK(!dnsdist::StageLatency::shouldSample());
+  }
+
+  dnsdist::StageLatency::setSamplingRate(10);
+  size_t sampled = 0;
+  for (size_t idx = 0; idx < 100; idx++) {
+    if (dnsdist::StageLatency::shouldSample()) {
+      sampled++;
+    }
+  }
+  BOOST_CHECK_EQUAL(sampled, 10U);
+
+  dnsdist::StageLatency::setSamplingRate(1);
+  for (size_t idx = 0; idx < 100; idx++) {
+    BOOST_CHECK(dnsdist::StageLatency::shouldSample());
+  }
+
+  dnsdist::StageLatency::setSamplingRate(0);
+}
+
+BOOST_AUTO_TEST_CASE(test_Histograms)
+{
+  using Stage = dnsdist::StageLatency::Stage;
+  dnsdist::StageLatency::clear();
+
+  dnsdist::StageLatency::record(Stage::CacheLookup, 0);
+  dnsdist::StageLatency::record(Stage::CacheLookup, 1);
+  dnsdist::StageLatency::record(Stage::CacheLookup, 2);
+  dnsdist::StageLatency::record(Stage::CacheLookup, 1000);
+  dnsdist::StageLatency::record(Stage::CacheLookup, 2000000);
+
+  const auto& histogram = dnsdist::StageLatency::getHistogram(Stage::CacheLookup);
+  BOOST_CHECK_EQUAL(histogram.d_count.load(), 5U);
+  BOOST_CHECK_EQUAL(histogram.d_sumUsec.load(), 2001003U);
+  /* <= 1 */
+  BOOST_CHECK_EQUAL(histogram.d_buckets.at(0).load(), 2U);
+  /* <= 10 */
+  BOOST_CHECK_EQUAL(histogram.d_buckets.at(1).load(), 1U);
+  /* <= 1000 */
+  BOOST_CHECK_EQUAL(histogram.d_buckets.at(5).load(), 1U);
+  /* above the last bound */
+  BOOST_CHECK_EQUAL(histogram.d_buckets.back().load(), 1U);
+
+  /* the other stages are not affected */
+  BOOST_CHECK_EQUAL(dnsdist::StageLatency::getHistogram(Stage::Rules).d_count.load(), 0U);
+
+  /* a disabled timer does not record anything */
+  {
+    dnsdist::StageLatency::Timer timer(false);
+    timer.record(Stage::Rules);
+  }
+  BOOST_CHECK_EQUAL(dnsdist::StageLatency::getHistogram(Stage::Rules).d_count.load(), 0U);
+
+  {
+    dnsdist::StageLatency::Timer timer(true);
+    timer.record(Stage::Rules);
+    timer.record(Stage::Rules);
+  }
+  BOOST_CHECK_EQUAL(dnsdist::StageLatency::getHistogram(Stage::Rules).d_count.load(), 2U);
+
+  dnsdist::StageLatency::clear();
+  BOOST_CHECK_EQUAL(histogram.d_count.load(), 0U);
+  BOOST_CHECK_EQUAL(histogram.d_sumUsec.load(), 0U);
+  BOOST_CHECK_EQUAL(histogram.d_buckets.back().load(), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -21,10 +21,14 @@
  */
 #include "dnsname.hh"
 #include <boost/format.hpp>
+#include <array>
+#include <functional>
 #include <string>
 #include <cinttypes>
+#include <unordered_map>
 
 #include "dnswriter.hh"
+#include "lock.hh"
 #include "misc.hh"
 
 #include <boost/functional/hash.hpp>
@@ -491,3 +495,103 @@ bool DNSName::has8bitBytes() const
 
   return false;
 }
+
+const DNSName InternedDNSName::s_emptyName;
+
+namespace
+{
+  struct InternedNameHash
+  {
+    size_t operator()(const DNSName& name) const
+    {
+      return name.hash(0);
+    }
+  };
+
+  /* unlike DNSName::operator==, case-sensitive, since we want to return the exact same name */
+  struct InternedNameEqual
+  {
+    bool operator()(const DNSName& lhs, const DNSName& rhs) const
+    {
+      return lhs.getStorage() == rhs.getStorage();
+    }
+  };
+
+  /* the key refers to the name owned by the shared_ptr, so we don't store it twice */
+  using InternedNamesMap = std::unordered_map<std::reference_wrapper<const DNSName>, std::weak_ptr<const DNSName>, InternedNameHash, InternedNameEqual>;
+
+  class InternedNamesTable
+  {
+  public:
+    std::shared_ptr<const DNSName> intern(const DNSName& name)
+    {
+      auto& shard = getShard(name);
+      auto map = shard.lock();
+      auto it = map->find(std::cref(name));
+      if (it != map->end()) {
+        auto existing = it->second.lock();
+        if (existing) {
+          return existing;
+        }
+        /* the last reference is being released, but the deleter has not removed the entry yet,
+           and the key refers to a name that is about to be destroyed */
+        map->erase(it);
+      }
+
+      std::shared_ptr<const DNSName> result(new DNSName(name), [this](const DNSName* ptr) {
+        release(ptr);
+      });
+      map->emplace(std::cref(*result), result);
+      return result;
+    }
+
+    size_t size()
+    {
+      size_t count = 0;
+      for (auto& shard : d_shards) {
+        count += shard.lock()->size();
+      }
+      return count;
+    }
+
+  private:
+    static const size_t s_shardsCount = 64;
+
+    LockGuarded<InternedNamesMap>& getShard(const DNSName& name)
+    {
+      return d_shards.at(name.hash(0) % d_shards.size());
+    }
+
+    void release(const DNSName* ptr)
+    {
+      {
+        auto map = getShard(*ptr).lock();
+        auto it = map->find(std::cref(*ptr));
+        /* the entry might have been replaced by a new one if the name was interned again in the meantime */
+        if (it != map->end() && &it->first.get() == ptr) {
+          map->erase(it);
+        }
+      }
+      delete ptr;
+    }
+
+    std::array<LockGuarded<InternedNamesMap>, s_shardsCount> d_shards;
+  };
+
+  InternedNamesTable& getInternedNamesTable()
+  {
+    /* never destroyed, since handles might still be released during the destruction of static objects */
+    static auto* table = new InternedNamesTable();
+    return *table;
+  }
+}
+
+InternedDNSName::InternedDNSName(const DNSName& name) :
+  d_name(getInternedNamesTable().intern(name))
+{
+}
+
+size_t InternedDNSName::getInternedCount()
+{
+  return getInternedNamesTable().size();
+}
@@ -20,7 +20,11 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 #pragma once
+#include <algorithm>
+#include <cstdint>
 #include <cstring>
+#include <limits>
+#include <memory>
 #include <string>
 #include <vector>
 #include <set>
@@ -30,12 +34,6 @@
 #include <iterator>
 #include <unordered_set>
 
-#include <boost/version.hpp>
-
-#if BOOST_VERSION >= 105300
-#include <boost/container/string.hpp>
-#endif
-
 #include "ascii.hh"
 
 uint32_t burtleCI(const unsigned char* k, uint32_t length, uint32_t init);
@@ -57,27 +55,344 @@ uint32_t burtleCI(const unsigned char* k, uint32_t length, uint32_t init);
    NOTE: For now, everything MUST be . terminated, otherwise it is an error
 */
 
-class DNSName
+/* Storage for the wire representation of a DNSName, only providing the subset of the std::string
+   interface that we actually need. A name is never longer than 255 bytes, so the size and capacity
+   fit in 16 bits, and names up to s_inlineCapacity bytes long are stored inline instead of on the heap.
+   That covers the vast majority of the names we see in practice, while a typical SSO string only
+   holds 15 to 23 bytes, so most names no longer require an allocation, nor an additional cache line
+   to be touched when they are hashed or compared.
+   When the name does not fit, the first bytes of the inline buffer hold a pointer to the heap buffer.
+*/
+class DNSNameStorage
 {
 public:
-  DNSName()  {}          //!< Constructs an *empty* DNSName, NOT the root!
-  // Work around assertion in some boost versions that do not like self-assignment of boost::container::string
-  DNSName& operator=(const DNSName& rhs)
+  using value_type = char;
+  using size_type = size_t;
+  using iterator = char*;
+  using const_iterator = const char*;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+  static const size_type npos = static_cast<size_type>(-1);
+  /* 44 bytes of inline storage plus the size and capacity make the whole object exactly 48 bytes */
+  static constexpr size_type s_inlineCapacity = 44;
+
+  DNSNameStorage()
+  {
+  }
+  DNSNameStorage(size_type count, char c)
+  {
+    append(count, c);
+  }
+  DNSNameStorage(const char* str, size_type len)
+  {
+    append(str, len);
+  }
+  DNSNameStorage(const DNSNameStorage& rhs)
+  {
+    append(rhs.data(), rhs.size());
+  }
+  DNSNameStorage(DNSNameStorage&& rhs) noexcept
+  {
+    moveFrom(rhs);
+  }
+  ~DNSNameStorage()
+  {
+    release();
+  }
+  DNSNameStorage& operator=(const DNSNameStorage& rhs)
   {
     if (this != &rhs) {
-      d_storage = rhs.d_storage;
+      d_size = 0;
+      append(rhs.data(), rhs.size());
     }
     return *this;
   }
-  DNSName& operator=(DNSName&& rhs)
+  DNSNameStorage& operator=(DNSNameStorage&& rhs) noexcept
   {
     if (this != &rhs) {
-      d_storage = std::move(rhs.d_storage);
+      release();
+      moveFrom(rhs);
+    }
+    return *this;
+  }
+
+  size_type size() const
+  {
+    return d_size;
+  }
+  size_type length() const
+  {
+    return d_size;
+  }
+  size_type capacity() const
+  {
+    return d_capacity;
+  }
+  bool empty() const
+  {
+    return d_size == 0;
+  }
+  /* the content is NOT null-terminated, but a DNS name in wire format contains null bytes anyway */
+  const char* c_str() const
+  {
+    return data();
+  }
+  const char* data() const
+  {
+    return isInline() ? d_buffer : getHeapBuffer();
+  }
+  char* data()
+  {
+    return isInline() ? d_buffer : getHeapBuffer();
+  }
+
+  iterator begin()
+  {
+    return data();
+  }
+  iterator end()
+  {
+    return data() + d_size;
+  }
+  const_iterator begin() const
+  {
+    return data();
+  }
+  const_iterator end() const
+  {
+    return data() + d_size;
+  }
+  const_iterator cbegin() const
+  {
+    return begin();
+  }
+  const_iterator cend() const
+  {
+    return end();
+  }
+  reverse_iterator rbegin()
+  {
+    return reverse_iterator(end());
+  }
+  reverse_iterator rend()
+  {
+    return reverse_iterator(begin());
+  }
+  const_reverse_iterator rbegin() const
+  {
+    return const_reverse_iterator(end());
+  }
+  const_reverse_iterator rend() const
+  {
+    return const_reverse_iterator(begin());
+  }
+
+  char& operator[](size_type pos)
+  {
+    return data()[pos];
+  }
+  const char& operator[](size_type pos) const
+  {
+    return data()[pos];
+  }
+  const char& at(size_type pos) const
+  {
+    if (pos >= d_size) {
+      throw std::out_of_range("Out-of-range access to a DNS name at position " + std::to_string(pos) + " of " + std::to_string(d_size));
+    }
+    return data()[pos];
+  }
+
+  void clear()
+  {
+    d_size = 0;
+  }
+  /* this is only a hint, and is silently capped to the maximum size we can hold */
+  void reserve(size_type wanted)
+  {
+    wanted = std::min(wanted, static_cast<size_type>(std::numeric_limits<uint16_t>::max()));
+    if (wanted > d_capacity) {
+      grow(wanted);
+    }
+  }
+
+  DNSNameStorage& append(size_type count, char c)
+  {
+    ensureCapacity(d_size + count);
+    memset(data() + d_size, c, count);
+    d_size += count;
+    return *this;
+  }
+  DNSNameStorage& append(const char* str, size_type len)
+  {
+    if (d_size + len > d_capacity && std::greater_equal<const char*>()(str, data()) && std::less<const char*>()(str, data() + d_size)) {
+      /* appending a part of ourselves, and growing would free the source */
+      DNSNameStorage copy(str, len);
+      return append(copy.data(), copy.size());
+    }
+    ensureCapacity(d_size + len);
+    memcpy(data() + d_size, str, len);
+    d_size += len;
+    return *this;
+  }
+  DNSNameStorage& append(const DNSNameStorage& str)
+  {
+    return append(str.data(), str.size());
+  }
+  template <typename InputIterator>
+  DNSNameStorage& append(InputIterator first, InputIterator last)
+  {
+    ensureCapacity(d_size + std::distance(first, last));
+    for (; first != last; ++first) {
+      data()[d_size++] = *first;
+    }
+    return *this;
+  }
+  DNSNameStorage& operator+=(const DNSNameStorage& rhs)
+  {
+    return append(rhs);
+  }
+  void push_back(char c)
+  {
+    append(1, c);
+  }
+  DNSNameStorage& assign(size_type count, char c)
+  {
+    d_size = 0;
+    return append(count, c);
+  }
+
+  DNSNameStorage& erase(size_type pos = 0, size_type len = npos)
+  {
+    if (pos > d_size) {
+      throw std::out_of_range("Out-of-range erase in a DNS name at position " + std::to_string(pos) + " of " + std::to_string(d_size));
     }
+    len = std::min(len, d_size - pos);
+    memmove(data() + pos, data() + pos + len, d_size - pos - len);
+    d_size -= len;
     return *this;
   }
+  /* replace the len bytes starting at pos by the content of str */
+  DNSNameStorage& replace(size_type pos, size_type len, const DNSNameStorage& str)
+  {
+    if (pos > d_size) {
+      throw std::out_of_range("Out-of-range replace in a DNS name at position " + std::to_string(pos) + " of " + std::to_string(d_size));
+    }
+    len = std::min(len, d_size - pos);
+    if (this == &str) {
+      DNSNameStorage copy(str);
+      return replace(pos, len, copy);
+    }
+    const size_type newSize = d_size - len + str.size();
+    ensureCapacity(newSize);
+    char* buffer = data();
+    memmove(buffer + pos + str.size(), buffer + pos + len, d_size - pos - len);
+    memcpy(buffer + pos, str.data(), str.size());
+    d_size = newSize;
+    return *this;
+  }
+  /* compare the len bytes starting at pos with the content of str */
+  int compare(size_type pos, size_type len, const DNSNameStorage& str) const
+  {
+    if (pos > d_size) {
+      throw std::out_of_range("Out-of-range compare in a DNS name at position " + std::to_string(pos) + " of " + std::to_string(d_size));
+    }
+    len = std::min(len, d_size - pos);
+    int res = memcmp(data() + pos, str.data(), std::min(len, str.size()));
+    if (res != 0) {
+      return res;
+    }
+    return len < str.size() ? -1 : (len > str.size() ? 1 : 0);
+  }
+  int compare(const DNSNameStorage& str) const
+  {
+    return compare(0, d_size, str);
+  }
+
+  bool operator==(const DNSNameStorage& rhs) const
+  {
+    return d_size == rhs.d_size && memcmp(data(), rhs.data(), d_size) == 0;
+  }
+  bool operator!=(const DNSNameStorage& rhs) const
+  {
+    return !(*this == rhs);
+  }
+
+private:
+  bool isInline() const
+  {
+    return d_capacity <= s_inlineCapacity;
+  }
+  char* getHeapBuffer() const
+  {
+    char* buffer;
+    memcpy(&buffer, d_buffer, sizeof(buffer));
+    return buffer;
+  }
+  void ensureCapacity(size_type wanted)
+  {
+    if (wanted > d_capacity) {
+      if (wanted > std::numeric_limits<uint16_t>::max()) {
+        throw std::range_error("name too long");
+      }
+      grow(wanted);
+    }
+  }
+  void grow(size_type wanted)
+  {
+    /* no need to be too clever here, a valid name is at most 255 bytes */
+    size_type newCapacity = std::min(std::max(wanted, static_cast<size_type>(d_capacity) * 2), static_cast<size_type>(std::numeric_limits<uint16_t>::max()));
+    char* buffer = new char[newCapacity];
+    memcpy(buffer, data(), d_size);
+    release();
+    memcpy(d_buffer, &buffer, sizeof(buffer));
+    d_capacity = static_cast<uint16_t>(newCapacity);
+  }
+  void release()
+  {
+    if (!isInline()) {
+      delete[] getHeapBuffer();
+      d_capacity = s_inlineCapacity;
+    }
+  }
+  /* we need to have been released before that */
+  void moveFrom(DNSNameStorage& rhs)
+  {
+    if (rhs.isInline()) {
+      memcpy(d_buffer, rhs.d_buffer, rhs.d_size);
+    }
+    else {
+      memcpy(d_buffer, rhs.d_buffer, sizeof(char*));
+      d_capacity = rhs.d_capacity;
+      rhs.d_capacity = s_inlineCapacity;
+    }
+    d_size = rhs.d_size;
+    rhs.d_size = 0;
+  }
+
+  static_assert(s_inlineCapacity >= sizeof(char*), "The inline buffer of DNSNameStorage should be able to hold a pointer");
+  char d_buffer[s_inlineCapacity];
+  uint16_t d_size{0};
+  uint16_t d_capacity{s_inlineCapacity};
+};
+
+inline DNSNameStorage operator+(const DNSNameStorage& lhs, const DNSNameStorage& rhs)
+{
+  DNSNameStorage ret;
+  ret.reserve(lhs.size() + rhs.size());
+  ret.append(lhs);
+  ret.append(rhs);
+  return ret;
+}
+
+class DNSName
+{
+public:
+  DNSName()  {}          //!< Constructs an *empty* DNSName, NOT the root!
+  DNSName& operator=(const DNSName& rhs) = default;
+  DNSName& operator=(DNSName&& rhs) noexcept = default;
   DNSName(const DNSName& a) = default;
-  DNSName(DNSName&& a) = default;
+  DNSName(DNSName&& a) noexcept = default;
   explicit DNSName(const char* p): DNSName(p, std::strlen(p)) {} //!< Constructs from a human formatted, escaped presentation
   explicit DNSName(const char* p, size_t len);      //!< Constructs from a human formatted, escaped presentation
   explicit DNSName(const std::string& str) : DNSName(str.c_str(), str.length()) {}; //!< Constructs from a human formatted, escaped presentation
@@ -156,11 +471,7 @@ public:
   inline bool canonCompare(const DNSName& rhs) const;
   bool slowCanonCompare(const DNSName& rhs) const;  
 
-#if BOOST_VERSION >= 105300
-  typedef boost::container::string string_t;
-#else
-  typedef std::string string_t;
-#endif
+  typedef DNSNameStorage string_t;
   const string_t& getStorage() const {
     return d_storage;
   }
@@ -530,3 +841,66 @@ struct DNSNameSet: public std::unordered_set<DNSName> {
         return oss.str();
     }
 };
+
+/* A reference-counted handle to a DNSName that is shared between all handles created from the same
+   name (byte for byte, so case is preserved). Meant for long-lived keys, like the ones in our caches,
+   where the same names are otherwise stored over and over: a handle is only the size of a shared_ptr.
+   Creating a handle requires a lookup into a global, sharded and locked, table, so it should not be
+   done for short-lived names, but copying a handle is cheap and the name is removed from the table
+   when the last handle to it is destroyed. */
+class InternedDNSName
+{
+public:
+  InternedDNSName()
+  {
+  }
+  explicit InternedDNSName(const DNSName& name);
+
+  const DNSName& get() const
+  {
+    return d_name ? *d_name : s_emptyName;
+  }
+  const DNSName& operator*() const
+  {
+    return get();
+  }
+  const DNSName* operator->() const
+  {
+    return &get();
+  }
+  bool empty() const
+  {
+    return get().empty();
+  }
+  bool operator==(const InternedDNSName& rhs) const
+  {
+    /* same handle means same name, but different handles might still be equal in a case-insensitive way */
+    return d_name == rhs.d_name || get() == rhs.get();
+  }
+  bool operator!=(const InternedDNSName& rhs) const
+  {
+    return !(*this == rhs);
+  }
+  bool operator<(const InternedDNSName& rhs) const
+  {
+    return get() < rhs.get();
+  }
+  size_t hash(size_t init = 0) const
+  {
+    return get().hash(init);
+  }
+
+  /* number of distinct names currently interned */
+  static size_t getInternedCount();
+
+private:
+  static const DNSName s_emptyName;
+  std::shared_ptr<const DNSName> d_name{nullptr};
+};
+
+namespace std {
+  template <>
+  struct hash<InternedDNSName> {
+    size_t operator () (const InternedDNSName& name) const { return name.hash(0); }
+  };
+}
@@ -21,6 +21,7 @@
  */
 #include "dnsparser.hh"
 #include "dnswriter.hh"
+#include "ednsoptions.hh"
 #include <boost/algorithm/string.hpp>
 #include <boost/format.hpp>
 
@@ -965,6 +966,108 @@ uint32_t getDNSPacketMinTTL(const char* packet, size_t length, bool* seenAuthSOA
   return result;
 }
 
+bool getDNSPacketSummary(const char* packet, size_t length, DNSPacketSummary& summary)
+{
+  summary = DNSPacketSummary();
+  if (length < sizeof(dnsheader)) {
+    return false;
+  }
+
+  const dnsheader* dh = reinterpret_cast<const dnsheader*>(packet);
+  summary.rcode = dh->rcode;
+
+  try
+  {
+    DNSPacketMangler dpm(const_cast<char*>(packet), length);
+
+    const uint16_t qdcount = ntohs(dh->qdcount);
+    for (size_t n = 0; n < qdcount; ++n) {
+      dpm.skipDomainName();
+      /* type and class */
+      dpm.skipBytes(4);
+    }
+
+    const size_t ancount = ntohs(dh->ancount);
+    const size_t nscount = ntohs(dh->nscount);
+    const size_t numrecords = ancount + nscount + ntohs(dh->arcount);
+    bool seenOPT = false;
+    for (size_t n = 0; n < numrecords; ++n) {
+      const uint32_t start = dpm.getOffset();
+      dpm.skipDomainName();
+      const uint16_t dnstype = dpm.get16BitInt();
+      const uint16_t dnsclass = dpm.get16BitInt();
+
+      if (dnstype == QType::OPT) {
+        /* extended rcode, version and Z */
+        dpm.skipBytes(4);
+        const uint16_t rdLength = dpm.get16BitInt();
+        const uint32_t rdStart = dpm.getOffset();
+        dpm.skipBytes(rdLength);
+
+        if (!summary.hasOPT && n >= (ancount + nscount)) {
+          summary.hasOPT = true;
+          summary.optStart = start;
+          summary.optLen = dpm.getOffset() - start;
+          summary.lastIsOPT = n == (numrecords - 1);
+
+          /* the EDNS Client Subnet SCOPE PREFIX-LENGTH byte is in position 3 (family: 2, source prefix-length: 1) */
+          const auto* options = reinterpret_cast<const uint8_t*>(packet + rdStart);
+          size_t pos = 0;
+          while ((pos + 4) <= rdLength) {
+            const uint16_t optionCode = (options[pos] << 8) + options[pos + 1];
+            const uint16_t optionLen = (options[pos + 2] << 8) + options[pos + 3];
+            pos += 4;
+            if ((pos + optionLen) > rdLength) {
+              break;
+            }
+            if (optionCode == EDNSOptionCode::ECS) {
+              if (optionLen >= 4) {
+                summary.hasECSScope = true;
+                summary.ecsScope = options[pos + 3];
+              }
+              break;
+            }
+            pos += optionLen;
+          }
+        }
+        seenOPT = true;
+      }
+      else {
+        if (!seenOPT) {
+          /* report it if we see a SOA record in the AUTHORITY section */
+          if (dnstype == QType::SOA && dnsclass == QClass::IN && n >= ancount && n < (ancount + nscount)) {
+            summary.seenAuthSOA = true;
+          }
+          const uint32_t ttl = dpm.get32BitInt();
+          if (summary.minTTL > ttl) {
+            summary.minTTL = ttl;
+          }
+        }
+        else {
+          dpm.skipBytes(4);
+        }
+        dpm.skipRData();
+      }
+
+      if (n < ancount) {
+        ++summary.answers;
+      }
+      else if (n < (ancount + nscount)) {
+        ++summary.authorities;
+      }
+      else {
+        ++summary.additionals;
+      }
+    }
+    summary.complete = true;
+  }
+  catch(...)
+  {
+  }
+
+  return summary.complete;
+}
+
 uint32_t getDNSPacketLength(const char* packet, size_t length)
 {
   uint32_t result = length;
@@ -438,6 +438,26 @@ void clearDNSPacketRecordTypes(vector<uint8_t>& packet, const std::set<QType>& q
 void clearDNSPacketRecordTypes(PacketBuffer& packet, const std::set<QType>& qtypes);
 void clearDNSPacketRecordTypes(char* packet, size_t& length, const std::set<QType>& qtypes);
 uint32_t getDNSPacketMinTTL(const char* packet, size_t length, bool* seenAuthSOA=nullptr);
+
+/* what the response path needs to know about a packet, collected in a single walk by getDNSPacketSummary() */
+struct DNSPacketSummary
+{
+  uint32_t minTTL{std::numeric_limits<uint32_t>::max()}; // lowest TTL of the records placed before the first OPT one, same as getDNSPacketMinTTL()
+  uint16_t optStart{0}; // position of the first OPT RR in the additional section, if hasOPT is set
+  uint16_t optLen{0}; // size of that OPT RR, including its owner name
+  uint16_t answers{0}; // number of records actually present in each section
+  uint16_t authorities{0};
+  uint16_t additionals{0};
+  uint8_t rcode{0};
+  uint8_t ecsScope{0}; // the SCOPE PREFIX-LENGTH of the EDNS Client Subnet option, if hasECSScope is set
+  bool seenAuthSOA{false}; // whether a SOA record was present in the authority section, before the first OPT one
+  bool hasOPT{false};
+  bool lastIsOPT{false}; // whether the OPT RR is the last record of the packet
+  bool hasECSScope{false};
+  bool complete{false}; // whether the whole packet could be parsed, otherwise the fields only cover what was parsed until the error
+};
+
+bool getDNSPacketSummary(const char* packet, size_t length, DNSPacketSummary& summary);
 uint32_t getDNSPacketLength(const char* packet, size_t length);
 uint16_t getRecordsOfTypeCount(const char* packet, size_t length, uint8_t section, uint16_t type);
 bool getEDNSUDPPayloadSizeAndZ(const char* packet, size_t length, uint16_t* payloadSize, uint16_t* z);
@@ -21,6 +21,8 @@
  */
 
 #include "dnsdist-cache.hh"
+#include "dnsdist-ecs.hh"
+#include "dnsparser.hh"
 
 extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
 
@@ -40,6 +42,33 @@ extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
   // Do not skip cookies
   pcHashCookies.setSkippedOptions({});
 
+  try {
+    /* the single-pass scanner used on the response path has to agree with the dedicated helpers it replaces */
+    DNSPacketSummary summary;
+    getDNSPacketSummary(reinterpret_cast<const char*>(data), size, summary);
+    bool seenAuthSOA = false;
+    const uint32_t minTTL = getDNSPacketMinTTL(reinterpret_cast<const char*>(data), size, &seenAuthSOA);
+    if (summary.minTTL != minTTL || summary.seenAuthSOA != seenAuthSOA) {
+      abort();
+    }
+
+    if (size >= sizeof(dnsheader)) {
+      const PacketBuffer packet(data, data + size);
+      uint16_t optStart = 0;
+      size_t optLen = 0;
+      bool last = false;
+      if (locateEDNSOptRR(packet, &optStart, &optLen, &last) == 0) {
+        if (!summary.hasOPT || summary.optStart != optStart || summary.optLen != optLen || summary.lastIsOPT != last) {
+          abort();
+        }
+      }
+    }
+  }
+  catch(const std::exception& e) {
+  }
+  catch(const PDNSException& e) {
+  }
+
   try {
     uint16_t qtype;
     uint16_t qclass;
@@ -33,7 +33,16 @@ extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
   bool tcp = false;  
 
   try {
-    parseProxyHeader(std::string(reinterpret_cast<const char*>(data), size), proxy, source, destination, tcp, values);
+    const std::string header(reinterpret_cast<const char*>(data), size);
+    parseProxyHeader(header, proxy, source, destination, tcp, values);
+
+    size_t valuesOffset = 0;
+    ssize_t used = parseProxyHeader(header, proxy, source, destination, tcp, valuesOffset);
+    if (used > 0) {
+      visitProxyProtocolValues(header.data() + valuesOffset, used - valuesOffset, [](const ProxyProtocolValueView&) {
+        return true;
+      });
+    }
   }
   catch(const std::exception& e) {
   }
@@ -21,6 +21,7 @@
 #include <openssl/rand.h>
 #include <openssl/ssl.h>
 #include <fcntl.h>
+#include <sys/file.h>
 
 #ifdef HAVE_LIBSODIUM
 #include <sodium.h>
@@ -593,24 +594,104 @@ size_t OpenSSLTLSTicketKeysRing::getKeysCount()
 
 void OpenSSLTLSTicketKeysRing::loadTicketsKeys(const std::string& keyFile)
 {
-  bool keyLoaded = false;
+  std::vector<std::shared_ptr<OpenSSLTLSTicketKey>> newKeys;
   std::ifstream file(keyFile);
   try {
     do {
-      auto newKey = std::make_shared<OpenSSLTLSTicketKey>(file);
-      addKey(newKey);
-      keyLoaded = true;
+      newKeys.push_back(std::make_shared<OpenSSLTLSTicketKey>(file));
     }
     while (!file.fail());
   }
   catch (const std::exception& e) {
     /* if we haven't been able to load at least one key, fail */
-    if (!keyLoaded) {
+    if (newKeys.empty()) {
       throw;
     }
   }
 
   file.close();
+
+  /* replace all the keys at once, so that the file might be reloaded at runtime
+     without any connection seeing a partially loaded set of keys, and so that
+     keys removed from the file are no longer accepted */
+  auto keys = d_ticketKeys.write_lock();
+  keys->clear();
+  for (auto& newKey : newKeys) {
+    keys->push_front(std::move(newKey));
+  }
+}
+
+void OpenSSLTLSTicketKeysRing::rotateTicketsKeyFile(const std::string& keyFile, size_t maxKeys)
+{
+  static const size_t keySize = TLS_TICKETS_KEY_NAME_SIZE + TLS_TICKETS_CIPHER_KEY_SIZE + TLS_TICKETS_MAC_KEY_SIZE;
+  if (maxKeys == 0) {
+    throw std::runtime_error("The maximum number of keys to keep in a tickets key file should be greater than 0");
+  }
+
+  const std::string lockFile = keyFile + ".lock";
+  FDWrapper lockFD(open(lockFile.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0600));
+  if (lockFD.getHandle() == -1) {
+    throw std::runtime_error("Unable to open the lock file '" + lockFile + "': " + stringerror());
+  }
+  if (flock(lockFD.getHandle(), LOCK_EX) != 0) {
+    throw std::runtime_error("Unable to lock '" + lockFile + "': " + stringerror());
+  }
+
+  std::string content;
+  {
+    std::ifstream existing(keyFile, std::ios::binary);
+    if (existing) {
+      content.assign(std::istreambuf_iterator<char>(existing), std::istreambuf_iterator<char>());
+    }
+  }
+
+  if (content.size() % keySize != 0) {
+    OPENSSL_cleanse(content.data(), content.size());
+    throw std::runtime_error("The existing tickets key file '" + keyFile + "' has an invalid size (" + std::to_string(content.size()) + "), refusing to rotate it");
+  }
+
+  /* the last key in the file is the active one, so we drop the oldest ones from the beginning */
+  size_t existingKeys = content.size() / keySize;
+  if (existingKeys >= maxKeys) {
+    size_t toRemove = (existingKeys - maxKeys + 1) * keySize;
+    OPENSSL_cleanse(content.data(), toRemove);
+    content.erase(0, toRemove);
+  }
+
+  size_t pos = content.size();
+  content.resize(pos + keySize);
+  if (RAND_bytes(reinterpret_cast<unsigned char*>(&content.at(pos)), keySize) != 1) {
+    OPENSSL_cleanse(content.data(), content.size());
+    throw std::runtime_error("Error while generating a new OpenSSL TLS ticket key");
+  }
+
+  std::string tmpFile = keyFile + ".XXXXXX";
+  FDWrapper tmpFD(mkstemp(&tmpFile.at(0)));
+  if (tmpFD.getHandle() == -1) {
+    OPENSSL_cleanse(content.data(), content.size());
+    throw std::runtime_error("Unable to create a temporary file to rotate the tickets key file '" + keyFile + "': " + stringerror());
+  }
+
+  std::string error;
+  try {
+    writen2(tmpFD.getHandle(), content.data(), content.size());
+    if (fsync(tmpFD.getHandle()) != 0) {
+      error = stringerror();
+    }
+  }
+  catch (const std::exception& e) {
+    error = e.what();
+  }
+  OPENSSL_cleanse(content.data(), content.size());
+
+  if (error.empty() && rename(tmpFile.c_str(), keyFile.c_str()) != 0) {
+    error = stringerror();
+  }
+
+  if (!error.empty()) {
+    unlink(tmpFile.c_str());
+    throw std::runtime_error("Unable to replace the tickets key file '" + keyFile + "': " + error);
+  }
 }
 
 void OpenSSLTLSTicketKeysRing::rotateTicketsKey(time_t now)
@@ -747,6 +828,14 @@ std::unique_ptr<SSL_CTX, void(*)(SSL_CTX*)> libssl_init_server_context(const TLS
 #endif
   }
 
+  if (config.d_ktls) {
+#ifdef SSL_OP_ENABLE_KTLS
+    sslOptions |= SSL_OP_ENABLE_KTLS;
+#else
+    cerr<<"Warning: kernel TLS offload requested but not supported by this version of OpenSSL"<<endl;
+#endif
+  }
+
   SSL_CTX_set_options(ctx.get(), sslOptions);
   if (!libssl_set_min_tls_version(ctx, config.d_minTLSVersion)) {
     throw std::runtime_error("Failed to set the minimum version to '" + libssl_tls_version_to_string(config.d_minTLSVersion));
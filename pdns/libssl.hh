@@ -1,13 +1,16 @@
 #pragma once
 
 #include <atomic>
+#include <ctime>
 #include <fstream>
+#include <functional>
 #include <map>
 #include <memory>
 #include <optional>
 #include <string>
 #include <vector>
 #include <optional>
+#include <sys/stat.h>
 
 #include "config.h"
 #include "circular_buffer.hh"
@@ -39,6 +42,9 @@ public:
   size_t d_maxStoredSessions{20480};
   time_t d_sessionTimeout{0};
   time_t d_ticketsKeyRotationDelay{43200};
+  /* if set, and d_ticketKeyFile is set as well, check that file for changes every
+     d_ticketsKeyFileCheckInterval seconds and reload it, instead of rotating random keys */
+  time_t d_ticketsKeyFileCheckInterval{0};
   uint8_t d_numberOfTicketsKeys{5};
   LibsslTLSVersion d_minTLSVersion{LibsslTLSVersion::TLS10};
 
@@ -51,6 +57,9 @@ public:
   bool d_enableRenegotiation{false};
   /* enable TLS async mode, if supported by any engine */
   bool d_asyncMode{false};
+  /* offload the encryption and decryption of TLS records to the kernel once the handshake
+     has been completed (kTLS), if supported by the TLS library, the kernel and the negotiated cipher */
+  bool d_ktls{false};
 };
 
 struct TLSErrorCounters
@@ -66,6 +75,98 @@ struct TLSErrorCounters
   std::atomic<uint64_t> d_unsupportedProtocol{0}; /* we don't accept this TLS version, sorry */
 };
 
+/* Keeps track of the identity of a tickets key file (device, inode, size and modification time),
+   so that a new version written by another process and atomically renamed over the previous one
+   can be detected with a single stat() call, then reloaded.
+   Shared by the DoT and DoH frontends, which call reloadIfChanged() from every worker thread. */
+class TLSTicketsKeyFileWatcher
+{
+public:
+  TLSTicketsKeyFileWatcher(const std::string& file, time_t checkInterval): d_file(file), d_checkInterval(checkInterval)
+  {
+    d_checking.clear();
+    struct stat st;
+    if (stat(d_file.c_str(), &st) == 0) {
+      update(st);
+    }
+    d_nextCheck = time(nullptr) + d_checkInterval;
+  }
+
+  const std::string& getFile() const
+  {
+    return d_file;
+  }
+
+  /* if the check interval has elapsed and the file has been modified or replaced since the last check,
+     call reload() with its path. Only one thread checks at a time, the other ones return right away */
+  void reloadIfChanged(time_t now, const std::function<void(const std::string&)>& reload)
+  {
+    if (!shouldCheck(now)) {
+      return;
+    }
+    if (d_checking.test_and_set()) {
+      /* someone is already checking */
+      return;
+    }
+    try {
+      if (hasChanged(now)) {
+        reload(d_file);
+      }
+      d_checking.clear();
+    }
+    catch (const std::runtime_error& e) {
+      d_checking.clear();
+      throw std::runtime_error(std::string("Error reloading the tickets keys for TLS context:") + e.what());
+    }
+    catch (...) {
+      d_checking.clear();
+      throw;
+    }
+  }
+
+private:
+  bool shouldCheck(time_t now) const
+  {
+    return now >= d_nextCheck.load();
+  }
+
+  /* returns true if the file has been modified or replaced since the last call */
+  bool hasChanged(time_t now)
+  {
+    d_nextCheck = now + d_checkInterval;
+
+    struct stat st;
+    if (stat(d_file.c_str(), &st) != 0) {
+      /* the file might be in the process of being replaced, keep the existing keys for now */
+      return false;
+    }
+
+    if (st.st_dev == d_dev && st.st_ino == d_ino && st.st_size == d_size && st.st_mtime == d_mtime) {
+      return false;
+    }
+
+    update(st);
+    return true;
+  }
+
+  void update(const struct stat& st)
+  {
+    d_dev = st.st_dev;
+    d_ino = st.st_ino;
+    d_size = st.st_size;
+    d_mtime = st.st_mtime;
+  }
+
+  const std::string d_file;
+  std::atomic<time_t> d_nextCheck{0};
+  std::atomic_flag d_checking;
+  const time_t d_checkInterval;
+  dev_t d_dev{0};
+  ino_t d_ino{0};
+  off_t d_size{0};
+  time_t d_mtime{0};
+};
+
 #ifdef HAVE_LIBSSL
 #include <openssl/ssl.h>
 
@@ -112,6 +213,12 @@ public:
   void loadTicketsKeys(const std::string& keyFile);
   void rotateTicketsKey(time_t now);
 
+  /* Generate a new key and append it to keyFile, keeping at most maxKeys keys in the file.
+     The new content is written to a temporary file then renamed over the existing one,
+     while holding an exclusive lock on keyFile + ".lock", so that several processes can
+     safely rotate the same file while others are loading it. */
+  static void rotateTicketsKeyFile(const std::string& keyFile, size_t maxKeys);
+
 private:
   SharedLockGuarded<boost::circular_buffer<std::shared_ptr<OpenSSLTLSTicketKey> > > d_ticketKeys;
 };
@@ -51,7 +51,8 @@ thread_local std::unique_ptr<MT_t> MT; // the big MTasker
 std::unique_ptr<MemRecursorCache> g_recCache;
 std::unique_ptr<NegCache> g_negCache;
 
-thread_local std::unique_ptr<RecursorPacketCache> t_packetCache;
+std::shared_ptr<RecursorPacketCache> g_packetCache;
+thread_local std::shared_ptr<RecursorPacketCache> t_packetCache;
 thread_local std::unique_ptr<FDMultiplexer> t_fdm;
 thread_local std::unique_ptr<addrringbuf_t> t_remotes, t_servfailremotes, t_largeanswerremotes, t_bogusremotes;
 thread_local std::unique_ptr<boost::circular_buffer<pair<DNSName, uint16_t>>> t_queryring, t_servfailqueryring, t_bogusqueryring;
@@ -68,6 +69,7 @@ NetmaskGroup g_XPFAcl;
 NetmaskGroup g_paddingFrom;
 size_t g_proxyProtocolMaximumSize;
 size_t g_maxUDPQueriesPerRound;
+size_t g_udpReceiveBatchSize{1};
 unsigned int g_maxMThreads;
 unsigned int g_paddingTag;
 PaddingMode g_paddingMode;
@@ -100,8 +102,23 @@ GlobalStateHolder<NetmaskGroup> g_dontThrottleNetmasks;
 GlobalStateHolder<SuffixMatchNode> g_DoTToAuthNames;
 uint64_t g_latencyStatSize;
 
+static void handleUDPServerResponse(int fd, FDMultiplexer::funcparam_t&);
+
+size_t UDPClientSocks::s_maxQueries{1};
+time_t UDPClientSocks::s_maxLifetime{1};
+
 LWResult::Result UDPClientSocks::getSocket(const ComboAddress& toaddr, int* fd)
 {
+  std::vector<int> closable;
+  *fd = d_pool.reuse(toaddr, g_now.tv_sec, closable);
+  for (const auto closableFD : closable) {
+    closeSocket(closableFD);
+  }
+  if (*fd >= 0) {
+    g_stats.udpOutSocketReuses++;
+    return LWResult::Result::Success;
+  }
+
   *fd = makeClientSocket(toaddr.sin4.sin_family);
   if (*fd < 0) { // temporary error - receive exception otherwise
     return LWResult::Result::OSLimitError;
@@ -123,18 +140,44 @@ LWResult::Result UDPClientSocks::getSocket(const ComboAddress& toaddr, int* fd)
     return LWResult::Result::PermanentError;
   }
 
+  /* since the socket is connected, only the remote can send us responses over it, and the response handler
+     matches them against all the queries in flight over that socket */
+  t_fdm->addReadFD(*fd, handleUDPServerResponse);
+  d_pool.add(*fd, toaddr, g_now.tv_sec);
+
   d_numsocks++;
   return LWResult::Result::Success;
 }
 
 // return a socket to the pool, or simply erase it
 void UDPClientSocks::returnSocket(int fd)
+{
+  if (d_pool.release(fd)) {
+    closeSocket(fd);
+  }
+}
+
+void UDPClientSocks::retireSocket(int fd)
+{
+  if (d_pool.retire(fd)) {
+    closeSocket(fd);
+  }
+}
+
+void UDPClientSocks::cleanup(time_t now)
+{
+  for (const auto fd : d_pool.cleanup(now)) {
+    closeSocket(fd);
+  }
+}
+
+void UDPClientSocks::closeSocket(int fd)
 {
   try {
     t_fdm->removeReadFD(fd);
   }
   catch (const FDMultiplexerException& e) {
-    // we sometimes return a socket that has not yet been assigned to t_fdm
+    // should not happen since the socket is registered when it is created, but closing it is what matters
   }
 
   try {
@@ -253,8 +296,6 @@ PacketBuffer GenUDPQueryResponse(const ComboAddress& dest, const string& query)
   return data;
 }
 
-static void handleUDPServerResponse(int fd, FDMultiplexer::funcparam_t&);
-
 thread_local std::unique_ptr<UDPClientSocks> t_udpclientsocks;
 
 /* these two functions are used by LWRes */
@@ -290,12 +331,12 @@ LWResult::Result asendto(const char* data, size_t len, int flags,
   pident->fd = *fd;
   pident->id = id;
 
-  t_fdm->addReadFD(*fd, handleUDPServerResponse, pident);
   ssize_t sent = send(*fd, data, len, 0);
 
   int tmp = errno;
 
   if (sent < 0) {
+    t_udpclientsocks->retireSocket(*fd);
     t_udpclientsocks->returnSocket(*fd);
     errno = tmp; // this is for logging purposes only
     return LWResult::Result::PermanentError;
@@ -320,7 +361,7 @@ LWResult::Result arecvfrom(PacketBuffer& packet, int flags, const ComboAddress&
 
   /* -1 means error, 0 means timeout, 1 means a result from handleUDPServerResponse() which might still be an error */
   if (ret > 0) {
-    /* handleUDPServerResponse() will close the socket for us no matter what */
+    /* handleUDPServerResponse() will return the socket for us no matter what */
     if (packet.empty()) { // means "error"
       return LWResult::Result::PermanentError;
     }
@@ -329,7 +370,9 @@ LWResult::Result arecvfrom(PacketBuffer& packet, int flags, const ComboAddress&
 
     if (nearMissLimit > 0 && pident->nearMisses > nearMissLimit) {
       /* we have received more than nearMissLimit answers on the right IP and port, from the right source (we are using connected sockets),
-         for the correct qname and qtype, but with an unexpected message ID. That looks like a spoofing attempt. */
+         for the correct qname and qtype, but with an unexpected message ID. That looks like a spoofing attempt.
+         Stop using that socket for new queries, since the attacker knows its source port. */
+      t_udpclientsocks->retireSocket(fd);
       g_log << Logger::Error << "Too many (" << pident->nearMisses << " > " << nearMissLimit << ") answers with a wrong message ID for '" << domain << "' from " << fromaddr.toString() << ", assuming spoof attempt." << endl;
       g_stats.spoofCount++;
       return LWResult::Result::Spoofed;
@@ -1777,6 +1820,120 @@ bool expectProxyProtocol(const ComboAddress& from)
   return g_proxyProtocolACL.match(from);
 }
 
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE)
+/* Responses to queries answered from the packet cache while a batch of queries received
+   via recvmmsg() is being processed, sent with a single sendmmsg() call afterwards.
+   What has to happen once a response has been sent (event trace, protobuf export, metrics)
+   is deferred until then as well, and gets the result of sending that response. */
+class UDPResponseBatch
+{
+public:
+  void add(std::string&& response, const ComboAddress& remote, const ComboAddress* local, std::function<void(int)>&& sent)
+  {
+    d_entries.emplace_back();
+    auto& entry = d_entries.back();
+    entry.response = std::move(response);
+    entry.remote = remote;
+    entry.sent = std::move(sent);
+    entry.hasLocal = local != nullptr;
+    if (local) {
+      entry.local = *local;
+    }
+  }
+
+  void send(int fd)
+  {
+    if (d_entries.empty()) {
+      return;
+    }
+
+    /* the message headers point into the entries, so they are only built once all the entries have been added */
+    d_msgs.resize(d_entries.size());
+    for (size_t idx = 0; idx < d_entries.size(); idx++) {
+      auto& entry = d_entries[idx];
+      auto& msgh = d_msgs[idx].msg_hdr;
+      fillMSGHdr(&msgh, &entry.iov, &entry.cbuf, 0, &entry.response[0], entry.response.size(), &entry.remote);
+      msgh.msg_control = nullptr;
+      if (entry.hasLocal) {
+        addCMsgSrcAddr(&msgh, &entry.cbuf, &entry.local, 0);
+      }
+      d_msgs[idx].msg_len = 0;
+    }
+
+    size_t offset = 0;
+    while (offset < d_msgs.size()) {
+      int sent = sendmmsg(fd, &d_msgs.at(offset), d_msgs.size() - offset, 0);
+      if (sent > 0) {
+        offset += sent;
+        continue;
+      }
+
+      /* the first remaining response could not be sent, skip it and carry on with the next ones */
+      d_entries.at(offset).sendErr = errno;
+      ++offset;
+    }
+
+    for (auto& entry : d_entries) {
+      try {
+        entry.sent(entry.sendErr);
+      }
+      catch (const std::exception& e) {
+        if (g_logCommonErrors) {
+          g_log << Logger::Error << "Error processing an answer sent from the packet cache: " << e.what() << endl;
+        }
+      }
+    }
+
+    clear();
+  }
+
+  void clear()
+  {
+    d_entries.clear();
+  }
+
+private:
+  struct Entry
+  {
+    std::string response;
+    std::function<void(int)> sent;
+    ComboAddress remote;
+    ComboAddress local;
+    struct iovec iov;
+    int sendErr{0};
+    bool hasLocal{false};
+    /* used by addCMsgSrcAddr */
+    cmsgbuf_aligned cbuf;
+  };
+
+  std::vector<Entry> d_entries;
+  std::vector<struct mmsghdr> d_msgs;
+};
+
+/* set while a batch of queries received via recvmmsg() is being processed by this thread */
+static thread_local UDPResponseBatch* t_udpResponseBatch{nullptr};
+
+class UDPResponseBatchGuard
+{
+public:
+  UDPResponseBatchGuard(UDPResponseBatch& batch) :
+    d_batch(batch)
+  {
+    t_udpResponseBatch = &d_batch;
+  }
+
+  ~UDPResponseBatchGuard()
+  {
+    t_udpResponseBatch = nullptr;
+    /* only non-empty if an exception prevented the batch from being sent */
+    d_batch.clear();
+  }
+
+private:
+  UDPResponseBatch& d_batch;
+};
+#endif /* defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE) */
+
 static string* doProcessUDPQuestion(const std::string& question, const ComboAddress& fromaddr, const ComboAddress& destaddr, ComboAddress source, ComboAddress destination, struct timeval tv, int fd, std::vector<ProxyProtocolValue>& proxyProtocolValues, RecEventTrace& eventTrace)
 {
   ++(RecThreadInfo::self().numberOfDistributedQueries);
@@ -1919,6 +2076,36 @@ static string* doProcessUDPQuestion(const std::string& question, const ComboAddr
         if (!g_quiet) {
           g_log << Logger::Notice << RecThreadInfo::id() << " question answered from packet cache tag=" << ctag << " from " << source.toStringWithPort() << (source != fromaddr ? " (via " + fromaddr.toStringWithPort() + ")" : "") << endl;
         }
+        /* called once the response has been sent, which happens after the whole batch has been processed when batching */
+        auto answerSent = [header = *dh, luaconfsLocal, pbData = std::move(pbData), tv, fromaddr, source, destination, ednssubnet, uniqueId, requestorId, deviceId, deviceName, meta, logResponse, eventTrace = std::move(eventTrace)](int sendErr) mutable {
+          eventTrace.add(RecEventTrace::AnswerSent);
+
+          if (t_protobufServers && logResponse && !(luaconfsLocal->protobufExportConfig.taggedOnly && pbData && !pbData->d_tagged)) {
+            protobufLogResponse(&header, luaconfsLocal, pbData, tv, false, source, destination, ednssubnet, uniqueId, requestorId, deviceId, deviceName, meta, eventTrace);
+          }
+
+          if (eventTrace.enabled() && SyncRes::s_event_trace_enabled & SyncRes::event_trace_to_log) {
+            g_log << Logger::Info << eventTrace.toString() << endl;
+          }
+          if (sendErr && g_logCommonErrors) {
+            g_log << Logger::Warning << "Sending UDP reply to client " << source.toStringWithPort()
+                  << (source != fromaddr ? " (via " + fromaddr.toStringWithPort() + ")" : "") << " failed with: "
+                  << strerror(sendErr) << endl;
+          }
+          struct timeval now;
+          Utility::gettimeofday(&now, nullptr);
+          uint64_t spentUsec = uSec(now - tv);
+          g_stats.cumulativeAnswers(spentUsec);
+        };
+
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE)
+        if (t_udpResponseBatch) {
+          /* sent, along with the other packet cache hits of this batch, once the whole batch has been processed */
+          t_udpResponseBatch->add(std::move(response), fromaddr, g_fromtosockets.count(fd) ? &destaddr : nullptr, std::move(answerSent));
+          return 0;
+        }
+#endif /* defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE) */
+
         struct msghdr msgh;
         struct iovec iov;
         cmsgbuf_aligned cbuf;
@@ -1928,25 +2115,7 @@ static string* doProcessUDPQuestion(const std::string& question, const ComboAddr
         if (g_fromtosockets.count(fd)) {
           addCMsgSrcAddr(&msgh, &cbuf, &destaddr, 0);
         }
-        int sendErr = sendOnNBSocket(fd, &msgh);
-        eventTrace.add(RecEventTrace::AnswerSent);
-
-        if (t_protobufServers && logResponse && !(luaconfsLocal->protobufExportConfig.taggedOnly && pbData && !pbData->d_tagged)) {
-          protobufLogResponse(dh, luaconfsLocal, pbData, tv, false, source, destination, ednssubnet, uniqueId, requestorId, deviceId, deviceName, meta, eventTrace);
-        }
-
-        if (eventTrace.enabled() && SyncRes::s_event_trace_enabled & SyncRes::event_trace_to_log) {
-          g_log << Logger::Info << eventTrace.toString() << endl;
-        }
-        if (sendErr && g_logCommonErrors) {
-          g_log << Logger::Warning << "Sending UDP reply to client " << source.toStringWithPort()
-                << (source != fromaddr ? " (via " + fromaddr.toStringWithPort() + ")" : "") << " failed with: "
-                << strerror(sendErr) << endl;
-        }
-        struct timeval now;
-        Utility::gettimeofday(&now, nullptr);
-        uint64_t spentUsec = uSec(now - tv);
-        g_stats.cumulativeAnswers(spentUsec);
+        answerSent(sendOnNBSocket(fd, &msgh));
         return 0;
       }
     }
@@ -2047,190 +2216,274 @@ static string* doProcessUDPQuestion(const std::string& question, const ComboAddr
   return 0;
 }
 
-static void handleNewUDPQuestion(int fd, FDMultiplexer::funcparam_t& var)
+/* Processes a single query received on the UDP socket fd. Returns false if the query was rejected
+   in a way that should stop the current round of reading from that socket. */
+static bool handleUDPQuestionPacket(int fd, struct msghdr& msgh, ssize_t len, const ComboAddress& fromaddr, std::string& data, std::vector<ProxyProtocolValue>& proxyProtocolValues, RecEventTrace& eventTrace)
 {
-  ssize_t len;
-  static const size_t maxIncomingQuerySize = g_proxyProtocolACL.empty() ? 512 : (512 + g_proxyProtocolMaximumSize);
-  static thread_local std::string data;
-  ComboAddress fromaddr;
+  bool proxyProto = false;
   ComboAddress source;
   ComboAddress destination;
-  struct msghdr msgh;
-  struct iovec iov;
-  cmsgbuf_aligned cbuf;
-  bool firstQuery = true;
-  std::vector<ProxyProtocolValue> proxyProtocolValues;
-  RecEventTrace eventTrace;
+  proxyProtocolValues.clear();
 
-  for (size_t queriesCounter = 0; queriesCounter < g_maxUDPQueriesPerRound; queriesCounter++) {
-    bool proxyProto = false;
-    proxyProtocolValues.clear();
-    data.resize(maxIncomingQuerySize);
-    fromaddr.sin6.sin6_family = AF_INET6; // this makes sure fromaddr is big enough
-    fillMSGHdr(&msgh, &iov, &cbuf, sizeof(cbuf), &data[0], data.size(), &fromaddr);
+  eventTrace.clear();
+  eventTrace.setEnabled(SyncRes::s_event_trace_enabled);
+  eventTrace.add(RecEventTrace::ReqRecv);
 
-    if ((len = recvmsg(fd, &msgh, 0)) >= 0) {
-      eventTrace.clear();
-      eventTrace.setEnabled(SyncRes::s_event_trace_enabled);
-      eventTrace.add(RecEventTrace::ReqRecv);
+  if (msgh.msg_flags & MSG_TRUNC) {
+    g_stats.truncatedDrops++;
+    if (!g_quiet) {
+      g_log << Logger::Error << "Ignoring truncated query from " << fromaddr.toString() << endl;
+    }
+    return false;
+  }
 
-      firstQuery = false;
+  data.resize(static_cast<size_t>(len));
 
-      if (msgh.msg_flags & MSG_TRUNC) {
-        g_stats.truncatedDrops++;
-        if (!g_quiet) {
-          g_log << Logger::Error << "Ignoring truncated query from " << fromaddr.toString() << endl;
-        }
-        return;
+  if (expectProxyProtocol(fromaddr)) {
+    bool tcp;
+    ssize_t used = parseProxyHeader(data, proxyProto, source, destination, tcp, proxyProtocolValues);
+    if (used <= 0) {
+      ++g_stats.proxyProtocolInvalidCount;
+      if (!g_quiet) {
+        g_log << Logger::Error << "Ignoring invalid proxy protocol (" << std::to_string(len) << ", " << std::to_string(used) << ") query from " << fromaddr.toStringWithPort() << endl;
       }
+      return false;
+    }
+    else if (static_cast<size_t>(used) > g_proxyProtocolMaximumSize) {
+      if (g_quiet) {
+        g_log << Logger::Error << "Proxy protocol header in UDP packet from " << fromaddr.toStringWithPort() << " is larger than proxy-protocol-maximum-size (" << used << "), dropping" << endl;
+      }
+      ++g_stats.proxyProtocolInvalidCount;
+      return false;
+    }
+
+    data.erase(0, used);
+  }
+  else if (len > 512) {
+    /* we only allow UDP packets larger than 512 for those with a proxy protocol header */
+    g_stats.truncatedDrops++;
+    if (!g_quiet) {
+      g_log << Logger::Error << "Ignoring truncated query from " << fromaddr.toStringWithPort() << endl;
+    }
+    return false;
+  }
+
+  if (data.size() < sizeof(dnsheader)) {
+    g_stats.ignoredCount++;
+    if (!g_quiet) {
+      g_log << Logger::Error << "Ignoring too-short (" << std::to_string(data.size()) << ") query from " << fromaddr.toString() << endl;
+    }
+    return false;
+  }
+
+  if (!proxyProto) {
+    source = fromaddr;
+  }
+
+  if (t_remotes) {
+    t_remotes->push_back(fromaddr);
+  }
+
+  if (t_allowFrom && !t_allowFrom->match(&source)) {
+    if (!g_quiet) {
+      g_log << Logger::Error << "[" << MT->getTid() << "] dropping UDP query from " << source.toString() << ", address not matched by allow-from" << endl;
+    }
+
+    g_stats.unauthorizedUDP++;
+    return false;
+  }
+
+  BOOST_STATIC_ASSERT(offsetof(sockaddr_in, sin_port) == offsetof(sockaddr_in6, sin6_port));
+  if (!fromaddr.sin4.sin_port) { // also works for IPv6
+    if (!g_quiet) {
+      g_log << Logger::Error << "[" << MT->getTid() << "] dropping UDP query from " << fromaddr.toStringWithPort() << ", can't deal with port 0" << endl;
+    }
 
-      data.resize(static_cast<size_t>(len));
+    g_stats.clientParseError++; // not quite the best place to put it, but needs to go somewhere
+    return false;
+  }
 
-      if (expectProxyProtocol(fromaddr)) {
-        bool tcp;
-        ssize_t used = parseProxyHeader(data, proxyProto, source, destination, tcp, proxyProtocolValues);
-        if (used <= 0) {
-          ++g_stats.proxyProtocolInvalidCount;
+  try {
+    const dnsheader_aligned headerdata(data.data());
+    const dnsheader* dh = headerdata.get();
+
+    if (dh->qr) {
+      g_stats.ignoredCount++;
+      if (g_logCommonErrors) {
+        g_log << Logger::Error << "Ignoring answer from " << fromaddr.toString() << " on server socket!" << endl;
+      }
+    }
+    else if (dh->opcode != Opcode::Query && dh->opcode != Opcode::Notify) {
+      g_stats.ignoredCount++;
+      if (g_logCommonErrors) {
+        g_log << Logger::Error << "Ignoring unsupported opcode " << Opcode::to_s(dh->opcode) << " from " << fromaddr.toString() << " on server socket!" << endl;
+      }
+    }
+    else if (dh->qdcount == 0) {
+      g_stats.emptyQueriesCount++;
+      if (g_logCommonErrors) {
+        g_log << Logger::Error << "Ignoring empty (qdcount == 0) query from " << fromaddr.toString() << " on server socket!" << endl;
+      }
+    }
+    else {
+      if (dh->opcode == Opcode::Notify) {
+        if (!t_allowNotifyFrom || !t_allowNotifyFrom->match(&source)) {
           if (!g_quiet) {
-            g_log << Logger::Error << "Ignoring invalid proxy protocol (" << std::to_string(len) << ", " << std::to_string(used) << ") query from " << fromaddr.toStringWithPort() << endl;
-          }
-          return;
-        }
-        else if (static_cast<size_t>(used) > g_proxyProtocolMaximumSize) {
-          if (g_quiet) {
-            g_log << Logger::Error << "Proxy protocol header in UDP packet from " << fromaddr.toStringWithPort() << " is larger than proxy-protocol-maximum-size (" << used << "), dropping" << endl;
+            g_log << Logger::Error << "[" << MT->getTid() << "] dropping UDP NOTIFY from " << source.toString() << ", address not matched by allow-notify-from" << endl;
           }
-          ++g_stats.proxyProtocolInvalidCount;
-          return;
-        }
 
-        data.erase(0, used);
-      }
-      else if (len > 512) {
-        /* we only allow UDP packets larger than 512 for those with a proxy protocol header */
-        g_stats.truncatedDrops++;
-        if (!g_quiet) {
-          g_log << Logger::Error << "Ignoring truncated query from " << fromaddr.toStringWithPort() << endl;
+          g_stats.sourceDisallowedNotify++;
+          return false;
         }
-        return;
       }
 
-      if (data.size() < sizeof(dnsheader)) {
-        g_stats.ignoredCount++;
-        if (!g_quiet) {
-          g_log << Logger::Error << "Ignoring too-short (" << std::to_string(data.size()) << ") query from " << fromaddr.toString() << endl;
+      struct timeval tv = {0, 0};
+      HarvestTimestamp(&msgh, &tv);
+      ComboAddress dest;
+      dest.reset(); // this makes sure we ignore this address if not returned by recvmsg above
+      auto loc = rplookup(g_listenSocketsAddresses, fd);
+      if (HarvestDestinationAddress(&msgh, &dest)) {
+        // but.. need to get port too
+        if (loc) {
+          dest.sin4.sin_port = loc->sin4.sin_port;
+        }
+      }
+      else {
+        if (loc) {
+          dest = *loc;
+        }
+        else {
+          dest.sin4.sin_family = fromaddr.sin4.sin_family;
+          socklen_t slen = dest.getSocklen();
+          getsockname(fd, (sockaddr*)&dest, &slen); // if this fails, we're ok with it
         }
-        return;
       }
-
       if (!proxyProto) {
-        source = fromaddr;
+        destination = dest;
       }
 
-      if (t_remotes) {
-        t_remotes->push_back(fromaddr);
+      if (RecThreadInfo::weDistributeQueries()) {
+        std::string localdata = data;
+        distributeAsyncFunction(data, [localdata, fromaddr, dest, source, destination, tv, fd, proxyProtocolValues, eventTrace]() mutable {
+          return doProcessUDPQuestion(localdata, fromaddr, dest, source, destination, tv, fd, proxyProtocolValues, eventTrace);
+        });
+      }
+      else {
+        doProcessUDPQuestion(data, fromaddr, dest, source, destination, tv, fd, proxyProtocolValues, eventTrace);
       }
+    }
+  }
+  catch (const MOADNSException& mde) {
+    g_stats.clientParseError++;
+    if (g_logCommonErrors) {
+      g_log << Logger::Error << "Unable to parse packet from remote UDP client " << fromaddr.toString() << ": " << mde.what() << endl;
+    }
+  }
+  catch (const std::runtime_error& e) {
+    g_stats.clientParseError++;
+    if (g_logCommonErrors) {
+      g_log << Logger::Error << "Unable to parse packet from remote UDP client " << fromaddr.toString() << ": " << e.what() << endl;
+    }
+  }
 
-      if (t_allowFrom && !t_allowFrom->match(&source)) {
-        if (!g_quiet) {
-          g_log << Logger::Error << "[" << MT->getTid() << "] dropping UDP query from " << source.toString() << ", address not matched by allow-from" << endl;
-        }
+  return true;
+}
 
-        g_stats.unauthorizedUDP++;
-        return;
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE)
+static void handleNewUDPQuestionBatch(int fd, size_t maxIncomingQuerySize)
+{
+  struct MMReceiver
+  {
+    std::string data;
+    ComboAddress fromaddr;
+    struct iovec iov;
+    /* used by HarvestDestinationAddress and HarvestTimestamp */
+    cmsgbuf_aligned cbuf;
+  };
+  static thread_local std::vector<MMReceiver> recvData;
+  static thread_local std::vector<struct mmsghdr> msgVec;
+  static thread_local UDPResponseBatch responses;
+  std::vector<ProxyProtocolValue> proxyProtocolValues;
+  RecEventTrace eventTrace;
+
+  if (recvData.size() < g_udpReceiveBatchSize) {
+    recvData.resize(g_udpReceiveBatchSize);
+    msgVec.resize(g_udpReceiveBatchSize);
+  }
+
+  size_t queriesCounter = 0;
+  bool keepGoing = true;
+  while (keepGoing && queriesCounter < g_maxUDPQueriesPerRound) {
+    const size_t wanted = std::min(g_udpReceiveBatchSize, g_maxUDPQueriesPerRound - queriesCounter);
+    for (size_t idx = 0; idx < wanted; idx++) {
+      auto& receiver = recvData[idx];
+      receiver.data.resize(maxIncomingQuerySize);
+      receiver.fromaddr.sin6.sin6_family = AF_INET6; // this makes sure fromaddr is big enough
+      fillMSGHdr(&msgVec[idx].msg_hdr, &receiver.iov, &receiver.cbuf, sizeof(receiver.cbuf), &receiver.data[0], receiver.data.size(), &receiver.fromaddr);
+      msgVec[idx].msg_len = 0;
+    }
+
+    int got = recvmmsg(fd, msgVec.data(), wanted, 0, nullptr);
+    if (got <= 0) {
+      if (queriesCounter == 0 && errno == EAGAIN) {
+        g_stats.noPacketError++;
       }
+      break;
+    }
 
-      BOOST_STATIC_ASSERT(offsetof(sockaddr_in, sin_port) == offsetof(sockaddr_in6, sin6_port));
-      if (!fromaddr.sin4.sin_port) { // also works for IPv6
-        if (!g_quiet) {
-          g_log << Logger::Error << "[" << MT->getTid() << "] dropping UDP query from " << fromaddr.toStringWithPort() << ", can't deal with port 0" << endl;
+    {
+      UDPResponseBatchGuard guard(responses);
+      for (int idx = 0; idx < got; idx++) {
+        auto& receiver = recvData[idx];
+        /* the datagrams have already been read from the socket, so we process all of them
+           even if one was rejected, but we stop reading after this batch */
+        if (!handleUDPQuestionPacket(fd, msgVec[idx].msg_hdr, msgVec[idx].msg_len, receiver.fromaddr, receiver.data, proxyProtocolValues, eventTrace)) {
+          keepGoing = false;
         }
-
-        g_stats.clientParseError++; // not quite the best place to put it, but needs to go somewhere
-        return;
       }
+      responses.send(fd);
+    }
 
-      try {
-        const dnsheader_aligned headerdata(data.data());
-        const dnsheader* dh = headerdata.get();
+    queriesCounter += got;
+    if (static_cast<size_t>(got) < wanted) {
+      /* the socket has been drained */
+      break;
+    }
+  }
+}
+#endif /* defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE) */
 
-        if (dh->qr) {
-          g_stats.ignoredCount++;
-          if (g_logCommonErrors) {
-            g_log << Logger::Error << "Ignoring answer from " << fromaddr.toString() << " on server socket!" << endl;
-          }
-        }
-        else if (dh->opcode != Opcode::Query && dh->opcode != Opcode::Notify) {
-          g_stats.ignoredCount++;
-          if (g_logCommonErrors) {
-            g_log << Logger::Error << "Ignoring unsupported opcode " << Opcode::to_s(dh->opcode) << " from " << fromaddr.toString() << " on server socket!" << endl;
-          }
-        }
-        else if (dh->qdcount == 0) {
-          g_stats.emptyQueriesCount++;
-          if (g_logCommonErrors) {
-            g_log << Logger::Error << "Ignoring empty (qdcount == 0) query from " << fromaddr.toString() << " on server socket!" << endl;
-          }
-        }
-        else {
-          if (dh->opcode == Opcode::Notify) {
-            if (!t_allowNotifyFrom || !t_allowNotifyFrom->match(&source)) {
-              if (!g_quiet) {
-                g_log << Logger::Error << "[" << MT->getTid() << "] dropping UDP NOTIFY from " << source.toString() << ", address not matched by allow-notify-from" << endl;
-              }
+static void handleNewUDPQuestion(int fd, FDMultiplexer::funcparam_t& var)
+{
+  static const size_t maxIncomingQuerySize = g_proxyProtocolACL.empty() ? 512 : (512 + g_proxyProtocolMaximumSize);
 
-              g_stats.sourceDisallowedNotify++;
-              return;
-            }
-          }
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE)
+  if (g_udpReceiveBatchSize > 1) {
+    handleNewUDPQuestionBatch(fd, maxIncomingQuerySize);
+    return;
+  }
+#endif /* defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE) */
 
-          struct timeval tv = {0, 0};
-          HarvestTimestamp(&msgh, &tv);
-          ComboAddress dest;
-          dest.reset(); // this makes sure we ignore this address if not returned by recvmsg above
-          auto loc = rplookup(g_listenSocketsAddresses, fd);
-          if (HarvestDestinationAddress(&msgh, &dest)) {
-            // but.. need to get port too
-            if (loc) {
-              dest.sin4.sin_port = loc->sin4.sin_port;
-            }
-          }
-          else {
-            if (loc) {
-              dest = *loc;
-            }
-            else {
-              dest.sin4.sin_family = fromaddr.sin4.sin_family;
-              socklen_t slen = dest.getSocklen();
-              getsockname(fd, (sockaddr*)&dest, &slen); // if this fails, we're ok with it
-            }
-          }
-          if (!proxyProto) {
-            destination = dest;
-          }
+  ssize_t len;
+  static thread_local std::string data;
+  ComboAddress fromaddr;
+  struct msghdr msgh;
+  struct iovec iov;
+  cmsgbuf_aligned cbuf;
+  bool firstQuery = true;
+  std::vector<ProxyProtocolValue> proxyProtocolValues;
+  RecEventTrace eventTrace;
 
-          if (RecThreadInfo::weDistributeQueries()) {
-            std::string localdata = data;
-            distributeAsyncFunction(data, [localdata, fromaddr, dest, source, destination, tv, fd, proxyProtocolValues, eventTrace]() mutable {
-              return doProcessUDPQuestion(localdata, fromaddr, dest, source, destination, tv, fd, proxyProtocolValues, eventTrace);
-            });
-          }
-          else {
-            doProcessUDPQuestion(data, fromaddr, dest, source, destination, tv, fd, proxyProtocolValues, eventTrace);
-          }
-        }
-      }
-      catch (const MOADNSException& mde) {
-        g_stats.clientParseError++;
-        if (g_logCommonErrors) {
-          g_log << Logger::Error << "Unable to parse packet from remote UDP client " << fromaddr.toString() << ": " << mde.what() << endl;
-        }
-      }
-      catch (const std::runtime_error& e) {
-        g_stats.clientParseError++;
-        if (g_logCommonErrors) {
-          g_log << Logger::Error << "Unable to parse packet from remote UDP client " << fromaddr.toString() << ": " << e.what() << endl;
-        }
+  for (size_t queriesCounter = 0; queriesCounter < g_maxUDPQueriesPerRound; queriesCounter++) {
+    data.resize(maxIncomingQuerySize);
+    fromaddr.sin6.sin6_family = AF_INET6; // this makes sure fromaddr is big enough
+    fillMSGHdr(&msgh, &iov, &cbuf, sizeof(cbuf), &data[0], data.size(), &fromaddr);
+
+    if ((len = recvmsg(fd, &msgh, 0)) >= 0) {
+      firstQuery = false;
+
+      if (!handleUDPQuestionPacket(fd, msgh, len, fromaddr, data, proxyProtocolValues, eventTrace)) {
+        return;
       }
     }
     else {
@@ -2350,24 +2603,16 @@ static bool trySendingQueryToWorker(unsigned int target, ThreadMSG* tmsg)
     _exit(1);
   }
 
-  const auto& tps = targetInfo.pipes;
+  if (!targetInfo.queriesQueue->push(tmsg)) {
+    return false;
+  }
 
-  ssize_t written = write(tps.writeQueriesToThread, &tmsg, sizeof(tmsg));
-  if (written > 0) {
-    if (static_cast<size_t>(written) != sizeof(tmsg)) {
-      delete tmsg;
-      unixDie("write to thread pipe returned wrong size or error");
-    }
+  try {
+    targetInfo.queriesNotifier->notify();
   }
-  else {
-    int error = errno;
-    if (error == EAGAIN || error == EWOULDBLOCK) {
-      return false;
-    }
-    else {
-      delete tmsg;
-      unixDie("write to thread pipe returned wrong size or error:" + std::to_string(error));
-    }
+  catch (const std::exception& e) {
+    /* the query is in the queue already, so it's not ours to delete anymore */
+    unixDie(e.what());
   }
 
   return true;
@@ -2432,7 +2677,7 @@ void distributeAsyncFunction(const string& packet, const pipefunc_t& func)
   tmsg->wantAnswer = false;
 
   if (!trySendingQueryToWorker(target, tmsg)) {
-    /* if this function failed but did not raise an exception, it means that the pipe
+    /* if this function failed but did not raise an exception, it means that the queue
        was full, let's try another one */
     unsigned int newTarget = 0;
     do {
@@ -2465,7 +2710,6 @@ static void doResends(MT_t::waiters_t::iterator& iter, const std::shared_ptr<Pac
 
 static void handleUDPServerResponse(int fd, FDMultiplexer::funcparam_t& var)
 {
-  std::shared_ptr<PacketID> pid = boost::any_cast<std::shared_ptr<PacketID>>(var);
   ssize_t len;
   PacketBuffer packet;
   packet.resize(g_outgoingEDNSBufsize);
@@ -2483,14 +2727,21 @@ static void handleUDPServerResponse(int fd, FDMultiplexer::funcparam_t& var)
         g_log << Logger::Error << "Unable to parse packet from remote UDP server " << fromaddr.toString() << ": packet smaller than DNS header" << endl;
     }
 
-    t_udpclientsocks->returnSocket(fd);
+    /* the socket might be used by several queries, all of them are failed and the socket is not used for new ones */
+    t_udpclientsocks->retireSocket(fd);
+    const auto pids = getWaitersOnSocket(MT->d_waiters, fd);
     PacketBuffer empty;
-
-    MT_t::waiters_t::iterator iter = MT->d_waiters.find(pid);
-    if (iter != MT->d_waiters.end())
+    for (const auto& pid : pids) {
+      MT_t::waiters_t::iterator iter = MT->d_waiters.find(pid);
+      if (iter == MT->d_waiters.end()) {
+        continue;
+      }
       doResends(iter, pid, empty);
 
-    MT->sendEvent(pid, &empty); // this denotes error (does lookup again.. at least L1 will be hot)
+      if (MT->sendEvent(pid, &empty)) { // this denotes error (does lookup again.. at least L1 will be hot)
+        t_udpclientsocks->returnSocket(fd);
+      }
+    }
     return;
   }
 
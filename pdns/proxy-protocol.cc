@@ -51,7 +51,8 @@ std::string makeLocalProxyHeader()
   return makeSimpleHeader(0x00, 0, 0);
 }
 
-std::string makeProxyHeader(bool tcp, const ComboAddress& source, const ComboAddress& destination, const std::vector<ProxyProtocolValue>& values)
+/* returns the PROXY header without its TLV values, valuesSize bytes of which are expected to be appended by the caller */
+static std::string makeProxyHeaderWithoutValues(bool tcp, const ComboAddress& source, const ComboAddress& destination, size_t valuesSize)
 {
   if (source.sin4.sin_family != destination.sin4.sin_family) {
     throw std::runtime_error("The PROXY destination and source addresses must be of the same family");
@@ -63,17 +64,6 @@ std::string makeProxyHeader(bool tcp, const ComboAddress& source, const ComboAdd
   const uint16_t sourcePort = source.sin4.sin_port;
   const uint16_t destinationPort = destination.sin4.sin_port;
 
-  size_t valuesSize = 0;
-  for (const auto& value : values) {
-    if (value.content.size() > std::numeric_limits<uint16_t>::max()) {
-      throw std::runtime_error("The size of proxy protocol values is limited to " + std::to_string(std::numeric_limits<uint16_t>::max()) + ", trying to add a value of size " + std::to_string(value.content.size()));
-    }
-    valuesSize += sizeof(uint8_t) + sizeof(uint8_t) * 2 + value.content.size();
-    if (valuesSize > std::numeric_limits<uint16_t>::max()) {
-      throw std::runtime_error("The total size of proxy protocol values is limited to " + std::to_string(std::numeric_limits<uint16_t>::max()));
-    }
-  }
-
   size_t total = (addrSize * 2) + sizeof(sourcePort) + sizeof(destinationPort) + valuesSize;
   if (total > std::numeric_limits<uint16_t>::max()) {
     throw std::runtime_error("The size of a proxy protocol header is limited to " + std::to_string(std::numeric_limits<uint16_t>::max()) + ", trying to send one of size " + std::to_string(total));
@@ -99,6 +89,24 @@ std::string makeProxyHeader(bool tcp, const ComboAddress& source, const ComboAdd
   ret.append(reinterpret_cast<const char*>(&sourcePort), sizeof(sourcePort));
   ret.append(reinterpret_cast<const char*>(&destinationPort), sizeof(destinationPort));
 
+  return ret;
+}
+
+std::string makeProxyHeader(bool tcp, const ComboAddress& source, const ComboAddress& destination, const std::vector<ProxyProtocolValue>& values)
+{
+  size_t valuesSize = 0;
+  for (const auto& value : values) {
+    if (value.content.size() > std::numeric_limits<uint16_t>::max()) {
+      throw std::runtime_error("The size of proxy protocol values is limited to " + std::to_string(std::numeric_limits<uint16_t>::max()) + ", trying to add a value of size " + std::to_string(value.content.size()));
+    }
+    valuesSize += sizeof(uint8_t) + sizeof(uint8_t) * 2 + value.content.size();
+    if (valuesSize > std::numeric_limits<uint16_t>::max()) {
+      throw std::runtime_error("The total size of proxy protocol values is limited to " + std::to_string(std::numeric_limits<uint16_t>::max()));
+    }
+  }
+
+  std::string ret = makeProxyHeaderWithoutValues(tcp, source, destination, valuesSize);
+
   for (const auto& value : values) {
     uint16_t contentSize = htons(static_cast<uint16_t>(value.content.size()));
     ret.append(reinterpret_cast<const char*>(&value.type), sizeof(value.type));
@@ -109,6 +117,13 @@ std::string makeProxyHeader(bool tcp, const ComboAddress& source, const ComboAdd
   return ret;
 }
 
+std::string makeProxyHeaderWithRawValues(bool tcp, const ComboAddress& source, const ComboAddress& destination, const std::string& rawValues)
+{
+  std::string ret = makeProxyHeaderWithoutValues(tcp, source, destination, rawValues.size());
+  ret.append(rawValues);
+  return ret;
+}
+
 /* returns: number of bytes consumed (positive) after successful parse
          or number of bytes missing (negative)
          or unfixable parse error (0)*/
@@ -205,10 +220,7 @@ template<typename Container> ssize_t isProxyHeaderComplete(const Container& head
   return s_proxyProtocolMinimumHeaderSize + contentlen;
 }
 
-/* returns: number of bytes consumed (positive) after successful parse
-         or number of bytes missing (negative)
-         or unfixable parse error (0)*/
-template<typename Container> ssize_t parseProxyHeader(const Container& header, bool& proxy, ComboAddress& source, ComboAddress& destination, bool& tcp, std::vector<ProxyProtocolValue>& values)
+template<typename Container> ssize_t parseProxyHeader(const Container& header, bool& proxy, ComboAddress& source, ComboAddress& destination, bool& tcp, size_t& valuesOffset)
 {
   size_t addrSize = 0;
   uint8_t protocol = 0;
@@ -230,34 +242,49 @@ template<typename Container> ssize_t parseProxyHeader(const Container& header, b
     pos = pos + sizeof(uint16_t);
   }
 
+  valuesOffset = pos;
+
   size_t remaining = got - pos;
   while (remaining >= (sizeof(uint8_t) + sizeof(uint16_t))) {
-    /* we still have TLV values to parse */
-    uint8_t type = static_cast<uint8_t>(header.at(pos));
+    /* we still have TLV values to validate */
     pos += sizeof(uint8_t);
     uint16_t len = (static_cast<uint8_t>(header.at(pos)) << 8) + static_cast<uint8_t>(header.at(pos + 1));
     pos += sizeof(uint16_t);
 
-    if (len > 0) {
-      if (len > (got - pos)) {
-        return 0;
-      }
-
-      values.push_back({std::string(reinterpret_cast<const char*>(&header.at(pos)), len), type});
-      pos += len;
-    }
-    else {
-      values.push_back({"", type});
+    if (len > (got - pos)) {
+      return 0;
     }
 
+    pos += len;
     remaining = got - pos;
   }
 
   return pos;
 }
 
+/* returns: number of bytes consumed (positive) after successful parse
+         or number of bytes missing (negative)
+         or unfixable parse error (0)*/
+template<typename Container> ssize_t parseProxyHeader(const Container& header, bool& proxy, ComboAddress& source, ComboAddress& destination, bool& tcp, std::vector<ProxyProtocolValue>& values)
+{
+  size_t valuesOffset = 0;
+  ssize_t got = parseProxyHeader(header, proxy, source, destination, tcp, valuesOffset);
+  if (got <= 0) {
+    return got;
+  }
+
+  visitProxyProtocolValues(reinterpret_cast<const char*>(header.data()) + valuesOffset, got - valuesOffset, [&values](const ProxyProtocolValueView& value) {
+    values.push_back({std::string(value.content), value.type});
+    return true;
+  });
+
+  return got;
+}
+
 #include "noinitvector.hh"
 template ssize_t isProxyHeaderComplete<std::string>(const std::string& header, bool* proxy, bool* tcp, size_t* addrSizeOut, uint8_t* protocolOut);
 template ssize_t isProxyHeaderComplete<PacketBuffer>(const PacketBuffer& header, bool* proxy, bool* tcp, size_t* addrSizeOut, uint8_t* protocolOut);
 template ssize_t parseProxyHeader<std::string>(const std::string& header, bool& proxy, ComboAddress& source, ComboAddress& destination, bool& tcp, std::vector<ProxyProtocolValue>& values);
 template ssize_t parseProxyHeader<PacketBuffer>(const PacketBuffer& header, bool& proxy, ComboAddress& source, ComboAddress& destination, bool& tcp, std::vector<ProxyProtocolValue>& values);
+template ssize_t parseProxyHeader<std::string>(const std::string& header, bool& proxy, ComboAddress& source, ComboAddress& destination, bool& tcp, size_t& valuesOffset);
+template ssize_t parseProxyHeader<PacketBuffer>(const PacketBuffer& header, bool& proxy, ComboAddress& source, ComboAddress& destination, bool& tcp, size_t& valuesOffset);
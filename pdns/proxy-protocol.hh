@@ -23,6 +23,7 @@
 #pragma once
 
 #include "iputils.hh"
+#include "namespaces.hh"
 
 struct ProxyProtocolValue
 {
@@ -35,10 +36,19 @@ struct ProxyProtocolValue
   }
 };
 
+/* same as ProxyProtocolValue but the content points into the buffer the header was parsed from */
+struct ProxyProtocolValueView
+{
+  pdns_string_view content;
+  uint8_t type;
+};
+
 static const size_t s_proxyProtocolMinimumHeaderSize = 16;
 
 std::string makeLocalProxyHeader();
 std::string makeProxyHeader(bool tcp, const ComboAddress& source, const ComboAddress& destination, const std::vector<ProxyProtocolValue>& values);
+/* same as above but the TLV values are passed already encoded, for example as received in an incoming header */
+std::string makeProxyHeaderWithRawValues(bool tcp, const ComboAddress& source, const ComboAddress& destination, const std::string& rawValues);
 
 /* returns: number of bytes consumed (positive) after successful parse
          or number of bytes missing (negative)
@@ -49,3 +59,27 @@ template<typename Container> ssize_t isProxyHeaderComplete(const Container& head
          or number of bytes missing (negative)
          or unfixable parse error (0)*/
 template<typename Container> ssize_t parseProxyHeader(const Container& header, bool& proxy, ComboAddress& source, ComboAddress& destination, bool& tcp, std::vector<ProxyProtocolValue>& values);
+
+/* same as above but without copying the TLV values, which are only validated: they can be accessed
+   later by passing the [valuesOffset, returned value[ part of the header to visitProxyProtocolValues() */
+template<typename Container> ssize_t parseProxyHeader(const Container& header, bool& proxy, ComboAddress& source, ComboAddress& destination, bool& tcp, size_t& valuesOffset);
+
+/* calls visitor(const ProxyProtocolValueView&) for every TLV value in an already validated values part of a header,
+   stopping as soon as the visitor returns false */
+template<typename Visitor> void visitProxyProtocolValues(const char* values, size_t size, Visitor visitor)
+{
+  size_t pos = 0;
+  while ((size - pos) >= (sizeof(uint8_t) + sizeof(uint16_t))) {
+    const uint8_t type = static_cast<uint8_t>(values[pos]);
+    const uint16_t len = (static_cast<uint8_t>(values[pos + 1]) << 8) + static_cast<uint8_t>(values[pos + 2]);
+    pos += sizeof(uint8_t) + sizeof(uint16_t);
+    if (len > (size - pos)) {
+      return;
+    }
+
+    if (!visitor(ProxyProtocolValueView{pdns_string_view(values + pos, len), type})) {
+      return;
+    }
+    pos += len;
+  }
+}
@@ -146,6 +146,7 @@ static const oid udp6InCsumErrorsOID[] = {RECURSOR_STATS_OID, 123};
 static const oid sourceDisallowedNotifyOID[] = {RECURSOR_STATS_OID, 124};
 static const oid zoneDisallowedNotifyOID[] = {RECURSOR_STATS_OID, 125};
 static const oid nonResolvingNameserverEntriesOID[] = {RECURSOR_STATS_OID, 126};
+static const oid udpOutSocketReusesOID[] = {RECURSOR_STATS_OID, 127};
 
 static std::unordered_map<oid, std::string> s_statsMap;
 
@@ -381,5 +382,6 @@ RecursorSNMPAgent::RecursorSNMPAgent(const std::string& name, const std::string&
   registerCounter64Stat("almost-expired-run", almostExpiredRun, OID_LENGTH(almostExpiredRun));
   registerCounter64Stat("almost-expired-exceptions", almostExpiredExceptions, OID_LENGTH(almostExpiredExceptions));
   registerCounter64Stat("non-resolving-nameserver-entries", nonResolvingNameserverEntriesOID, OID_LENGTH(nonResolvingNameserverEntriesOID));
+  registerCounter64Stat("udp-out-socket-reuses", udpOutSocketReusesOID, OID_LENGTH(udpOutSocketReusesOID));
 #endif /* HAVE_NET_SNMP */
 }
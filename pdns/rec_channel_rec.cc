@@ -38,6 +38,7 @@
 #include "rec-taskqueue.hh"
 #include "rec-tcpout.hh"
 #include "rec-main.hh"
+#include "rec-snapshot.hh"
 
 std::pair<std::string, std::string> PrefixDashNumberCompare::prefixAndTrailingNum(const std::string& a)
 {
@@ -424,7 +425,8 @@ static RecursorControlChannel::Answer doDumpCache(int s)
   uint64_t total = 0;
   try {
     int fd = fdw;
-    total = g_recCache->doDump(fd) + dumpNegCache(fd) + broadcastAccFunction<uint64_t>([fd] { return pleaseDump(fd); }) + dumpAggressiveNSECCache(fd);
+    const uint64_t packets = g_packetCache ? g_packetCache->doDump(fd) : broadcastAccFunction<uint64_t>([fd] { return pleaseDump(fd); });
+    total = g_recCache->doDump(fd) + dumpNegCache(fd) + packets + dumpAggressiveNSECCache(fd);
   }
   catch (...) {
   }
@@ -432,6 +434,35 @@ static RecursorControlChannel::Answer doDumpCache(int s)
   return {0, "dumped " + std::to_string(total) + " records\n"};
 }
 
+// Does not follow the generic dump to file pattern, writes the caches in binary form
+static RecursorControlChannel::Answer doDumpCacheSnapshot(int s)
+{
+  auto fdw = getfd(s);
+
+  if (fdw < 0) {
+    return {1, "Error opening dump file for writing: " + stringerror() + "\n"};
+  }
+  int newfd = dup(fdw);
+  if (newfd == -1) {
+    return {1, "Error duplicating the dump file descriptor: " + stringerror() + "\n"};
+  }
+  auto fp = std::unique_ptr<FILE, int (*)(FILE*)>(fdopen(newfd, "w"), fclose);
+  if (!fp) {
+    close(newfd);
+    return {1, "Error opening dump file for writing: " + stringerror() + "\n"};
+  }
+
+  uint64_t total = 0;
+  try {
+    total = saveCacheSnapshot(fp.get(), time(nullptr));
+  }
+  catch (const std::exception& e) {
+    return {1, "Error writing the cache snapshot: " + string(e.what()) + "\n"};
+  }
+
+  return {0, "dumped " + std::to_string(total) + " cache entries\n"};
+}
+
 // Does not follow the generic dump to file pattern, has an argument
 template <typename T>
 static RecursorControlChannel::Answer doDumpRPZ(int s, T begin, T end)
@@ -953,14 +984,9 @@ static string doCurrentQueries()
   return broadcastAccFunction<string>(pleaseGetCurrentQueries);
 }
 
-uint64_t* pleaseGetThrottleSize()
-{
-  return new uint64_t(SyncRes::getThrottledServersSize());
-}
-
 static uint64_t getThrottleSize()
 {
-  return broadcastAccFunction<uint64_t>(pleaseGetThrottleSize);
+  return SyncRes::getThrottledServersSize();
 }
 
 static uint64_t getNegCacheSize()
@@ -968,19 +994,9 @@ static uint64_t getNegCacheSize()
   return g_negCache->size();
 }
 
-uint64_t* pleaseGetNsSpeedsSize()
-{
-  return new uint64_t(SyncRes::getNSSpeedsSize());
-}
-
 static uint64_t getNsSpeedsSize()
 {
-  return broadcastAccFunction<uint64_t>(pleaseGetNsSpeedsSize);
-}
-
-uint64_t* pleaseGetEDNSStatusesSize()
-{
-  return new uint64_t(SyncRes::getEDNSStatusesSize());
+  return SyncRes::getNSSpeedsSize();
 }
 
 uint64_t* pleaseGetConcurrentQueries()
@@ -1025,31 +1041,43 @@ static uint64_t* pleaseGetPacketCacheBytes()
 
 static uint64_t doGetPacketCacheSize()
 {
+  if (g_packetCache) {
+    return g_packetCache->size();
+  }
   return broadcastAccFunction<uint64_t>(pleaseGetPacketCacheSize);
 }
 
 static uint64_t doGetPacketCacheBytes()
 {
+  if (g_packetCache) {
+    return g_packetCache->bytes();
+  }
   return broadcastAccFunction<uint64_t>(pleaseGetPacketCacheBytes);
 }
 
 uint64_t* pleaseGetPacketCacheHits()
 {
-  return new uint64_t(t_packetCache ? t_packetCache->d_hits : 0);
+  return new uint64_t(t_packetCache ? t_packetCache->getHits() : 0);
 }
 
 static uint64_t doGetPacketCacheHits()
 {
+  if (g_packetCache) {
+    return g_packetCache->getHits();
+  }
   return broadcastAccFunction<uint64_t>(pleaseGetPacketCacheHits);
 }
 
 static uint64_t* pleaseGetPacketCacheMisses()
 {
-  return new uint64_t(t_packetCache ? t_packetCache->d_misses : 0);
+  return new uint64_t(t_packetCache ? t_packetCache->getMisses() : 0);
 }
 
 static uint64_t doGetPacketCacheMisses()
 {
+  if (g_packetCache) {
+    return g_packetCache->getMisses();
+  }
   return broadcastAccFunction<uint64_t>(pleaseGetPacketCacheMisses);
 }
 
@@ -1223,6 +1251,7 @@ static void registerAllStats1()
   addGetStat("qa-latency", []() { return round(g_stats.avgLatencyUsec.load()); });
   addGetStat("x-our-latency", []() { return round(g_stats.avgLatencyOursUsec.load()); });
   addGetStat("unexpected-packets", &g_stats.unexpectedCount);
+  addGetStat("udp-out-socket-reuses", &g_stats.udpOutSocketReuses);
   addGetStat("case-mismatches", &g_stats.caseMismatchCount);
   addGetStat("spoof-prevents", &g_stats.spoofCount);
 
@@ -1900,6 +1929,7 @@ RecursorControlChannel::Answer RecursorControlParser::getAnswer(int s, const str
             "clear-nta [DOMAIN]...            Clear the Negative Trust Anchor for DOMAINs, if no DOMAIN is specified, remove all\n"
             "clear-ta [DOMAIN]...             Clear the Trust Anchor for DOMAINs\n"
             "dump-cache <filename>            dump cache contents to the named file\n"
+            "dump-cache-snapshot <filename>   dump a binary snapshot of the caches, to be loaded on startup, to the named file\n"
             "dump-edns [status] <filename>    dump EDNS status to the named file\n"
             "dump-failedservers <filename>    dump the failed servers to the named file\n"
             "dump-non-resolving <filename>    dump non-resolving nameservers addresses to the named file\n"
@@ -1971,11 +2001,14 @@ RecursorControlChannel::Answer RecursorControlParser::getAnswer(int s, const str
   if (cmd == "dump-cache") {
     return doDumpCache(s);
   }
+  if (cmd == "dump-cache-snapshot") {
+    return doDumpCacheSnapshot(s);
+  }
   if (cmd == "dump-ednsstatus" || cmd == "dump-edns") {
-    return doDumpToFile(s, pleaseDumpEDNSMap, cmd);
+    return doDumpToFile(s, pleaseDumpEDNSMap, cmd, false);
   }
   if (cmd == "dump-nsspeeds") {
-    return doDumpToFile(s, pleaseDumpNSSpeeds, cmd);
+    return doDumpToFile(s, pleaseDumpNSSpeeds, cmd, false);
   }
   if (cmd == "dump-failedservers") {
     return doDumpToFile(s, pleaseDumpFailedServers, cmd, false);
@@ -1984,7 +2017,7 @@ RecursorControlChannel::Answer RecursorControlParser::getAnswer(int s, const str
     return doDumpRPZ(s, begin, end);
   }
   if (cmd == "dump-throttlemap") {
-    return doDumpToFile(s, pleaseDumpThrottleMap, cmd);
+    return doDumpToFile(s, pleaseDumpThrottleMap, cmd, false);
   }
   if (cmd == "dump-non-resolving") {
     return doDumpToFile(s, pleaseDumpNonResolvingNS, cmd, false);
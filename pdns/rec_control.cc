@@ -89,6 +89,7 @@ int main(int argc, char** argv)
 {
   const set<string> fileCommands = {
     "dump-cache",
+    "dump-cache-snapshot",
     "dump-edns",
     "dump-ednsstatus",
     "dump-nsspeeds",
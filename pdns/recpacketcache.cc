@@ -10,9 +10,9 @@
 #include "namespaces.hh"
 #include "rec-taskqueue.hh"
 
-RecursorPacketCache::RecursorPacketCache()
+RecursorPacketCache::RecursorPacketCache(size_t shards) :
+  d_maps(std::max(shards, static_cast<size_t>(1)))
 {
-  d_hits = d_misses = 0;
 }
 
 unsigned int RecursorPacketCache::s_refresh_ttlperc{0};
@@ -20,24 +20,28 @@ unsigned int RecursorPacketCache::s_refresh_ttlperc{0};
 int RecursorPacketCache::doWipePacketCache(const DNSName& name, uint16_t qtype, bool subtree)
 {
   int count = 0;
-  auto& idx = d_packetCache.get<NameTag>();
-  for (auto iter = idx.lower_bound(name); iter != idx.end();) {
-    if (subtree) {
-      if (!iter->d_name.isPartOf(name)) { // this is case insensitive
-        break;
+  /* the shard is picked from the hash of the query, so every shard might hold entries for that name */
+  for (auto& map : d_maps) {
+    auto shard = map.lock();
+    auto& idx = shard->d_map.get<NameTag>();
+    for (auto iter = idx.lower_bound(name); iter != idx.end();) {
+      if (subtree) {
+        if (!iter->d_name.isPartOf(name)) { // this is case insensitive
+          break;
+        }
+      }
+      else {
+        if (iter->d_name != name)
+          break;
       }
-    }
-    else {
-      if (iter->d_name != name)
-        break;
-    }
 
-    if (qtype == 0xffff || iter->d_type == qtype) {
-      iter = idx.erase(iter);
-      count++;
+      if (qtype == 0xffff || iter->d_type == qtype) {
+        iter = idx.erase(iter);
+        count++;
+      }
+      else
+        ++iter;
     }
-    else
-      ++iter;
   }
   return count;
 }
@@ -53,7 +57,7 @@ bool RecursorPacketCache::qrMatch(const packetCache_t::index<HashTag>::type::ite
   return queryMatches(iter->d_query, queryPacket, qname, optionsToSkip);
 }
 
-bool RecursorPacketCache::checkResponseMatches(std::pair<packetCache_t::index<HashTag>::type::iterator, packetCache_t::index<HashTag>::type::iterator> range, const std::string& queryPacket, const DNSName& qname, uint16_t qtype, uint16_t qclass, time_t now, std::string* responsePacket, uint32_t* age, vState* valState, OptPBData* pbdata)
+bool RecursorPacketCache::checkResponseMatches(MapCombo::LockedContent& shard, std::pair<packetCache_t::index<HashTag>::type::iterator, packetCache_t::index<HashTag>::type::iterator> range, const std::string& queryPacket, const DNSName& qname, uint16_t qtype, uint16_t qclass, time_t now, std::string* responsePacket, uint32_t* age, vState* valState, OptPBData* pbdata)
 {
   for (auto iter = range.first; iter != range.second; ++iter) {
     // the possibility is VERY real that we get hits that are not right - birthday paradox
@@ -65,10 +69,11 @@ bool RecursorPacketCache::checkResponseMatches(std::pair<packetCache_t::index<Ha
       *age = static_cast<uint32_t>(now - iter->d_creation);
       // we know ttl is > 0
       uint32_t ttl = static_cast<uint32_t>(iter->d_ttd - now);
+      iter->d_hits++;
       if (s_refresh_ttlperc > 0 && !iter->d_submitted) {
         const uint32_t deadline = iter->getOrigTTL() * s_refresh_ttlperc / 100;
         const bool almostExpired = ttl <= deadline;
-        if (almostExpired) {
+        if (almostExpired && almostExpiredTaskWanted(qname, iter->d_hits, iter->getOrigTTL(), ttl, deadline)) {
           iter->d_submitted = true;
           pushAlmostExpiredTask(qname, qtype, iter->d_ttd);
         }
@@ -82,8 +87,8 @@ bool RecursorPacketCache::checkResponseMatches(std::pair<packetCache_t::index<Ha
         responsePacket->replace(sizeof(dnsheader), wirelength, queryPacket, sizeof(dnsheader), wirelength);
       }
 
-      d_hits++;
-      moveCacheItemToBack<SequencedTag>(d_packetCache, iter);
+      shard.d_hits++;
+      moveCacheItemToBack<SequencedTag>(shard.d_map, iter);
 
       if (pbdata != nullptr) {
         if (iter->d_pbdata) {
@@ -97,8 +102,8 @@ bool RecursorPacketCache::checkResponseMatches(std::pair<packetCache_t::index<Ha
       return true;
     }
     else {
-      moveCacheItemToFront<SequencedTag>(d_packetCache, iter);
-      d_misses++;
+      moveCacheItemToFront<SequencedTag>(shard.d_map, iter);
+      shard.d_misses++;
       break;
     }
   }
@@ -128,37 +133,40 @@ bool RecursorPacketCache::getResponsePacket(unsigned int tag, const std::string&
                                             std::string* responsePacket, uint32_t* age, vState* valState, uint32_t* qhash, OptPBData* pbdata, bool tcp)
 {
   *qhash = canHashPacket(queryPacket, s_skipOptions);
-  const auto& idx = d_packetCache.get<HashTag>();
+  auto shard = getMap(*qhash).lock();
+  const auto& idx = shard->d_map.get<HashTag>();
   auto range = idx.equal_range(std::tie(tag, *qhash, tcp));
 
   if (range.first == range.second) {
-    d_misses++;
+    shard->d_misses++;
     return false;
   }
 
-  return checkResponseMatches(range, queryPacket, qname, qtype, qclass, now, responsePacket, age, valState, pbdata);
+  return checkResponseMatches(*shard, range, queryPacket, qname, qtype, qclass, now, responsePacket, age, valState, pbdata);
 }
 
 bool RecursorPacketCache::getResponsePacket(unsigned int tag, const std::string& queryPacket, DNSName& qname, uint16_t* qtype, uint16_t* qclass, time_t now,
                                             std::string* responsePacket, uint32_t* age, vState* valState, uint32_t* qhash, OptPBData* pbdata, bool tcp)
 {
   *qhash = canHashPacket(queryPacket, s_skipOptions);
-  const auto& idx = d_packetCache.get<HashTag>();
+  auto shard = getMap(*qhash).lock();
+  const auto& idx = shard->d_map.get<HashTag>();
   auto range = idx.equal_range(std::tie(tag, *qhash, tcp));
 
   if (range.first == range.second) {
-    d_misses++;
+    shard->d_misses++;
     return false;
   }
 
   qname = DNSName(queryPacket.c_str(), queryPacket.length(), sizeof(dnsheader), false, qtype, qclass, 0);
 
-  return checkResponseMatches(range, queryPacket, qname, *qtype, *qclass, now, responsePacket, age, valState, pbdata);
+  return checkResponseMatches(*shard, range, queryPacket, qname, *qtype, *qclass, now, responsePacket, age, valState, pbdata);
 }
 
 void RecursorPacketCache::insertResponsePacket(unsigned int tag, uint32_t qhash, std::string&& query, const DNSName& qname, uint16_t qtype, uint16_t qclass, std::string&& responsePacket, time_t now, uint32_t ttl, const vState& valState, OptPBData&& pbdata, bool tcp)
 {
-  auto& idx = d_packetCache.get<HashTag>();
+  auto shard = getMap(qhash).lock();
+  auto& idx = shard->d_map.get<HashTag>();
   auto range = idx.equal_range(std::tie(tag, qhash, tcp));
   auto iter = range.first;
 
@@ -167,13 +175,14 @@ void RecursorPacketCache::insertResponsePacket(unsigned int tag, uint32_t qhash,
       continue;
     }
 
-    moveCacheItemToBack<SequencedTag>(d_packetCache, iter);
+    moveCacheItemToBack<SequencedTag>(shard->d_map, iter);
     iter->d_packet = std::move(responsePacket);
     iter->d_query = std::move(query);
     iter->d_ttd = now + ttl;
     iter->d_creation = now;
     iter->d_vstate = valState;
     iter->d_submitted = false;
+    iter->d_hits = 0;
     if (pbdata) {
       iter->d_pbdata = std::move(*pbdata);
     }
@@ -194,27 +203,58 @@ void RecursorPacketCache::insertResponsePacket(unsigned int tag, uint32_t qhash,
       e.d_pbdata = std::move(*pbdata);
     }
 
-    d_packetCache.insert(e);
+    shard->d_map.insert(e);
   }
 }
 
 uint64_t RecursorPacketCache::size()
 {
-  return d_packetCache.size();
+  uint64_t count = 0;
+  for (auto& map : d_maps) {
+    count += map.lock()->d_map.size();
+  }
+  return count;
 }
 
 uint64_t RecursorPacketCache::bytes()
 {
   uint64_t sum = 0;
-  for (const auto& e : d_packetCache) {
-    sum += sizeof(e) + e.d_packet.length() + 4;
+  for (auto& map : d_maps) {
+    auto shard = map.lock();
+    for (const auto& e : shard->d_map) {
+      sum += sizeof(e) + e.d_packet.length() + 4;
+    }
+  }
+  return sum;
+}
+
+uint64_t RecursorPacketCache::getHits()
+{
+  uint64_t sum = 0;
+  for (auto& map : d_maps) {
+    sum += map.lock()->d_hits;
+  }
+  return sum;
+}
+
+uint64_t RecursorPacketCache::getMisses()
+{
+  uint64_t sum = 0;
+  for (auto& map : d_maps) {
+    sum += map.lock()->d_misses;
   }
   return sum;
 }
 
 void RecursorPacketCache::doPruneTo(size_t maxCached)
 {
-  pruneCollection<SequencedTag>(*this, d_packetCache, maxCached);
+  /* spread the remainder over the first shards, so that a limit lower than the number of shards does not empty them all */
+  const size_t maxPerShard = maxCached / d_maps.size();
+  const size_t remainder = maxCached % d_maps.size();
+  for (size_t idx = 0; idx < d_maps.size(); idx++) {
+    auto shard = d_maps[idx].lock();
+    pruneCollection<SequencedTag>(*this, shard->d_map, maxPerShard + (idx < remainder ? 1 : 0));
+  }
 }
 
 uint64_t RecursorPacketCache::doDump(int fd)
@@ -226,17 +266,20 @@ uint64_t RecursorPacketCache::doDump(int fd)
 
   fprintf(fp.get(), "; main packet cache dump from thread follows\n;\n");
 
-  const auto& sidx = d_packetCache.get<SequencedTag>();
   uint64_t count = 0;
   time_t now = time(nullptr);
 
-  for (const auto& i : sidx) {
-    count++;
-    try {
-      fprintf(fp.get(), "%s %" PRId64 " %s  ; tag %d %s\n", i.d_name.toString().c_str(), static_cast<int64_t>(i.d_ttd - now), DNSRecordContent::NumberToType(i.d_type).c_str(), i.d_tag, i.d_tcp ? "tcp" : "udp");
-    }
-    catch (...) {
-      fprintf(fp.get(), "; error printing '%s'\n", i.d_name.empty() ? "EMPTY" : i.d_name.toString().c_str());
+  for (auto& map : d_maps) {
+    auto shard = map.lock();
+    const auto& sidx = shard->d_map.get<SequencedTag>();
+    for (const auto& i : sidx) {
+      count++;
+      try {
+        fprintf(fp.get(), "%s %" PRId64 " %s  ; tag %d %s\n", i.d_name.toString().c_str(), static_cast<int64_t>(i.d_ttd - now), DNSRecordContent::NumberToType(i.d_type).c_str(), i.d_tag, i.d_tcp ? "tcp" : "udp");
+      }
+      catch (...) {
+        fprintf(fp.get(), "; error printing '%s'\n", i.d_name.empty() ? "EMPTY" : i.d_name.toString().c_str());
+      }
     }
   }
   return count;
@@ -32,6 +32,7 @@
 #include <boost/multi_index/key_extractors.hpp>
 #include <boost/optional.hpp>
 
+#include "lock.hh"
 #include "packetcache.hh"
 #include "validate.hh"
 
@@ -41,11 +42,14 @@
 
 using namespace ::boost::multi_index;
 
-//! Stores whole packets, ready for lobbing back at the client. Not threadsafe.
+//! Stores whole packets, ready for lobbing back at the client.
 /* Note: we store answers as value AND KEY, and with careful work, we make sure that
    you can use a query as a key too. But query and answer must compare as identical! 
    
-   This precludes doing anything smart with EDNS directly from the packet */
+   This precludes doing anything smart with EDNS directly from the packet.
+
+   The entries are spread over shards, picked from the hash of the query, each protected by its own lock,
+   so a single instance can be shared by all threads. A per-thread instance only needs one shard. */
 class RecursorPacketCache : public PacketCache
 {
 public:
@@ -59,7 +63,7 @@ public:
   };
   typedef boost::optional<PBData> OptPBData;
 
-  RecursorPacketCache();
+  RecursorPacketCache(size_t shards = 1);
   bool getResponsePacket(unsigned int tag, const std::string& queryPacket, time_t now, std::string* responsePacket, uint32_t* age, uint32_t* qhash);
   bool getResponsePacket(unsigned int tag, const std::string& queryPacket, const DNSName& qname, uint16_t qtype, uint16_t qclass, time_t now, std::string* responsePacket, uint32_t* age, uint32_t* qhash);
   bool getResponsePacket(unsigned int tag, const std::string& queryPacket, const DNSName& qname, uint16_t qtype, uint16_t qclass, time_t now, std::string* responsePacket, uint32_t* age, vState* valState, uint32_t* qhash, OptPBData* pbdata, bool tcp);
@@ -71,9 +75,10 @@ public:
   int doWipePacketCache(const DNSName& name, uint16_t qtype = 0xffff, bool subtree = false);
 
   void prune();
-  uint64_t d_hits, d_misses;
   uint64_t size();
   uint64_t bytes();
+  uint64_t getHits();
+  uint64_t getMisses();
 
 private:
   struct HashTag
@@ -100,6 +105,7 @@ private:
     uint16_t d_type;
     uint16_t d_class;
     mutable vState d_vstate;
+    mutable uint32_t d_hits{0}; // since the entry was created, to decide whether it's worth refreshing
     mutable bool d_submitted{false}; // whether this entry has been queued for refetch
     bool d_tcp; // whether this entry was created from a TCP query
     inline bool operator<(const struct Entry& rhs) const;
@@ -130,8 +136,33 @@ private:
       ordered_non_unique<tag<NameTag>, member<Entry, DNSName, &Entry::d_name>, CanonDNSNameCompare>>>
     packetCache_t;
 
-  packetCache_t d_packetCache;
+  struct MapCombo
+  {
+    MapCombo() {}
+    MapCombo(const MapCombo&) = delete;
+    MapCombo& operator=(const MapCombo&) = delete;
+    struct LockedContent
+    {
+      packetCache_t d_map;
+      uint64_t d_hits{0};
+      uint64_t d_misses{0};
+    };
+
+    LockGuardedHolder<LockedContent> lock()
+    {
+      return d_content.lock();
+    }
+
+  private:
+    LockGuarded<LockedContent> d_content;
+  };
+
+  vector<MapCombo> d_maps;
+  MapCombo& getMap(uint32_t qhash)
+  {
+    return d_maps.at(qhash % d_maps.size());
+  }
 
   static bool qrMatch(const packetCache_t::index<HashTag>::type::iterator& iter, const std::string& queryPacket, const DNSName& qname, uint16_t qtype, uint16_t qclass);
-  bool checkResponseMatches(std::pair<packetCache_t::index<HashTag>::type::iterator, packetCache_t::index<HashTag>::type::iterator> range, const std::string& queryPacket, const DNSName& qname, uint16_t qtype, uint16_t qclass, time_t now, std::string* responsePacket, uint32_t* age, vState* valState, OptPBData* pbdata);
+  static bool checkResponseMatches(MapCombo::LockedContent& shard, std::pair<packetCache_t::index<HashTag>::type::iterator, packetCache_t::index<HashTag>::type::iterator> range, const std::string& queryPacket, const DNSName& qname, uint16_t qtype, uint16_t qclass, time_t now, std::string* responsePacket, uint32_t* age, vState* valState, OptPBData* pbdata);
 };
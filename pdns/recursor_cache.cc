@@ -14,12 +14,169 @@
 #include "namespaces.hh"
 #include "cachecleaner.hh"
 #include "rec-taskqueue.hh"
+#include "rec-snapshot.hh"
 
-MemRecursorCache::MemRecursorCache(size_t mapsCount) :
-  d_maps(mapsCount)
+MemRecursorCache::MemRecursorCache(size_t mapsCount, bool packedRecords) :
+  d_maps(mapsCount), d_packedRecords(packedRecords)
 {
 }
 
+bool MemRecursorCache::CacheEntry::RecordSet::pack(const DNSName& qname, const vector<DNSRecord>& records, const vector<std::shared_ptr<RRSIGRecordContent>>& signatures)
+{
+  const size_t count = records.size() + signatures.size();
+  if (count == 0 || count > std::numeric_limits<uint16_t>::max()) {
+    return false;
+  }
+
+  std::string packed;
+  auto add = [&packed, &qname](DNSRecordContent& content) {
+    /* canonic so that names are not compressed, as the records will not be at the same position when unpacked */
+    const auto rdata = content.serialize(qname, true);
+    if (rdata.size() > std::numeric_limits<uint16_t>::max()) {
+      return false;
+    }
+    packed.push_back(static_cast<char>(rdata.size() >> 8));
+    packed.push_back(static_cast<char>(rdata.size() & 0xff));
+    packed.append(rdata);
+    return true;
+  };
+
+  try {
+    for (const auto& record : records) {
+      if (!record.d_content || !add(*record.d_content)) {
+        return false;
+      }
+    }
+    for (const auto& signature : signatures) {
+      if (!signature || !add(*signature)) {
+        return false;
+      }
+    }
+  }
+  catch (const std::exception&) {
+    return false;
+  }
+  catch (const PDNSException&) {
+    return false;
+  }
+
+  /* unpack() builds a packet holding the qname once then a record header and a compression pointer per record */
+  if (sizeof(dnsheader) + qname.getStorage().size() + 4 + count * (2 + sizeof(dnsrecordheader)) + packed.size() > std::numeric_limits<uint16_t>::max()) {
+    return false;
+  }
+
+  packed.shrink_to_fit();
+  d_packed = std::move(packed);
+  d_packedRecordsCount = records.size();
+  d_packedSignaturesCount = signatures.size();
+  return true;
+}
+
+void MemRecursorCache::CacheEntry::RecordSet::unpack(const DNSName& qname, QType qtype, records_t* records, vector<std::shared_ptr<RRSIGRecordContent>>* signatures) const
+{
+  /* build a pseudo-packet with the qname in the question section and one answer per record,
+     the owner name of each answer being a compression pointer to the qname */
+  const auto& encoded = qname.getStorage();
+  const size_t count = d_packedRecordsCount + d_packedSignaturesCount;
+  const uint16_t qnamePos = sizeof(dnsheader);
+
+  std::string packet;
+  packet.reserve(sizeof(dnsheader) + encoded.size() + 4 + count * (2 + sizeof(dnsrecordheader)) + d_packed.size());
+
+  dnsheader dh;
+  memset(&dh, 0, sizeof(dh));
+  dh.qdcount = htons(1);
+  dh.ancount = htons(count);
+  packet.append(reinterpret_cast<const char*>(&dh), sizeof(dh));
+  packet.append(encoded.c_str(), encoded.size());
+  const uint16_t qtypeAndClass[2] = {htons(qtype.getCode()), htons(QClass::IN)};
+  packet.append(reinterpret_cast<const char*>(qtypeAndClass), sizeof(qtypeAndClass));
+
+  size_t pos = 0;
+  for (size_t idx = 0; idx < count; idx++) {
+    const uint16_t rdlength = (static_cast<uint8_t>(d_packed.at(pos)) << 8) + static_cast<uint8_t>(d_packed.at(pos + 1));
+    pos += 2;
+
+    packet.push_back(static_cast<char>(0xc0 | (qnamePos >> 8)));
+    packet.push_back(static_cast<char>(qnamePos & 0xff));
+    dnsrecordheader drh;
+    drh.d_type = htons(idx < d_packedRecordsCount ? qtype.getCode() : static_cast<uint16_t>(QType::RRSIG));
+    drh.d_class = htons(QClass::IN);
+    drh.d_ttl = 0;
+    drh.d_clen = htons(rdlength);
+    packet.append(reinterpret_cast<const char*>(&drh), sizeof(drh));
+    packet.append(d_packed, pos, rdlength);
+    pos += rdlength;
+  }
+
+  MOADNSParser mdp(false, packet);
+  size_t idx = 0;
+  for (const auto& answer : mdp.d_answers) {
+    if (idx < d_packedRecordsCount) {
+      if (records) {
+        records->push_back(answer.first.d_content);
+      }
+    }
+    else if (signatures) {
+      auto rrsig = std::dynamic_pointer_cast<RRSIGRecordContent>(answer.first.d_content);
+      if (rrsig) {
+        signatures->push_back(std::move(rrsig));
+      }
+    }
+    idx++;
+  }
+}
+
+/* the in-memory size of a record content is not known, so we use the size of its wire format plus the size of the object itself as an estimate.
+   The wire length is passed when the record has been parsed from a packet, so that we only need to serialize the ones we built ourselves. */
+static size_t contentBytes(DNSRecordContent& content, uint16_t wireLength)
+{
+  size_t ret = sizeof(content);
+  if (wireLength > 0) {
+    return ret + wireLength;
+  }
+  try {
+    ret += content.serialize(g_rootdnsname, true).size();
+  }
+  catch (const std::exception&) {
+  }
+  catch (const PDNSException&) {
+  }
+  return ret;
+}
+
+void MemRecursorCache::CacheEntry::RecordSet::computeBytes(const vector<DNSRecord>& records)
+{
+  /* the name of the zone is interned, and shared with the other entries from that zone */
+  size_t ret = sizeof(*this);
+  ret += d_packed.capacity();
+  ret += d_records.capacity() * sizeof(records_t::value_type);
+  if (!isPacked()) {
+    for (const auto& record : records) {
+      if (record.d_content) {
+        ret += contentBytes(*record.d_content, record.d_clen);
+      }
+    }
+  }
+  ret += d_signatures.capacity() * sizeof(std::shared_ptr<RRSIGRecordContent>);
+  for (const auto& signature : d_signatures) {
+    if (signature) {
+      /* fixed part of the RDATA, then the signer and the signature */
+      ret += sizeof(*signature) + 18 + signature->d_signer.getStorage().size() + signature->d_signature.size();
+    }
+  }
+  ret += d_authorityRecs.capacity() * sizeof(std::shared_ptr<DNSRecord>);
+  for (const auto& record : d_authorityRecs) {
+    if (record) {
+      ret += sizeof(*record) + record->d_name.getStorage().size();
+      if (record->d_content) {
+        ret += contentBytes(*record->d_content, record->d_clen);
+      }
+    }
+  }
+  d_bytes = ret;
+}
+
 size_t MemRecursorCache::size() const
 {
   size_t count = 0;
@@ -59,9 +216,9 @@ size_t MemRecursorCache::bytes()
     auto m = mc.lock();
     for (const auto& i : m->d_map) {
       ret += sizeof(struct CacheEntry);
-      ret += i.d_qname.toString().length();
-      for (const auto& record : i.d_records) {
-        ret += sizeof(record); // XXX WRONG we don't know the stored size!
+      ret += i.d_qname.getStorage().size();
+      if (i.d_recordSet) {
+        ret += i.d_recordSet->bytes();
       }
     }
   }
@@ -100,7 +257,7 @@ static void updateDNSSECValidationStateFromCache(boost::optional<vState>& state,
   }
 }
 
-time_t MemRecursorCache::handleHit(MapCombo::LockedContent& content, MemRecursorCache::OrderedTagIterator_t& entry, const DNSName& qname, uint32_t& origTTL, vector<DNSRecord>* res, vector<std::shared_ptr<RRSIGRecordContent>>* signatures, std::vector<std::shared_ptr<DNSRecord>>* authorityRecs, bool* variable, boost::optional<vState>& state, bool* wasAuth, DNSName* fromAuthZone, ComboAddress* fromAuthIP)
+time_t MemRecursorCache::handleHit(MapCombo::LockedContent& content, MemRecursorCache::OrderedTagIterator_t& entry, uint32_t& origTTL, std::vector<Hit>* hits, bool* variable, boost::optional<vState>& state, bool* wasAuth, ComboAddress* fromAuthIP)
 {
   // MUTEX SHOULD BE ACQUIRED (as indicated by the reference to the content which is protected by a lock)
   time_t ttd = entry->d_ttd;
@@ -110,28 +267,10 @@ time_t MemRecursorCache::handleHit(MapCombo::LockedContent& content, MemRecursor
     *variable = true;
   }
 
-  if (res) {
-    res->reserve(res->size() + entry->d_records.size());
-
-    for (const auto& k : entry->d_records) {
-      DNSRecord dr;
-      dr.d_name = qname;
-      dr.d_type = entry->d_qtype;
-      dr.d_class = QClass::IN;
-      dr.d_content = k;
-      dr.d_ttl = static_cast<uint32_t>(entry->d_ttd); // XXX truncation
-      dr.d_place = DNSResourceRecord::ANSWER;
-      res->push_back(std::move(dr));
-    }
-  }
-
-  if (signatures) {
-    signatures->insert(signatures->end(), entry->d_signatures.begin(), entry->d_signatures.end());
-  }
-
-  if (authorityRecs) {
-    authorityRecs->insert(authorityRecs->end(), entry->d_authorityRecs.begin(), entry->d_authorityRecs.end());
+  if (hits) {
+    hits->push_back({entry->d_recordSet, entry->d_ttd, entry->d_qtype});
   }
+  entry->d_hits++;
 
   updateDNSSECValidationStateFromCache(state, entry->d_state);
 
@@ -139,10 +278,6 @@ time_t MemRecursorCache::handleHit(MapCombo::LockedContent& content, MemRecursor
     *wasAuth = *wasAuth && entry->d_auth;
   }
 
-  if (fromAuthZone) {
-    *fromAuthZone = entry->d_authZone;
-  }
-
   if (fromAuthIP) {
     *fromAuthIP = entry->d_from;
   }
@@ -152,6 +287,50 @@ time_t MemRecursorCache::handleHit(MapCombo::LockedContent& content, MemRecursor
   return ttd;
 }
 
+void MemRecursorCache::copyHits(const std::vector<Hit>& hits, const DNSName& qname, vector<DNSRecord>* res, vector<std::shared_ptr<RRSIGRecordContent>>* signatures, std::vector<std::shared_ptr<DNSRecord>>* authorityRecs, DNSName* fromAuthZone)
+{
+  // the lock is NOT held, the record sets are immutable
+  for (const auto& hit : hits) {
+    const auto& recordSet = *hit.d_recordSet;
+    const auto* records = &recordSet.d_records;
+    const auto* sigs = &recordSet.d_signatures;
+    CacheEntry::records_t unpackedRecords;
+    vector<std::shared_ptr<RRSIGRecordContent>> unpackedSignatures;
+    if (recordSet.isPacked() && (res || signatures)) {
+      recordSet.unpack(qname, hit.d_qtype, res ? &unpackedRecords : nullptr, signatures ? &unpackedSignatures : nullptr);
+      records = &unpackedRecords;
+      sigs = &unpackedSignatures;
+    }
+
+    if (res) {
+      res->reserve(res->size() + records->size());
+
+      for (const auto& k : *records) {
+        DNSRecord dr;
+        dr.d_name = qname;
+        dr.d_type = hit.d_qtype;
+        dr.d_class = QClass::IN;
+        dr.d_content = k;
+        dr.d_ttl = static_cast<uint32_t>(hit.d_ttd); // XXX truncation
+        dr.d_place = DNSResourceRecord::ANSWER;
+        res->push_back(std::move(dr));
+      }
+    }
+
+    if (signatures) {
+      signatures->insert(signatures->end(), sigs->begin(), sigs->end());
+    }
+
+    if (authorityRecs) {
+      authorityRecs->insert(authorityRecs->end(), recordSet.d_authorityRecs.begin(), recordSet.d_authorityRecs.end());
+    }
+
+    if (fromAuthZone) {
+      *fromAuthZone = recordSet.d_authZone.get();
+    }
+  }
+}
+
 MemRecursorCache::cache_t::const_iterator MemRecursorCache::getEntryUsingECSIndex(MapCombo::LockedContent& map, time_t now, const DNSName& qname, const QType qtype, bool requireAuth, const ComboAddress& who)
 {
   // MUTEX SHOULD BE ACQUIRED (as indicated by the reference to the content which is protected by a lock)
@@ -251,7 +430,7 @@ time_t MemRecursorCache::fakeTTD(MemRecursorCache::OrderedTagIterator_t& entry,
         return -1;
       }
       else {
-        if (!entry->d_submitted) {
+        if (!entry->d_submitted && almostExpiredTaskWanted(qname, entry->d_hits, origTTL, static_cast<uint32_t>(ttl), deadline)) {
           if (qtype == QType::ADDR) {
             pushAlmostExpiredTask(qname, QType::A, entry->d_ttd);
             pushAlmostExpiredTask(qname, QType::AAAA, entry->d_ttd);
@@ -266,38 +445,26 @@ time_t MemRecursorCache::fakeTTD(MemRecursorCache::OrderedTagIterator_t& entry,
   }
   return ttl;
 }
-// returns -1 for no hits
-time_t MemRecursorCache::get(time_t now, const DNSName& qname, const QType qt, bool requireAuth, vector<DNSRecord>* res, const ComboAddress& who, bool refresh, const OptTag& routingTag, vector<std::shared_ptr<RRSIGRecordContent>>* signatures, std::vector<std::shared_ptr<DNSRecord>>* authorityRecs, bool* variable, vState* state, bool* wasAuth, DNSName* fromAuthZone, ComboAddress* fromAuthIP)
+
+time_t MemRecursorCache::lookup(MapCombo::LockedContent& map, time_t now, const DNSName& qname, const QType qt, bool requireAuth, const ComboAddress& who, bool refresh, const OptTag& routingTag, std::vector<Hit>* hits, bool* variable, boost::optional<vState>& cachedState, bool* wasAuth, ComboAddress* fromAuthIP)
 {
-  boost::optional<vState> cachedState{boost::none};
+  // MUTEX SHOULD BE ACQUIRED (as indicated by the reference to the content which is protected by a lock)
   uint32_t origTTL;
-
-  if (res) {
-    res->clear();
-  }
   const uint16_t qtype = qt.getCode();
-  if (wasAuth) {
-    // we might retrieve more than one entry, we need to set that to true
-    // so it will be set to false if at least one entry is not auth
-    *wasAuth = true;
-  }
-
-  auto& mc = getMap(qname);
-  auto map = mc.lock();
 
   /* If we don't have any netmask-specific entries at all, let's just skip this
      to be able to use the nice d_cachecache hack. */
-  if (qtype != QType::ANY && !map->d_ecsIndex.empty() && !routingTag) {
+  if (qtype != QType::ANY && !map.d_ecsIndex.empty() && !routingTag) {
     if (qtype == QType::ADDR) {
       time_t ret = -1;
 
-      auto entryA = getEntryUsingECSIndex(*map, now, qname, QType::A, requireAuth, who);
-      if (entryA != map->d_map.end()) {
-        ret = handleHit(*map, entryA, qname, origTTL, res, signatures, authorityRecs, variable, cachedState, wasAuth, fromAuthZone, fromAuthIP);
+      auto entryA = getEntryUsingECSIndex(map, now, qname, QType::A, requireAuth, who);
+      if (entryA != map.d_map.end()) {
+        ret = handleHit(map, entryA, origTTL, hits, variable, cachedState, wasAuth, fromAuthIP);
       }
-      auto entryAAAA = getEntryUsingECSIndex(*map, now, qname, QType::AAAA, requireAuth, who);
-      if (entryAAAA != map->d_map.end()) {
-        time_t ttdAAAA = handleHit(*map, entryAAAA, qname, origTTL, res, signatures, authorityRecs, variable, cachedState, wasAuth, fromAuthZone, fromAuthIP);
+      auto entryAAAA = getEntryUsingECSIndex(map, now, qname, QType::AAAA, requireAuth, who);
+      if (entryAAAA != map.d_map.end()) {
+        time_t ttdAAAA = handleHit(map, entryAAAA, origTTL, hits, variable, cachedState, wasAuth, fromAuthIP);
         if (ret > 0) {
           ret = std::min(ret, ttdAAAA);
         }
@@ -306,19 +473,12 @@ time_t MemRecursorCache::get(time_t now, const DNSName& qname, const QType qt, b
         }
       }
 
-      if (state && cachedState) {
-        *state = *cachedState;
-      }
-
       return ret > 0 ? (ret - now) : ret;
     }
     else {
-      auto entry = getEntryUsingECSIndex(*map, now, qname, qtype, requireAuth, who);
-      if (entry != map->d_map.end()) {
-        time_t ret = handleHit(*map, entry, qname, origTTL, res, signatures, authorityRecs, variable, cachedState, wasAuth, fromAuthZone, fromAuthIP);
-        if (state && cachedState) {
-          *state = *cachedState;
-        }
+      auto entry = getEntryUsingECSIndex(map, now, qname, qtype, requireAuth, who);
+      if (entry != map.d_map.end()) {
+        time_t ret = handleHit(map, entry, origTTL, hits, variable, cachedState, wasAuth, fromAuthIP);
         return fakeTTD(entry, qname, qtype, ret, now, origTTL, refresh);
       }
       return -1;
@@ -326,17 +486,17 @@ time_t MemRecursorCache::get(time_t now, const DNSName& qname, const QType qt, b
   }
 
   if (routingTag) {
-    auto entries = getEntries(*map, qname, qt, routingTag);
+    auto entries = getEntries(map, qname, qt, routingTag);
     bool found = false;
     time_t ttd;
 
     if (entries.first != entries.second) {
       OrderedTagIterator_t firstIndexIterator;
       for (auto i = entries.first; i != entries.second; ++i) {
-        firstIndexIterator = map->d_map.project<OrderedTag>(i);
+        firstIndexIterator = map.d_map.project<OrderedTag>(i);
 
         if (i->d_ttd <= now) {
-          moveCacheItemToFront<SequencedTag>(map->d_map, firstIndexIterator);
+          moveCacheItemToFront<SequencedTag>(map.d_map, firstIndexIterator);
           continue;
         }
 
@@ -344,16 +504,13 @@ time_t MemRecursorCache::get(time_t now, const DNSName& qname, const QType qt, b
           continue;
         }
         found = true;
-        ttd = handleHit(*map, firstIndexIterator, qname, origTTL, res, signatures, authorityRecs, variable, cachedState, wasAuth, fromAuthZone, fromAuthIP);
+        ttd = handleHit(map, firstIndexIterator, origTTL, hits, variable, cachedState, wasAuth, fromAuthIP);
 
         if (qt != QType::ANY && qt != QType::ADDR) { // normally if we have a hit, we are done
           break;
         }
       }
       if (found) {
-        if (state && cachedState) {
-          *state = *cachedState;
-        }
         return fakeTTD(firstIndexIterator, qname, qtype, ttd, now, origTTL, refresh);
       }
       else {
@@ -362,7 +519,7 @@ time_t MemRecursorCache::get(time_t now, const DNSName& qname, const QType qt, b
     }
   }
   // Try (again) without tag
-  auto entries = getEntries(*map, qname, qt, boost::none);
+  auto entries = getEntries(map, qname, qt, boost::none);
 
   if (entries.first != entries.second) {
     OrderedTagIterator_t firstIndexIterator;
@@ -370,10 +527,10 @@ time_t MemRecursorCache::get(time_t now, const DNSName& qname, const QType qt, b
     time_t ttd;
 
     for (auto i = entries.first; i != entries.second; ++i) {
-      firstIndexIterator = map->d_map.project<OrderedTag>(i);
+      firstIndexIterator = map.d_map.project<OrderedTag>(i);
 
       if (i->d_ttd <= now) {
-        moveCacheItemToFront<SequencedTag>(map->d_map, firstIndexIterator);
+        moveCacheItemToFront<SequencedTag>(map.d_map, firstIndexIterator);
         continue;
       }
 
@@ -382,24 +539,68 @@ time_t MemRecursorCache::get(time_t now, const DNSName& qname, const QType qt, b
       }
 
       found = true;
-      ttd = handleHit(*map, firstIndexIterator, qname, origTTL, res, signatures, authorityRecs, variable, cachedState, wasAuth, fromAuthZone, fromAuthIP);
+      ttd = handleHit(map, firstIndexIterator, origTTL, hits, variable, cachedState, wasAuth, fromAuthIP);
 
       if (qt != QType::ANY && qt != QType::ADDR) { // normally if we have a hit, we are done
         break;
       }
     }
     if (found) {
-      if (state && cachedState) {
-        *state = *cachedState;
-      }
       return fakeTTD(firstIndexIterator, qname, qtype, ttd, now, origTTL, refresh);
     }
   }
   return -1;
 }
 
+// returns -1 for no hits
+time_t MemRecursorCache::get(time_t now, const DNSName& qname, const QType qt, bool requireAuth, vector<DNSRecord>* res, const ComboAddress& who, bool refresh, const OptTag& routingTag, vector<std::shared_ptr<RRSIGRecordContent>>* signatures, std::vector<std::shared_ptr<DNSRecord>>* authorityRecs, bool* variable, vState* state, bool* wasAuth, DNSName* fromAuthZone, ComboAddress* fromAuthIP)
+{
+  boost::optional<vState> cachedState{boost::none};
+
+  if (res) {
+    res->clear();
+  }
+  if (wasAuth) {
+    // we might retrieve more than one entry, we need to set that to true
+    // so it will be set to false if at least one entry is not auth
+    *wasAuth = true;
+  }
+
+  const bool wantRecords = res || signatures || authorityRecs || fromAuthZone;
+  std::vector<Hit> hits;
+  time_t ret;
+  {
+    auto& mc = getMap(qname);
+    auto map = mc.lock();
+    ret = lookup(*map, now, qname, qt, requireAuth, who, refresh, routingTag, wantRecords ? &hits : nullptr, variable, cachedState, wasAuth, fromAuthIP);
+  }
+
+  copyHits(hits, qname, res, signatures, authorityRecs, fromAuthZone);
+
+  if (state && cachedState) {
+    *state = *cachedState;
+  }
+
+  return ret;
+}
+
 void MemRecursorCache::replace(time_t now, const DNSName& qname, const QType qt, const vector<DNSRecord>& content, const vector<shared_ptr<RRSIGRecordContent>>& signatures, const std::vector<std::shared_ptr<DNSRecord>>& authorityRecs, bool auth, const DNSName& authZone, boost::optional<Netmask> ednsmask, const OptTag& routingTag, vState state, boost::optional<ComboAddress> from)
 {
+  /* build the new version of the records before taking the lock */
+  auto recordSet = std::make_shared<CacheEntry::RecordSet>();
+  if (!d_packedRecords || !recordSet->pack(qname, content, signatures)) {
+    recordSet->d_signatures = signatures;
+    recordSet->d_records.reserve(content.size());
+    for (const auto& i : content) {
+      recordSet->d_records.push_back(i.d_content);
+    }
+  }
+  recordSet->d_authorityRecs = authorityRecs;
+  if (!authZone.empty()) {
+    recordSet->d_authZone = InternedDNSName(authZone);
+  }
+  recordSet->computeBytes(content);
+
   auto& mc = getMap(qname);
   auto map = mc.lock();
 
@@ -472,11 +673,7 @@ void MemRecursorCache::replace(time_t now, const DNSName& qname, const QType qt,
     ce.d_auth = true;
   }
 
-  ce.d_signatures = signatures;
-  ce.d_authorityRecs = authorityRecs;
-  ce.d_records.clear();
-  ce.d_records.reserve(content.size());
-  ce.d_authZone = authZone;
+  ce.d_recordSet = std::move(recordSet);
   if (from) {
     ce.d_from = *from;
   }
@@ -489,13 +686,13 @@ void MemRecursorCache::replace(time_t now, const DNSName& qname, const QType qt,
        prior to calling this function, so the TTL actually holds a TTD. */
     ce.d_ttd = min(maxTTD, static_cast<time_t>(i.d_ttl)); // XXX this does weird things if TTLs differ in the set
     ce.d_orig_ttl = ce.d_ttd - now;
-    ce.d_records.push_back(i.d_content);
   }
 
   if (!isNew) {
     moveCacheItemToBack<SequencedTag>(map->d_map, stored);
   }
   ce.d_submitted = false;
+  ce.d_hits = 0;
   map->d_map.replace(stored, ce);
 }
 
@@ -648,31 +845,60 @@ uint64_t MemRecursorCache::doDump(int fd)
   if (newfd == -1) {
     return 0;
   }
+  /* declared before fp so that it outlives it */
+  std::vector<char> buffer(s_dumpBufferSize);
   auto fp = std::unique_ptr<FILE, int (*)(FILE*)>(fdopen(newfd, "w"), fclose);
   if (!fp) { // dup probably failed
     close(newfd);
     return 0;
   }
+  setvbuf(fp.get(), buffer.data(), _IOFBF, buffer.size());
 
   fprintf(fp.get(), "; main record cache dump follows\n;\n");
   uint64_t count = 0;
 
+  std::vector<CacheEntry> entries;
   for (auto& mc : d_maps) {
-    auto map = mc.lock();
-    const auto& sidx = map->d_map.get<SequencedTag>();
+    /* take a snapshot of the shard, so that the lock is not held while we format and write
+       the entries. The records themselves are immutable and shared, not copied. */
+    entries.clear();
+    {
+      auto map = mc.lock();
+      const auto& sidx = map->d_map.get<SequencedTag>();
+      entries.reserve(sidx.size());
+      for (const auto& i : sidx) {
+        entries.push_back(i);
+      }
+    }
 
     time_t now = time(nullptr);
-    for (const auto& i : sidx) {
-      for (const auto& j : i.d_records) {
+    for (const auto& i : entries) {
+      if (!i.d_recordSet) {
+        continue;
+      }
+      CacheEntry::records_t records;
+      vector<std::shared_ptr<RRSIGRecordContent>> signatures;
+      if (i.d_recordSet->isPacked()) {
+        try {
+          i.d_recordSet->unpack(i.d_qname, i.d_qtype, &records, &signatures);
+        }
+        catch (...) {
+          fprintf(fp.get(), "; error unpacking '%s'\n", i.d_qname.empty() ? "EMPTY" : i.d_qname.toString().c_str());
+          continue;
+        }
+      }
+      const auto& recs = i.d_recordSet->isPacked() ? records : i.d_recordSet->d_records;
+      const auto& sigs = i.d_recordSet->isPacked() ? signatures : i.d_recordSet->d_signatures;
+      for (const auto& j : recs) {
         count++;
         try {
-          fprintf(fp.get(), "%s %" PRIu32 " %" PRId64 " IN %s %s ; (%s) auth=%i zone=%s from=%s %s %s\n", i.d_qname.toString().c_str(), i.d_orig_ttl, static_cast<int64_t>(i.d_ttd - now), i.d_qtype.toString().c_str(), j->getZoneRepresentation().c_str(), vStateToString(i.d_state).c_str(), i.d_auth, i.d_authZone.toLogString().c_str(), i.d_from.toString().c_str(), i.d_netmask.empty() ? "" : i.d_netmask.toString().c_str(), !i.d_rtag ? "" : i.d_rtag.get().c_str());
+          fprintf(fp.get(), "%s %" PRIu32 " %" PRId64 " IN %s %s ; (%s) auth=%i zone=%s from=%s %s %s\n", i.d_qname.toString().c_str(), i.d_orig_ttl, static_cast<int64_t>(i.d_ttd - now), i.d_qtype.toString().c_str(), j->getZoneRepresentation().c_str(), vStateToString(i.d_state).c_str(), i.d_auth, i.d_recordSet->d_authZone->toLogString().c_str(), i.d_from.toString().c_str(), i.d_netmask.empty() ? "" : i.d_netmask.toString().c_str(), !i.d_rtag ? "" : i.d_rtag.get().c_str());
         }
         catch (...) {
           fprintf(fp.get(), "; error printing '%s'\n", i.d_qname.empty() ? "EMPTY" : i.d_qname.toString().c_str());
         }
       }
-      for (const auto& sig : i.d_signatures) {
+      for (const auto& sig : sigs) {
         count++;
         try {
           fprintf(fp.get(), "%s %" PRIu32 " %" PRId64 " IN RRSIG %s ; %s\n", i.d_qname.toString().c_str(), i.d_orig_ttl, static_cast<int64_t>(i.d_ttd - now), sig->getZoneRepresentation().c_str(), i.d_netmask.empty() ? "" : i.d_netmask.toString().c_str());
@@ -686,11 +912,150 @@ uint64_t MemRecursorCache::doDump(int fd)
   return count;
 }
 
-void MemRecursorCache::doPrune(size_t keep)
+uint64_t MemRecursorCache::saveSnapshot(FILE* fp, time_t now)
+{
+  pdns::snapshot::SectionWriter writer(fp, pdns::snapshot::Section::RecordCache);
+  std::vector<CacheEntry> entries;
+  for (auto& mc : d_maps) {
+    entries.clear();
+    {
+      auto map = mc.lock();
+      entries.reserve(map->d_map.size());
+      for (const auto& entry : map->d_map) {
+        if (entry.d_ttd > now) {
+          entries.push_back(entry);
+        }
+      }
+    }
+
+    for (const auto& entry : entries) {
+      /* the records are always stored packed in a snapshot, so that they can be loaded as-is when packing is enabled */
+      const CacheEntry::RecordSet* recordSet = entry.d_recordSet.get();
+      CacheEntry::RecordSet packed;
+      if (!recordSet->isPacked()) {
+        vector<DNSRecord> records;
+        records.reserve(recordSet->d_records.size());
+        for (const auto& content : recordSet->d_records) {
+          DNSRecord record;
+          record.d_content = content;
+          records.push_back(std::move(record));
+        }
+        if (!packed.pack(entry.d_qname, records, recordSet->d_signatures)) {
+          continue;
+        }
+        recordSet = &packed;
+      }
+
+      auto& encoder = writer.encoder();
+      encoder.putName(entry.d_qname);
+      encoder.putUInt16(entry.d_qtype.getCode());
+      encoder.putUInt8(entry.d_rtag ? 1 : 0);
+      if (entry.d_rtag) {
+        encoder.putString(*entry.d_rtag);
+      }
+      encoder.putNetmask(entry.d_netmask);
+      encoder.putAddress(entry.d_from);
+      encoder.putUInt64(entry.d_ttd);
+      encoder.putUInt32(entry.d_orig_ttl);
+      encoder.putState(entry.d_state);
+      encoder.putUInt8(entry.d_auth ? 1 : 0);
+      encoder.putName(entry.d_recordSet->d_authZone.get());
+      encoder.putUInt16(recordSet->d_packedRecordsCount);
+      encoder.putUInt16(recordSet->d_packedSignaturesCount);
+      encoder.putString(recordSet->d_packed);
+      encoder.putUInt16(entry.d_recordSet->d_authorityRecs.size());
+      for (const auto& record : entry.d_recordSet->d_authorityRecs) {
+        encoder.putRecord(*record);
+      }
+      writer.entryDone();
+    }
+  }
+
+  writer.flush();
+  return writer.getEntriesCount();
+}
+
+size_t MemRecursorCache::loadSnapshotSection(pdns::snapshot::Decoder& decoder, uint32_t entries, time_t now)
+{
+  size_t loaded = 0;
+  for (uint32_t idx = 0; idx < entries; idx++) {
+    const auto qname = decoder.getName();
+    const QType qtype(decoder.getUInt16());
+    OptTag rtag;
+    if (decoder.getUInt8() != 0) {
+      rtag = decoder.getString();
+    }
+    const auto netmask = decoder.getNetmask();
+    const auto from = decoder.getAddress();
+    const time_t ttd = decoder.getUInt64();
+    const auto origTTL = decoder.getUInt32();
+    const auto state = decoder.getState();
+    const bool auth = decoder.getUInt8() != 0;
+    auto recordSet = std::make_shared<CacheEntry::RecordSet>();
+    const auto authZone = decoder.getName();
+    if (!authZone.empty()) {
+      recordSet->d_authZone = InternedDNSName(authZone);
+    }
+    recordSet->d_packedRecordsCount = decoder.getUInt16();
+    recordSet->d_packedSignaturesCount = decoder.getUInt16();
+    recordSet->d_packed = decoder.getString();
+    const auto authorityRecsCount = decoder.getUInt16();
+    recordSet->d_authorityRecs.reserve(authorityRecsCount);
+    for (uint16_t authIdx = 0; authIdx < authorityRecsCount; authIdx++) {
+      recordSet->d_authorityRecs.push_back(std::make_shared<DNSRecord>(decoder.getRecord()));
+    }
+
+    if (ttd <= now || recordSet->d_packedRecordsCount + recordSet->d_packedSignaturesCount == 0) {
+      continue;
+    }
+
+    vector<DNSRecord> records;
+    if (!d_packedRecords) {
+      recordSet->unpack(qname, qtype, &recordSet->d_records, &recordSet->d_signatures);
+      std::string().swap(recordSet->d_packed);
+      records.reserve(recordSet->d_records.size());
+      for (const auto& content : recordSet->d_records) {
+        DNSRecord record;
+        record.d_content = content;
+        records.push_back(std::move(record));
+      }
+    }
+    recordSet->computeBytes(records);
+
+    CacheEntry entry(std::make_tuple(qname, qtype, rtag, netmask), auth);
+    entry.d_recordSet = std::move(recordSet);
+    entry.d_from = from;
+    entry.d_state = state;
+    entry.d_ttd = ttd;
+    entry.d_orig_ttl = origTTL;
+
+    auto& mc = getMap(qname);
+    auto map = mc.lock();
+    map->d_cachecachevalid = false;
+    if (!map->d_map.insert(entry).second) {
+      continue;
+    }
+    ++mc.d_entriesCount;
+    ++loaded;
+
+    if (!entry.d_netmask.empty()) {
+      auto ecsIndexKey = std::make_tuple(qname, qtype.getCode());
+      auto ecsIndex = map->d_ecsIndex.find(ecsIndexKey);
+      if (ecsIndex == map->d_ecsIndex.end()) {
+        ecsIndex = map->d_ecsIndex.insert(ECSIndexEntry(qname, qtype.getCode())).first;
+      }
+      ecsIndex->addMask(entry.d_netmask);
+    }
+  }
+
+  return loaded;
+}
+
+void MemRecursorCache::doPrune(size_t keep, size_t workers)
 {
   //size_t maxCached = d_maxEntries;
   size_t cacheSize = size();
-  pruneMutexCollectionsVector<SequencedTag>(*this, d_maps, keep, cacheSize);
+  pruneMutexCollectionsVector<SequencedTag>(*this, d_maps, keep, cacheSize, workers);
 }
 
 namespace boost
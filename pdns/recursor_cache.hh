@@ -44,10 +44,18 @@
 #include "namespaces.hh"
 using namespace ::boost::multi_index;
 
+namespace pdns
+{
+namespace snapshot
+{
+class Decoder;
+}
+}
+
 class MemRecursorCache : public boost::noncopyable //  : public RecursorCache
 {
 public:
-  MemRecursorCache(size_t mapsCount = 1024);
+  MemRecursorCache(size_t mapsCount = 1024, bool packedRecords = false);
 
   size_t size() const;
   size_t bytes();
@@ -60,8 +68,14 @@ public:
 
   void replace(time_t, const DNSName& qname, const QType qt, const vector<DNSRecord>& content, const vector<shared_ptr<RRSIGRecordContent>>& signatures, const std::vector<std::shared_ptr<DNSRecord>>& authorityRecs, bool auth, const DNSName& authZone, boost::optional<Netmask> ednsmask = boost::none, const OptTag& routingTag = boost::none, vState state = vState::Indeterminate, boost::optional<ComboAddress> from = boost::none);
 
-  void doPrune(size_t keep);
+  /* the shards are pruned by up to 'workers' threads, the calling one included */
+  void doPrune(size_t keep, size_t workers = 1);
   uint64_t doDump(int fd);
+  /* write the entries that have not expired yet to a snapshot, returns the number of entries written */
+  uint64_t saveSnapshot(FILE* fp, time_t now);
+  /* insert the entries of a snapshot section that have not expired yet, keeping the existing
+     entries with the same key. Returns the number of entries inserted */
+  size_t loadSnapshotSection(pdns::snapshot::Decoder& decoder, uint32_t entries, time_t now);
 
   size_t doWipeCache(const DNSName& name, bool sub, QType qtype = 0xffff);
   bool doAgeCache(time_t now, const DNSName& name, QType qtype, uint32_t newTTL);
@@ -70,10 +84,12 @@ public:
   pdns::stat_t cacheHits{0}, cacheMisses{0};
 
 private:
+  static const size_t s_dumpBufferSize = 1024 * 1024;
+
   struct CacheEntry
   {
     CacheEntry(const std::tuple<DNSName, QType, OptTag, Netmask>& key, bool auth) :
-      d_qname(std::get<0>(key)), d_netmask(std::get<3>(key).getNormalized()), d_rtag(std::get<2>(key)), d_state(vState::Indeterminate), d_ttd(0), d_qtype(std::get<1>(key)), d_auth(auth), d_submitted(false)
+      d_qname(std::get<0>(key)), d_netmask(std::get<3>(key).getNormalized()), d_rtag(std::get<2>(key)), d_state(vState::Indeterminate), d_ttd(0), d_hits(0), d_qtype(std::get<1>(key)), d_auth(auth), d_submitted(false)
     {
     }
 
@@ -83,17 +99,50 @@ private:
       return d_ttd;
     }
 
-    records_t d_records;
-    std::vector<std::shared_ptr<RRSIGRecordContent>> d_signatures;
-    std::vector<std::shared_ptr<DNSRecord>> d_authorityRecs;
+    /* The records of an entry are never modified once published: replace() builds a new
+       RecordSet and swaps it in, so get() only holds the shard lock long enough to find the
+       entry and take a reference to its current RecordSet, and copies the records out after
+       releasing the lock. */
+    struct RecordSet
+    {
+      /* store the records and signatures in wire format, returns false if they can't be packed */
+      bool pack(const DNSName& qname, const vector<DNSRecord>& records, const vector<std::shared_ptr<RRSIGRecordContent>>& signatures);
+      void unpack(const DNSName& qname, QType qtype, records_t* records, vector<std::shared_ptr<RRSIGRecordContent>>* signatures) const;
+      bool isPacked() const
+      {
+        return !d_packed.empty();
+      }
+      /* estimate the memory used by this set, once it has been built. The records are only
+         looked at when the set is not packed, and their wire length is used when known */
+      void computeBytes(const vector<DNSRecord>& records);
+      size_t bytes() const
+      {
+        return d_bytes;
+      }
+
+      records_t d_records;
+      std::vector<std::shared_ptr<RRSIGRecordContent>> d_signatures;
+      std::vector<std::shared_ptr<DNSRecord>> d_authorityRecs;
+      /* the same few zones are shared by a lot of entries, so their names are interned */
+      InternedDNSName d_authZone;
+      /* When packed, d_records and d_signatures are empty and the records then the signatures
+         are stored here in a single allocation, in wire format, each one prefixed by its length
+         as a 16-bit big endian integer. They are decoded on every lookup. */
+      std::string d_packed;
+      uint16_t d_packedRecordsCount{0};
+      uint16_t d_packedSignaturesCount{0};
+      size_t d_bytes{0};
+    };
+
+    std::shared_ptr<const RecordSet> d_recordSet;
     DNSName d_qname;
-    DNSName d_authZone;
     ComboAddress d_from;
     Netmask d_netmask;
     OptTag d_rtag;
     mutable vState d_state;
     mutable time_t d_ttd;
     uint32_t d_orig_ttl;
+    mutable uint32_t d_hits; // since the entry was last replaced, to decide whether it's worth refreshing
     QType d_qtype;
     bool d_auth;
     mutable bool d_submitted; // whether this entry has been queued for refetch
@@ -240,6 +289,7 @@ private:
   };
 
   vector<MapCombo> d_maps;
+  const bool d_packedRecords;
   MapCombo& getMap(const DNSName& qname)
   {
     return d_maps.at(qname.hash() % d_maps.size());
@@ -251,7 +301,17 @@ private:
   Entries getEntries(MapCombo::LockedContent& content, const DNSName& qname, const QType qt, const OptTag& rtag);
   cache_t::const_iterator getEntryUsingECSIndex(MapCombo::LockedContent& content, time_t now, const DNSName& qname, QType qtype, bool requireAuth, const ComboAddress& who);
 
-  time_t handleHit(MapCombo::LockedContent& content, OrderedTagIterator_t& entry, const DNSName& qname, uint32_t& origTTL, vector<DNSRecord>* res, vector<std::shared_ptr<RRSIGRecordContent>>* signatures, std::vector<std::shared_ptr<DNSRecord>>* authorityRecs, bool* variable, boost::optional<vState>& state, bool* wasAuth, DNSName* authZone, ComboAddress* fromAuthIP);
+  /* a matching entry found by lookup(), whose records are copied out once the lock has been released */
+  struct Hit
+  {
+    std::shared_ptr<const CacheEntry::RecordSet> d_recordSet;
+    time_t d_ttd;
+    QType d_qtype;
+  };
+
+  time_t lookup(MapCombo::LockedContent& map, time_t now, const DNSName& qname, const QType qt, bool requireAuth, const ComboAddress& who, bool refresh, const OptTag& routingTag, std::vector<Hit>* hits, bool* variable, boost::optional<vState>& cachedState, bool* wasAuth, ComboAddress* fromAuthIP);
+  time_t handleHit(MapCombo::LockedContent& content, OrderedTagIterator_t& entry, uint32_t& origTTL, std::vector<Hit>* hits, bool* variable, boost::optional<vState>& state, bool* wasAuth, ComboAddress* fromAuthIP);
+  static void copyHits(const std::vector<Hit>& hits, const DNSName& qname, vector<DNSRecord>* res, vector<std::shared_ptr<RRSIGRecordContent>>* signatures, std::vector<std::shared_ptr<DNSRecord>>* authorityRecs, DNSName* fromAuthZone);
 
 public:
   void preRemoval(MapCombo::LockedContent& map, const CacheEntry& entry)
@@ -24,6 +24,7 @@
 #include "aggressive_nsec.hh"
 #include "cachecleaner.hh"
 #include "recursor_cache.hh"
+#include "rec-snapshot.hh"
 #include "logger.hh"
 #include "validate.hh"
 
@@ -120,29 +121,44 @@ void AggressiveNSECCache::removeZoneInfo(const DNSName& zone, bool subzones)
   }
 }
 
-void AggressiveNSECCache::prune(time_t now)
+void AggressiveNSECCache::prune(time_t now, size_t workers)
 {
   uint64_t maxNumberOfEntries = d_maxEntries;
-  std::vector<DNSName> emptyEntries;
+  LockGuarded<std::vector<DNSName>> emptyEntries;
 
-  uint64_t erased = 0;
-  uint64_t lookedAt = 0;
+  std::atomic<uint64_t> erased{0};
+  std::atomic<uint64_t> lookedAt{0};
   uint64_t toLook = std::max(d_entriesCount / 5U, static_cast<uint64_t>(1U));
+  uint64_t toErase = 0;
+  const bool full = d_entriesCount > maxNumberOfEntries;
 
-  if (d_entriesCount > maxNumberOfEntries) {
-    uint64_t toErase = d_entriesCount - maxNumberOfEntries;
-    toLook = toErase * 5;
+  if (full) {
     // we are full, scan at max 5 * toErase entries and stop once we have nuked enough
+    toErase = d_entriesCount - maxNumberOfEntries;
+    toLook = toErase * 5;
+  }
 
-    auto zones = d_zones.write_lock();
-    zones->visit([now, &erased, toErase, toLook, &lookedAt, &emptyEntries](const SuffixMatchTree<std::shared_ptr<LockGuarded<ZoneEntry>>>& node) {
-      if (!node.d_value || erased > toErase || lookedAt > toLook) {
-        return;
+  /* only hold the zones lock long enough to collect the zones, which are then pruned one by one,
+     possibly in parallel, without blocking lookups and insertions into the other zones */
+  std::vector<std::shared_ptr<LockGuarded<ZoneEntry>>> zoneEntries;
+  {
+    auto zones = d_zones.read_lock();
+    zones->visit([&zoneEntries](const SuffixMatchTree<std::shared_ptr<LockGuarded<ZoneEntry>>>& node) {
+      if (node.d_value) {
+        zoneEntries.push_back(node.d_value);
       }
+    });
+  }
 
-      auto zoneEntry = node.d_value->lock();
-      auto& sidx = boost::multi_index::get<ZoneEntry::SequencedTag>(zoneEntry->d_entries);
-      for (auto it = sidx.begin(); it != sidx.end(); ++lookedAt) {
+  runOnShards(zoneEntries.size(), workers, [&](size_t idx) {
+    if (full && (erased > toErase || lookedAt > toLook)) {
+      return;
+    }
+
+    auto zoneEntry = zoneEntries.at(idx)->lock();
+    auto& sidx = boost::multi_index::get<ZoneEntry::SequencedTag>(zoneEntry->d_entries);
+    for (auto it = sidx.begin(); it != sidx.end(); ++lookedAt) {
+      if (full) {
         if (erased >= toErase || lookedAt >= toLook) {
           break;
         }
@@ -155,23 +171,8 @@ void AggressiveNSECCache::prune(time_t now)
           ++it;
         }
       }
-
-      if (zoneEntry->d_entries.size() == 0) {
-        emptyEntries.push_back(zoneEntry->d_zone);
-      }
-    });
-  }
-  else {
-    // we are not full, just look through 10% of the cache and nuke everything that is expired
-    auto zones = d_zones.write_lock();
-    zones->visit([now, &erased, toLook, &lookedAt, &emptyEntries](const SuffixMatchTree<std::shared_ptr<LockGuarded<ZoneEntry>>>& node) {
-      if (!node.d_value) {
-        return;
-      }
-
-      auto zoneEntry = node.d_value->lock();
-      auto& sidx = boost::multi_index::get<ZoneEntry::SequencedTag>(zoneEntry->d_entries);
-      for (auto it = sidx.begin(); it != sidx.end(); ++lookedAt) {
+      else {
+        // we are not full, just look through 10% of the cache and nuke everything that is expired
         if (lookedAt >= toLook) {
           break;
         }
@@ -183,19 +184,29 @@ void AggressiveNSECCache::prune(time_t now)
           ++it;
         }
       }
+    }
 
-      if (zoneEntry->d_entries.size() == 0) {
-        emptyEntries.push_back(zoneEntry->d_zone);
-      }
-    });
-  }
+    if (zoneEntry->d_entries.size() == 0) {
+      emptyEntries.lock()->push_back(zoneEntry->d_zone);
+    }
+  });
 
-  d_entriesCount -= erased;
+  d_entriesCount -= erased.load();
 
-  if (!emptyEntries.empty()) {
+  auto empty = emptyEntries.lock();
+  if (!empty->empty()) {
     auto zones = d_zones.write_lock();
-    for (const auto& entry : emptyEntries) {
-      zones->remove(entry);
+    for (const auto& entry : *empty) {
+      /* the zone might have been refilled since we looked at it */
+      auto got = zones->lookup(entry);
+      if (!got || !*got) {
+        continue;
+      }
+      auto zoneEntry = *got;
+      auto locked = zoneEntry->lock();
+      if (locked->d_zone == entry && locked->d_entries.empty()) {
+        zones->remove(entry);
+      }
     }
   }
 }
@@ -875,32 +886,154 @@ size_t AggressiveNSECCache::dumpToFile(std::unique_ptr<FILE, int (*)(FILE*)>& fp
 {
   size_t ret = 0;
 
-  auto zones = d_zones.read_lock();
-  zones->visit([&ret, now, &fp](const SuffixMatchTree<std::shared_ptr<LockGuarded<ZoneEntry>>>& node) {
-    if (!node.d_value) {
-      return;
+  /* only hold the zones lock long enough to collect the zones, then each zone lock long enough to take a snapshot of its entries */
+  std::vector<std::shared_ptr<LockGuarded<ZoneEntry>>> zoneEntries;
+  {
+    auto zones = d_zones.read_lock();
+    zones->visit([&zoneEntries](const SuffixMatchTree<std::shared_ptr<LockGuarded<ZoneEntry>>>& node) {
+      if (node.d_value) {
+        zoneEntries.push_back(node.d_value);
+      }
+    });
+  }
+
+  std::vector<ZoneEntry::CacheEntry> entries;
+  for (const auto& zoneEntry : zoneEntries) {
+    DNSName zoneName;
+    bool nsec3;
+    entries.clear();
+    {
+      auto zone = zoneEntry->lock();
+      zoneName = zone->d_zone;
+      nsec3 = zone->d_nsec3;
+      entries.reserve(zone->d_entries.size());
+      for (const auto& entry : zone->d_entries) {
+        entries.push_back(entry);
+      }
     }
 
-    auto zone = node.d_value->lock();
-    fprintf(fp.get(), "; Zone %s\n", zone->d_zone.toString().c_str());
+    fprintf(fp.get(), "; Zone %s\n", zoneName.toString().c_str());
 
-    for (const auto& entry : zone->d_entries) {
+    for (const auto& entry : entries) {
       int64_t ttl = entry.d_ttd - now.tv_sec;
       try {
-        fprintf(fp.get(), "%s %" PRId64 " IN %s %s\n", entry.d_owner.toString().c_str(), ttl, zone->d_nsec3 ? "NSEC3" : "NSEC", entry.d_record->getZoneRepresentation().c_str());
+        fprintf(fp.get(), "%s %" PRId64 " IN %s %s\n", entry.d_owner.toString().c_str(), ttl, nsec3 ? "NSEC3" : "NSEC", entry.d_record->getZoneRepresentation().c_str());
         for (const auto& signature : entry.d_signatures) {
           fprintf(fp.get(), "- RRSIG %s\n", signature->getZoneRepresentation().c_str());
         }
         ++ret;
       }
       catch (const std::exception& e) {
-        fprintf(fp.get(), "; Error dumping record from zone %s: %s\n", zone->d_zone.toString().c_str(), e.what());
+        fprintf(fp.get(), "; Error dumping record from zone %s: %s\n", zoneName.toString().c_str(), e.what());
       }
       catch (...) {
-        fprintf(fp.get(), "; Error dumping record from zone %s\n", zone->d_zone.toString().c_str());
+        fprintf(fp.get(), "; Error dumping record from zone %s\n", zoneName.toString().c_str());
       }
     }
-  });
+  }
 
   return ret;
 }
+
+uint64_t AggressiveNSECCache::saveSnapshot(FILE* fp, time_t now)
+{
+  pdns::snapshot::SectionWriter writer(fp, pdns::snapshot::Section::AggressiveNSECCache);
+
+  std::vector<std::shared_ptr<LockGuarded<ZoneEntry>>> zoneEntries;
+  {
+    auto zones = d_zones.read_lock();
+    zones->visit([&zoneEntries](const SuffixMatchTree<std::shared_ptr<LockGuarded<ZoneEntry>>>& node) {
+      if (node.d_value) {
+        zoneEntries.push_back(node.d_value);
+      }
+    });
+  }
+
+  std::vector<ZoneEntry::CacheEntry> entries;
+  for (const auto& zoneEntry : zoneEntries) {
+    DNSName zoneName;
+    std::string salt;
+    uint16_t iterations;
+    bool nsec3;
+    entries.clear();
+    {
+      auto zone = zoneEntry->lock();
+      zoneName = zone->d_zone;
+      salt = zone->d_salt;
+      iterations = zone->d_iterations;
+      nsec3 = zone->d_nsec3;
+      entries.reserve(zone->d_entries.size());
+      for (const auto& entry : zone->d_entries) {
+        if (entry.d_ttd > now) {
+          entries.push_back(entry);
+        }
+      }
+    }
+
+    /* the zone parameters are repeated for every entry so that sections can be loaded in any order */
+    for (const auto& entry : entries) {
+      auto& encoder = writer.encoder();
+      encoder.putName(zoneName);
+      encoder.putUInt8(nsec3 ? 1 : 0);
+      encoder.putString(salt);
+      encoder.putUInt16(iterations);
+      encoder.putName(entry.d_owner);
+      encoder.putName(entry.d_next);
+      encoder.putUInt64(entry.d_ttd);
+      encoder.putContent(entry.d_owner, *entry.d_record);
+      encoder.putUInt16(entry.d_signatures.size());
+      for (const auto& signature : entry.d_signatures) {
+        encoder.putContent(entry.d_owner, *signature);
+      }
+      writer.entryDone();
+    }
+  }
+
+  writer.flush();
+  return writer.getEntriesCount();
+}
+
+size_t AggressiveNSECCache::loadSnapshotSection(pdns::snapshot::Decoder& decoder, uint32_t entries, time_t now)
+{
+  size_t loaded = 0;
+  for (uint32_t idx = 0; idx < entries; idx++) {
+    const auto zoneName = decoder.getName();
+    const bool nsec3 = decoder.getUInt8() != 0;
+    const auto salt = decoder.getString();
+    const auto iterations = decoder.getUInt16();
+    ZoneEntry::CacheEntry entry;
+    entry.d_owner = decoder.getName();
+    entry.d_next = decoder.getName();
+    entry.d_ttd = decoder.getUInt64();
+    entry.d_record = decoder.getContent(entry.d_owner, nsec3 ? QType::NSEC3 : QType::NSEC);
+    const auto signaturesCount = decoder.getUInt16();
+    for (uint16_t sigIdx = 0; sigIdx < signaturesCount; sigIdx++) {
+      auto signature = std::dynamic_pointer_cast<RRSIGRecordContent>(decoder.getContent(entry.d_owner, QType::RRSIG));
+      if (signature) {
+        entry.d_signatures.push_back(std::move(signature));
+      }
+    }
+
+    if (entry.d_ttd <= now || entry.d_signatures.empty()) {
+      continue;
+    }
+
+    auto zoneEntry = getZone(zoneName);
+    auto zone = zoneEntry->lock();
+    if (zone->d_entries.empty()) {
+      zone->d_nsec3 = nsec3;
+      zone->d_salt = salt;
+      zone->d_iterations = iterations;
+    }
+    else if (zone->d_nsec3 != nsec3 || zone->d_salt != salt || zone->d_iterations != iterations) {
+      continue;
+    }
+
+    if (zone->d_entries.insert(std::move(entry)).second) {
+      ++d_entriesCount;
+      ++loaded;
+    }
+  }
+
+  return loaded;
+}
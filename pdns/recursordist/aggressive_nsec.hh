@@ -36,6 +36,14 @@ using namespace ::boost::multi_index;
 #include "lock.hh"
 #include "stat_t.hh"
 
+namespace pdns
+{
+namespace snapshot
+{
+class Decoder;
+}
+}
+
 class AggressiveNSECCache
 {
 public:
@@ -74,8 +82,10 @@ public:
     return d_nsec3WildcardHits;
   }
 
-  void prune(time_t now);
+  void prune(time_t now, size_t workers = 1);
   size_t dumpToFile(std::unique_ptr<FILE, int (*)(FILE*)>& fp, const struct timeval& now);
+  uint64_t saveSnapshot(FILE* fp, time_t now);
+  size_t loadSnapshotSection(pdns::snapshot::Decoder& decoder, uint32_t entries, time_t now);
 
 private:
   struct ZoneEntry
@@ -0,0 +1,96 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdexcept>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include "mpscqueue.hh"
+#include "misc.hh"
+
+namespace pdns
+{
+WakeupNotifier::WakeupNotifier()
+{
+#ifdef __linux__
+  d_readFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (d_readFD == -1) {
+    throw std::runtime_error("Error creating an eventfd: " + stringerror());
+  }
+  d_writeFD = d_readFD;
+#else
+  int fds[2];
+  if (pipe(fds) < 0) {
+    throw std::runtime_error("Error creating a pipe: " + stringerror());
+  }
+  d_readFD = fds[0];
+  d_writeFD = fds[1];
+  if (!setNonBlocking(d_readFD) || !setNonBlocking(d_writeFD)) {
+    int err = errno;
+    close(d_readFD);
+    close(d_writeFD);
+    throw std::runtime_error("Error making a pipe non-blocking: " + stringerror(err));
+  }
+#endif
+}
+
+WakeupNotifier::~WakeupNotifier()
+{
+  if (d_writeFD != d_readFD) {
+    close(d_writeFD);
+  }
+  close(d_readFD);
+}
+
+void WakeupNotifier::notify()
+{
+  if (d_notified.exchange(true)) {
+    /* the consumer has not cleared the previous notification yet */
+    return;
+  }
+
+#ifdef __linux__
+  const uint64_t value = 1;
+#else
+  const char value = 1;
+#endif
+  /* EAGAIN means that the descriptor is readable already, which is all we want */
+  if (write(d_writeFD, &value, sizeof(value)) != sizeof(value) && errno != EAGAIN && errno != EWOULDBLOCK) {
+    throw std::runtime_error("Error writing to a wakeup descriptor: " + stringerror());
+  }
+}
+
+void WakeupNotifier::clear()
+{
+#ifdef __linux__
+  uint64_t value;
+#else
+  char value;
+#endif
+  while (read(d_readFD, &value, sizeof(value)) == sizeof(value)) {
+  }
+  /* acquire, so that we see whatever was produced before the notification */
+  d_notified.exchange(false);
+}
+}
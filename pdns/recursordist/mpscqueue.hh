@@ -0,0 +1,151 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace pdns
+{
+/* Bounded, lock-free queue supporting any number of producers but a single consumer.
+   Each cell carries a sequence number telling whether it is ready to be written to
+   (sequence == position) or to be read from (sequence == position + 1), so producers
+   only contend on the enqueue position and never on the consumer's side.
+   The capacity is rounded up to the next power of two. */
+template <typename T>
+class MPSCQueue
+{
+public:
+  MPSCQueue(size_t capacity) :
+    d_capacity(roundUp(capacity)), d_mask(d_capacity - 1), d_cells(new Cell[d_capacity])
+  {
+    for (size_t idx = 0; idx < d_capacity; idx++) {
+      d_cells[idx].d_sequence.store(idx, std::memory_order_relaxed);
+    }
+  }
+
+  MPSCQueue(const MPSCQueue&) = delete;
+  MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+  /* can be called from any thread, returns false if the queue is full */
+  bool push(T item)
+  {
+    Cell* cell;
+    size_t pos = d_enqueuePos.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &d_cells[pos & d_mask];
+      const size_t seq = cell->d_sequence.load(std::memory_order_acquire);
+      const auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (d_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      }
+      else if (diff < 0) {
+        /* the consumer has not read that cell yet */
+        return false;
+      }
+      else {
+        /* another producer took that cell */
+        pos = d_enqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+
+    cell->d_item = std::move(item);
+    cell->d_sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /* consumer only, returns false if the queue is empty or if the producer of the next
+     item has not finished writing it yet */
+  bool pop(T& item)
+  {
+    Cell* cell = &d_cells[d_dequeuePos & d_mask];
+    const size_t seq = cell->d_sequence.load(std::memory_order_acquire);
+    if (static_cast<intptr_t>(seq) - static_cast<intptr_t>(d_dequeuePos + 1) < 0) {
+      return false;
+    }
+
+    item = std::move(cell->d_item);
+    cell->d_sequence.store(d_dequeuePos + d_capacity, std::memory_order_release);
+    ++d_dequeuePos;
+    return true;
+  }
+
+  size_t capacity() const
+  {
+    return d_capacity;
+  }
+
+private:
+  static size_t roundUp(size_t capacity)
+  {
+    size_t ret = 2;
+    while (ret < capacity) {
+      ret <<= 1;
+    }
+    return ret;
+  }
+
+  struct Cell
+  {
+    std::atomic<size_t> d_sequence;
+    T d_item;
+  };
+
+  const size_t d_capacity;
+  const size_t d_mask;
+  std::unique_ptr<Cell[]> d_cells;
+  /* on separate cache lines, as they are written by different threads */
+  alignas(64) std::atomic<size_t> d_enqueuePos{0};
+  alignas(64) size_t d_dequeuePos{0};
+};
+
+/* Wakes up a consumer waiting for a file descriptor to become readable, coalescing the
+   notifications: only the first notify() since the last clear() writes to the descriptor,
+   so a busy consumer costs the producers no system call at all.
+   The consumer has to call clear() before draining what it has been notified about, so that
+   anything produced after that point triggers a new notification.
+   Uses an eventfd on Linux and a pipe elsewhere. */
+class WakeupNotifier
+{
+public:
+  WakeupNotifier();
+  ~WakeupNotifier();
+  WakeupNotifier(const WakeupNotifier&) = delete;
+  WakeupNotifier& operator=(const WakeupNotifier&) = delete;
+
+  void notify();
+  void clear();
+
+  int getDescriptor() const
+  {
+    return d_readFD;
+  }
+
+private:
+  std::atomic<bool> d_notified{false};
+  int d_readFD{-1};
+  int d_writeFD{-1};
+};
+}
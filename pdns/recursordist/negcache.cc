@@ -24,6 +24,7 @@
 #include "negcache.hh"
 #include "misc.hh"
 #include "cachecleaner.hh"
+#include "rec-snapshot.hh"
 #include "utility.hh"
 
 NegCache::NegCache(size_t mapsCount) :
@@ -229,11 +230,12 @@ void NegCache::clear()
  * Perform some cleanup in the cache, removing stale entries
  *
  * \param maxEntries The maximum number of entries that may exist in the cache.
+ * \param workers    The number of threads, the calling one included, pruning the shards.
  */
-void NegCache::prune(size_t maxEntries)
+void NegCache::prune(size_t maxEntries, size_t workers)
 {
   size_t cacheSize = size();
-  pruneMutexCollectionsVector<SequenceTag>(*this, d_maps, maxEntries, cacheSize);
+  pruneMutexCollectionsVector<SequenceTag>(*this, d_maps, maxEntries, cacheSize, workers);
 }
 
 /*!
@@ -245,10 +247,19 @@ size_t NegCache::dumpToFile(FILE* fp, const struct timeval& now)
 {
   size_t ret = 0;
 
+  std::vector<NegCacheEntry> entries;
   for (auto& mc : d_maps) {
-    auto m = mc.lock();
-    auto& sidx = m->d_map.get<SequenceTag>();
-    for (const NegCacheEntry& ne : sidx) {
+    /* take a snapshot of the shard so that the lock is not held while we write */
+    entries.clear();
+    {
+      auto m = mc.lock();
+      auto& sidx = m->d_map.get<SequenceTag>();
+      entries.reserve(sidx.size());
+      for (const NegCacheEntry& ne : sidx) {
+        entries.push_back(ne);
+      }
+    }
+    for (const NegCacheEntry& ne : entries) {
       ret++;
       int64_t ttl = ne.d_ttd - now.tv_sec;
       fprintf(fp, "%s %" PRId64 " IN %s VIA %s ; (%s)\n", ne.d_name.toString().c_str(), ttl, ne.d_qtype.toString().c_str(), ne.d_auth.toString().c_str(), vStateToString(ne.d_validationState).c_str());
@@ -268,3 +279,83 @@ size_t NegCache::dumpToFile(FILE* fp, const struct timeval& now)
   }
   return ret;
 }
+
+/*!
+ * Writes the entries that have not expired yet to a cache snapshot
+ *
+ * \param fp  A pointer to an open FILE object
+ * \param now The current time
+ */
+uint64_t NegCache::saveSnapshot(FILE* fp, time_t now)
+{
+  pdns::snapshot::SectionWriter writer(fp, pdns::snapshot::Section::NegCache);
+  std::vector<NegCacheEntry> entries;
+  for (auto& mc : d_maps) {
+    entries.clear();
+    {
+      auto m = mc.lock();
+      auto& sidx = m->d_map.get<SequenceTag>();
+      entries.reserve(sidx.size());
+      for (const NegCacheEntry& ne : sidx) {
+        if (ne.d_ttd > now) {
+          entries.push_back(ne);
+        }
+      }
+    }
+
+    for (const NegCacheEntry& ne : entries) {
+      auto& encoder = writer.encoder();
+      encoder.putName(ne.d_name);
+      encoder.putUInt16(ne.d_qtype.getCode());
+      encoder.putName(ne.d_auth);
+      encoder.putUInt64(ne.d_ttd);
+      encoder.putState(ne.d_validationState);
+      encoder.putRecords(ne.authoritySOA.records);
+      encoder.putRecords(ne.authoritySOA.signatures);
+      encoder.putRecords(ne.DNSSECRecords.records);
+      encoder.putRecords(ne.DNSSECRecords.signatures);
+      writer.entryDone();
+    }
+  }
+
+  writer.flush();
+  return writer.getEntriesCount();
+}
+
+/*!
+ * Inserts the entries of a cache snapshot section that have not expired yet,
+ * keeping the existing entries. Returns the number of entries inserted.
+ *
+ * \param decoder The decoder of the section
+ * \param entries The number of entries in the section
+ * \param now     The current time
+ */
+size_t NegCache::loadSnapshotSection(pdns::snapshot::Decoder& decoder, uint32_t entries, time_t now)
+{
+  size_t loaded = 0;
+  for (uint32_t idx = 0; idx < entries; idx++) {
+    NegCacheEntry ne;
+    ne.d_name = decoder.getName();
+    ne.d_qtype = decoder.getUInt16();
+    ne.d_auth = decoder.getName();
+    ne.d_ttd = decoder.getUInt64();
+    ne.d_validationState = decoder.getState();
+    ne.authoritySOA.records = decoder.getRecords();
+    ne.authoritySOA.signatures = decoder.getRecords();
+    ne.DNSSECRecords.records = decoder.getRecords();
+    ne.DNSSECRecords.signatures = decoder.getRecords();
+
+    if (ne.d_ttd <= now) {
+      continue;
+    }
+
+    auto& map = getMap(ne.d_name);
+    auto content = map.lock();
+    if (content->d_map.insert(std::move(ne)).second) {
+      ++map.d_entriesCount;
+      ++loaded;
+    }
+  }
+
+  return loaded;
+}
@@ -37,6 +37,14 @@
 
 using namespace ::boost::multi_index;
 
+namespace pdns
+{
+namespace snapshot
+{
+class Decoder;
+}
+}
+
 /* FIXME should become part of the normal cache (I think) and should become more like
  * struct {
  *   vector<DNSRecord> records;
@@ -77,9 +85,11 @@ public:
   bool getRootNXTrust(const DNSName& qname, const struct timeval& now, NegCacheEntry& ne);
   size_t count(const DNSName& qname);
   size_t count(const DNSName& qname, const QType qtype);
-  void prune(size_t maxEntries);
+  void prune(size_t maxEntries, size_t workers = 1);
   void clear();
   size_t dumpToFile(FILE* fd, const struct timeval& now);
+  uint64_t saveSnapshot(FILE* fp, time_t now);
+  size_t loadSnapshotSection(pdns::snapshot::Decoder& decoder, uint32_t entries, time_t now);
   size_t wipe(const DNSName& name, bool subtree = false);
   size_t size() const;
 
@@ -36,6 +36,7 @@
 #include "opensslsigners.hh"
 #include "ws-recursor.hh"
 #include "rec-taskqueue.hh"
+#include "rec-snapshot.hh"
 #include "secpoll-recursor.hh"
 #include "logging.hh"
 
@@ -89,6 +90,7 @@ std::shared_ptr<NetmaskGroup> g_initialAllowNotifyFrom; // new threads need this
 std::shared_ptr<notifyset_t> g_initialAllowNotifyFor; // new threads need this to be setup
 bool g_logRPZChanges{false};
 static time_t s_statisticsInterval;
+static size_t s_cachePruneThreads{1};
 bool g_addExtendedResolutionDNSErrors;
 static std::atomic<uint32_t> s_counter;
 int g_argc;
@@ -284,9 +286,13 @@ int RecThreadInfo::runThreads()
 
 void RecThreadInfo::makeThreadPipes()
 {
-  auto pipeBufferSize = ::arg().asNum("distribution-pipe-buffer-size");
-  if (pipeBufferSize > 0) {
-    g_log << Logger::Info << "Resizing the buffer of the distribution pipe to " << pipeBufferSize << endl;
+  if (::arg().asNum("distribution-pipe-buffer-size") > 0) {
+    g_log << Logger::Warning << "distribution-pipe-buffer-size is no longer used since queries are passed to the workers via queues, see distribution-queue-size instead" << endl;
+  }
+  auto queueSize = ::arg().asNum("distribution-queue-size");
+  if (queueSize <= 0) {
+    g_log << Logger::Warning << "distribution-queue-size has to be positive, raising it to 1" << endl;
+    queueSize = 1;
   }
 
   /* thread 0 is the handler / SNMP, worker threads start at 1 */
@@ -311,25 +317,13 @@ void RecThreadInfo::makeThreadPipes()
     threadInfo.pipes.readFromThread = fd[0];
     threadInfo.pipes.writeFromThread = fd[1];
 
-    if (pipe(fd) < 0)
-      unixDie("Creating pipe for inter-thread communications");
-
-    threadInfo.pipes.readQueriesToThread = fd[0];
-    threadInfo.pipes.writeQueriesToThread = fd[1];
-
-    if (pipeBufferSize > 0) {
-      if (!setPipeBufferSize(threadInfo.pipes.writeQueriesToThread, pipeBufferSize)) {
-        int err = errno;
-        g_log << Logger::Warning << "Error resizing the buffer of the distribution pipe for thread " << n << " to " << pipeBufferSize << ": " << strerror(err) << endl;
-        auto existingSize = getPipeBufferSize(threadInfo.pipes.writeQueriesToThread);
-        if (existingSize > 0) {
-          g_log << Logger::Warning << "The current size of the distribution pipe's buffer for thread " << n << " is " << existingSize << endl;
-        }
-      }
+    threadInfo.queriesQueue = std::make_unique<pdns::MPSCQueue<ThreadMSG*>>(queueSize);
+    try {
+      threadInfo.queriesNotifier = std::make_unique<pdns::WakeupNotifier>();
     }
-
-    if (!setNonBlocking(threadInfo.pipes.writeQueriesToThread)) {
-      unixDie("Making pipe for inter-thread communications non-blocking");
+    catch (const std::exception& e) {
+      g_log << Logger::Critical << "Creating the query distribution notifier: " << e.what() << endl;
+      _exit(1);
     }
   }
 }
@@ -878,16 +872,16 @@ static void doStats(void)
     g_log << Logger::Notice << "stats: cache contended/acquired " << rc_stats.first << '/' << rc_stats.second << " = " << r << '%' << endl;
 
     g_log << Logger::Notice << "stats: throttle map: "
-          << broadcastAccFunction<uint64_t>(pleaseGetThrottleSize) << ", ns speeds: "
-          << broadcastAccFunction<uint64_t>(pleaseGetNsSpeedsSize) << ", failed ns: "
+          << SyncRes::getThrottledServersSize() << ", ns speeds: "
+          << SyncRes::getNSSpeedsSize() << ", failed ns: "
           << SyncRes::getFailedServersSize() << ", ednsmap: "
-          << broadcastAccFunction<uint64_t>(pleaseGetEDNSStatusesSize) << endl;
+          << SyncRes::getEDNSStatusesSize() << endl;
     g_log << Logger::Notice << "stats: outpacket/query ratio " << ratePercentage(SyncRes::s_outqueries, SyncRes::s_queries) << "%";
     g_log << Logger::Notice << ", " << ratePercentage(SyncRes::s_throttledqueries, SyncRes::s_outqueries + SyncRes::s_throttledqueries) << "% throttled" << endl;
     g_log << Logger::Notice << "stats: " << SyncRes::s_tcpoutqueries << "/" << SyncRes::s_dotoutqueries << "/" << getCurrentIdleTCPConnections() << " outgoing tcp/dot/idle connections, " << broadcastAccFunction<uint64_t>(pleaseGetConcurrentQueries) << " queries running, " << SyncRes::s_outgoingtimeouts << " outgoing timeouts " << endl;
 
-    uint64_t pcSize = broadcastAccFunction<uint64_t>(pleaseGetPacketCacheSize);
-    uint64_t pcHits = broadcastAccFunction<uint64_t>(pleaseGetPacketCacheHits);
+    uint64_t pcSize = g_packetCache ? g_packetCache->size() : broadcastAccFunction<uint64_t>(pleaseGetPacketCacheSize);
+    uint64_t pcHits = g_packetCache ? g_packetCache->getHits() : broadcastAccFunction<uint64_t>(pleaseGetPacketCacheHits);
     g_log << Logger::Notice << "stats: " << pcSize << " packet cache entries, " << ratePercentage(pcHits, SyncRes::s_queries) << "% packet cache hits" << endl;
 
     size_t idx = 0;
@@ -1149,6 +1143,58 @@ template vector<ComboAddress> broadcastAccFunction(const boost::function<vector<
 template vector<pair<DNSName, uint16_t>> broadcastAccFunction(const boost::function<vector<pair<DNSName, uint16_t>>*()>& fun); // explicit instantiation
 template ThreadTimes broadcastAccFunction(const boost::function<ThreadTimes*()>& fun);
 
+static void loadCacheSnapshotFile(const std::string& fname, size_t workers)
+{
+  auto fp = std::unique_ptr<FILE, int (*)(FILE*)>(fopen(fname.c_str(), "r"), fclose);
+  if (!fp) {
+    if (errno != ENOENT) {
+      g_log << Logger::Error << "Unable to open the cache snapshot '" << fname << "': " << stringerror() << endl;
+    }
+    return;
+  }
+
+  DTime dt;
+  dt.set();
+  const time_t now = time(nullptr);
+  time_t written = 0;
+  try {
+    const auto loaded = loadCacheSnapshot(fp.get(), now, workers, written);
+    g_log << Logger::Warning << "Loaded " << loaded << " cache entries from the snapshot '" << fname << "' written " << (now - written) << " seconds ago, in " << dt.udiff() / 1000 << " ms" << endl;
+  }
+  catch (const std::exception& e) {
+    g_log << Logger::Error << "Error loading the cache snapshot '" << fname << "': " << e.what() << endl;
+  }
+  catch (const PDNSException& e) {
+    g_log << Logger::Error << "Error loading the cache snapshot '" << fname << "': " << e.reason << endl;
+  }
+}
+
+/* write to a temporary file first so that an interrupted save does not destroy the previous snapshot */
+static void saveCacheSnapshotFile(const std::string& fname)
+{
+  const std::string tmpName = fname + ".tmp";
+  auto fp = std::unique_ptr<FILE, int (*)(FILE*)>(fopen(tmpName.c_str(), "w"), fclose);
+  if (!fp) {
+    g_log << Logger::Error << "Unable to open '" << tmpName << "' to save the cache snapshot: " << stringerror() << endl;
+    return;
+  }
+
+  try {
+    const auto saved = saveCacheSnapshot(fp.get(), time(nullptr));
+    if (fclose(fp.release()) != 0) {
+      throw std::runtime_error("Error closing the file: " + stringerror());
+    }
+    if (rename(tmpName.c_str(), fname.c_str()) != 0) {
+      throw std::runtime_error("Error renaming '" + tmpName + "': " + stringerror());
+    }
+    g_log << Logger::Warning << "Saved " << saved << " cache entries to the snapshot '" << fname << "'" << endl;
+  }
+  catch (const std::exception& e) {
+    g_log << Logger::Error << "Error saving the cache snapshot '" << fname << "': " << e.what() << endl;
+    unlink(tmpName.c_str());
+  }
+}
+
 static int serviceMain(int argc, char* argv[])
 {
   g_slogStructured = ::arg().mustDo("structured-logging");
@@ -1226,6 +1272,7 @@ static int serviceMain(int argc, char* argv[])
 
   g_maxCacheEntries = ::arg().asNum("max-cache-entries");
   g_maxPacketCacheEntries = ::arg().asNum("max-packetcache-entries");
+  s_cachePruneThreads = std::max(::arg().asNum("cache-prune-threads"), 1);
 
   luaConfigDelayedThreads delayedLuaThreads;
   try {
@@ -1302,6 +1349,7 @@ static int serviceMain(int argc, char* argv[])
   SyncRes::s_rootNXTrust = ::arg().mustDo("root-nx-trust");
   SyncRes::s_refresh_ttlperc = ::arg().asNum("refresh-on-ttl-perc");
   RecursorPacketCache::s_refresh_ttlperc = SyncRes::s_refresh_ttlperc;
+  setAlmostExpiredTaskParameters(::arg().asNum("refresh-on-ttl-min-hits-per-minute"), ::arg().asNum("refresh-on-ttl-jitter-perc"), ::arg().asNum("refresh-on-ttl-max-qps"));
   SyncRes::s_tcp_fast_open = ::arg().asNum("tcp-fast-open");
   SyncRes::s_tcp_fast_open_connect = ::arg().mustDo("tcp-fast-open-connect");
 
@@ -1455,6 +1503,9 @@ static int serviceMain(int argc, char* argv[])
   TCPOutConnectionManager::s_maxQueries = ::arg().asNum("tcp-out-max-queries");
   TCPOutConnectionManager::s_maxIdlePerThread = ::arg().asNum("tcp-out-max-idle-per-thread");
 
+  UDPClientSocks::s_maxQueries = ::arg().asNum("udp-out-max-queries");
+  UDPClientSocks::s_maxLifetime = ::arg().asNum("udp-out-max-lifetime");
+
   g_gettagNeedsEDNSOptions = ::arg().mustDo("gettag-needs-edns-options");
 
   s_statisticsInterval = ::arg().asNum("statistics-interval");
@@ -1692,6 +1743,18 @@ static int serviceMain(int argc, char* argv[])
   g_maxTCPPerClient = ::arg().asNum("max-tcp-per-client");
   g_tcpMaxQueriesPerConn = ::arg().asNum("max-tcp-queries-per-connection");
   g_maxUDPQueriesPerRound = ::arg().asNum("max-udp-queries-per-round");
+  g_udpReceiveBatchSize = std::max(::arg().asNum("udp-receive-batch-size"), 1);
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE)
+  if (g_udpReceiveBatchSize > 1024) {
+    g_log << Logger::Warning << "Limiting udp-receive-batch-size to 1024, the maximum number of messages the kernel handles in a single call" << endl;
+    g_udpReceiveBatchSize = 1024;
+  }
+#else
+  if (g_udpReceiveBatchSize > 1) {
+    g_log << Logger::Warning << "udp-receive-batch-size is set but recvmmsg() and sendmmsg() are not available, ignoring" << endl;
+    g_udpReceiveBatchSize = 1;
+  }
+#endif
 
   g_useKernelTimestamp = ::arg().mustDo("protobuf-use-kernel-timestamp");
 
@@ -1737,17 +1800,21 @@ static int serviceMain(int argc, char* argv[])
     g_avoidUdpSourcePorts.insert(port);
   }
 
-  return RecThreadInfo::runThreads();
-}
+  const std::string snapshotFile = ::arg()["cache-snapshot-file"];
+  if (!snapshotFile.empty()) {
+    loadCacheSnapshotFile(snapshotFile, std::max(::arg().asNum("cache-snapshot-load-threads"), 1));
+  }
 
-static void handlePipeRequest(int fd, FDMultiplexer::funcparam_t& var)
-{
-  ThreadMSG* tmsg = nullptr;
+  int ret = RecThreadInfo::runThreads();
 
-  if (read(fd, &tmsg, sizeof(tmsg)) != sizeof(tmsg)) { // fd == readToThread || fd == readQueriesToThread
-    unixDie("read from thread pipe returned wrong size or error");
+  if (!snapshotFile.empty()) {
+    saveCacheSnapshotFile(snapshotFile);
   }
+  return ret;
+}
 
+static void runThreadMSG(ThreadMSG* tmsg)
+{
   void* resp = 0;
   try {
     resp = tmsg->func();
@@ -1770,6 +1837,39 @@ static void handlePipeRequest(int fd, FDMultiplexer::funcparam_t& var)
   delete tmsg;
 }
 
+static void handlePipeRequest(int fd, FDMultiplexer::funcparam_t& var)
+{
+  ThreadMSG* tmsg = nullptr;
+
+  if (read(fd, &tmsg, sizeof(tmsg)) != sizeof(tmsg)) { // fd == readToThread
+    unixDie("read from thread pipe returned wrong size or error");
+  }
+
+  runThreadMSG(tmsg);
+}
+
+static void handleDistributedQueries(int fd, FDMultiplexer::funcparam_t& var)
+{
+  auto& threadInfo = RecThreadInfo::self();
+  /* clear first, so that a query pushed while we are draining the queue wakes us up again */
+  threadInfo.queriesNotifier->clear();
+
+  /* cap the number of queries handled per wakeup, like we do for incoming UDP queries, so that
+     a busy distributor does not prevent us from handling responses and other events */
+  const size_t maxQueries = std::max(g_maxUDPQueriesPerRound, static_cast<size_t>(1));
+  size_t count = 0;
+  ThreadMSG* tmsg = nullptr;
+  while (count < maxQueries && threadInfo.queriesQueue->pop(tmsg)) {
+    runThreadMSG(tmsg);
+    count++;
+  }
+
+  if (count == maxQueries) {
+    /* there might be more waiting, make sure we are woken up again once the other events have been handled */
+    threadInfo.queriesNotifier->notify();
+  }
+}
+
 static void handleRCC(int fd, FDMultiplexer::funcparam_t& var)
 {
   try {
@@ -1854,23 +1954,10 @@ static void houseKeeping(void*)
     // Below are the tasks that run for every recursorThread, including handler and taskThread
     static thread_local PeriodicTask packetCacheTask{"packetCacheTask", 5};
     packetCacheTask.runIfDue(now, []() {
-      t_packetCache->doPruneTo(g_maxPacketCacheEntries / (RecThreadInfo::numDistributors() + RecThreadInfo::numWorkers()));
-    });
-
-    // This is a full scan
-    static thread_local PeriodicTask pruneNSpeedTask{"pruneNSSpeedTask", 100};
-    pruneNSpeedTask.runIfDue(now, [now]() {
-      SyncRes::pruneNSSpeeds(now.tv_sec - 300);
-    });
-
-    static thread_local PeriodicTask pruneEDNSTask{"pruneEDNSTask", 5}; // period could likely be longer
-    pruneEDNSTask.runIfDue(now, [now]() {
-      SyncRes::pruneEDNSStatuses(now.tv_sec - 2 * 3600);
-    });
-
-    static thread_local PeriodicTask pruneThrottledTask{"pruneThrottledTask", 5};
-    pruneThrottledTask.runIfDue(now, []() {
-      SyncRes::pruneThrottledServers();
+      // the shared packet cache is pruned by the handler thread
+      if (!g_packetCache) {
+        t_packetCache->doPruneTo(g_maxPacketCacheEntries / (RecThreadInfo::numDistributors() + RecThreadInfo::numWorkers()));
+      }
     });
 
     static thread_local PeriodicTask pruneTCPTask{"pruneTCPTask", 5};
@@ -1878,6 +1965,13 @@ static void houseKeeping(void*)
       t_tcp_manager.cleanup(now);
     });
 
+    static thread_local PeriodicTask pruneUDPTask{"pruneUDPTask", 5};
+    pruneUDPTask.runIfDue(now, [now]() {
+      if (t_udpclientsocks) {
+        t_udpclientsocks->cleanup(now.tv_sec);
+      }
+    });
+
     const auto& info = RecThreadInfo::self();
 
     // Below are the thread specific tasks for the handler and the taskThread
@@ -1899,21 +1993,44 @@ static void houseKeeping(void*)
     else if (info.isHandler()) {
       static PeriodicTask recordCachePruneTask{"RecordCachePruneTask", 5};
       recordCachePruneTask.runIfDue(now, []() {
-        g_recCache->doPrune(g_maxCacheEntries);
+        g_recCache->doPrune(g_maxCacheEntries, s_cachePruneThreads);
+      });
+
+      static PeriodicTask sharedPacketCachePruneTask{"SharedPacketCachePruneTask", 5};
+      sharedPacketCachePruneTask.runIfDue(now, []() {
+        if (g_packetCache) {
+          g_packetCache->doPruneTo(g_maxPacketCacheEntries);
+        }
       });
 
       static PeriodicTask negCachePruneTask{"NegCachePrunteTask", 5};
       negCachePruneTask.runIfDue(now, []() {
-        g_negCache->prune(g_maxCacheEntries / 10);
+        g_negCache->prune(g_maxCacheEntries / 10, s_cachePruneThreads);
       });
 
       static PeriodicTask aggrNSECPruneTask{"AggrNSECPruneTask", 5};
       aggrNSECPruneTask.runIfDue(now, [now]() {
         if (g_aggressiveNSECCache) {
-          g_aggressiveNSECCache->prune(now.tv_sec);
+          g_aggressiveNSECCache->prune(now.tv_sec, s_cachePruneThreads);
         }
       });
 
+      // This is a full scan
+      static PeriodicTask pruneNSpeedTask{"pruneNSSpeedTask", 100};
+      pruneNSpeedTask.runIfDue(now, [now]() {
+        SyncRes::pruneNSSpeeds(now.tv_sec - 300);
+      });
+
+      static PeriodicTask pruneEDNSTask{"pruneEDNSTask", 5}; // period could likely be longer
+      pruneEDNSTask.runIfDue(now, [now]() {
+        SyncRes::pruneEDNSStatuses(now.tv_sec - 2 * 3600);
+      });
+
+      static PeriodicTask pruneThrottledTask{"pruneThrottledTask", 5};
+      pruneThrottledTask.runIfDue(now, []() {
+        SyncRes::pruneThrottledServers();
+      });
+
       static PeriodicTask pruneFailedServersTask{"pruneFailedServerTask", 5};
       pruneFailedServersTask.runIfDue(now, [now]() {
         SyncRes::pruneFailedServers(now.tv_sec - SyncRes::s_serverdownthrottletime * 10);
@@ -2035,7 +2152,12 @@ static void recursorThread()
       }
     }
 
-    t_packetCache = std::make_unique<RecursorPacketCache>();
+    if (g_packetCache) {
+      t_packetCache = g_packetCache;
+    }
+    else {
+      t_packetCache = std::make_shared<RecursorPacketCache>();
+    }
 
 #ifdef NOD_ENABLED
     if (threadInfo.isWorker())
@@ -2111,7 +2233,7 @@ static void recursorThread()
       g_log << Logger::Info << "Enabled '" << t_fdm->getName() << "' multiplexer" << endl;
     }
     else {
-      t_fdm->addReadFD(threadInfo.pipes.readQueriesToThread, handlePipeRequest);
+      t_fdm->addReadFD(threadInfo.queriesNotifier->getDescriptor(), handleDistributedQueries);
 
       if (threadInfo.isListener()) {
         if (g_reusePort) {
@@ -2330,12 +2452,17 @@ int main(int argc, char** argv)
 
     ::arg().set("hint-file", "If set, load root hints from this file") = "";
     ::arg().set("max-cache-entries", "If set, maximum number of entries in the main cache") = "1000000";
+    ::arg().set("cache-prune-threads", "Number of threads pruning the shards of the record, negative and aggressive NSEC caches in parallel") = "1";
+    ::arg().set("cache-snapshot-file", "If set, load the caches from this file on startup and save them to it when stopped nicely") = "";
+    ::arg().set("cache-snapshot-load-threads", "Number of threads loading the cache snapshot on startup") = "4";
     ::arg().set("max-negative-ttl", "maximum number of seconds to keep a negative cached entry in memory") = "3600";
     ::arg().set("max-cache-bogus-ttl", "maximum number of seconds to keep a Bogus (positive or negative) cached entry in memory") = "3600";
     ::arg().set("max-cache-ttl", "maximum number of seconds to keep a cached entry in memory") = "86400";
     ::arg().set("packetcache-ttl", "maximum number of seconds to keep a cached entry in packetcache") = "3600";
     ::arg().set("max-packetcache-entries", "maximum number of entries to keep in the packetcache") = "500000";
     ::arg().set("packetcache-servfail-ttl", "maximum number of seconds to keep a cached servfail entry in packetcache") = "60";
+    ::arg().setSwitch("packetcache-shared", "Share a single packetcache between all threads instead of having one per thread") = "no";
+    ::arg().set("packetcache-shards", "Number of shards in the packetcache, if shared between all threads") = "1024";
     ::arg().set("server-id", "Returned when queried for 'id.server' TXT or NSID, defaults to hostname, set custom or 'disabled'") = "";
     ::arg().set("stats-ringbuffer-entries", "maximum number of packets to store statistics for") = "10000";
     ::arg().set("version-string", "string reported on version.pdns or version.bind") = fullVersionString();
@@ -2392,8 +2519,10 @@ int main(int argc, char** argv)
     ::arg().set("max-total-msec", "Maximum total wall-clock time per query in milliseconds, 0 for unlimited") = "7000";
     ::arg().set("max-recursion-depth", "Maximum number of internal recursion calls per query, 0 for unlimited") = "40";
     ::arg().set("max-udp-queries-per-round", "Maximum number of UDP queries processed per recvmsg() round, before returning back to normal processing") = "10000";
+    ::arg().set("udp-receive-batch-size", "Maximum number of UDP queries read in a single recvmmsg() call, packet cache hits being answered with a single sendmmsg() call. 1 disables batching") = "1";
     ::arg().set("protobuf-use-kernel-timestamp", "Compute the latency of queries in protobuf messages by using the timestamp set by the kernel when the query was received (when available)") = "";
-    ::arg().set("distribution-pipe-buffer-size", "Size in bytes of the internal buffer of the pipe used by the distributor to pass incoming queries to a worker thread") = "0";
+    ::arg().set("distribution-pipe-buffer-size", "No longer used, see distribution-queue-size") = "0";
+    ::arg().set("distribution-queue-size", "Maximum number of incoming queries waiting in the queue of a worker thread, when distributed by distributor threads") = "8192";
 
     ::arg().set("include-dir", "Include *.conf files from this directory") = "";
     ::arg().set("security-poll-suffix", "Domain name from which to query security update notifications") = "secpoll.powerdns.com.";
@@ -2451,7 +2580,11 @@ int main(int argc, char** argv)
     ::arg().set("max-generate-steps", "Maximum number of $GENERATE steps when loading a zone from a file") = "0";
     ::arg().set("max-include-depth", "Maximum nested $INCLUDE depth when loading a zone from a file") = "20";
     ::arg().set("record-cache-shards", "Number of shards in the record cache") = "1024";
+    ::arg().setSwitch("record-cache-packed", "Store the records of the record cache in wire format, trading CPU on lookups for memory") = "no";
     ::arg().set("refresh-on-ttl-perc", "If a record is requested from the cache and only this % of original TTL remains, refetch") = "0";
+    ::arg().set("refresh-on-ttl-min-hits-per-minute", "Only refetch almost expired records that have been requested at least this many times per minute since they were cached") = "0";
+    ::arg().set("refresh-on-ttl-jitter-perc", "Spread the refetching of almost expired records over up to this % of the refresh window") = "0";
+    ::arg().set("refresh-on-ttl-max-qps", "Maximum number of outgoing queries per second sent to refetch almost expired records, 0 means no limit") = "0";
 
     ::arg().set("x-dnssec-names", "Collect DNSSEC statistics for names or suffixes in this list in separate x-dnssec counters") = "";
 
@@ -2487,6 +2620,8 @@ int main(int argc, char** argv)
     ::arg().set("tcp-out-max-idle-per-auth", "Maximum number of idle TCP/DoT connections to a specific IP per thread, 0 means do not keep idle connections open") = "10";
     ::arg().set("tcp-out-max-queries", "Maximum total number of queries per TCP/DoT connection, 0 means no limit") = "0";
     ::arg().set("tcp-out-max-idle-per-thread", "Maximum number of idle TCP/DoT connections per thread") = "100";
+    ::arg().set("udp-out-max-queries", "Maximum total number of queries sent over the same outgoing UDP socket to an authoritative server, 1 means that sockets are not reused, 0 means no limit") = "1";
+    ::arg().set("udp-out-max-lifetime", "Maximum time in seconds during which an outgoing UDP socket is used for new queries, 0 means no limit") = "1";
     ::arg().setSwitch("structured-logging", "Prefer structured logging") = "yes";
 
     ::arg().setCmd("help", "Provide a helpful message");
@@ -2579,8 +2714,11 @@ int main(int argc, char** argv)
       cout << ::arg().helpstring(::arg()["help"]) << endl;
       exit(0);
     }
-    g_recCache = std::make_unique<MemRecursorCache>(::arg().asNum("record-cache-shards"));
+    g_recCache = std::make_unique<MemRecursorCache>(::arg().asNum("record-cache-shards"), ::arg().mustDo("record-cache-packed"));
     g_negCache = std::make_unique<NegCache>(::arg().asNum("record-cache-shards"));
+    if (::arg().mustDo("packetcache-shared")) {
+      g_packetCache = std::make_shared<RecursorPacketCache>(::arg().asNum("packetcache-shards"));
+    }
 
     g_quiet = ::arg().mustDo("quiet");
     Logger::Urgency logUrgency = (Logger::Urgency)::arg().asNum("loglevel");
@@ -2678,7 +2816,12 @@ struct WipeCacheResult wipeCaches(const DNSName& canon, bool subtree, uint16_t q
 
   try {
     res.record_count = g_recCache->doWipeCache(canon, subtree, qtype);
-    res.packet_count = broadcastAccFunction<uint64_t>([=] { return pleaseWipePacketCache(canon, subtree, qtype); });
+    if (g_packetCache) {
+      res.packet_count = g_packetCache->doWipePacketCache(canon, qtype, subtree);
+    }
+    else {
+      res.packet_count = broadcastAccFunction<uint64_t>([=] { return pleaseWipePacketCache(canon, subtree, qtype); });
+    }
     res.negative_record_count = g_negCache->wipe(canon, subtree);
     if (g_aggressiveNSECCache) {
       g_aggressiveNSECCache->removeZoneInfo(canon, subtree);
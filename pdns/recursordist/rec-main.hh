@@ -29,11 +29,13 @@
 #include "logger.hh"
 #include "lua-recursor4.hh"
 #include "mplexer.hh"
+#include "mpscqueue.hh"
 #include "namespaces.hh"
 #include "rec-lua-conf.hh"
 #include "rec-protozero.hh"
 #include "syncres.hh"
 #include "rec-snmp.hh"
+#include "rec-udpsocketpool.hh"
 #include "rec_channel.hh"
 #include "threadname.hh"
 
@@ -150,13 +152,19 @@ extern uint16_t g_maxUdpSourcePort;
 // you can ask this class for a UDP socket to send a query from
 // this socket is not yours, don't even think about deleting it
 // but after you call 'returnSocket' on it, don't assume anything anymore
+// sockets are connected to the remote, and may be reused for several queries to that same remote
 class UDPClientSocks
 {
   unsigned int d_numsocks;
 
 public:
+  // Max total number of queries sent over a socket, 1 means that sockets are not reused, 0 is no max
+  static size_t s_maxQueries;
+  // Max time in seconds during which a socket is used for new queries, 0 is no max
+  static time_t s_maxLifetime;
+
   UDPClientSocks() :
-    d_numsocks(0)
+    d_numsocks(0), d_pool(s_maxQueries, s_maxLifetime)
   {
   }
 
@@ -165,9 +173,18 @@ public:
   // return a socket to the pool, or simply erase it
   void returnSocket(int fd);
 
+  // do not use this socket for new queries, it will be closed once all its queries have been returned
+  void retireSocket(int fd);
+
+  // retire the sockets that have exceeded their lifetime, closing the ones that are not in use
+  void cleanup(time_t now);
+
 private:
+  void closeSocket(int fd);
   // returns -1 for errors which might go away, throws for ones that won't
   static int makeClientSocket(int family);
+
+  UDPSocketPool d_pool;
 };
 
 enum class PaddingMode
@@ -199,6 +216,7 @@ extern int g_tcpTimeout;
 extern uint16_t g_udpTruncationThreshold;
 extern double g_balancingFactor;
 extern size_t g_maxUDPQueriesPerRound;
+extern size_t g_udpReceiveBatchSize;
 extern bool g_useKernelTimestamp;
 extern thread_local std::shared_ptr<NetmaskGroup> t_allowFrom;
 extern thread_local std::shared_ptr<NetmaskGroup> t_allowNotifyFrom;
@@ -294,6 +312,8 @@ static bool sendResponseOverTCP(const std::unique_ptr<DNSComboWriter>& dc, const
   return hadError;
 }
 
+struct ThreadMSG;
+
 // For communicating with our threads effectively readonly after
 // startup.
 // First we have the handler thread, t_id == 0 (some other helper
@@ -307,8 +327,6 @@ struct RecThreadInfo
     int readToThread{-1};
     int writeFromThread{-1};
     int readFromThread{-1};
-    int writeQueriesToThread{-1}; // this one is non-blocking
-    int readQueriesToThread{-1};
   };
 
 public:
@@ -456,6 +474,10 @@ public:
   deferredAdd_t deferredAdds;
 
   struct ThreadPipeSet pipes;
+  // queries passed to this worker by the distributor threads, the notifier's descriptor
+  // becoming readable when the queue goes from drained to non-empty
+  std::unique_ptr<pdns::MPSCQueue<ThreadMSG*>> queriesQueue;
+  std::unique_ptr<pdns::WakeupNotifier> queriesNotifier;
   MT_t* mt{nullptr};
   uint64_t numberOfDistributedQueries{0};
 
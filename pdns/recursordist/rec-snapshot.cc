@@ -0,0 +1,435 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <atomic>
+#include <thread>
+
+#include "rec-snapshot.hh"
+#include "aggressive_nsec.hh"
+#include "lock.hh"
+#include "negcache.hh"
+#include "recursor_cache.hh"
+#include "syncres.hh"
+
+namespace pdns
+{
+namespace snapshot
+{
+static const char s_magic[8] = {'P', 'D', 'N', 'S', 'R', 'S', 'N', 'P'};
+static const uint32_t s_version = 1;
+/* type, number of entries, length */
+static const size_t s_sectionHeaderSize = 1 + 4 + 4;
+
+void Encoder::putUInt8(uint8_t value)
+{
+  d_buffer.push_back(static_cast<char>(value));
+}
+
+void Encoder::putUInt16(uint16_t value)
+{
+  putUInt8(value >> 8);
+  putUInt8(value & 0xff);
+}
+
+void Encoder::putUInt32(uint32_t value)
+{
+  putUInt16(value >> 16);
+  putUInt16(value & 0xffff);
+}
+
+void Encoder::putUInt64(uint64_t value)
+{
+  putUInt32(value >> 32);
+  putUInt32(value & 0xffffffff);
+}
+
+void Encoder::putString(const std::string& value)
+{
+  if (value.size() > std::numeric_limits<uint32_t>::max()) {
+    throw std::runtime_error("String too large to be stored in a snapshot");
+  }
+  putUInt32(value.size());
+  d_buffer.append(value);
+}
+
+void Encoder::putName(const DNSName& name)
+{
+  /* the wire format of a name is at most 255 bytes */
+  const auto& storage = name.getStorage();
+  putUInt8(storage.size());
+  d_buffer.append(storage.c_str(), storage.size());
+}
+
+void Encoder::putAddress(const ComboAddress& address)
+{
+  if (address.sin4.sin_family == AF_INET) {
+    putUInt8(4);
+  }
+  else if (address.sin4.sin_family == AF_INET6) {
+    putUInt8(6);
+  }
+  else {
+    putUInt8(0);
+    return;
+  }
+  d_buffer.append(address.toByteString());
+  putUInt16(address.getPort());
+}
+
+void Encoder::putNetmask(const Netmask& netmask)
+{
+  if (netmask.empty()) {
+    putUInt8(0);
+    return;
+  }
+  putAddress(netmask.getNetwork());
+  putUInt8(netmask.getBits());
+}
+
+void Encoder::putState(vState state)
+{
+  putUInt8(static_cast<uint8_t>(state));
+}
+
+void Encoder::putContent(const DNSName& owner, DNSRecordContent& content)
+{
+  /* canonic so that names are not compressed */
+  putString(content.serialize(owner, true));
+}
+
+void Encoder::putRecord(const DNSRecord& record)
+{
+  if (!record.d_content) {
+    throw std::runtime_error("Trying to store a record without content in a snapshot");
+  }
+  putName(record.d_name);
+  putUInt16(record.d_type);
+  putUInt16(record.d_class);
+  putUInt32(record.d_ttl);
+  putUInt8(record.d_place);
+  putContent(record.d_name, *record.d_content);
+}
+
+void Encoder::putRecords(const std::vector<DNSRecord>& records)
+{
+  if (records.size() > std::numeric_limits<uint16_t>::max()) {
+    throw std::runtime_error("Too many records to be stored in a snapshot");
+  }
+  putUInt16(records.size());
+  for (const auto& record : records) {
+    putRecord(record);
+  }
+}
+
+const char* Decoder::consume(size_t size)
+{
+  if (size > d_data.size() - d_pos) {
+    throw std::out_of_range("Truncated snapshot data");
+  }
+  const char* ret = d_data.data() + d_pos;
+  d_pos += size;
+  return ret;
+}
+
+uint8_t Decoder::getUInt8()
+{
+  return static_cast<uint8_t>(*consume(1));
+}
+
+uint16_t Decoder::getUInt16()
+{
+  uint16_t value = getUInt8();
+  return (value << 8) + getUInt8();
+}
+
+uint32_t Decoder::getUInt32()
+{
+  uint32_t value = getUInt16();
+  return (value << 16) + getUInt16();
+}
+
+uint64_t Decoder::getUInt64()
+{
+  uint64_t value = getUInt32();
+  return (value << 32) + getUInt32();
+}
+
+std::string Decoder::getString()
+{
+  const auto size = getUInt32();
+  return std::string(consume(size), size);
+}
+
+DNSName Decoder::getName()
+{
+  const auto size = getUInt8();
+  if (size == 0) {
+    return DNSName();
+  }
+  const char* raw = consume(size);
+  try {
+    return DNSName(raw, size, 0, false);
+  }
+  catch (const std::exception& e) {
+    throw std::out_of_range("Invalid name in snapshot: " + std::string(e.what()));
+  }
+}
+
+ComboAddress Decoder::getAddress()
+{
+  const auto version = getUInt8();
+  if (version == 0) {
+    ComboAddress unset;
+    unset.sin4.sin_family = 0;
+    return unset;
+  }
+  if (version != 4 && version != 6) {
+    throw std::out_of_range("Invalid address family in snapshot");
+  }
+  const size_t size = version == 4 ? 4 : 16;
+  auto address = makeComboAddressFromRaw(version, consume(size), size);
+  address.setPort(getUInt16());
+  return address;
+}
+
+Netmask Decoder::getNetmask()
+{
+  auto network = getAddress();
+  if (network.sin4.sin_family == 0) {
+    return Netmask();
+  }
+  return Netmask(network, getUInt8());
+}
+
+vState Decoder::getState()
+{
+  const auto state = getUInt8();
+  if (state > static_cast<uint8_t>(vState::BogusInvalidDNSKEYProtocol)) {
+    throw std::out_of_range("Invalid validation state in snapshot");
+  }
+  return static_cast<vState>(state);
+}
+
+std::shared_ptr<DNSRecordContent> Decoder::getContent(const DNSName& owner, uint16_t qtype)
+{
+  const auto rdata = getString();
+  try {
+    return DNSRecordContent::deserialize(owner, qtype, rdata);
+  }
+  catch (const std::exception& e) {
+    throw std::out_of_range("Invalid record content in snapshot: " + std::string(e.what()));
+  }
+}
+
+DNSRecord Decoder::getRecord()
+{
+  DNSRecord record;
+  record.d_name = getName();
+  record.d_type = getUInt16();
+  record.d_class = getUInt16();
+  record.d_ttl = getUInt32();
+  const auto place = getUInt8();
+  if (place > DNSResourceRecord::ADDITIONAL) {
+    throw std::out_of_range("Invalid record place in snapshot");
+  }
+  record.d_place = static_cast<DNSResourceRecord::Place>(place);
+  record.d_content = getContent(record.d_name, record.d_type);
+  return record;
+}
+
+std::vector<DNSRecord> Decoder::getRecords()
+{
+  const auto count = getUInt16();
+  std::vector<DNSRecord> records;
+  records.reserve(count);
+  for (uint16_t idx = 0; idx < count; idx++) {
+    records.push_back(getRecord());
+  }
+  return records;
+}
+
+static void writeOrThrow(FILE* fp, const void* data, size_t size)
+{
+  if (size > 0 && fwrite(data, size, 1, fp) != 1) {
+    throw std::runtime_error("Error writing snapshot: " + stringerror());
+  }
+}
+
+void SectionWriter::entryDone()
+{
+  ++d_entries;
+  ++d_total;
+  if (d_encoder.d_buffer.size() >= s_sectionSize || d_entries == std::numeric_limits<uint32_t>::max()) {
+    flush();
+  }
+}
+
+void SectionWriter::flush()
+{
+  if (d_entries == 0) {
+    return;
+  }
+
+  Encoder header;
+  header.putUInt8(static_cast<uint8_t>(d_section));
+  header.putUInt32(d_entries);
+  header.putUInt32(d_encoder.d_buffer.size());
+  writeOrThrow(d_fp, header.d_buffer.data(), header.d_buffer.size());
+  writeOrThrow(d_fp, d_encoder.d_buffer.data(), d_encoder.d_buffer.size());
+  d_encoder.d_buffer.clear();
+  d_entries = 0;
+}
+
+void writeHeader(FILE* fp, time_t now)
+{
+  Encoder header;
+  header.d_buffer.append(s_magic, sizeof(s_magic));
+  header.putUInt32(s_version);
+  header.putUInt64(now);
+  writeOrThrow(fp, header.d_buffer.data(), header.d_buffer.size());
+}
+
+static bool readOrThrow(FILE* fp, std::string& buffer, size_t size, bool eofAllowed)
+{
+  buffer.resize(size);
+  if (size == 0) {
+    return true;
+  }
+  const auto got = fread(&buffer.at(0), 1, size, fp);
+  if (got == size) {
+    return true;
+  }
+  if (ferror(fp)) {
+    throw std::runtime_error("Error reading snapshot: " + stringerror());
+  }
+  if (got == 0 && eofAllowed) {
+    return false;
+  }
+  throw std::runtime_error("Truncated snapshot");
+}
+
+uint64_t load(FILE* fp, const std::map<Section, SectionLoader>& loaders, size_t workers, time_t& written)
+{
+  std::string buffer;
+  readOrThrow(fp, buffer, sizeof(s_magic) + 4 + 8, false);
+  if (memcmp(buffer.data(), s_magic, sizeof(s_magic)) != 0) {
+    throw std::runtime_error("Not a cache snapshot");
+  }
+  {
+    Decoder header(buffer);
+    header.getUInt64(); // magic
+    const auto version = header.getUInt32();
+    if (version != s_version) {
+      throw std::runtime_error("Unsupported cache snapshot version " + std::to_string(version));
+    }
+    written = header.getUInt64();
+  }
+
+  /* each worker reads the next section under the lock, then decodes it without holding it */
+  LockGuarded<FILE*> file(fp);
+  std::atomic<uint64_t> loaded{0};
+  std::atomic<bool> failed{false};
+  LockGuarded<std::exception_ptr> error;
+
+  auto worker = [&]() {
+    std::string data;
+    std::string header;
+    try {
+      while (!failed) {
+        Section section;
+        uint32_t entries;
+        {
+          auto locked = file.lock();
+          if (!readOrThrow(*locked, header, s_sectionHeaderSize, true)) {
+            break;
+          }
+          Decoder decoder(header);
+          section = static_cast<Section>(decoder.getUInt8());
+          entries = decoder.getUInt32();
+          readOrThrow(*locked, data, decoder.getUInt32(), false);
+        }
+
+        const auto loader = loaders.find(section);
+        if (loader == loaders.end()) {
+          continue;
+        }
+        Decoder decoder(data);
+        loaded += loader->second(decoder, entries);
+      }
+    }
+    catch (...) {
+      failed = true;
+      auto lock = error.lock();
+      if (!*lock) {
+        *lock = std::current_exception();
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t idx = 1; idx < workers; idx++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  auto lock = error.lock();
+  if (*lock) {
+    std::rethrow_exception(*lock);
+  }
+  return loaded;
+}
+}
+}
+
+uint64_t saveCacheSnapshot(FILE* fp, time_t now)
+{
+  pdns::snapshot::writeHeader(fp, now);
+  uint64_t saved = g_recCache->saveSnapshot(fp, now);
+  saved += g_negCache->saveSnapshot(fp, now);
+  if (g_aggressiveNSECCache) {
+    saved += g_aggressiveNSECCache->saveSnapshot(fp, now);
+  }
+  if (fflush(fp) != 0) {
+    throw std::runtime_error("Error writing snapshot: " + stringerror());
+  }
+  return saved;
+}
+
+uint64_t loadCacheSnapshot(FILE* fp, time_t now, size_t workers, time_t& written)
+{
+  std::map<pdns::snapshot::Section, pdns::snapshot::SectionLoader> loaders;
+  loaders[pdns::snapshot::Section::RecordCache] = [now](pdns::snapshot::Decoder& decoder, uint32_t entries) {
+    return g_recCache->loadSnapshotSection(decoder, entries, now);
+  };
+  loaders[pdns::snapshot::Section::NegCache] = [now](pdns::snapshot::Decoder& decoder, uint32_t entries) {
+    return g_negCache->loadSnapshotSection(decoder, entries, now);
+  };
+  if (g_aggressiveNSECCache) {
+    loaders[pdns::snapshot::Section::AggressiveNSECCache] = [now](pdns::snapshot::Decoder& decoder, uint32_t entries) {
+      return g_aggressiveNSECCache->loadSnapshotSection(decoder, entries, now);
+    };
+  }
+  return pdns::snapshot::load(fp, loaders, workers, written);
+}
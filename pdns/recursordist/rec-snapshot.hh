@@ -0,0 +1,152 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <string>
+
+#include "dnsname.hh"
+#include "dnsparser.hh"
+#include "iputils.hh"
+#include "validate.hh"
+
+/* Binary snapshot of the record cache, the negative cache and the aggressive NSEC cache, so that
+   a restarted recursor does not have to start with empty caches.
+   A snapshot starts with a header (magic, version and time of writing) followed by sections, each one
+   holding a batch of entries from one of the caches. Sections are independent from each other so that
+   they can be decoded by several threads at once.
+   Expiration times are stored as absolute times: entries that expired while the recursor was not
+   running are skipped when loading, and the TTL of the remaining ones is reduced by the elapsed time.
+   Records are stored in uncompressed wire format, integers in network byte order. */
+namespace pdns
+{
+namespace snapshot
+{
+enum class Section : uint8_t
+{
+  RecordCache = 1,
+  NegCache = 2,
+  AggressiveNSECCache = 3
+};
+
+class Encoder
+{
+public:
+  void putUInt8(uint8_t value);
+  void putUInt16(uint16_t value);
+  void putUInt32(uint32_t value);
+  void putUInt64(uint64_t value);
+  void putString(const std::string& value);
+  void putName(const DNSName& name);
+  void putAddress(const ComboAddress& address);
+  void putNetmask(const Netmask& netmask);
+  void putState(vState state);
+  void putContent(const DNSName& owner, DNSRecordContent& content);
+  void putRecord(const DNSRecord& record);
+  void putRecords(const std::vector<DNSRecord>& records);
+
+  std::string d_buffer;
+};
+
+/* all methods throw a std::out_of_range exception on truncated or invalid data */
+class Decoder
+{
+public:
+  Decoder(const std::string& data) :
+    d_data(data)
+  {
+  }
+
+  uint8_t getUInt8();
+  uint16_t getUInt16();
+  uint32_t getUInt32();
+  uint64_t getUInt64();
+  std::string getString();
+  DNSName getName();
+  ComboAddress getAddress();
+  Netmask getNetmask();
+  vState getState();
+  std::shared_ptr<DNSRecordContent> getContent(const DNSName& owner, uint16_t qtype);
+  DNSRecord getRecord();
+  std::vector<DNSRecord> getRecords();
+
+private:
+  const char* consume(size_t size);
+
+  const std::string& d_data;
+  size_t d_pos{0};
+};
+
+/* buffers the entries of a cache and writes them as sections of a reasonable size,
+   throws a std::runtime_error if writing fails */
+class SectionWriter
+{
+public:
+  SectionWriter(FILE* fp, Section section) :
+    d_fp(fp), d_section(section)
+  {
+  }
+
+  Encoder& encoder()
+  {
+    return d_encoder;
+  }
+
+  /* to be called once an entry has been completely encoded */
+  void entryDone();
+  /* write the pending entries, if any */
+  void flush();
+
+  uint64_t getEntriesCount() const
+  {
+    return d_total;
+  }
+
+private:
+  static const size_t s_sectionSize = 1024 * 1024;
+
+  Encoder d_encoder;
+  FILE* d_fp;
+  uint64_t d_total{0};
+  uint32_t d_entries{0};
+  Section d_section;
+};
+
+/* decodes the 'entries' entries of a section, returning the number of entries actually loaded */
+using SectionLoader = std::function<size_t(Decoder& decoder, uint32_t entries)>;
+
+void writeHeader(FILE* fp, time_t now);
+/* Checks the header, then hands each section over to the loader of its type, from up to 'workers'
+   threads including the calling one. Sections without a loader are skipped.
+   Returns the number of entries loaded, and the time the snapshot was written in 'written'.
+   Throws a std::runtime_error or std::out_of_range exception on error, in which case some of
+   the entries might have been loaded already. */
+uint64_t load(FILE* fp, const std::map<Section, SectionLoader>& loaders, size_t workers, time_t& written);
+}
+}
+
+/* save the record cache, negative cache and aggressive NSEC cache, returns the number of entries saved */
+uint64_t saveCacheSnapshot(FILE* fp, time_t now);
+/* load a snapshot into the caches, using up to 'workers' threads. Returns the number of entries loaded */
+uint64_t loadCacheSnapshot(FILE* fp, time_t now, size_t workers, time_t& written);
@@ -98,10 +98,17 @@ private:
 struct Queue
 {
   pdns::TaskQueue queue;
+  // almost expired tasks are kept apart so that they can wait for the query budget without delaying the other tasks
+  pdns::TaskQueue almostExpiredQueue;
   TimedSet rateLimitSet{60};
+  pdns::QueryBudget almostExpiredBudget;
 };
 static LockGuarded<Queue> s_taskQueue;
 
+// Set at startup, before any task is pushed
+static uint32_t s_almostExpiredMinHitsPerMinute{0};
+static uint32_t s_almostExpiredJitterPerc{0};
+
 struct taskstats
 {
   pdns::stat_t pushed;
@@ -145,6 +152,9 @@ static void resolve(const struct timeval& now, bool logErrors, const pdns::Resol
   catch (...) {
     log->error(Logr::Error, msg, "Unexpectec exception");
   }
+  if (task.d_refreshMode) {
+    consumeAlmostExpiredBudget(sr.d_outqueries);
+  }
   if (ex) {
     if (task.d_refreshMode) {
       ++s_almost_expired_tasks.exceptions;
@@ -168,14 +178,36 @@ void runTaskOnce(bool logErrors)
   pdns::ResolveTask task;
   {
     auto lock = s_taskQueue.lock();
-    if (lock->queue.empty()) {
-      return;
+    if (!lock->queue.empty()) {
+      task = lock->queue.pop();
+    }
+    else {
+      auto& almostExpired = lock->almostExpiredQueue;
+      if (almostExpired.empty()) {
+        return;
+      }
+      struct timeval now;
+      Utility::gettimeofday(&now);
+      if (!lock->almostExpiredBudget.allowed(now)) {
+        // almost expired tasks stay queued until we have the budget to run them, but the ones whose deadline has passed can go
+        while (!almostExpired.empty() && almostExpired.front().d_deadline < now.tv_sec) {
+          almostExpired.pop();
+          almostExpired.incExpired();
+        }
+        return;
+      }
+      task = almostExpired.pop();
     }
-    task = lock->queue.pop();
   }
   bool expired = task.run(logErrors);
   if (expired) {
-    s_taskQueue.lock()->queue.incExpired();
+    auto lock = s_taskQueue.lock();
+    if (task.d_refreshMode) {
+      lock->almostExpiredQueue.incExpired();
+    }
+    else {
+      lock->queue.incExpired();
+    }
   }
 }
 
@@ -187,10 +219,45 @@ void pushAlmostExpiredTask(const DNSName& qname, uint16_t qtype, time_t deadline
     return;
   }
   pdns::ResolveTask task{qname, qtype, deadline, true, resolve};
-  s_taskQueue.lock()->queue.push(std::move(task));
+  s_taskQueue.lock()->almostExpiredQueue.push(std::move(task));
   ++s_almost_expired_tasks.pushed;
 }
 
+bool almostExpiredTaskWanted(const DNSName& qname, uint32_t hits, uint32_t origTTL, uint32_t ttl, uint32_t window)
+{
+  if (s_almostExpiredMinHitsPerMinute > 0) {
+    // count at least a minute so that a few hits on a short-lived entry are not enough
+    const uint64_t elapsed = std::max(origTTL > ttl ? origTTL - ttl : 0U, 60U);
+    if (static_cast<uint64_t>(hits) * 60 < s_almostExpiredMinHitsPerMinute * elapsed) {
+      return false;
+    }
+  }
+
+  if (s_almostExpiredJitterPerc > 0) {
+    // a stable offset per name, so that entries cached at the same time are not all refreshed at once
+    const uint32_t offset = qname.hash() % (static_cast<uint64_t>(window) * s_almostExpiredJitterPerc / 100 + 1);
+    if (ttl > window - offset) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void setAlmostExpiredTaskParameters(uint32_t minHitsPerMinute, uint32_t jitterPerc, uint32_t maxQPS)
+{
+  s_almostExpiredMinHitsPerMinute = minHitsPerMinute;
+  s_almostExpiredJitterPerc = std::min(jitterPerc, 100U);
+  struct timeval now;
+  Utility::gettimeofday(&now);
+  s_taskQueue.lock()->almostExpiredBudget.setRate(maxQPS, now);
+}
+
+void consumeAlmostExpiredBudget(unsigned int queries)
+{
+  s_taskQueue.lock()->almostExpiredBudget.consume(queries);
+}
+
 void pushResolveTask(const DNSName& qname, uint16_t qtype, time_t now, time_t deadline)
 {
   if (SyncRes::isUnsupported(qtype)) {
@@ -209,29 +276,37 @@ void pushResolveTask(const DNSName& qname, uint16_t qtype, time_t now, time_t de
 
 uint64_t getTaskPushes()
 {
-  return s_taskQueue.lock()->queue.getPushes();
+  auto lock = s_taskQueue.lock();
+  return lock->queue.getPushes() + lock->almostExpiredQueue.getPushes();
 }
 
 uint64_t getTaskExpired()
 {
-  return s_taskQueue.lock()->queue.getExpired();
+  auto lock = s_taskQueue.lock();
+  return lock->queue.getExpired() + lock->almostExpiredQueue.getExpired();
 }
 
 uint64_t getTaskSize()
 {
-  return s_taskQueue.lock()->queue.size();
+  auto lock = s_taskQueue.lock();
+  return lock->queue.size() + lock->almostExpiredQueue.size();
 }
 
 void taskQueueClear()
 {
   auto lock = s_taskQueue.lock();
   lock->queue.clear();
+  lock->almostExpiredQueue.clear();
   lock->rateLimitSet.clear();
 }
 
 pdns::ResolveTask taskQueuePop()
 {
-  return s_taskQueue.lock()->queue.pop();
+  auto lock = s_taskQueue.lock();
+  if (!lock->queue.empty()) {
+    return lock->queue.pop();
+  }
+  return lock->almostExpiredQueue.pop();
 }
 
 uint64_t getAlmostExpiredTasksPushed()
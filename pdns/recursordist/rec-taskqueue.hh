@@ -31,6 +31,12 @@ struct ResolveTask;
 }
 void runTaskOnce(bool logErrors);
 void pushAlmostExpiredTask(const DNSName& qname, uint16_t qtype, time_t deadline);
+// Whether an almost expired entry, hit 'hits' times since it was cached with a TTL of 'origTTL',
+// is worth refreshing now that only 'ttl' seconds are left, the refresh window being 'window' seconds
+bool almostExpiredTaskWanted(const DNSName& qname, uint32_t hits, uint32_t origTTL, uint32_t ttl, uint32_t window);
+void setAlmostExpiredTaskParameters(uint32_t minHitsPerMinute, uint32_t jitterPerc, uint32_t maxQPS);
+// Account for the outgoing queries sent by an almost expired task
+void consumeAlmostExpiredBudget(unsigned int queries);
 void pushResolveTask(const DNSName& qname, uint16_t qtype, time_t now, time_t deadline);
 void taskQueueClear();
 pdns::ResolveTask taskQueuePop();
@@ -0,0 +1,129 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "rec-udpsocketpool.hh"
+
+int UDPSocketPool::reuse(const ComboAddress& remote, time_t now, std::vector<int>& closable)
+{
+  if (d_maxQueries == 1) {
+    return -1;
+  }
+
+  auto current = d_current.find(remote);
+  if (current == d_current.end()) {
+    return -1;
+  }
+
+  const int fd = current->second;
+  auto& state = d_sockets.at(fd);
+  if (expired(state, now)) {
+    if (retire(fd)) {
+      closable.push_back(fd);
+    }
+    return -1;
+  }
+
+  ++state.d_numqueries;
+  ++state.d_inflight;
+  if (d_maxQueries > 0 && state.d_numqueries >= d_maxQueries) {
+    state.d_retired = true;
+    d_current.erase(current);
+  }
+  return fd;
+}
+
+void UDPSocketPool::add(int fd, const ComboAddress& remote, time_t now)
+{
+  auto& state = d_sockets[fd];
+  state.d_remote = remote;
+  state.d_created = now;
+  state.d_numqueries = 1;
+  state.d_inflight = 1;
+  state.d_retired = d_maxQueries == 1;
+  if (!state.d_retired) {
+    d_current[remote] = fd;
+  }
+}
+
+bool UDPSocketPool::release(int fd)
+{
+  auto it = d_sockets.find(fd);
+  if (it == d_sockets.end()) {
+    return false;
+  }
+
+  auto& state = it->second;
+  if (state.d_inflight > 0) {
+    --state.d_inflight;
+  }
+  if (state.d_inflight == 0 && state.d_retired) {
+    d_sockets.erase(it);
+    return true;
+  }
+  return false;
+}
+
+bool UDPSocketPool::retire(int fd)
+{
+  auto it = d_sockets.find(fd);
+  if (it == d_sockets.end()) {
+    return false;
+  }
+
+  auto& state = it->second;
+  if (!state.d_retired) {
+    state.d_retired = true;
+    auto current = d_current.find(state.d_remote);
+    if (current != d_current.end() && current->second == fd) {
+      d_current.erase(current);
+    }
+  }
+  if (state.d_inflight == 0) {
+    d_sockets.erase(it);
+    return true;
+  }
+  return false;
+}
+
+std::vector<int> UDPSocketPool::cleanup(time_t now)
+{
+  std::vector<int> closable;
+  if (d_maxLifetime == 0) {
+    return closable;
+  }
+
+  for (auto current = d_current.begin(); current != d_current.end();) {
+    const int fd = current->second;
+    auto state = d_sockets.find(fd);
+    if (!expired(state->second, now)) {
+      ++current;
+      continue;
+    }
+    current = d_current.erase(current);
+    state->second.d_retired = true;
+    if (state->second.d_inflight == 0) {
+      d_sockets.erase(state);
+      closable.push_back(fd);
+    }
+  }
+  return closable;
+}
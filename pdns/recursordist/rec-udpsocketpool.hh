@@ -0,0 +1,99 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include "iputils.hh"
+
+// Keeps track of the outgoing UDP sockets opened to send queries, and of which of them can be reused for a
+// new query to the same remote. This class does not open or close any socket, it only tells its caller
+// which ones can be closed.
+class UDPSocketPool
+{
+public:
+  UDPSocketPool(size_t maxQueries, time_t maxLifetime) :
+    d_maxQueries(maxQueries), d_maxLifetime(maxLifetime)
+  {
+  }
+
+  // Returns a socket that can be used for a new query to that remote, or -1 if a new one has to be opened.
+  // A socket that has exceeded its lifetime is retired, and added to 'closable' if it is not in use anymore
+  int reuse(const ComboAddress& remote, time_t now, std::vector<int>& closable);
+  // Registers a newly opened socket, used by one query
+  void add(int fd, const ComboAddress& remote, time_t now);
+  // A query is done with this socket, returns true if the socket should now be closed
+  bool release(int fd);
+  // Do not use this socket for new queries, returns true if it is not in use and should be closed now
+  bool retire(int fd);
+  // Retires the sockets that have exceeded their lifetime, returns the ones that should be closed now
+  std::vector<int> cleanup(time_t now);
+
+  size_t size() const
+  {
+    return d_sockets.size();
+  }
+
+  size_t inFlight(int fd) const
+  {
+    auto it = d_sockets.find(fd);
+    return it != d_sockets.end() ? it->second.d_inflight : 0;
+  }
+
+private:
+  struct SocketState
+  {
+    ComboAddress d_remote;
+    time_t d_created{0};
+    size_t d_numqueries{0};
+    size_t d_inflight{0};
+    bool d_retired{false};
+  };
+
+  bool expired(const SocketState& state, time_t now) const
+  {
+    return d_maxLifetime != 0 && now >= state.d_created + d_maxLifetime;
+  }
+
+  std::unordered_map<int, SocketState> d_sockets;
+  // the socket currently used for new queries to a given remote, if any
+  std::map<ComboAddress, int> d_current;
+  // Max total number of queries sent over a socket, 1 means that sockets are not reused, 0 is no max
+  size_t d_maxQueries;
+  // Max time in seconds during which a socket is used for new queries, 0 is no max
+  time_t d_maxLifetime;
+};
+
+// The keys of the waiters, whose key is a PacketID, waiting for a response over that socket
+template <class Waiters>
+auto getWaitersOnSocket(const Waiters& waiters, int fd)
+{
+  std::vector<decltype(waiters.begin()->key)> keys;
+  for (const auto& waiter : waiters) {
+    if (waiter.key->fd == fd) {
+      keys.push_back(waiter.key);
+    }
+  }
+  return keys;
+}
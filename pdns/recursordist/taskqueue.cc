@@ -44,6 +44,19 @@ ResolveTask TaskQueue::pop()
   return ret;
 }
 
+bool QueryBudget::allowed(const struct timeval& now)
+{
+  if (d_rate == 0) {
+    return true;
+  }
+  const double elapsed = (now.tv_sec - d_last.tv_sec) + (now.tv_usec - d_last.tv_usec) / 1000000.0;
+  if (elapsed > 0) {
+    d_tokens = std::min(static_cast<double>(d_rate), d_tokens + elapsed * d_rate);
+    d_last = now;
+  }
+  return d_tokens >= 1.0;
+}
+
 bool ResolveTask::run(bool logErrors)
 {
   if (d_func == nullptr) {
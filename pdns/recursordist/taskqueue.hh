@@ -55,6 +55,32 @@ struct ResolveTask
   bool run(bool logErrors);
 };
 
+// Token bucket limiting the outgoing queries sent by almost expired tasks, allowing bursts of one second worth of queries
+class QueryBudget
+{
+public:
+  void setRate(uint32_t qps, const struct timeval& now)
+  {
+    d_rate = qps;
+    d_tokens = qps;
+    d_last = now;
+  }
+
+  bool allowed(const struct timeval& now);
+
+  void consume(unsigned int queries)
+  {
+    if (d_rate != 0) {
+      d_tokens -= queries;
+    }
+  }
+
+private:
+  struct timeval d_last{0, 0};
+  double d_tokens{0};
+  uint32_t d_rate{0};
+};
+
 class TaskQueue
 {
 public:
@@ -70,6 +96,10 @@ public:
 
   void push(ResolveTask&& task);
   ResolveTask pop();
+  const ResolveTask& front() const
+  {
+    return d_queue.get<SequencedTag>().front();
+  }
 
   uint64_t getPushes()
   {
@@ -0,0 +1,112 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <boost/test/unit_test.hpp>
+
+#include <poll.h>
+#include <thread>
+
+#include "mpscqueue.hh"
+
+BOOST_AUTO_TEST_SUITE(mpscqueue_hh)
+
+BOOST_AUTO_TEST_CASE(test_queue_fifo)
+{
+  pdns::MPSCQueue<int> queue(3);
+  /* rounded up to a power of two */
+  BOOST_CHECK_EQUAL(queue.capacity(), 4U);
+
+  int value = 0;
+  BOOST_CHECK(!queue.pop(value));
+
+  for (int idx = 0; idx < 4; idx++) {
+    BOOST_CHECK(queue.push(idx));
+  }
+  BOOST_CHECK(!queue.push(42));
+
+  BOOST_CHECK(queue.pop(value));
+  BOOST_CHECK_EQUAL(value, 0);
+  /* room for one more */
+  BOOST_CHECK(queue.push(4));
+  BOOST_CHECK(!queue.push(42));
+
+  for (int idx = 1; idx < 5; idx++) {
+    BOOST_CHECK(queue.pop(value));
+    BOOST_CHECK_EQUAL(value, idx);
+  }
+  BOOST_CHECK(!queue.pop(value));
+}
+
+BOOST_AUTO_TEST_CASE(test_queue_producers)
+{
+  const size_t producersCount = 4;
+  const uint64_t itemsPerProducer = 100000;
+  pdns::MPSCQueue<uint64_t> queue(64);
+
+  std::vector<std::thread> producers;
+  for (size_t producer = 0; producer < producersCount; producer++) {
+    producers.emplace_back([&queue, producer]() {
+      for (uint64_t idx = 0; idx < itemsPerProducer; idx++) {
+        const uint64_t item = (producer << 32) | idx;
+        while (!queue.push(item)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  /* every item is received once, in the order it was pushed by its producer */
+  std::vector<uint64_t> expected(producersCount, 0);
+  uint64_t received = 0;
+  while (received < producersCount * itemsPerProducer) {
+    uint64_t item;
+    if (!queue.pop(item)) {
+      std::this_thread::yield();
+      continue;
+    }
+    const auto producer = item >> 32;
+    BOOST_REQUIRE_LT(producer, producersCount);
+    BOOST_REQUIRE_EQUAL(item & 0xffffffff, expected.at(producer));
+    expected.at(producer)++;
+    received++;
+  }
+
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  uint64_t item;
+  BOOST_CHECK(!queue.pop(item));
+}
+
+static bool isReadable(int fd)
+{
+  struct pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+
+BOOST_AUTO_TEST_CASE(test_notifier)
+{
+  pdns::WakeupNotifier notifier;
+  BOOST_CHECK(!isReadable(notifier.getDescriptor()));
+
+  notifier.notify();
+  BOOST_CHECK(isReadable(notifier.getDescriptor()));
+  /* coalesced */
+  notifier.notify();
+  notifier.clear();
+  BOOST_CHECK(!isReadable(notifier.getDescriptor()));
+
+  /* a notification after a clear is not lost */
+  notifier.notify();
+  BOOST_CHECK(isReadable(notifier.getDescriptor()));
+  notifier.clear();
+  BOOST_CHECK(!isReadable(notifier.getDescriptor()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,6 +3,7 @@
 #include <boost/test/unit_test.hpp>
 
 #include "negcache.hh"
+#include "rec-snapshot.hh"
 #include "dnsrecords.hh"
 #include "utility.hh"
 
@@ -482,6 +483,55 @@ BOOST_AUTO_TEST_CASE(test_dumpToFile)
   free(line);
 }
 
+BOOST_AUTO_TEST_CASE(test_snapshot)
+{
+  NegCache cache(4);
+
+  struct timeval now;
+  Utility::gettimeofday(&now, 0);
+
+  auto entry = genNegCacheEntry(DNSName("www1.powerdns.com"), DNSName("powerdns.com"), now, QType::A);
+  entry.d_validationState = vState::Secure;
+  cache.add(entry);
+  cache.add(genNegCacheEntry(DNSName("www2.powerdns.com"), DNSName("powerdns.com"), now));
+  auto expired = genNegCacheEntry(DNSName("www3.powerdns.com"), DNSName("powerdns.com"), now);
+  expired.d_ttd = now.tv_sec - 1;
+  cache.add(expired);
+  BOOST_CHECK_EQUAL(cache.size(), 3U);
+
+  auto fp = std::unique_ptr<FILE, int (*)(FILE*)>(tmpfile(), fclose);
+  if (!fp)
+    BOOST_FAIL("Temporary file could not be opened");
+
+  pdns::snapshot::writeHeader(fp.get(), now.tv_sec);
+  BOOST_CHECK_EQUAL(cache.saveSnapshot(fp.get(), now.tv_sec), 2U);
+  rewind(fp.get());
+
+  NegCache restored(2);
+  std::map<pdns::snapshot::Section, pdns::snapshot::SectionLoader> loaders;
+  loaders[pdns::snapshot::Section::NegCache] = [&restored, &now](pdns::snapshot::Decoder& decoder, uint32_t entries) {
+    return restored.loadSnapshotSection(decoder, entries, now.tv_sec);
+  };
+  time_t written = 0;
+  BOOST_CHECK_EQUAL(pdns::snapshot::load(fp.get(), loaders, 2, written), 2U);
+  BOOST_CHECK_EQUAL(restored.size(), 2U);
+
+  NegCache::NegCacheEntry ne;
+  BOOST_REQUIRE(restored.get(DNSName("www1.powerdns.com"), QType(QType::A), now, ne, true));
+  BOOST_CHECK_EQUAL(ne.d_auth, DNSName("powerdns.com"));
+  BOOST_CHECK_EQUAL(ne.d_ttd, entry.d_ttd);
+  BOOST_CHECK_EQUAL(ne.d_validationState, vState::Secure);
+  BOOST_REQUIRE_EQUAL(ne.authoritySOA.records.size(), 1U);
+  BOOST_CHECK_EQUAL(ne.authoritySOA.records.at(0).d_content->getZoneRepresentation(), entry.authoritySOA.records.at(0).d_content->getZoneRepresentation());
+  BOOST_CHECK_EQUAL(ne.authoritySOA.records.at(0).d_place, DNSResourceRecord::AUTHORITY);
+  BOOST_REQUIRE_EQUAL(ne.authoritySOA.signatures.size(), 1U);
+  BOOST_CHECK_EQUAL(ne.authoritySOA.signatures.at(0).d_content->getZoneRepresentation(), entry.authoritySOA.signatures.at(0).d_content->getZoneRepresentation());
+  BOOST_REQUIRE_EQUAL(ne.DNSSECRecords.records.size(), 1U);
+  BOOST_REQUIRE_EQUAL(ne.DNSSECRecords.signatures.size(), 1U);
+  BOOST_CHECK(restored.get(DNSName("www2.powerdns.com"), QType(QType::A), now, ne));
+  BOOST_CHECK(!restored.get(DNSName("www3.powerdns.com"), QType(QType::A), now, ne));
+}
+
 BOOST_AUTO_TEST_CASE(test_count)
 {
   string qname(".powerdns.com");
@@ -44,4 +44,101 @@ BOOST_AUTO_TEST_CASE(test_resolve_queue_rate_limit)
   BOOST_CHECK_EQUAL(getTaskSize(), 1U);
 }
 
+BOOST_AUTO_TEST_CASE(test_almostexpired_wanted)
+{
+  const DNSName name("powerdns.com.");
+
+  setAlmostExpiredTaskParameters(0, 0, 0);
+  BOOST_CHECK(almostExpiredTaskWanted(name, 0, 3600, 360, 360));
+
+  // popularity: 10 hits per minute
+  setAlmostExpiredTaskParameters(10, 0, 0);
+  BOOST_CHECK(!almostExpiredTaskWanted(name, 539, 3600, 360, 360));
+  BOOST_CHECK(almostExpiredTaskWanted(name, 540, 3600, 360, 360));
+  // short-lived entries need to have been hit at least as often as during a minute
+  BOOST_CHECK(!almostExpiredTaskWanted(name, 9, 30, 3, 3));
+  BOOST_CHECK(almostExpiredTaskWanted(name, 10, 30, 3, 3));
+
+  // jitter: up to half of the refresh window
+  setAlmostExpiredTaskParameters(0, 50, 0);
+  const uint32_t offset = name.hash() % 51;
+  BOOST_CHECK(almostExpiredTaskWanted(name, 0, 1000, 50, 100));
+  BOOST_CHECK(almostExpiredTaskWanted(name, 0, 1000, 100 - offset, 100));
+  BOOST_CHECK(!almostExpiredTaskWanted(name, 0, 1000, 101 - offset, 100));
+
+  setAlmostExpiredTaskParameters(0, 0, 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_query_budget)
+{
+  pdns::QueryBudget budget;
+  struct timeval now = {1000, 0};
+
+  // no limit
+  BOOST_CHECK(budget.allowed(now));
+  budget.consume(1000);
+  BOOST_CHECK(budget.allowed(now));
+
+  // a burst of one second worth of queries
+  budget.setRate(10, now);
+  BOOST_CHECK(budget.allowed(now));
+  budget.consume(9);
+  BOOST_CHECK(budget.allowed(now));
+  budget.consume(1);
+  BOOST_CHECK(!budget.allowed(now));
+
+  // refilled at the rate, 100 ms per query
+  now.tv_usec = 50000;
+  BOOST_CHECK(!budget.allowed(now));
+  now.tv_usec = 110000;
+  BOOST_CHECK(budget.allowed(now));
+  // a task can overdraw the budget, which then takes longer to refill
+  budget.consume(5);
+  now.tv_usec = 480000;
+  BOOST_CHECK(!budget.allowed(now));
+  now.tv_usec = 650000;
+  BOOST_CHECK(budget.allowed(now));
+
+  // idle time does not allow more than a one second burst
+  now.tv_sec += 60;
+  BOOST_CHECK(budget.allowed(now));
+  budget.consume(10);
+  BOOST_CHECK(!budget.allowed(now));
+}
+
+BOOST_AUTO_TEST_CASE(test_almostexpired_budget)
+{
+  taskQueueClear();
+  const auto expired = getTaskExpired();
+  const time_t now = time(nullptr);
+
+  setAlmostExpiredTaskParameters(0, 0, 1);
+  consumeAlmostExpiredBudget(1000);
+
+  // a refresh task waiting for the budget does not delay the other tasks
+  pushAlmostExpiredTask(DNSName("foo"), QType::A, now + 3600);
+  pushResolveTask(DNSName("bar"), QType::A, now, now - 1);
+  BOOST_CHECK_EQUAL(getTaskSize(), 2U);
+  runTaskOnce(false);
+  BOOST_CHECK_EQUAL(getTaskSize(), 1U);
+  BOOST_CHECK_EQUAL(getTaskExpired(), expired + 1);
+
+  // refresh tasks stay queued while the budget is exhausted
+  runTaskOnce(false);
+  BOOST_CHECK_EQUAL(getTaskSize(), 1U);
+
+  // unless their deadline has passed
+  taskQueueClear();
+  pushAlmostExpiredTask(DNSName("foo"), QType::A, now - 1);
+  pushAlmostExpiredTask(DNSName("foo"), QType::AAAA, now - 1);
+  pushAlmostExpiredTask(DNSName("foo"), QType::MX, now + 3600);
+  BOOST_CHECK_EQUAL(getTaskSize(), 3U);
+  runTaskOnce(false);
+  BOOST_CHECK_EQUAL(getTaskSize(), 1U);
+  BOOST_CHECK_EQUAL(getTaskExpired(), expired + 3);
+
+  taskQueueClear();
+  setAlmostExpiredTaskParameters(0, 0, 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,220 @@
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include "mtasker.hh"
+#include "rec-udpsocketpool.hh"
+#include "syncres.hh"
+
+BOOST_AUTO_TEST_SUITE(rec_udpsocketpool)
+
+BOOST_AUTO_TEST_CASE(test_no_reuse)
+{
+  UDPSocketPool pool(1, 10);
+  const ComboAddress remote("192.0.2.1:53");
+  std::vector<int> closable;
+
+  // every query gets its own socket, closed as soon as the query is done with it
+  BOOST_CHECK_EQUAL(pool.reuse(remote, 0, closable), -1);
+  pool.add(5, remote, 0);
+  BOOST_CHECK_EQUAL(pool.reuse(remote, 0, closable), -1);
+  pool.add(6, remote, 0);
+  BOOST_CHECK(closable.empty());
+  BOOST_CHECK_EQUAL(pool.size(), 2U);
+  BOOST_CHECK(pool.release(5));
+  BOOST_CHECK(pool.release(6));
+  BOOST_CHECK_EQUAL(pool.size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_reuse)
+{
+  UDPSocketPool pool(3, 10);
+  const ComboAddress remote("192.0.2.1:53");
+  const ComboAddress other("192.0.2.2:53");
+  std::vector<int> closable;
+
+  pool.add(5, remote, 0);
+  // only for the same remote
+  BOOST_CHECK_EQUAL(pool.reuse(other, 0, closable), -1);
+  pool.add(6, other, 0);
+  BOOST_CHECK_EQUAL(pool.reuse(ComboAddress("192.0.2.1:54"), 0, closable), -1);
+
+  // while the first query is still in flight
+  BOOST_CHECK_EQUAL(pool.reuse(remote, 0, closable), 5);
+  BOOST_CHECK_EQUAL(pool.inFlight(5), 2U);
+  BOOST_CHECK(!pool.release(5));
+  BOOST_CHECK(!pool.release(5));
+  BOOST_CHECK_EQUAL(pool.inFlight(5), 0U);
+  // or not
+  BOOST_CHECK_EQUAL(pool.reuse(remote, 0, closable), 5);
+  // the socket has now been used for three queries, so it is retired and closed once that last query is done with it
+  BOOST_CHECK_EQUAL(pool.reuse(remote, 0, closable), -1);
+  pool.add(7, remote, 0);
+  BOOST_CHECK(pool.release(5));
+  BOOST_CHECK(closable.empty());
+  BOOST_CHECK_EQUAL(pool.size(), 2U);
+}
+
+BOOST_AUTO_TEST_CASE(test_retire_on_spoof)
+{
+  UDPSocketPool pool(0, 10);
+  const ComboAddress remote("192.0.2.1:53");
+  std::vector<int> closable;
+
+  pool.add(5, remote, 0);
+  BOOST_CHECK_EQUAL(pool.reuse(remote, 0, closable), 5);
+
+  // a spoofing attempt has been detected by one of the queries while both are still in flight
+  BOOST_CHECK(!pool.retire(5));
+  BOOST_CHECK_EQUAL(pool.inFlight(5), 2U);
+  // the socket is not used for new queries anymore
+  BOOST_CHECK_EQUAL(pool.reuse(remote, 0, closable), -1);
+  pool.add(6, remote, 0);
+  // and is closed once the last query is done with it
+  BOOST_CHECK(!pool.release(5));
+  BOOST_CHECK(pool.release(5));
+  BOOST_CHECK(closable.empty());
+  BOOST_CHECK_EQUAL(pool.size(), 1U);
+  // retiring a socket that has already been closed does nothing
+  BOOST_CHECK(!pool.retire(5));
+  BOOST_CHECK_EQUAL(pool.size(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(test_lifetime)
+{
+  UDPSocketPool pool(0, 10);
+  const ComboAddress remote("192.0.2.1:53");
+  const ComboAddress other("192.0.2.2:53");
+  std::vector<int> closable;
+
+  pool.add(5, remote, 100);
+  BOOST_CHECK(!pool.release(5));
+  BOOST_CHECK_EQUAL(pool.reuse(remote, 109, closable), 5);
+
+  // an expired socket is not used for new queries, and closed right away if it is not in use
+  BOOST_CHECK(!pool.release(5));
+  BOOST_CHECK_EQUAL(pool.reuse(remote, 110, closable), -1);
+  BOOST_REQUIRE_EQUAL(closable.size(), 1U);
+  BOOST_CHECK_EQUAL(closable.at(0), 5);
+  BOOST_CHECK_EQUAL(pool.size(), 0U);
+  closable.clear();
+
+  // or once its last query is done with it
+  pool.add(6, remote, 200);
+  BOOST_CHECK_EQUAL(pool.reuse(remote, 210, closable), -1);
+  BOOST_CHECK(closable.empty());
+  pool.add(7, remote, 210);
+  BOOST_CHECK_EQUAL(pool.reuse(remote, 210, closable), 7);
+  BOOST_CHECK(pool.release(6));
+
+  // the periodic cleanup retires expired sockets, closing the idle ones
+  pool.add(8, other, 215);
+  BOOST_CHECK(!pool.release(8));
+  BOOST_CHECK(pool.cleanup(219).empty());
+  auto closed = pool.cleanup(220);
+  BOOST_CHECK(closed.empty());
+  BOOST_CHECK_EQUAL(pool.reuse(remote, 220, closable), -1);
+  BOOST_CHECK(closable.empty());
+  closed = pool.cleanup(225);
+  BOOST_REQUIRE_EQUAL(closed.size(), 1U);
+  BOOST_CHECK_EQUAL(closed.at(0), 8);
+  BOOST_CHECK_EQUAL(pool.reuse(other, 225, closable), -1);
+  BOOST_CHECK(!pool.release(7));
+  BOOST_CHECK(pool.release(7));
+  BOOST_CHECK_EQUAL(pool.size(), 0U);
+
+  // no limit
+  UDPSocketPool unlimited(0, 0);
+  unlimited.add(5, remote, 0);
+  BOOST_CHECK_EQUAL(unlimited.reuse(remote, 100000, closable), 5);
+  BOOST_CHECK(unlimited.cleanup(100000).empty());
+  BOOST_CHECK(closable.empty());
+}
+
+using test_mt_t = MTasker<std::shared_ptr<PacketID>, PacketBuffer, PacketIDCompare>;
+
+struct Waiter
+{
+  test_mt_t* d_mt;
+  std::shared_ptr<PacketID> d_pid;
+  PacketBuffer d_packet;
+  int d_result{-2};
+};
+
+static void waitForResponse(void* arg)
+{
+  auto* waiter = reinterpret_cast<Waiter*>(arg);
+  waiter->d_result = waiter->d_mt->waitEvent(waiter->d_pid, &waiter->d_packet);
+}
+
+static std::shared_ptr<PacketID> makePID(int fd, const ComboAddress& remote, uint16_t id)
+{
+  auto pid = std::make_shared<PacketID>();
+  pid->fd = fd;
+  pid->remote = remote;
+  pid->id = id;
+  pid->domain = DNSName("powerdns.com.");
+  pid->type = QType::A;
+  return pid;
+}
+
+BOOST_AUTO_TEST_CASE(test_error_fanout)
+{
+  UDPSocketPool pool(0, 10);
+  const ComboAddress remote("192.0.2.1:53");
+  const ComboAddress other("192.0.2.2:53");
+  std::vector<int> closable;
+
+  pool.add(5, remote, 0);
+  BOOST_CHECK_EQUAL(pool.reuse(remote, 0, closable), 5);
+  pool.add(6, other, 0);
+
+  test_mt_t mt;
+  std::vector<Waiter> waiters{{&mt, makePID(5, remote, 1)}, {&mt, makePID(5, remote, 2)}, {&mt, makePID(6, other, 3)}};
+  for (auto& waiter : waiters) {
+    mt.makeThread(waitForResponse, &waiter);
+  }
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+  while (mt.schedule(&now)) {
+  }
+  BOOST_CHECK_EQUAL(mt.d_waiters.size(), 3U);
+
+  // what handleUDPServerResponse() does when a socket reports an error: the socket is no longer used for new
+  // queries, every query in flight over it gets an empty response, meaning an error, and returns the socket
+  BOOST_CHECK(!pool.retire(5));
+  const auto pids = getWaitersOnSocket(mt.d_waiters, 5);
+  BOOST_CHECK_EQUAL(pids.size(), 2U);
+  size_t closed = 0;
+  PacketBuffer empty;
+  for (const auto& pid : pids) {
+    if (mt.sendEvent(pid, &empty) == 1 && pool.release(5)) {
+      ++closed;
+    }
+  }
+  BOOST_CHECK_EQUAL(closed, 1U);
+  BOOST_CHECK_EQUAL(pool.size(), 1U);
+  for (size_t idx = 0; idx < 2; idx++) {
+    BOOST_CHECK_EQUAL(waiters.at(idx).d_result, 1);
+    BOOST_CHECK(waiters.at(idx).d_packet.empty());
+  }
+
+  // the other socket is not affected
+  BOOST_CHECK_EQUAL(waiters.at(2).d_result, -2);
+  BOOST_CHECK_EQUAL(mt.d_waiters.size(), 1U);
+  BOOST_CHECK_EQUAL(pool.inFlight(6), 1U);
+  BOOST_CHECK_EQUAL(pool.reuse(other, 0, closable), 6);
+
+  // and a new query to that remote gets a new socket
+  BOOST_CHECK_EQUAL(pool.reuse(remote, 0, closable), -1);
+  BOOST_CHECK(closable.empty());
+
+  PacketBuffer response{'a'};
+  BOOST_CHECK_EQUAL(mt.sendEvent(waiters.at(2).d_pid, &response), 1);
+  BOOST_CHECK_EQUAL(waiters.at(2).d_result, 1);
+  BOOST_CHECK(waiters.at(2).d_packet == response);
+  while (mt.schedule(&now)) {
+  }
+  BOOST_CHECK(mt.noProcesses());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
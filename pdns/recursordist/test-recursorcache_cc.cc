@@ -5,8 +5,10 @@
 #include "config.h"
 #endif
 #include <boost/test/unit_test.hpp>
+#include <thread>
 
 #include "iputils.hh"
+#include "rec-snapshot.hh"
 #include "recursor_cache.hh"
 
 BOOST_AUTO_TEST_SUITE(recursorcache_cc)
@@ -695,6 +697,49 @@ BOOST_AUTO_TEST_CASE(test_RecursorCache_ExpungingValidEntries)
   BOOST_CHECK_EQUAL(MRC.ecsIndexSize(), 0U);
 }
 
+BOOST_AUTO_TEST_CASE(test_RecursorCache_ParallelPruning)
+{
+  MemRecursorCache MRC(16);
+
+  std::vector<std::shared_ptr<RRSIGRecordContent>> signatures;
+  std::vector<std::shared_ptr<DNSRecord>> authRecs;
+  const DNSName authZone(".");
+  const time_t now = time(nullptr);
+  const size_t expiredCount = 5000;
+  const size_t validCount = 5000;
+
+  DNSRecord dr;
+  dr.d_type = QType::A;
+  dr.d_class = QClass::IN;
+  dr.d_content = std::make_shared<ARecordContent>(ComboAddress("192.0.2.1"));
+  dr.d_place = DNSResourceRecord::ANSWER;
+
+  for (size_t idx = 0; idx < expiredCount + validCount; idx++) {
+    dr.d_name = DNSName("name" + std::to_string(idx) + ".powerdns.com.");
+    /* the first entries are already expired */
+    dr.d_ttl = static_cast<uint32_t>(idx < expiredCount ? now - 1 : now + 3600);
+    MRC.replace(now, dr.d_name, QType(QType::A), {dr}, signatures, authRecs, true, authZone, boost::none);
+  }
+  BOOST_CHECK_EQUAL(MRC.size(), expiredCount + validCount);
+
+  /* below the limit: only expired entries are removed, 10% of the cache is looked at */
+  MRC.doPrune(expiredCount + validCount, 4);
+  BOOST_CHECK_LT(MRC.size(), expiredCount + validCount);
+  BOOST_CHECK_GE(MRC.size(), validCount);
+
+  /* above the limit: expired entries go first, then valid ones are trimmed in slices until we reach the limit */
+  MRC.doPrune(validCount / 2, 4);
+  BOOST_CHECK_EQUAL(MRC.size(), validCount / 2);
+
+  /* the remaining entries are the most recently inserted ones */
+  std::vector<DNSRecord> retrieved;
+  const ComboAddress who("192.0.2.1");
+  BOOST_CHECK_GT(MRC.get(now, DNSName("name" + std::to_string(expiredCount + validCount - 1) + ".powerdns.com."), QType(QType::A), false, &retrieved, who), 0);
+
+  MRC.doPrune(0, 4);
+  BOOST_CHECK_EQUAL(MRC.size(), 0U);
+}
+
 BOOST_AUTO_TEST_CASE(test_RecursorCacheECSIndex)
 {
   MemRecursorCache MRC(1);
@@ -1177,4 +1222,297 @@ BOOST_AUTO_TEST_CASE(test_RecursorCacheTagged)
   }
 }
 
+
+BOOST_AUTO_TEST_CASE(test_RecursorCachePackedRecords)
+{
+  MemRecursorCache MRC(1, true);
+
+  const DNSName power("powerdns.com.");
+  const DNSName authZone("powerdns.com.");
+  const time_t now = time(nullptr);
+  const time_t ttd = now + 30;
+  const ComboAddress who("192.0.2.1");
+  std::vector<DNSRecord> records;
+  std::vector<std::shared_ptr<DNSRecord>> authRecords;
+  std::vector<std::shared_ptr<RRSIGRecordContent>> signatures;
+  std::vector<DNSRecord> retrieved;
+  std::vector<std::shared_ptr<RRSIGRecordContent>> retrievedSignatures;
+
+  DNSRecord dr;
+  dr.d_name = power;
+  dr.d_type = QType::A;
+  dr.d_class = QClass::IN;
+  dr.d_ttl = static_cast<uint32_t>(ttd);
+  dr.d_place = DNSResourceRecord::ANSWER;
+  dr.d_content = std::make_shared<ARecordContent>(ComboAddress("192.0.2.2"));
+  records.push_back(dr);
+  dr.d_content = std::make_shared<ARecordContent>(ComboAddress("192.0.2.3"));
+  records.push_back(dr);
+  signatures.push_back(std::dynamic_pointer_cast<RRSIGRecordContent>(RRSIGRecordContent::make("A 8 2 30 20380101000000 20200101000000 12345 powerdns.com. c2lnbmF0dXJl")));
+
+  MRC.replace(now, power, QType(QType::A), records, signatures, authRecords, true, authZone, boost::none, boost::none, vState::Secure);
+  BOOST_CHECK_EQUAL(MRC.size(), 1U);
+  const auto packedBytes = MRC.bytes();
+  BOOST_CHECK_GT(packedBytes, 0U);
+
+  vState state = vState::Indeterminate;
+  DNSName fromAuthZone;
+  BOOST_CHECK_EQUAL(MRC.get(now, power, QType(QType::A), false, &retrieved, who, false, boost::none, &retrievedSignatures, nullptr, nullptr, &state, nullptr, &fromAuthZone), ttd - now);
+  BOOST_REQUIRE_EQUAL(retrieved.size(), records.size());
+  for (size_t idx = 0; idx < records.size(); idx++) {
+    BOOST_CHECK(retrieved.at(idx).d_name == power);
+    BOOST_CHECK_EQUAL(retrieved.at(idx).d_type, QType::A);
+    BOOST_CHECK_EQUAL(retrieved.at(idx).d_ttl, static_cast<uint32_t>(ttd));
+    BOOST_CHECK_EQUAL(retrieved.at(idx).d_content->getZoneRepresentation(), records.at(idx).d_content->getZoneRepresentation());
+  }
+  BOOST_REQUIRE_EQUAL(retrievedSignatures.size(), 1U);
+  BOOST_CHECK_EQUAL(retrievedSignatures.at(0)->getZoneRepresentation(), signatures.at(0)->getZoneRepresentation());
+  BOOST_CHECK_EQUAL(state, vState::Secure);
+  BOOST_CHECK(fromAuthZone == authZone);
+
+  /* records whose content holds a name */
+  dr.d_type = QType::NS;
+  records.clear();
+  dr.d_content = std::make_shared<NSRecordContent>(DNSName("ns1.powerdns.com."));
+  records.push_back(dr);
+  dr.d_content = std::make_shared<NSRecordContent>(DNSName("ns2.powerdns.com."));
+  records.push_back(dr);
+  MRC.replace(now, power, QType(QType::NS), records, {}, authRecords, true, authZone, boost::none);
+  BOOST_CHECK_EQUAL(MRC.get(now, power, QType(QType::NS), false, &retrieved, who), ttd - now);
+  BOOST_REQUIRE_EQUAL(retrieved.size(), 2U);
+  BOOST_CHECK(getRR<NSRecordContent>(retrieved.at(0))->getNS() == DNSName("ns1.powerdns.com."));
+  BOOST_CHECK(getRR<NSRecordContent>(retrieved.at(1))->getNS() == DNSName("ns2.powerdns.com."));
+  BOOST_CHECK_GT(MRC.bytes(), packedBytes);
+
+  /* ANY returns the records of both entries */
+  BOOST_CHECK_EQUAL(MRC.get(now, power, QType(QType::ANY), false, &retrieved, who), ttd - now);
+  BOOST_CHECK_EQUAL(retrieved.size(), 4U);
+
+  BOOST_CHECK_EQUAL(MRC.doWipeCache(power, false), 2U);
+  BOOST_CHECK_EQUAL(MRC.bytes(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_RecursorCacheBytes)
+{
+  const DNSName power("powerdns.com.");
+  const DNSName authZone("powerdns.com.");
+  const time_t now = time(nullptr);
+  const time_t ttd = now + 30;
+  std::vector<std::shared_ptr<DNSRecord>> authRecords;
+  std::vector<std::shared_ptr<RRSIGRecordContent>> signatures;
+
+  std::string txt;
+  for (size_t idx = 0; idx < 4; idx++) {
+    txt += "\"" + std::string(250, 'a') + "\" ";
+  }
+  DNSRecord dr;
+  dr.d_name = power;
+  dr.d_type = QType::TXT;
+  dr.d_class = QClass::IN;
+  dr.d_ttl = static_cast<uint32_t>(ttd);
+  dr.d_place = DNSResourceRecord::ANSWER;
+  dr.d_content = DNSRecordContent::mastermake(QType::TXT, QClass::IN, txt);
+  const std::vector<DNSRecord> records{dr};
+
+  /* the size of the record contents is accounted for, whether the records are stored packed or not */
+  for (const bool packed : {false, true}) {
+    MemRecursorCache MRC(1, packed);
+    MRC.replace(now, power, QType(QType::TXT), records, signatures, authRecords, true, authZone, boost::none);
+    BOOST_CHECK_EQUAL(MRC.size(), 1U);
+    BOOST_CHECK_GT(MRC.bytes(), 1000U);
+    BOOST_CHECK_EQUAL(MRC.doWipeCache(power, false), 1U);
+    BOOST_CHECK_EQUAL(MRC.bytes(), 0U);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_RecursorCacheContention)
+{
+  /* a single shard, hammered by several readers while a writer keeps replacing the entry they are
+     looking up, as happens for the NS set of a popular TLD. Readers should always get a complete,
+     consistent version of the records. The contention on the shard lock is reported when run
+     with --log_level=message. */
+  MemRecursorCache MRC(1);
+
+  const DNSName tld("com.");
+  const DNSName authZone(".");
+  const size_t recordsCount = 13;
+  const size_t readersCount = 4;
+  const size_t lookupsPerReader = 50000;
+  const time_t now = time(nullptr);
+  const time_t ttd = now + 3600;
+  std::vector<std::shared_ptr<DNSRecord>> authRecords;
+  std::vector<std::shared_ptr<RRSIGRecordContent>> signatures;
+
+  auto makeRecords = [&](size_t generation) {
+    std::vector<DNSRecord> records;
+    for (size_t idx = 0; idx < recordsCount; idx++) {
+      DNSRecord dr;
+      dr.d_name = tld;
+      dr.d_type = QType::NS;
+      dr.d_class = QClass::IN;
+      dr.d_content = std::make_shared<NSRecordContent>(DNSName(std::string(1, 'a' + idx) + ".gtld-servers.net.") + DNSName(std::to_string(generation)));
+      dr.d_ttl = static_cast<uint32_t>(ttd);
+      dr.d_place = DNSResourceRecord::ANSWER;
+      records.push_back(std::move(dr));
+    }
+    return records;
+  };
+
+  MRC.replace(now, tld, QType(QType::NS), makeRecords(0), signatures, authRecords, true, authZone, boost::none);
+
+  std::atomic<bool> done{false};
+  std::atomic<uint64_t> errors{0};
+  std::vector<std::thread> readers;
+  for (size_t idx = 0; idx < readersCount; idx++) {
+    readers.emplace_back([&]() {
+      std::vector<DNSRecord> retrieved;
+      for (size_t count = 0; count < lookupsPerReader; count++) {
+        if (MRC.get(now, tld, QType(QType::NS), false, &retrieved, ComboAddress("192.0.2.1")) <= 0 || retrieved.size() != recordsCount) {
+          ++errors;
+          continue;
+        }
+        /* all the records have to come from the same generation */
+        const auto generation = getRR<NSRecordContent>(retrieved.at(0))->getNS().getRawLabels().back();
+        for (const auto& record : retrieved) {
+          if (record.d_name != tld || getRR<NSRecordContent>(record)->getNS().getRawLabels().back() != generation) {
+            ++errors;
+            break;
+          }
+        }
+      }
+    });
+  }
+
+  std::thread writer([&]() {
+    size_t generation = 1;
+    while (!done) {
+      MRC.replace(now, tld, QType(QType::NS), makeRecords(generation++ % 10), signatures, authRecords, true, authZone, boost::none);
+    }
+  });
+
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  done = true;
+  writer.join();
+
+  BOOST_CHECK_EQUAL(errors.load(), 0U);
+  BOOST_CHECK_EQUAL(MRC.size(), 1U);
+
+  const auto lockStats = MRC.stats();
+  BOOST_TEST_MESSAGE("record cache lock: " << lockStats.first << " contended out of " << lockStats.second << " acquisitions");
+}
+
+BOOST_AUTO_TEST_CASE(test_RecursorCacheSnapshot)
+{
+  const DNSName power("powerdns.com.");
+  const DNSName authZone("powerdns.com.");
+  const time_t now = time(nullptr);
+  const time_t ttd = now + 30;
+  const ComboAddress who("192.0.2.1");
+  const Netmask ecs("192.0.2.0/24");
+  const ComboAddress from("192.0.2.53");
+  std::vector<DNSRecord> records;
+  std::vector<std::shared_ptr<DNSRecord>> authRecords;
+  std::vector<std::shared_ptr<RRSIGRecordContent>> signatures;
+
+  MemRecursorCache source(4);
+
+  DNSRecord dr;
+  dr.d_name = power;
+  dr.d_type = QType::A;
+  dr.d_class = QClass::IN;
+  dr.d_ttl = static_cast<uint32_t>(ttd);
+  dr.d_place = DNSResourceRecord::ANSWER;
+  dr.d_content = std::make_shared<ARecordContent>(ComboAddress("192.0.2.2"));
+  records.push_back(dr);
+  signatures.push_back(std::dynamic_pointer_cast<RRSIGRecordContent>(RRSIGRecordContent::make("A 8 2 30 20380101000000 20200101000000 12345 powerdns.com. c2lnbmF0dXJl")));
+  auto authRecord = std::make_shared<DNSRecord>();
+  authRecord->d_name = DNSName("sub.powerdns.com.");
+  authRecord->d_type = QType::NS;
+  authRecord->d_ttl = static_cast<uint32_t>(ttd);
+  authRecord->d_place = DNSResourceRecord::AUTHORITY;
+  authRecord->d_content = std::make_shared<NSRecordContent>(DNSName("ns1.powerdns.com."));
+  authRecords.push_back(authRecord);
+  source.replace(now, power, QType(QType::A), records, signatures, authRecords, true, authZone, boost::none, boost::none, vState::Secure, from);
+
+  /* ECS-specific entry */
+  records.at(0).d_content = std::make_shared<ARecordContent>(ComboAddress("192.0.2.3"));
+  source.replace(now, power, QType(QType::A), records, {}, {}, true, authZone, ecs);
+
+  /* expired entry, not saved */
+  records.at(0).d_name = DNSName("expired.powerdns.com.");
+  records.at(0).d_ttl = static_cast<uint32_t>(now - 1);
+  source.replace(now - 10, records.at(0).d_name, QType(QType::A), records, {}, {}, true, authZone, boost::none);
+  BOOST_CHECK_EQUAL(source.size(), 3U);
+
+  auto fp = std::unique_ptr<FILE, int (*)(FILE*)>(tmpfile(), fclose);
+  BOOST_REQUIRE(fp);
+  pdns::snapshot::writeHeader(fp.get(), now);
+  BOOST_CHECK_EQUAL(source.saveSnapshot(fp.get(), now), 2U);
+
+  for (const bool packed : {false, true}) {
+    rewind(fp.get());
+    MemRecursorCache target(8, packed);
+    std::map<pdns::snapshot::Section, pdns::snapshot::SectionLoader> loaders;
+    loaders[pdns::snapshot::Section::RecordCache] = [&target, now](pdns::snapshot::Decoder& decoder, uint32_t entries) {
+      return target.loadSnapshotSection(decoder, entries, now);
+    };
+    time_t written = 0;
+    BOOST_CHECK_EQUAL(pdns::snapshot::load(fp.get(), loaders, 2, written), 2U);
+    BOOST_CHECK_EQUAL(written, now);
+    BOOST_CHECK_EQUAL(target.size(), 2U);
+
+    std::vector<DNSRecord> retrieved;
+    std::vector<std::shared_ptr<RRSIGRecordContent>> retrievedSignatures;
+    std::vector<std::shared_ptr<DNSRecord>> retrievedAuthRecords;
+    vState state = vState::Indeterminate;
+    DNSName fromAuthZone;
+    ComboAddress fromAuthIP;
+    bool wasAuth = false;
+    /* not in the ECS scope */
+    BOOST_CHECK_EQUAL(target.get(now, power, QType(QType::A), false, &retrieved, ComboAddress("198.51.100.1"), false, boost::none, &retrievedSignatures, &retrievedAuthRecords, nullptr, &state, &wasAuth, &fromAuthZone, &fromAuthIP), ttd - now);
+    BOOST_REQUIRE_EQUAL(retrieved.size(), 1U);
+    BOOST_CHECK_EQUAL(retrieved.at(0).d_content->getZoneRepresentation(), "192.0.2.2");
+    BOOST_CHECK_EQUAL(retrieved.at(0).d_ttl, static_cast<uint32_t>(ttd));
+    BOOST_REQUIRE_EQUAL(retrievedSignatures.size(), 1U);
+    BOOST_CHECK_EQUAL(retrievedSignatures.at(0)->getZoneRepresentation(), signatures.at(0)->getZoneRepresentation());
+    BOOST_REQUIRE_EQUAL(retrievedAuthRecords.size(), 1U);
+    BOOST_CHECK(retrievedAuthRecords.at(0)->d_name == authRecord->d_name);
+    BOOST_CHECK_EQUAL(retrievedAuthRecords.at(0)->d_content->getZoneRepresentation(), "ns1.powerdns.com.");
+    BOOST_CHECK_EQUAL(state, vState::Secure);
+    BOOST_CHECK(wasAuth);
+    BOOST_CHECK(fromAuthZone == authZone);
+    BOOST_CHECK(fromAuthIP == from);
+
+    /* in the ECS scope */
+    BOOST_CHECK_EQUAL(target.get(now, power, QType(QType::A), false, &retrieved, who), ttd - now);
+    BOOST_REQUIRE_EQUAL(retrieved.size(), 1U);
+    BOOST_CHECK_EQUAL(retrieved.at(0).d_content->getZoneRepresentation(), "192.0.2.3");
+    BOOST_CHECK_EQUAL(target.ecsIndexSize(), 1U);
+
+    /* loading again does not replace the existing entries */
+    rewind(fp.get());
+    BOOST_CHECK_EQUAL(pdns::snapshot::load(fp.get(), loaders, 1, written), 0U);
+    BOOST_CHECK_EQUAL(target.size(), 2U);
+
+    /* entries expired since the snapshot was written are skipped */
+    MemRecursorCache later(1, packed);
+    loaders[pdns::snapshot::Section::RecordCache] = [&later, ttd](pdns::snapshot::Decoder& decoder, uint32_t entries) {
+      return later.loadSnapshotSection(decoder, entries, ttd);
+    };
+    rewind(fp.get());
+    BOOST_CHECK_EQUAL(pdns::snapshot::load(fp.get(), loaders, 1, written), 0U);
+    BOOST_CHECK_EQUAL(later.size(), 0U);
+  }
+
+  /* not a snapshot */
+  auto garbage = std::unique_ptr<FILE, int (*)(FILE*)>(tmpfile(), fclose);
+  BOOST_REQUIRE(garbage);
+  fputs("; this is a cache dump, not a snapshot\n", garbage.get());
+  rewind(garbage.get());
+  time_t written = 0;
+  BOOST_CHECK_THROW(pdns::snapshot::load(garbage.get(), {}, 1, written), std::runtime_error);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
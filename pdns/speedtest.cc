@@ -769,7 +769,96 @@ struct DNSNameRootTest
 
 };
 
+struct DNSNameCopyTest
+{
+  explicit DNSNameCopyTest(const std::string& name) : d_name(name)
+  {
+  }
+
+  string getName() const
+  {
+    return "DNSName copy of a " + std::to_string(d_name.wirelength()) + "-byte name";
+  }
+
+  void operator()() const
+  {
+    DNSName copy(d_name);
+    g_ret = copy.isRoot();
+  }
+
+  DNSName d_name;
+};
+
+struct DNSNameHashCompareTest
+{
+  explicit DNSNameHashCompareTest(size_t count)
+  {
+    d_names.reserve(count);
+    for (size_t idx = 0; idx < count; idx++) {
+      d_names.push_back(DNSName("host" + std::to_string(idx) + ".example.com"));
+    }
+  }
+
+  string getName() const
+  {
+    return "DNSName hash and compare of " + std::to_string(d_names.size()) + " names";
+  }
+
+  void operator()() const
+  {
+    /* mostly hashing and comparing names stored in a vector, as a cache lookup would */
+    size_t hash = 0;
+    for (size_t idx = 1; idx < d_names.size(); idx++) {
+      hash += d_names[idx].hash();
+      g_ret = d_names[idx] == d_names[idx - 1];
+    }
+    g_ret = hash == 0;
+  }
+
+  std::vector<DNSName> d_names;
+};
+
+struct InternedDNSNameTest
+{
+  explicit InternedDNSNameTest(const std::string& name) : d_name(name), d_interned(d_name)
+  {
+  }
 
+  string getName() const
+  {
+    return "InternedDNSName creation of a " + std::to_string(d_name.wirelength()) + "-byte name";
+  }
+
+  void operator()() const
+  {
+    /* the name is already interned, so this is a lookup into the table */
+    InternedDNSName interned(d_name);
+    g_ret = interned->isRoot();
+  }
+
+  DNSName d_name;
+  InternedDNSName d_interned;
+};
+
+struct InternedDNSNameCopyTest
+{
+  explicit InternedDNSNameCopyTest(const std::string& name) : d_interned(DNSName(name))
+  {
+  }
+
+  string getName() const
+  {
+    return "InternedDNSName copy of a " + std::to_string(d_interned->wirelength()) + "-byte name";
+  }
+
+  void operator()() const
+  {
+    InternedDNSName copy(d_interned);
+    g_ret = copy->isRoot();
+  }
+
+  InternedDNSName d_interned;
+};
 
 struct IEqualsTest
 {
@@ -1240,6 +1329,13 @@ try
 
   doRun(DNSNameParseTest());
   doRun(DNSNameRootTest());
+  doRun(DNSNameCopyTest("www.powerdns.com"));
+  doRun(DNSNameCopyTest("e1234.dscx.akamaiedge.net"));
+  doRun(DNSNameCopyTest("a-rather-long-label.another-long-label.yet-another-one.powerdns.com"));
+  doRun(DNSNameHashCompareTest(1000));
+  doRun(InternedDNSNameTest("www.powerdns.com"));
+  doRun(InternedDNSNameTest("a-rather-long-label.another-long-label.yet-another-one.powerdns.com"));
+  doRun(InternedDNSNameCopyTest("a-rather-long-label.another-long-label.yet-another-one.powerdns.com"));
 
   doRun(NetmaskTreeTest());
 
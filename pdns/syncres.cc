@@ -51,6 +51,9 @@ SyncRes::LogMode SyncRes::s_lm;
 const std::unordered_set<QType> SyncRes::s_redirectionQTypes = {QType::CNAME, QType::DNAME};
 LockGuarded<fails_t<ComboAddress>> SyncRes::s_fails;
 LockGuarded<fails_t<DNSName>> SyncRes::s_nonresolving;
+LockGuardedShards<SyncRes::nsspeeds_t> SyncRes::s_nsSpeeds{1024};
+LockGuardedShards<SyncRes::throttle_t> SyncRes::s_throttle{1024};
+LockGuardedShards<SyncRes::ednsstatus_t> SyncRes::s_ednsstatus{1024};
 
 unsigned int SyncRes::s_maxnegttl;
 unsigned int SyncRes::s_maxbogusttl;
@@ -615,11 +618,23 @@ uint64_t SyncRes::doEDNSDump(int fd)
   }
   uint64_t count = 0;
 
-  fprintf(fp.get(),"; edns from thread follows\n;\n");
-  for(const auto& eds : t_sstorage.ednsstatus) {
-    count++;
-    char tmp[26];
-    fprintf(fp.get(), "%s\t%d\t%s", eds.address.toString().c_str(), (int)eds.mode, ctime_r(&eds.modeSetAt, tmp));
+  fprintf(fp.get(),"; edns dump follows\n;\n");
+  std::vector<EDNSStatus> entries;
+  for (size_t idx = 0; idx < s_ednsstatus.getShardsCount(); idx++) {
+    /* copy the shard so that the lock is not held while we write */
+    entries.clear();
+    {
+      auto ednsstatus = s_ednsstatus.lockShard(idx);
+      entries.reserve(ednsstatus->size());
+      for (const auto& eds : *ednsstatus) {
+        entries.push_back(eds);
+      }
+    }
+    for (const auto& eds : entries) {
+      count++;
+      char tmp[26];
+      fprintf(fp.get(), "%s\t%d\t%s", eds.address.toString().c_str(), (int)eds.mode, ctime_r(&eds.modeSetAt, tmp));
+    }
   }
   return count;
 }
@@ -635,21 +650,38 @@ uint64_t SyncRes::doDumpNSSpeeds(int fd)
     close(newfd);
     return 0;
   }
-  fprintf(fp.get(), "; nsspeed dump from thread follows\n;\n");
+  fprintf(fp.get(), "; nsspeed dump follows\n;\n");
   uint64_t count=0;
 
-  for(const auto& i : t_sstorage.nsSpeeds)
-  {
-    count++;
+  std::vector<std::pair<DNSName, std::vector<std::pair<ComboAddress, float>>>> entries;
+  for (size_t idx = 0; idx < s_nsSpeeds.getShardsCount(); idx++) {
+    /* copy the shard so that the lock is not held while we write */
+    entries.clear();
+    {
+      auto nsSpeeds = s_nsSpeeds.lockShard(idx);
+      entries.reserve(nsSpeeds->size());
+      for (const auto& i : *nsSpeeds) {
+        std::vector<std::pair<ComboAddress, float>> speeds;
+        speeds.reserve(i.second.d_collection.size());
+        for (const auto& j : i.second.d_collection) {
+          speeds.emplace_back(j.first, j.second.peek());
+        }
+        entries.emplace_back(i.first, std::move(speeds));
+      }
+    }
 
-    // an <empty> can appear hear in case of authoritative (hosted) zones
-    fprintf(fp.get(), "%s -> ", i.first.toLogString().c_str());
-    for(const auto& j : i.second.d_collection)
+    for(const auto& i : entries)
     {
-      // typedef vector<pair<ComboAddress, DecayingEwma> > collection_t;
-      fprintf(fp.get(), "%s/%f ", j.first.toString().c_str(), j.second.peek());
+      count++;
+
+      // an <empty> can appear hear in case of authoritative (hosted) zones
+      fprintf(fp.get(), "%s -> ", i.first.toLogString().c_str());
+      for(const auto& j : i.second)
+      {
+        fprintf(fp.get(), "%s/%f ", j.first.toString().c_str(), j.second);
+      }
+      fprintf(fp.get(), "\n");
     }
-    fprintf(fp.get(), "\n");
   }
   return count;
 }
@@ -669,13 +701,26 @@ uint64_t SyncRes::doDumpThrottleMap(int fd)
   fprintf(fp.get(), "; remote IP\tqname\tqtype\tcount\tttd\n");
   uint64_t count=0;
 
-  const auto& throttleMap = t_sstorage.throttle.getThrottleMap();
-  for(const auto& i : throttleMap)
-  {
-    count++;
-    char tmp[26];
-    // remote IP, dns name, qtype, count, ttd
-    fprintf(fp.get(), "%s\t%s\t%d\t%u\t%s", std::get<0>(i.thing).toString().c_str(), std::get<1>(i.thing).toLogString().c_str(), std::get<2>(i.thing), i.count, ctime_r(&i.ttd, tmp));
+  std::vector<throttle_t::entry_t> entries;
+  for (size_t idx = 0; idx < s_throttle.getShardsCount(); idx++) {
+    /* copy the shard so that the lock is not held while we write */
+    entries.clear();
+    {
+      auto throttle = s_throttle.lockShard(idx);
+      const auto& throttleMap = throttle->getThrottleMap();
+      entries.reserve(throttleMap.size());
+      for (const auto& i : throttleMap) {
+        entries.push_back(i);
+      }
+    }
+
+    for(const auto& i : entries)
+    {
+      count++;
+      char tmp[26];
+      // remote IP, dns name, qtype, count, ttd
+      fprintf(fp.get(), "%s\t%s\t%d\t%u\t%s", std::get<0>(i.thing).toString().c_str(), std::get<1>(i.thing).toLogString().c_str(), std::get<2>(i.thing), i.count, ctime_r(&i.ttd, tmp));
+    }
   }
 
   return count;
@@ -778,15 +823,20 @@ LWResult::Result SyncRes::asyncresolveWrapper(const ComboAddress& ip, bool ednsM
      If '3', send bare queries
   */
 
-  auto ednsstatus = t_sstorage.ednsstatus.insert(ip).first; // does this include port? YES
-  auto &ind = t_sstorage.ednsstatus.get<ComboAddress>();
-  if (ednsstatus->modeSetAt && ednsstatus->modeSetAt + 3600 < d_now.tv_sec) {
-    t_sstorage.ednsstatus.reset(ind, ednsstatus);
-    //    cerr<<"Resetting EDNS Status for "<<ip.toString()<<endl);
+  SyncRes::EDNSStatus::EDNSMode mode;
+  {
+    /* the shard lock can't be held across the (asynchronous) query below, so we work on a copy of the mode */
+    auto lock = s_ednsstatus.lock(ComboAddress::addressOnlyHash()(ip));
+    auto ednsstatus = lock->insert(ip).first; // does this include port? YES
+    auto &ind = lock->get<ComboAddress>();
+    if (ednsstatus->modeSetAt && ednsstatus->modeSetAt + 3600 < d_now.tv_sec) {
+      lock->reset(ind, ednsstatus);
+      //    cerr<<"Resetting EDNS Status for "<<ip.toString()<<endl);
+    }
+    mode = ednsstatus->mode;
   }
 
-  const SyncRes::EDNSStatus::EDNSMode *mode = &ednsstatus->mode;
-  const SyncRes::EDNSStatus::EDNSMode oldmode = *mode;
+  const SyncRes::EDNSStatus::EDNSMode oldmode = mode;
   int EDNSLevel = 0;
   auto luaconfsLocal = g_luaconfs.getLocal();
   ResolveContext ctx;
@@ -800,11 +850,11 @@ LWResult::Result SyncRes::asyncresolveWrapper(const ComboAddress& ip, bool ednsM
   for(int tries = 0; tries < 3; ++tries) {
     //    cerr<<"Remote '"<<ip.toString()<<"' currently in mode "<<mode<<endl;
 
-    if (*mode == EDNSStatus::NOEDNS) {
+    if (mode == EDNSStatus::NOEDNS) {
       g_stats.noEdnsOutQueries++;
       EDNSLevel = 0; // level != mode
     }
-    else if (ednsMANDATORY || *mode == EDNSStatus::UNKNOWN || *mode == EDNSStatus::EDNSOK || *mode == EDNSStatus::EDNSIGNORANT)
+    else if (ednsMANDATORY || mode == EDNSStatus::UNKNOWN || mode == EDNSStatus::EDNSOK || mode == EDNSStatus::EDNSIGNORANT)
       EDNSLevel = 1;
 
     DNSName sendQname(domain);
@@ -817,9 +867,6 @@ LWResult::Result SyncRes::asyncresolveWrapper(const ComboAddress& ip, bool ednsM
     else {
       ret = asyncresolve(ip, sendQname, type, doTCP, sendRDQuery, EDNSLevel, now, srcmask, ctx, d_outgoingProtobufServers, d_frameStreamServers, luaconfsLocal->outgoingProtobufExportConfig.exportTypes, res, chained);
     }
-    // ednsstatus might be cleared, so do a new lookup
-    ednsstatus = t_sstorage.ednsstatus.insert(ip).first;
-    mode = &ednsstatus->mode;
     if (ret == LWResult::Result::PermanentError || ret == LWResult::Result::OSLimitError || ret == LWResult::Result::Spoofed) {
       return ret; // transport error, nothing to learn here
     }
@@ -827,26 +874,40 @@ LWResult::Result SyncRes::asyncresolveWrapper(const ComboAddress& ip, bool ednsM
     if (ret == LWResult::Result::Timeout) { // timeout, not doing anything with it now
       return ret;
     }
-    else if (*mode == EDNSStatus::UNKNOWN || *mode == EDNSStatus::EDNSOK || *mode == EDNSStatus::EDNSIGNORANT ) {
-      if(res->d_validpacket && !res->d_haveEDNS && res->d_rcode == RCode::FormErr)  {
-	//	cerr<<"Downgrading to NOEDNS because of "<<RCode::to_s(res->d_rcode)<<" for query to "<<ip.toString()<<" for '"<<domain<<"'"<<endl;
-        t_sstorage.ednsstatus.setMode(ind, ednsstatus, EDNSStatus::NOEDNS);
-        continue;
-      }
-      else if(!res->d_haveEDNS) {
-        if (*mode != EDNSStatus::EDNSIGNORANT) {
-          t_sstorage.ednsstatus.setMode(ind, ednsstatus, EDNSStatus::EDNSIGNORANT);
-	  //	  cerr<<"We find that "<<ip.toString()<<" is an EDNS-ignorer for '"<<domain<<"', moving to mode 2"<<endl;
-	}
+
+    bool downgraded = false;
+    {
+      auto lock = s_ednsstatus.lock(ComboAddress::addressOnlyHash()(ip));
+      // ednsstatus might have been cleared or updated by another query in the meantime, so do a new lookup
+      auto ednsstatus = lock->insert(ip).first;
+      auto &ind = lock->get<ComboAddress>();
+      mode = ednsstatus->mode;
+      if (mode == EDNSStatus::UNKNOWN || mode == EDNSStatus::EDNSOK || mode == EDNSStatus::EDNSIGNORANT ) {
+        if(res->d_validpacket && !res->d_haveEDNS && res->d_rcode == RCode::FormErr)  {
+          //	cerr<<"Downgrading to NOEDNS because of "<<RCode::to_s(res->d_rcode)<<" for query to "<<ip.toString()<<" for '"<<domain<<"'"<<endl;
+          lock->setMode(ind, ednsstatus, EDNSStatus::NOEDNS);
+          downgraded = true;
+        }
+        else if(!res->d_haveEDNS) {
+          if (mode != EDNSStatus::EDNSIGNORANT) {
+            lock->setMode(ind, ednsstatus, EDNSStatus::EDNSIGNORANT);
+            //	  cerr<<"We find that "<<ip.toString()<<" is an EDNS-ignorer for '"<<domain<<"', moving to mode 2"<<endl;
+          }
+        }
+        else {
+          lock->setMode(ind, ednsstatus, EDNSStatus::EDNSOK);
+          //	cerr<<"We find that "<<ip.toString()<<" is EDNS OK!"<<endl;
+        }
       }
-      else {
-        t_sstorage.ednsstatus.setMode(ind, ednsstatus, EDNSStatus::EDNSOK);
-	//	cerr<<"We find that "<<ip.toString()<<" is EDNS OK!"<<endl;
+
+      if (!downgraded && (oldmode != ednsstatus->mode || !ednsstatus->modeSetAt)) {
+        lock->setTS(ind, ednsstatus, d_now.tv_sec);
       }
+      mode = ednsstatus->mode;
     }
 
-    if (oldmode != *mode || !ednsstatus->modeSetAt) {
-      t_sstorage.ednsstatus.setTS(ind, ednsstatus, d_now.tv_sec);
+    if (downgraded) {
+      continue;
     }
     //    cerr<<"Result: ret="<<ret<<", EDNS-level: "<<EDNSLevel<<", haveEDNS: "<<res->d_haveEDNS<<", new mode: "<<mode<<endl;
     return LWResult::Result::Success;
@@ -1391,13 +1452,16 @@ vector<ComboAddress> SyncRes::getAddrs(const DNSName &qname, unsigned int depth,
      is only one or none at all in the current set.
   */
   map<ComboAddress, float> speeds;
-  auto& collection = t_sstorage.nsSpeeds[qname];
-  float factor = collection.getFactor(d_now);
-  for(const auto& val: ret) {
-    speeds[val] = collection.d_collection[val].get(factor);
-  }
+  {
+    auto nsSpeeds = s_nsSpeeds.lock(qname.hash());
+    auto& collection = (*nsSpeeds)[qname];
+    float factor = collection.getFactor(d_now);
+    for(const auto& val: ret) {
+      speeds[val] = collection.d_collection[val].get(factor);
+    }
 
-  t_sstorage.nsSpeeds[qname].purge(speeds);
+    collection.purge(speeds);
+  }
 
   if (ret.size() > 1) {
     shuffle(ret.begin(), ret.end(), pdns::dns_random_engine());
@@ -2197,7 +2261,7 @@ inline std::vector<std::pair<DNSName, float>> SyncRes::shuffleInSpeedOrder(NsSet
   std::vector<std::pair<DNSName, float>> rnameservers;
   rnameservers.reserve(tnameservers.size());
   for(const auto& tns: tnameservers) {
-    float speed = t_sstorage.nsSpeeds[tns.first].get(d_now);
+    float speed = (*s_nsSpeeds.lock(tns.first.hash()))[tns.first].get(d_now);
     rnameservers.emplace_back(tns.first, speed);
     if(tns.first.empty()) // this was an authoritative OOB zone, don't pollute the nsSpeeds with that
       return rnameservers;
@@ -2231,7 +2295,7 @@ inline vector<ComboAddress> SyncRes::shuffleForwardSpeed(const vector<ComboAddre
   for(const auto& val: nameservers) {
     float speed;
     DNSName nsName = DNSName(val.toStringWithPort());
-    speed=t_sstorage.nsSpeeds[nsName].get(d_now);
+    speed=(*s_nsSpeeds.lock(nsName.hash()))[nsName].get(d_now);
     speeds[val]=speed;
   }
   shuffle(nameservers.begin(),nameservers.end(), pdns::dns_random_engine());
@@ -2588,12 +2652,12 @@ vector<ComboAddress> SyncRes::retrieveAddressesForNS(const std::string& prefix,
 
 bool SyncRes::throttledOrBlocked(const std::string& prefix, const ComboAddress& remoteIP, const DNSName& qname, const QType qtype, bool pierceDontQuery)
 {
-  if(t_sstorage.throttle.shouldThrottle(d_now.tv_sec, std::make_tuple(remoteIP, g_rootdnsname, 0))) {
+  if(isThrottled(d_now.tv_sec, remoteIP)) {
     LOG(prefix<<qname<<": server throttled "<<endl);
     s_throttledqueries++; d_throttledqueries++;
     return true;
   }
-  else if(t_sstorage.throttle.shouldThrottle(d_now.tv_sec, std::make_tuple(remoteIP, qname, qtype.getCode()))) {
+  else if(isThrottled(d_now.tv_sec, remoteIP, qname, qtype.getCode())) {
     LOG(prefix<<qname<<": query throttled "<<remoteIP.toString()<<", "<<qname<<"; "<<qtype<<endl);
     s_throttledqueries++; d_throttledqueries++;
     return true;
@@ -4255,21 +4319,21 @@ bool SyncRes::doResolveAtThisIP(const std::string& prefix, const DNSName& qname,
     if (resolveret != LWResult::Result::OSLimitError && !chained && !dontThrottle) {
       // don't account for resource limits, they are our own fault
       // And don't throttle when the IP address is on the dontThrottleNetmasks list or the name is part of dontThrottleNames
-      t_sstorage.nsSpeeds[nsName.empty()? DNSName(remoteIP.toStringWithPort()) : nsName].submit(remoteIP, 1000000, d_now); // 1 sec
+      submitNSSpeed(nsName.empty()? DNSName(remoteIP.toStringWithPort()) : nsName, remoteIP, 1000000, d_now); // 1 sec
 
       // code below makes sure we don't filter COM or the root
       if (s_serverdownmaxfails > 0 && (auth != g_rootdnsname) && s_fails.lock()->incr(remoteIP, d_now) >= s_serverdownmaxfails) {
         LOG(prefix<<qname<<": Max fails reached resolving on "<< remoteIP.toString() <<". Going full throttle for "<< s_serverdownthrottletime <<" seconds" <<endl);
         // mark server as down
-        t_sstorage.throttle.throttle(d_now.tv_sec, std::make_tuple(remoteIP, g_rootdnsname, 0), s_serverdownthrottletime, 10000);
+        doThrottle(d_now.tv_sec, remoteIP, s_serverdownthrottletime, 10000);
       }
       else if (resolveret == LWResult::Result::PermanentError) {
         // unreachable, 1 minute or 100 queries
-        t_sstorage.throttle.throttle(d_now.tv_sec, std::make_tuple(remoteIP, qname, qtype.getCode()), 60, 100);
+        doThrottle(d_now.tv_sec, remoteIP, qname, qtype, 60, 100);
       }
       else {
         // timeout, 10 seconds or 5 queries
-        t_sstorage.throttle.throttle(d_now.tv_sec, std::make_tuple(remoteIP, qname, qtype.getCode()), 10, 5);
+        doThrottle(d_now.tv_sec, remoteIP, qname, qtype, 10, 5);
       }
     }
 
@@ -4281,14 +4345,14 @@ bool SyncRes::doResolveAtThisIP(const std::string& prefix, const DNSName& qname,
     if (!chained && !dontThrottle) {
 
       // let's make sure we prefer a different server for some time, if there is one available
-      t_sstorage.nsSpeeds[nsName.empty()? DNSName(remoteIP.toStringWithPort()) : nsName].submit(remoteIP, 1000000, d_now); // 1 sec
+      submitNSSpeed(nsName.empty()? DNSName(remoteIP.toStringWithPort()) : nsName, remoteIP, 1000000, d_now); // 1 sec
 
       if (doTCP) {
         // we can be more heavy-handed over TCP
-        t_sstorage.throttle.throttle(d_now.tv_sec, std::make_tuple(remoteIP, qname, qtype.getCode()), 60, 10);
+        doThrottle(d_now.tv_sec, remoteIP, qname, qtype, 60, 10);
       }
       else {
-        t_sstorage.throttle.throttle(d_now.tv_sec, std::make_tuple(remoteIP, qname, qtype.getCode()), 10, 2);
+        doThrottle(d_now.tv_sec, remoteIP, qname, qtype, 10, 2);
       }
     }
     return false;
@@ -4302,10 +4366,10 @@ bool SyncRes::doResolveAtThisIP(const std::string& prefix, const DNSName& qname,
           // rather than throttling what could be the only server we have for this destination, let's make sure we try a different one if there is one available
           // on the other hand, we might keep hammering a server under attack if there is no other alternative, or the alternative is overwhelmed as well, but
           // at the very least we will detect that if our packets stop being answered
-          t_sstorage.nsSpeeds[nsName.empty()? DNSName(remoteIP.toStringWithPort()) : nsName].submit(remoteIP, 1000000, d_now); // 1 sec
+          submitNSSpeed(nsName.empty()? DNSName(remoteIP.toStringWithPort()) : nsName, remoteIP, 1000000, d_now); // 1 sec
         }
         else {
-          t_sstorage.throttle.throttle(d_now.tv_sec, std::make_tuple(remoteIP, qname, qtype.getCode()), 60, 3);
+          doThrottle(d_now.tv_sec, remoteIP, qname, qtype, 60, 3);
         }
       }
       return false;
@@ -4324,7 +4388,7 @@ bool SyncRes::doResolveAtThisIP(const std::string& prefix, const DNSName& qname,
       LOG(prefix<<qname<<": truncated bit set, over TCP?"<<endl);
       if (!dontThrottle) {
         /* let's treat that as a ServFail answer from this server */
-        t_sstorage.throttle.throttle(d_now.tv_sec, std::make_tuple(remoteIP, qname, qtype.getCode()), 60, 3);
+        doThrottle(d_now.tv_sec, remoteIP, qname, qtype, 60, 3);
       }
       return false;
     }
@@ -4704,7 +4768,7 @@ int SyncRes::doResolveAt(NsSet &nameservers, DNSName auth, bool flawedNSSet, con
           */
           //        cout<<"msec: "<<lwr.d_usec/1000.0<<", "<<g_avgLatency/1000.0<<'\n';
 
-          t_sstorage.nsSpeeds[tns->first.empty()? DNSName(remoteIP->toStringWithPort()) : tns->first].submit(*remoteIP, lwr.d_usec, d_now);
+          submitNSSpeed(tns->first.empty()? DNSName(remoteIP->toStringWithPort()) : tns->first, *remoteIP, lwr.d_usec, d_now);
 
           /* we have received an answer, are we done ? */
           bool done = processAnswer(depth, lwr, qname, qtype, auth, wasForwarded, ednsmask, sendRDQuery, nameservers, ret, luaconfsLocal->dfe, &gotNewServers, &rcode, state, *remoteIP);
@@ -4719,7 +4783,7 @@ int SyncRes::doResolveAt(NsSet &nameservers, DNSName auth, bool flawedNSSet, con
             break;
           }
           /* was lame */
-          t_sstorage.throttle.throttle(d_now.tv_sec, std::make_tuple(*remoteIP, qname, qtype.getCode()), 60, 100);
+          doThrottle(d_now.tv_sec, *remoteIP, qname, qtype, 60, 100);
         }
 
         if (gotNewServers) {
@@ -261,6 +261,52 @@ private:
   cont_t d_cont;
 };
 
+/* A process-wide table split into shards, each of them protected by its own lock.
+   The shard is selected from a hash of the key, so threads working on different keys rarely contend. */
+template <class T>
+class LockGuardedShards : public boost::noncopyable
+{
+public:
+  LockGuardedShards(size_t shardsCount) :
+    d_shards(shardsCount)
+  {
+  }
+
+  LockGuardedHolder<T> lock(size_t hash)
+  {
+    return d_shards.at(hash % d_shards.size()).lock();
+  }
+
+  LockGuardedHolder<T> lockShard(size_t idx)
+  {
+    return d_shards.at(idx).lock();
+  }
+
+  size_t getShardsCount() const
+  {
+    return d_shards.size();
+  }
+
+  size_t size()
+  {
+    size_t count = 0;
+    for (auto& shard : d_shards) {
+      count += shard.lock()->size();
+    }
+    return count;
+  }
+
+  void clear()
+  {
+    for (auto& shard : d_shards) {
+      shard.lock()->clear();
+    }
+  }
+
+private:
+  std::vector<LockGuarded<T>> d_shards;
+};
+
 extern std::unique_ptr<NegCache> g_negCache;
 
 class SyncRes : public boost::noncopyable
@@ -409,11 +455,12 @@ public:
 
   static LockGuarded<fails_t<ComboAddress>> s_fails;
   static LockGuarded<fails_t<DNSName>> s_nonresolving;
+  // shared by all threads, so that what one thread learns about a server benefits all of them
+  static LockGuardedShards<nsspeeds_t> s_nsSpeeds;
+  static LockGuardedShards<throttle_t> s_throttle;
+  static LockGuardedShards<ednsstatus_t> s_ednsstatus;
 
   struct ThreadLocalStorage {
-    nsspeeds_t nsSpeeds;
-    throttle_t throttle;
-    ednsstatus_t ednsstatus;
     std::shared_ptr<domainmap_t> domainmap;
   };
 
@@ -473,74 +520,88 @@ public:
   }
   static void pruneNSSpeeds(time_t limit)
   {
-    for(auto i = t_sstorage.nsSpeeds.begin(), end = t_sstorage.nsSpeeds.end(); i != end; ) {
-      if(i->second.stale(limit)) {
-        i = t_sstorage.nsSpeeds.erase(i);
-      }
-      else {
-        ++i;
+    for (size_t idx = 0; idx < s_nsSpeeds.getShardsCount(); idx++) {
+      auto nsSpeeds = s_nsSpeeds.lockShard(idx);
+      for (auto i = nsSpeeds->begin(), end = nsSpeeds->end(); i != end; ) {
+        if (i->second.stale(limit)) {
+          i = nsSpeeds->erase(i);
+        }
+        else {
+          ++i;
+        }
       }
     }
   }
   static uint64_t getNSSpeedsSize()
   {
-    return t_sstorage.nsSpeeds.size();
+    return s_nsSpeeds.size();
   }
   static void submitNSSpeed(const DNSName& server, const ComboAddress& ca, uint32_t usec, const struct timeval& now)
   {
-    t_sstorage.nsSpeeds[server].submit(ca, usec, now);
+    auto nsSpeeds = s_nsSpeeds.lock(server.hash());
+    (*nsSpeeds)[server].submit(ca, usec, now);
   }
   static void clearNSSpeeds()
   {
-    t_sstorage.nsSpeeds.clear();
+    s_nsSpeeds.clear();
   }
   static float getNSSpeed(const DNSName& server, const ComboAddress& ca)
   {
-    return t_sstorage.nsSpeeds[server].d_collection[ca].peek();
+    auto nsSpeeds = s_nsSpeeds.lock(server.hash());
+    return (*nsSpeeds)[server].d_collection[ca].peek();
   }
   static EDNSStatus::EDNSMode getEDNSStatus(const ComboAddress& server)
   {
-    const auto& it = t_sstorage.ednsstatus.find(server);
-    if (it == t_sstorage.ednsstatus.end())
+    auto ednsstatus = s_ednsstatus.lock(ComboAddress::addressOnlyHash()(server));
+    const auto& it = ednsstatus->find(server);
+    if (it == ednsstatus->end())
       return EDNSStatus::UNKNOWN;
 
     return it->mode;
   }
   static uint64_t getEDNSStatusesSize()
   {
-    return t_sstorage.ednsstatus.size();
+    return s_ednsstatus.size();
   }
   static void clearEDNSStatuses()
   {
-    t_sstorage.ednsstatus.clear();
+    s_ednsstatus.clear();
   }
   static void pruneEDNSStatuses(time_t cutoff)
   {
-    t_sstorage.ednsstatus.prune(cutoff);
+    for (size_t idx = 0; idx < s_ednsstatus.getShardsCount(); idx++) {
+      s_ednsstatus.lockShard(idx)->prune(cutoff);
+    }
   }
   static uint64_t getThrottledServersSize()
   {
-    return t_sstorage.throttle.size();
+    return s_throttle.size();
   }
   static void pruneThrottledServers()
   {
-    t_sstorage.throttle.prune();
+    for (size_t idx = 0; idx < s_throttle.getShardsCount(); idx++) {
+      s_throttle.lockShard(idx)->prune();
+    }
   }
   static void clearThrottle()
   {
-    t_sstorage.throttle.clear();
+    s_throttle.clear();
   }
   static bool isThrottled(time_t now, const ComboAddress& server, const DNSName& target, uint16_t qtype)
   {
-    return t_sstorage.throttle.shouldThrottle(now, std::make_tuple(server, target, qtype));
+    return s_throttle.lock(ComboAddress::addressOnlyHash()(server))->shouldThrottle(now, std::make_tuple(server, target, qtype));
   }
   static bool isThrottled(time_t now, const ComboAddress& server)
   {
-    return t_sstorage.throttle.shouldThrottle(now, std::make_tuple(server, g_rootdnsname, 0));
+    return s_throttle.lock(ComboAddress::addressOnlyHash()(server))->shouldThrottle(now, std::make_tuple(server, g_rootdnsname, 0));
   }
   static void doThrottle(time_t now, const ComboAddress& server, time_t duration, unsigned int tries)
   {
-    t_sstorage.throttle.throttle(now, std::make_tuple(server, g_rootdnsname, 0), duration, tries);
+    s_throttle.lock(ComboAddress::addressOnlyHash()(server))->throttle(now, std::make_tuple(server, g_rootdnsname, 0), duration, tries);
+  }
+  static void doThrottle(time_t now, const ComboAddress& server, const DNSName& name, QType qtype, time_t duration, unsigned int tries)
+  {
+    s_throttle.lock(ComboAddress::addressOnlyHash()(server))->throttle(now, std::make_tuple(server, name, qtype.getCode()), duration, tries);
   }
   static uint64_t getFailedServersSize()
   {
@@ -1042,7 +1103,10 @@ struct PacketIDBirthdayCompare
   }
 };
 extern std::unique_ptr<MemRecursorCache> g_recCache;
-extern thread_local std::unique_ptr<RecursorPacketCache> t_packetCache;
+// process-wide packet cache, only set when packetcache-shared is enabled
+extern std::shared_ptr<RecursorPacketCache> g_packetCache;
+// the packet cache of this thread, which is g_packetCache when it is set
+extern thread_local std::shared_ptr<RecursorPacketCache> t_packetCache;
 
 struct RecursorStats
 {
@@ -1073,6 +1137,7 @@ struct RecursorStats
   pdns::stat_t truncatedDrops;
   pdns::stat_t queryPipeFullDrops;
   pdns::stat_t unexpectedCount;
+  pdns::stat_t udpOutSocketReuses;
   pdns::stat_t caseMismatchCount;
   pdns::stat_t spoofCount;
   pdns::stat_t resourceLimits;
@@ -1208,11 +1273,8 @@ typedef std::unordered_set<DNSName> notifyset_t;
 std::tuple<std::shared_ptr<SyncRes::domainmap_t>, std::shared_ptr<notifyset_t>> parseZoneConfiguration();
 void* pleaseSupplantAllowNotifyFor(std::shared_ptr<notifyset_t> ns);
 
-uint64_t* pleaseGetNsSpeedsSize();
 uint64_t* pleaseGetFailedServersSize();
-uint64_t* pleaseGetEDNSStatusesSize();
 uint64_t* pleaseGetConcurrentQueries();
-uint64_t* pleaseGetThrottleSize();
 uint64_t* pleaseGetPacketCacheHits();
 uint64_t* pleaseGetPacketCacheSize();
 void doCarbonDump(void*);
@@ -530,6 +530,30 @@ public:
     return false;
   }
 
+  /* when kTLS is enabled, SSL_write() and SSL_read() are directly mapped to send() and recv() calls
+     on the socket by OpenSSL, the records being encrypted and decrypted by the kernel. OpenSSL
+     automatically falls back to doing the work in userspace if the kernel does not support
+     the negotiated cipher. */
+  bool isKTLSSendEnabled() const override
+  {
+#ifdef BIO_get_ktls_send
+    if (d_conn) {
+      return BIO_get_ktls_send(SSL_get_wbio(d_conn.get()));
+    }
+#endif /* BIO_get_ktls_send */
+    return false;
+  }
+
+  bool isKTLSRecvEnabled() const override
+  {
+#ifdef BIO_get_ktls_recv
+    if (d_conn) {
+      return BIO_get_ktls_recv(SSL_get_rbio(d_conn.get()));
+    }
+#endif /* BIO_get_ktls_recv */
+    return false;
+  }
+
   std::vector<std::unique_ptr<TLSSession>> getSessions() override
   {
     return std::move(d_tlsSessions);
@@ -604,6 +628,7 @@ public:
       }
       else {
         OpenSSLTLSIOCtx::loadTicketsKeys(fe.d_tlsConfig.d_ticketKeyFile);
+        setupTicketsKeyFileWatcher(fe.d_tlsConfig);
       }
     }
     catch (const std::exception& e) {
@@ -629,6 +654,13 @@ public:
       sslOptions |= SSL_OP_NO_CLIENT_RENEGOTIATION;
 #endif
     }
+    if (params.d_ktls) {
+#ifdef SSL_OP_ENABLE_KTLS
+      sslOptions |= SSL_OP_ENABLE_KTLS;
+#else
+      warnlog("Kernel TLS offload requested but not supported by this version of OpenSSL");
+#endif
+    }
 
     registerOpenSSLUser();
 
@@ -857,6 +889,9 @@ private:
 #ifdef HAVE_GNUTLS
 #include <gnutls/gnutls.h>
 #include <gnutls/x509.h>
+#ifdef HAVE_GNUTLS_TRANSPORT_IS_KTLS_ENABLED
+#include <gnutls/socket.h>
+#endif /* HAVE_GNUTLS_TRANSPORT_IS_KTLS_ENABLED */
 
 static void safe_memory_lock(void* data, size_t size)
 {
@@ -1453,6 +1488,28 @@ public:
     return false;
   }
 
+  /* GnuTLS does not allow enabling kTLS per session, only via its system-wide configuration
+     ('ktls = true' in the '[global]' section), but we can still report whether it has been used */
+  bool isKTLSSendEnabled() const override
+  {
+#ifdef HAVE_GNUTLS_TRANSPORT_IS_KTLS_ENABLED
+    if (d_conn) {
+      return (gnutls_transport_is_ktls_enabled(d_conn.get()) & GNUTLS_KTLS_SEND) != 0;
+    }
+#endif /* HAVE_GNUTLS_TRANSPORT_IS_KTLS_ENABLED */
+    return false;
+  }
+
+  bool isKTLSRecvEnabled() const override
+  {
+#ifdef HAVE_GNUTLS_TRANSPORT_IS_KTLS_ENABLED
+    if (d_conn) {
+      return (gnutls_transport_is_ktls_enabled(d_conn.get()) & GNUTLS_KTLS_RECV) != 0;
+    }
+#endif /* HAVE_GNUTLS_TRANSPORT_IS_KTLS_ENABLED */
+    return false;
+  }
+
   std::vector<std::unique_ptr<TLSSession>> getSessions() override
   {
     return std::move(d_tlsSessions);
@@ -1566,6 +1623,7 @@ public:
       }
       else {
         GnuTLSIOCtx::loadTicketsKeys(fe.d_tlsConfig.d_ticketKeyFile);
+        setupTicketsKeyFileWatcher(fe.d_tlsConfig);
       }
     }
     catch(const std::runtime_error& e) {
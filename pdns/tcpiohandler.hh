@@ -37,6 +37,16 @@ public:
   virtual std::vector<uint8_t> getNextProtocol() const = 0;
   virtual LibsslTLSVersion getTLSVersion() const = 0;
   virtual bool hasSessionBeenResumed() const = 0;
+  /* whether the encryption of outgoing, respectively decryption of incoming, TLS records
+     has been offloaded to the kernel (kTLS) */
+  virtual bool isKTLSSendEnabled() const
+  {
+    return false;
+  }
+  virtual bool isKTLSRecvEnabled() const
+  {
+    return false;
+  }
   virtual std::vector<std::unique_ptr<TLSSession>> getSessions() = 0;
   virtual void setSession(std::unique_ptr<TLSSession>& session) = 0;
   virtual bool isUsable() const = 0;
@@ -87,6 +97,13 @@ public:
 
   void handleTicketsKeyRotation(time_t now)
   {
+    if (d_ticketsKeyFileWatcher) {
+      /* the keys are managed outside of this process, possibly shared with other ones,
+         so we only reload them when the file changes */
+      d_ticketsKeyFileWatcher->reloadIfChanged(now, [this](const std::string& file) { loadTicketsKeys(file); });
+      return;
+    }
+
     if (d_ticketsKeyRotationDelay != 0 && now > d_ticketsKeyNextRotation) {
       if (d_rotatingTicketsKey.test_and_set()) {
         /* someone is already rotating */
@@ -128,6 +145,14 @@ public:
   }
 
 protected:
+  void setupTicketsKeyFileWatcher(const TLSConfig& config)
+  {
+    if (!config.d_ticketKeyFile.empty() && config.d_ticketsKeyFileCheckInterval > 0) {
+      d_ticketsKeyFileWatcher = std::make_unique<TLSTicketsKeyFileWatcher>(config.d_ticketKeyFile, config.d_ticketsKeyFileCheckInterval);
+    }
+  }
+
+  std::unique_ptr<TLSTicketsKeyFileWatcher> d_ticketsKeyFileWatcher{nullptr};
   std::atomic_flag d_rotatingTicketsKey;
   std::atomic<time_t> d_ticketsKeyNextRotation{0};
   time_t d_ticketsKeyRotationDelay{0};
@@ -520,6 +545,16 @@ public:
     return d_conn && d_conn->getResumedFromInactiveTicketKey();
   }
 
+  bool isKTLSSendEnabled() const
+  {
+    return d_conn && d_conn->isKTLSSendEnabled();
+  }
+
+  bool isKTLSRecvEnabled() const
+  {
+    return d_conn && d_conn->isKTLSRecvEnabled();
+  }
+
   bool getUnknownTicketKey() const
   {
     return d_conn && d_conn->getUnknownTicketKey();
@@ -577,6 +612,7 @@ struct TLSContextParameters
   bool d_validateCertificates{true};
   bool d_releaseBuffers{true};
   bool d_enableRenegotiation{false};
+  bool d_ktls{false};
 };
 
 std::shared_ptr<TLSCtx> getTLSContext(const TLSContextParameters& params);
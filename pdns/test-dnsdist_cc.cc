@@ -964,6 +964,128 @@ BOOST_AUTO_TEST_CASE(insertECSAfterTSIG) {
 }
 
 
+BOOST_AUTO_TEST_CASE(generateECSOptionEncoding) {
+  for (const auto& [address, prefix] : std::vector<std::pair<std::string, uint16_t>>{{"192.0.2.1", 24}, {"192.0.2.255", 17}, {"192.0.2.1", 32}, {"192.0.2.1", 0}, {"2001:db8::1", 56}, {"2001:db8:ffff::1", 33}, {"2001:db8::1", 128}}) {
+    const ComboAddress source(address);
+    EDNSSubnetOpts ecsOpts;
+    ecsOpts.source = Netmask(source, prefix);
+    std::string expected;
+    generateEDNSOption(EDNSOptionCode::ECS, makeEDNSSubnetOptsString(ecsOpts), expected);
+
+    std::string result;
+    generateECSOption(source, result, prefix);
+    BOOST_CHECK_EQUAL(makeHexDump(result), makeHexDump(expected));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(rewriteEDNSOptionInPlace) {
+  DNSName name("www.powerdns.com.");
+  ComboAddress remote("192.0.2.1");
+  string newECSOption;
+  generateECSOption(remote, newECSOption, ECSSourcePrefixV4);
+  string existingECSOption;
+  generateECSOption(ComboAddress("198.51.100.1"), existingECSOption, 8);
+
+  PacketBuffer query;
+  GenericDNSPacketWriter<PacketBuffer> pw(query, name, QType::A, QClass::IN, 0);
+  pw.getHeader()->rd = 1;
+  pw.startRecord(name, QType::A, 60, QClass::IN, DNSResourceRecord::ANSWER, true);
+  pw.xfr32BitInt(0x01020304);
+  GenericDNSPacketWriter<PacketBuffer>::optvect_t opts;
+  opts.emplace_back(EDNSOptionCode::COOKIE, std::string(8, 'C'));
+  opts.emplace_back(EDNSOptionCode::ECS, existingECSOption.substr(EDNS_OPTION_CODE_SIZE + EDNS_OPTION_LENGTH_SIZE));
+  opts.emplace_back(EDNSOptionCode::PADDING, std::string(4, '\0'));
+  pw.addOpt(512, 0, EDNS_HEADER_FLAG_DO, opts);
+  pw.commit();
+
+  /* existing option, no override: nothing changes except for the trailing data being removed */
+  auto packet = query;
+  packet.push_back(42);
+  bool ednsAdded = true;
+  bool optionAdded = true;
+  BOOST_CHECK(rewriteEDNSOptionInQuery(packet, 4096, ednsAdded, EDNSOptionCode::ECS, optionAdded, false, newECSOption));
+  BOOST_CHECK(!ednsAdded);
+  BOOST_CHECK(!optionAdded);
+  BOOST_CHECK(packet == query);
+
+  /* not enough room: the packet is left untouched */
+  packet = query;
+  packet.resize(query.size() + 2);
+  BOOST_CHECK(!rewriteEDNSOptionInQuery(packet, query.size(), ednsAdded, EDNSOptionCode::ECS, optionAdded, true, newECSOption));
+  BOOST_CHECK_EQUAL(packet.size(), query.size() + 2);
+
+  /* override: the existing option is replaced, the other ones are kept */
+  packet = query;
+  BOOST_CHECK(rewriteEDNSOptionInQuery(packet, 4096, ednsAdded, EDNSOptionCode::ECS, optionAdded, true, newECSOption));
+  BOOST_CHECK(!ednsAdded);
+  BOOST_CHECK(!optionAdded);
+  BOOST_CHECK_EQUAL(packet.size(), query.size() + newECSOption.size() - existingECSOption.size());
+  validateQuery(packet, true, false, 0, 1);
+
+  uint16_t optStart = 0;
+  size_t optLen = 0;
+  bool last = false;
+  BOOST_REQUIRE_EQUAL(locateEDNSOptRR(packet, &optStart, &optLen, &last), 0);
+  BOOST_CHECK(last);
+  BOOST_CHECK_EQUAL(packet.at(optStart + 3) * 256 + packet.at(optStart + 4), 512);
+  std::vector<std::pair<uint16_t, std::string>> options;
+  BOOST_REQUIRE(getEDNSOptionsFromContent(std::string(reinterpret_cast<const char*>(&packet.at(optStart + optRecordMinimumSize)), optLen - optRecordMinimumSize), options));
+  BOOST_REQUIRE_EQUAL(options.size(), 3U);
+  BOOST_CHECK_EQUAL(options.at(0).first, EDNSOptionCode::COOKIE);
+  BOOST_CHECK_EQUAL(options.at(1).first, EDNSOptionCode::PADDING);
+  BOOST_CHECK_EQUAL(options.at(2).first, EDNSOptionCode::ECS);
+  BOOST_CHECK_EQUAL(makeHexDump(options.at(2).second), makeHexDump(newECSOption.substr(EDNS_OPTION_CODE_SIZE + EDNS_OPTION_LENGTH_SIZE)));
+}
+
+BOOST_AUTO_TEST_CASE(rewriteEDNSOptionNotLast) {
+  DNSName name("www.powerdns.com.");
+  DNSName target("target.powerdns.com.");
+  ComboAddress remote("192.0.2.1");
+  string newECSOption;
+  generateECSOption(remote, newECSOption, ECSSourcePrefixV4);
+
+  /* the OPT RR is followed by two records, the owner name of the second one being a compression pointer
+     to the owner name of the first one, located after the OPT RR */
+  PacketBuffer query;
+  GenericDNSPacketWriter<PacketBuffer> pw(query, name, QType::A, QClass::IN, 0);
+  pw.getHeader()->rd = 1;
+  pw.addOpt(512, 0, 0);
+  pw.commit();
+  pw.startRecord(target, QType::A, 60, QClass::IN, DNSResourceRecord::ADDITIONAL, true);
+  pw.xfr32BitInt(0x01020304);
+  pw.commit();
+  const size_t firstRecordEnd = query.size();
+  pw.startRecord(target, QType::A, 60, QClass::IN, DNSResourceRecord::ADDITIONAL, true);
+  pw.xfr32BitInt(0x05060708);
+  pw.commit();
+  /* the owner name of the last record is compressed */
+  BOOST_REQUIRE_EQUAL(query.at(firstRecordEnd) & 0xc0, 0xc0);
+
+  auto packet = query;
+  bool ednsAdded = true;
+  bool optionAdded = false;
+  BOOST_CHECK(rewriteEDNSOptionInQuery(packet, 4096, ednsAdded, EDNSOptionCode::ECS, optionAdded, true, newECSOption));
+  BOOST_CHECK(!ednsAdded);
+  BOOST_CHECK(optionAdded);
+  validateQuery(packet, true, false, 2);
+  validateECS(packet, remote);
+
+  MOADNSParser mdp(true, reinterpret_cast<const char*>(packet.data()), packet.size());
+  size_t records = 0;
+  for (const auto& answer : mdp.d_answers) {
+    if (answer.first.d_type == QType::A) {
+      BOOST_CHECK_EQUAL(answer.first.d_name, target);
+      ++records;
+    }
+  }
+  BOOST_CHECK_EQUAL(records, 2U);
+
+  /* not enough room: the packet is left untouched */
+  packet = query;
+  BOOST_CHECK(!rewriteEDNSOptionInQuery(packet, query.size(), ednsAdded, EDNSOptionCode::ECS, optionAdded, true, newECSOption));
+  BOOST_CHECK(packet == query);
+}
+
 BOOST_AUTO_TEST_CASE(removeEDNSWhenFirst) {
   DNSName name("www.powerdns.com.");
 
@@ -8,6 +8,7 @@
 #include "ednssubnet.hh"
 #include "dnsdist.hh"
 #include "iputils.hh"
+#include "dnsparser.hh"
 #include "dnswriter.hh"
 #include "dnsdist-cache.hh"
 #include "gettime.hh"
@@ -443,6 +444,180 @@ BOOST_AUTO_TEST_CASE(test_PacketCacheNXDomainTTL) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(test_PacketCacheRefresh) {
+  const size_t maxEntries = 150000;
+  DNSDistPacketCache PC(maxEntries, /* maxTTL */ 86400, /* minTTL */ 1);
+  PC.setPrefetchPercentage(50);
+  PC.setStaleWhileRevalidateTTL(60);
+  BOOST_CHECK(PC.isRefreshEnabled());
+
+  struct timespec queryTime;
+  gettime(&queryTime);  // does not have to be accurate ("realTime") in tests
+
+  ComboAddress remote;
+  bool dnssecOK = false;
+  try {
+    DNSName name("refresh");
+    PacketBuffer query;
+    GenericDNSPacketWriter<PacketBuffer> pwQ(query, name, QType::A, QClass::IN, 0);
+    pwQ.getHeader()->rd = 1;
+
+    PacketBuffer response;
+    GenericDNSPacketWriter<PacketBuffer> pwR(response, name, QType::A, QClass::IN, 0);
+    pwR.getHeader()->rd = 1;
+    pwR.getHeader()->ra = 1;
+    pwR.getHeader()->qr = 1;
+    pwR.getHeader()->id = pwQ.getHeader()->id;
+    pwR.startRecord(name, QType::A, 2, QClass::IN, DNSResourceRecord::ANSWER);
+    pwR.xfr32BitInt(0x01020304);
+    pwR.commit();
+
+    uint32_t key = 0;
+    boost::optional<Netmask> subnet;
+    {
+      PacketBuffer packet(query);
+      DNSQuestion dq(&name, QType::A, QClass::IN, &remote, &remote, packet, dnsdist::Protocol::DoUDP, &queryTime);
+      bool found = PC.get(dq, 0, &key, subnet, dnssecOK, receivedOverUDP, 0, false, true);
+      BOOST_CHECK_EQUAL(found, false);
+      BOOST_CHECK(dq.cacheRefreshQuery == nullptr);
+      PC.insert(key, subnet, *(getFlagsFromDNSHeader(dq.getHeader())), dnssecOK, name, QType::A, QClass::IN, response, receivedOverUDP, 0, boost::none);
+    }
+
+    auto lookup = [&](bool refreshAllowed, bool& refreshNeeded) {
+      PacketBuffer packet(query);
+      DNSQuestion dq(&name, QType::A, QClass::IN, &remote, &remote, packet, dnsdist::Protocol::DoUDP, &queryTime);
+      bool found = PC.get(dq, 0, &key, subnet, dnssecOK, receivedOverUDP, 0, false, refreshAllowed);
+      refreshNeeded = dq.cacheRefreshQuery != nullptr;
+      if (refreshNeeded) {
+        /* we should get an exact copy of the query */
+        BOOST_CHECK(*dq.cacheRefreshQuery == query);
+      }
+      return found;
+    };
+
+    bool refreshNeeded = false;
+    /* fresh entry, no refresh needed */
+    BOOST_CHECK_EQUAL(lookup(true, refreshNeeded), true);
+    BOOST_CHECK_EQUAL(refreshNeeded, false);
+    BOOST_CHECK_EQUAL(PC.getRefreshes(), 0U);
+
+    sleep(1);
+    /* at most half of the TTL remaining (or already expired), the first lookup should trigger a refresh */
+    BOOST_CHECK_EQUAL(lookup(true, refreshNeeded), true);
+    BOOST_CHECK_EQUAL(refreshNeeded, true);
+    BOOST_CHECK_EQUAL(PC.getRefreshes(), 1U);
+    /* but not the next ones, the refresh is already in progress */
+    BOOST_CHECK_EQUAL(lookup(true, refreshNeeded), true);
+    BOOST_CHECK_EQUAL(refreshNeeded, false);
+    BOOST_CHECK_EQUAL(PC.getRefreshes(), 1U);
+
+    sleep(2);
+    /* expired: only usable when a refresh is possible */
+    BOOST_CHECK_EQUAL(lookup(false, refreshNeeded), false);
+    BOOST_CHECK_EQUAL(refreshNeeded, false);
+    auto staleHits = PC.getStaleHits();
+    BOOST_CHECK_EQUAL(lookup(true, refreshNeeded), true);
+    /* the previous refresh is still pending */
+    BOOST_CHECK_EQUAL(refreshNeeded, false);
+    BOOST_CHECK_EQUAL(PC.getStaleHits(), staleHits + 1);
+
+    /* the response to the refresh query clears the pending state */
+    PC.insert(key, subnet, *(getFlagsFromDNSHeader(reinterpret_cast<dnsheader*>(query.data()))), dnssecOK, name, QType::A, QClass::IN, response, receivedOverUDP, 0, boost::none);
+    sleep(2);
+    BOOST_CHECK_EQUAL(lookup(true, refreshNeeded), true);
+    BOOST_CHECK_EQUAL(refreshNeeded, true);
+    BOOST_CHECK_EQUAL(PC.getRefreshes(), 2U);
+  }
+  catch(const PDNSException& e) {
+    cerr<<"Had error: "<<e.reason<<endl;
+    throw;
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_PacketCacheSnapshot) {
+  const size_t maxEntries = 150000;
+  DNSDistPacketCache PC(maxEntries, /* maxTTL */ 86400, /* minTTL */ 1, /* tempFailureTTL */ 60, /* maxNegativeTTL */ 3600, /* staleTTL */ 60, /* dontAge */ false, /* numberOfShards */ 4);
+
+  struct timespec queryTime;
+  gettime(&queryTime);  // does not have to be accurate ("realTime") in tests
+
+  ComboAddress remote;
+  bool dnssecOK = false;
+  const size_t numberOfEntries = 100;
+
+  auto buildResponse = [](const DNSName& name, const PacketBuffer& query, uint32_t ttl) {
+    PacketBuffer response;
+    GenericDNSPacketWriter<PacketBuffer> pwR(response, name, QType::A, QClass::IN, 0);
+    pwR.getHeader()->rd = 1;
+    pwR.getHeader()->ra = 1;
+    pwR.getHeader()->qr = 1;
+    pwR.getHeader()->id = reinterpret_cast<const dnsheader*>(query.data())->id;
+    pwR.startRecord(name, QType::A, ttl, QClass::IN, DNSResourceRecord::ANSWER);
+    pwR.xfr32BitInt(0x01020304);
+    pwR.commit();
+    return response;
+  };
+
+  try {
+    for (size_t counter = 0; counter < numberOfEntries; counter++) {
+      DNSName name = DNSName("snapshot") + DNSName(std::to_string(counter));
+      PacketBuffer query;
+      GenericDNSPacketWriter<PacketBuffer> pwQ(query, name, QType::A, QClass::IN, 0);
+      pwQ.getHeader()->rd = 1;
+      /* the last entry will be expired by the time we load the snapshot */
+      auto response = buildResponse(name, query, counter == (numberOfEntries - 1) ? 1 : 3600);
+
+      uint32_t key = 0;
+      boost::optional<Netmask> subnet;
+      DNSQuestion dq(&name, QType::A, QClass::IN, &remote, &remote, query, dnsdist::Protocol::DoUDP, &queryTime);
+      bool found = PC.get(dq, 0, &key, subnet, dnssecOK, receivedOverUDP);
+      BOOST_CHECK_EQUAL(found, false);
+      PC.insert(key, subnet, *(getFlagsFromDNSHeader(dq.getHeader())), dnssecOK, name, QType::A, QClass::IN, response, receivedOverUDP, 0, boost::none);
+    }
+    BOOST_CHECK_EQUAL(PC.getSize(), numberOfEntries);
+
+    char fileName[] = "/tmp/dnsdist-pc-snapshot.XXXXXX";
+    int fd = mkstemp(fileName);
+    BOOST_REQUIRE(fd >= 0);
+    close(fd);
+
+    BOOST_CHECK_EQUAL(PC.saveSnapshot(fileName), numberOfEntries);
+
+    sleep(2);
+
+    DNSDistPacketCache restored(maxEntries, /* maxTTL */ 86400, /* minTTL */ 1, /* tempFailureTTL */ 60, /* maxNegativeTTL */ 3600, /* staleTTL */ 60, /* dontAge */ false, /* numberOfShards */ 4);
+    BOOST_CHECK_EQUAL(restored.loadSnapshot(fileName), numberOfEntries - 1);
+    BOOST_CHECK_EQUAL(restored.getSize(), numberOfEntries - 1);
+    unlink(fileName);
+
+    for (size_t counter = 0; counter < numberOfEntries; counter++) {
+      DNSName name = DNSName("snapshot") + DNSName(std::to_string(counter));
+      PacketBuffer query;
+      GenericDNSPacketWriter<PacketBuffer> pwQ(query, name, QType::A, QClass::IN, 0);
+      pwQ.getHeader()->rd = 1;
+
+      uint32_t key = 0;
+      boost::optional<Netmask> subnet;
+      DNSQuestion dq(&name, QType::A, QClass::IN, &remote, &remote, query, dnsdist::Protocol::DoUDP, &queryTime);
+      bool found = restored.get(dq, 0, &key, subnet, dnssecOK, receivedOverUDP);
+      BOOST_CHECK_EQUAL(found, counter != (numberOfEntries - 1));
+      if (found) {
+        /* the remaining TTL has been preserved, not reset */
+        uint32_t ttl = getDNSPacketMinTTL(reinterpret_cast<const char*>(query.data()), query.size());
+        BOOST_CHECK_LE(ttl, 3598U);
+        BOOST_CHECK_GE(ttl, 3590U);
+      }
+    }
+
+    /* loading a file that is not a snapshot fails */
+    BOOST_CHECK_THROW(restored.loadSnapshot("/dev/null"), std::runtime_error);
+  }
+  catch (const PDNSException& e) {
+    cerr<<"Had error: "<<e.reason<<endl;
+    throw;
+  }
+}
+
 static DNSDistPacketCache g_PC(500000);
 
 static void threadMangler(unsigned int offset)
@@ -513,6 +688,135 @@ static void threadReader(unsigned int offset)
   }
 }
 
+BOOST_AUTO_TEST_CASE(test_PacketCacheECSScopeSharing) {
+  const size_t maxEntries = 150000;
+  DNSDistPacketCache PC(maxEntries, /* maxTTL */ 86400, /* minTTL */ 1, /* tempFailureTTL */ 60, /* maxNegativeTTL */ 3600, /* staleTTL */ 60, /* dontAge */ false, /* numberOfShards */ 4, /* deferrableInsertLock */ true, /* parseECS */ true);
+  PC.setECSScopeSharingEnabled(true);
+
+  struct timespec queryTime;
+  gettime(&queryTime);  // does not have to be accurate ("realTime") in tests
+
+  ComboAddress remote("192.0.2.1");
+  bool dnssecOK = false;
+  DNSName name("scoped.powerdns.com.");
+  PacketBuffer query;
+  GenericDNSPacketWriter<PacketBuffer> pwQ(query, name, QType::A, QClass::IN, 0);
+  pwQ.getHeader()->rd = 1;
+  /* a hit overwrites the query with the response */
+  const PacketBuffer originalQuery(query);
+  const uint16_t queryFlags = *(getFlagsFromDNSHeader(pwQ.getHeader()));
+
+  PacketBuffer response;
+  GenericDNSPacketWriter<PacketBuffer> pwR(response, name, QType::A, QClass::IN, 0);
+  pwR.getHeader()->rd = 1;
+  pwR.getHeader()->ra = 1;
+  pwR.getHeader()->qr = 1;
+  pwR.getHeader()->id = pwQ.getHeader()->id;
+  pwR.startRecord(name, QType::A, 100, QClass::IN, DNSResourceRecord::ANSWER);
+  pwR.xfr32BitInt(0x01020304);
+  pwR.commit();
+
+  try {
+    uint32_t noECSKey = 0;
+    boost::optional<Netmask> subnet;
+    DNSQuestion dq(&name, QType::A, QClass::IN, &remote, &remote, query, dnsdist::Protocol::DoUDP, &queryTime);
+    bool found = PC.get(dq, 0, &noECSKey, subnet, dnssecOK, receivedOverUDP);
+    BOOST_CHECK_EQUAL(found, false);
+    BOOST_CHECK(!subnet);
+
+    /* nothing has been inserted yet */
+    BOOST_CHECK_EQUAL(PC.getScoped(dq, 0, noECSKey, Netmask("192.0.2.0/24"), dnssecOK, receivedOverUDP), false);
+
+    /* the backend told us that the answer is valid for 192.0.0.0/16 */
+    BOOST_CHECK(PC.insertScoped(noECSKey, Netmask("192.0.2.0/16"), queryFlags, dnssecOK, name, QType::A, QClass::IN, response, receivedOverUDP, 0, boost::none));
+    BOOST_CHECK_EQUAL(PC.getSize(), 1U);
+
+    /* the same client */
+    found = PC.getScoped(dq, 0, noECSKey, Netmask("192.0.2.0/24"), dnssecOK, receivedOverUDP);
+    BOOST_CHECK_EQUAL(found, true);
+    BOOST_CHECK(dq.getData() == response);
+
+    /* another client in the same /16 */
+    ComboAddress otherRemote("192.0.42.1");
+    PacketBuffer otherQuery(originalQuery);
+    DNSQuestion otherDQ(&name, QType::A, QClass::IN, &otherRemote, &otherRemote, otherQuery, dnsdist::Protocol::DoUDP, &queryTime);
+    found = PC.getScoped(otherDQ, 0, noECSKey, Netmask("192.0.42.0/24"), dnssecOK, receivedOverUDP);
+    BOOST_CHECK_EQUAL(found, true);
+    BOOST_CHECK_EQUAL(PC.getScopedHits(), 2U);
+
+    /* a client outside of that scope */
+    ComboAddress farRemote("198.51.100.1");
+    PacketBuffer farQuery(originalQuery);
+    DNSQuestion farDQ(&name, QType::A, QClass::IN, &farRemote, &farRemote, farQuery, dnsdist::Protocol::DoUDP, &queryTime);
+    found = PC.getScoped(farDQ, 0, noECSKey, Netmask("198.51.100.0/24"), dnssecOK, receivedOverUDP);
+    BOOST_CHECK_EQUAL(found, false);
+
+    /* a more specific answer for that last client does not change anything for the others */
+    BOOST_CHECK(PC.insertScoped(noECSKey, Netmask("198.51.100.0/24"), queryFlags, dnssecOK, name, QType::A, QClass::IN, response, receivedOverUDP, 0, boost::none));
+    BOOST_CHECK_EQUAL(PC.getSize(), 2U);
+    BOOST_CHECK_EQUAL(PC.getECSIndexSize(), 2U);
+    farQuery = originalQuery;
+    BOOST_CHECK_EQUAL(PC.getScoped(farDQ, 0, noECSKey, Netmask("198.51.100.0/24"), dnssecOK, receivedOverUDP), true);
+    farQuery = originalQuery;
+    BOOST_CHECK_EQUAL(PC.getScoped(farDQ, 0, noECSKey, Netmask("198.51.101.0/24"), dnssecOK, receivedOverUDP), false);
+    BOOST_CHECK_EQUAL(PC.getScopedHits(), 3U);
+
+    /* the regular, unscoped lookup is not affected */
+    query = originalQuery;
+    found = PC.get(dq, 0, &noECSKey, subnet, dnssecOK, receivedOverUDP);
+    BOOST_CHECK_EQUAL(found, false);
+
+    /* scoped entries survive a snapshot round-trip, and are still reachable afterwards */
+    {
+      char fileName[] = "/tmp/dnsdist-pc-snapshot.XXXXXX";
+      int fd = mkstemp(fileName);
+      BOOST_REQUIRE(fd >= 0);
+      close(fd);
+      BOOST_CHECK_EQUAL(PC.saveSnapshot(fileName), 2U);
+
+      DNSDistPacketCache restored(PC.getMaxEntries(), /* maxTTL */ 86400, /* minTTL */ 1, /* tempFailureTTL */ 60, /* maxNegativeTTL */ 3600, /* staleTTL */ 60, /* dontAge */ false, /* numberOfShards */ 4, /* deferrableInsertLock */ true, /* parseECS */ true);
+      BOOST_CHECK_EQUAL(restored.loadSnapshot(fileName), 2U);
+      unlink(fileName);
+      BOOST_CHECK_EQUAL(restored.getSize(), 2U);
+      BOOST_CHECK_EQUAL(restored.getECSIndexSize(), 2U);
+      otherQuery = originalQuery;
+      BOOST_CHECK_EQUAL(restored.getScoped(otherDQ, 0, noECSKey, Netmask("192.0.42.0/24"), dnssecOK, receivedOverUDP), true);
+      BOOST_CHECK(otherDQ.getData() == response);
+      farQuery = originalQuery;
+      BOOST_CHECK_EQUAL(restored.getScoped(farDQ, 0, noECSKey, Netmask("198.51.100.0/24"), dnssecOK, receivedOverUDP), true);
+      /* and removed from the index when they are removed */
+      BOOST_CHECK_EQUAL(restored.expungeByName(name), 2U);
+      BOOST_CHECK_EQUAL(restored.getECSIndexSize(), 0U);
+    }
+
+    /* once the entries are removed, the scopes are gone as well */
+    BOOST_CHECK_EQUAL(PC.expungeByName(name), 2U);
+    BOOST_CHECK_EQUAL(PC.getSize(), 0U);
+    BOOST_CHECK_EQUAL(PC.getECSIndexSize(), 0U);
+    BOOST_CHECK_EQUAL(PC.getScoped(dq, 0, noECSKey, Netmask("192.0.2.0/24"), dnssecOK, receivedOverUDP), false);
+    farQuery = originalQuery;
+    BOOST_CHECK_EQUAL(PC.getScoped(farDQ, 0, noECSKey, Netmask("198.51.100.0/24"), dnssecOK, receivedOverUDP), false);
+
+    /* the same goes for expired and expunged entries */
+    BOOST_CHECK(PC.insertScoped(noECSKey, Netmask("192.0.2.0/16"), queryFlags, dnssecOK, name, QType::A, QClass::IN, response, receivedOverUDP, 0, boost::none));
+    BOOST_CHECK(PC.insertScoped(noECSKey, Netmask("198.51.100.0/24"), queryFlags, dnssecOK, name, QType::A, QClass::IN, response, receivedOverUDP, 0, boost::none));
+    BOOST_CHECK_EQUAL(PC.getECSIndexSize(), 2U);
+    BOOST_CHECK_EQUAL(PC.purgeExpired(0, time(nullptr) + 3600), 2U);
+    BOOST_CHECK_EQUAL(PC.getSize(), 0U);
+    BOOST_CHECK_EQUAL(PC.getECSIndexSize(), 0U);
+
+    BOOST_CHECK(PC.insertScoped(noECSKey, Netmask("192.0.2.0/16"), queryFlags, dnssecOK, name, QType::A, QClass::IN, response, receivedOverUDP, 0, boost::none));
+    BOOST_CHECK(PC.insertScoped(noECSKey, Netmask("198.51.100.0/24"), queryFlags, dnssecOK, name, QType::A, QClass::IN, response, receivedOverUDP, 0, boost::none));
+    BOOST_CHECK_EQUAL(PC.expunge(0), 2U);
+    BOOST_CHECK_EQUAL(PC.getSize(), 0U);
+    BOOST_CHECK_EQUAL(PC.getECSIndexSize(), 0U);
+  }
+  catch (const PDNSException& e) {
+    cerr<<"Had error: "<<e.reason<<endl;
+    throw;
+  }
+}
+
 BOOST_AUTO_TEST_CASE(test_PacketCacheThreaded) {
   try {
     std::vector<std::thread> threads;
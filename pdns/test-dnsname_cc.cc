@@ -1003,4 +1003,100 @@ BOOST_AUTO_TEST_CASE(test_getcommonlabels) {
   BOOST_CHECK_EQUAL(name4.getCommonLabels(name3), name4);
 }
 
+BOOST_AUTO_TEST_CASE(test_storage) {
+  /* short enough to be stored inline */
+  const DNSName shortName("www.powerdns.com");
+  BOOST_CHECK_LE(shortName.getStorage().size(), DNSName::string_t::s_inlineCapacity);
+  BOOST_CHECK_EQUAL(shortName.getStorage().capacity(), DNSName::string_t::s_inlineCapacity);
+
+  /* that one is not */
+  const DNSName longName("a-rather-long-label.another-long-label.yet-another-one.powerdns.com");
+  BOOST_CHECK_GT(longName.getStorage().size(), DNSName::string_t::s_inlineCapacity);
+
+  for (const auto& name : {shortName, longName}) {
+    DNSName copy(name);
+    BOOST_CHECK_EQUAL(copy, name);
+    BOOST_CHECK(copy.getStorage() == name.getStorage());
+
+    DNSName moved(std::move(copy));
+    BOOST_CHECK_EQUAL(moved, name);
+    BOOST_CHECK(copy.empty());
+
+    DNSName assigned("x");
+    assigned = moved;
+    BOOST_CHECK_EQUAL(assigned, name);
+    assigned = std::move(moved);
+    BOOST_CHECK_EQUAL(assigned, name);
+    BOOST_CHECK(moved.empty());
+    /* self-assignment */
+    const auto& ref = assigned;
+    assigned = ref;
+    BOOST_CHECK_EQUAL(assigned, name);
+  }
+
+  /* growing from inline to the heap, then shrinking back */
+  DNSName name("com");
+  for (size_t idx = 0; idx < 20; idx++) {
+    name.prependRawLabel("label" + std::to_string(idx));
+  }
+  BOOST_CHECK_EQUAL(name.countLabels(), 21U);
+  BOOST_CHECK_GT(name.getStorage().capacity(), DNSName::string_t::s_inlineCapacity);
+  BOOST_CHECK_EQUAL(name.getRawLabel(0), "label19");
+  BOOST_CHECK_EQUAL(name.getLastLabel(), DNSName("com"));
+  while (name.countLabels() > 1) {
+    BOOST_CHECK(name.chopOff());
+  }
+  BOOST_CHECK_EQUAL(name, DNSName("com"));
+
+  /* appending a name to itself */
+  DNSName doubled("powerdns.com");
+  doubled += doubled;
+  BOOST_CHECK_EQUAL(doubled, DNSName("powerdns.com.powerdns.com"));
+  doubled += doubled;
+  BOOST_CHECK_EQUAL(doubled, DNSName("powerdns.com.powerdns.com.powerdns.com.powerdns.com"));
+}
+
+BOOST_AUTO_TEST_CASE(test_interned) {
+  const auto initialCount = InternedDNSName::getInternedCount();
+  {
+    InternedDNSName empty;
+    BOOST_CHECK(empty.empty());
+    BOOST_CHECK(empty.get().empty());
+
+    const DNSName name("www.powerdns.com");
+    InternedDNSName first(name);
+    InternedDNSName second(DNSName("www.powerdns.com"));
+    BOOST_CHECK_EQUAL(first.get(), name);
+    /* the same object is shared */
+    BOOST_CHECK_EQUAL(&first.get(), &second.get());
+    BOOST_CHECK(first == second);
+    BOOST_CHECK_EQUAL(first.hash(), name.hash());
+    BOOST_CHECK_EQUAL(InternedDNSName::getInternedCount(), initialCount + 1);
+
+    /* the case is preserved, so this is a different object, but still equal */
+    InternedDNSName upper(DNSName("WWW.PowerDNS.COM"));
+    BOOST_CHECK_NE(&first.get(), &upper.get());
+    BOOST_CHECK(first == upper);
+    BOOST_CHECK_EQUAL(upper->toString(), "WWW.PowerDNS.COM.");
+    BOOST_CHECK_EQUAL(InternedDNSName::getInternedCount(), initialCount + 2);
+
+    InternedDNSName other(DNSName("powerdns.org"));
+    BOOST_CHECK(first != other);
+
+    std::unordered_set<InternedDNSName> set;
+    set.insert(first);
+    set.insert(second);
+    set.insert(other);
+    BOOST_CHECK_EQUAL(set.size(), 2U);
+  }
+  /* all the handles are gone, so the names should have been removed from the table */
+  BOOST_CHECK_EQUAL(InternedDNSName::getInternedCount(), initialCount);
+
+  {
+    InternedDNSName again(DNSName("www.powerdns.com"));
+    BOOST_CHECK_EQUAL(InternedDNSName::getInternedCount(), initialCount + 1);
+  }
+  BOOST_CHECK_EQUAL(InternedDNSName::getInternedCount(), initialCount);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -8,6 +8,7 @@
 #include <boost/test/unit_test.hpp>
 
 #include "dnsparser.hh"
+#include "ednsoptions.hh"
 
 BOOST_AUTO_TEST_SUITE(test_dnsparser_cc)
 
@@ -347,6 +348,128 @@ BOOST_AUTO_TEST_CASE(test_getDNSPacketMinTTL) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(test_getDNSPacketSummary) {
+
+  const DNSName name("powerdns.com.");
+  const ComboAddress v4("1.2.3.4");
+  /* family (2), source prefix-length (1), scope prefix-length (1), address (3) */
+  const std::string ecsOption("\x00\x01\x18\x10\xc0\x00\x02", 7);
+  const size_t optLen = /* root */ 1 + /* type, class, TTL, rdlength */ 10 + /* option code and length */ 4 + ecsOption.size();
+
+  {
+    /* no records */
+    vector<uint8_t> packet;
+    DNSPacketWriter pwR(packet, name, QType::A, QClass::IN, 0);
+    pwR.getHeader()->qr = 1;
+    pwR.getHeader()->rcode = RCode::NXDomain;
+    pwR.commit();
+
+    DNSPacketSummary summary;
+    BOOST_CHECK(getDNSPacketSummary(reinterpret_cast<char*>(packet.data()), packet.size(), summary));
+    BOOST_CHECK_EQUAL(summary.minTTL, std::numeric_limits<uint32_t>::max());
+    BOOST_CHECK_EQUAL(summary.rcode, RCode::NXDomain);
+    BOOST_CHECK_EQUAL(summary.answers, 0U);
+    BOOST_CHECK(!summary.hasOPT);
+    BOOST_CHECK(!summary.seenAuthSOA);
+  }
+
+  {
+    /* records in every section, SOA in auth, OPT with ECS last */
+    vector<uint8_t> packet;
+    DNSPacketWriter pwR(packet, name, QType::A, QClass::IN, 0);
+    pwR.getHeader()->qr = 1;
+    pwR.commit();
+
+    pwR.startRecord(name, QType::A, 300, QClass::IN, DNSResourceRecord::ANSWER);
+    pwR.xfrIP(v4.sin4.sin_addr.s_addr);
+    pwR.commit();
+
+    pwR.startRecord(name, QType::SOA, 60, QClass::IN, DNSResourceRecord::AUTHORITY);
+    pwR.commit();
+
+    pwR.startRecord(name, QType::A, 120, QClass::IN, DNSResourceRecord::ADDITIONAL);
+    pwR.xfrIP(v4.sin4.sin_addr.s_addr);
+    pwR.commit();
+
+    pwR.addOpt(4096, 0, 0, {{EDNSOptionCode::ECS, ecsOption}});
+    pwR.commit();
+
+    DNSPacketSummary summary;
+    BOOST_CHECK(getDNSPacketSummary(reinterpret_cast<char*>(packet.data()), packet.size(), summary));
+    bool seenAuthSOA = false;
+    BOOST_CHECK_EQUAL(summary.minTTL, getDNSPacketMinTTL(reinterpret_cast<char*>(packet.data()), packet.size(), &seenAuthSOA));
+    BOOST_CHECK_EQUAL(summary.minTTL, 60U);
+    BOOST_CHECK_EQUAL(summary.seenAuthSOA, seenAuthSOA);
+    BOOST_CHECK(summary.seenAuthSOA);
+    BOOST_CHECK_EQUAL(summary.answers, 1U);
+    BOOST_CHECK_EQUAL(summary.authorities, 1U);
+    BOOST_CHECK_EQUAL(summary.additionals, 2U);
+    BOOST_CHECK(summary.hasOPT);
+    BOOST_CHECK(summary.lastIsOPT);
+    BOOST_CHECK_EQUAL(summary.optLen, optLen);
+    BOOST_CHECK_EQUAL(summary.optStart, packet.size() - optLen);
+    BOOST_CHECK(summary.hasECSScope);
+    BOOST_CHECK_EQUAL(summary.ecsScope, 16U);
+  }
+
+  {
+    /* OPT without ECS, followed by a record whose TTL should be ignored, as getDNSPacketMinTTL() does */
+    vector<uint8_t> packet;
+    DNSPacketWriter pwR(packet, name, QType::A, QClass::IN, 0);
+    pwR.getHeader()->qr = 1;
+    pwR.commit();
+
+    pwR.startRecord(name, QType::A, 300, QClass::IN, DNSResourceRecord::ANSWER);
+    pwR.xfrIP(v4.sin4.sin_addr.s_addr);
+    pwR.commit();
+
+    pwR.addOpt(4096, 0, 0);
+    pwR.commit();
+
+    pwR.startRecord(name, QType::A, 1, QClass::IN, DNSResourceRecord::ADDITIONAL);
+    pwR.xfrIP(v4.sin4.sin_addr.s_addr);
+    pwR.commit();
+
+    DNSPacketSummary summary;
+    BOOST_CHECK(getDNSPacketSummary(reinterpret_cast<char*>(packet.data()), packet.size(), summary));
+    BOOST_CHECK_EQUAL(summary.minTTL, getDNSPacketMinTTL(reinterpret_cast<char*>(packet.data()), packet.size(), nullptr));
+    BOOST_CHECK_EQUAL(summary.minTTL, 300U);
+    BOOST_CHECK_EQUAL(summary.additionals, 2U);
+    BOOST_CHECK(summary.hasOPT);
+    BOOST_CHECK(!summary.lastIsOPT);
+    BOOST_CHECK(!summary.hasECSScope);
+  }
+
+  {
+    /* truncated packet, no exception should be raised and the TTL of the records seen so far should be reported */
+    vector<uint8_t> packet;
+    DNSPacketWriter pwR(packet, name, QType::A, QClass::IN, 0);
+    pwR.getHeader()->qr = 1;
+    pwR.commit();
+
+    pwR.startRecord(name, QType::A, 255, QClass::IN, DNSResourceRecord::ANSWER);
+    pwR.xfrIP(v4.sin4.sin_addr.s_addr);
+    pwR.commit();
+
+    pwR.startRecord(name, QType::SOA, 257, QClass::IN, DNSResourceRecord::AUTHORITY);
+    pwR.commit();
+
+    pwR.startRecord(name, QType::A, 254, QClass::IN, DNSResourceRecord::ADDITIONAL);
+    pwR.xfrIP(v4.sin4.sin_addr.s_addr);
+    pwR.commit();
+
+    const size_t truncatedSize = packet.size() - sizeof(uint32_t) - /* rdata length */ sizeof (uint16_t) - /* IPv4 payload in rdata */ 4;
+    DNSPacketSummary summary;
+    BOOST_CHECK(!getDNSPacketSummary(reinterpret_cast<char*>(packet.data()), truncatedSize, summary));
+    BOOST_CHECK(!summary.complete);
+    BOOST_CHECK_EQUAL(summary.minTTL, 255U);
+    BOOST_CHECK(summary.seenAuthSOA);
+    BOOST_CHECK_EQUAL(summary.answers, 1U);
+    BOOST_CHECK_EQUAL(summary.authorities, 1U);
+    BOOST_CHECK_EQUAL(summary.additionals, 0U);
+  }
+}
+
 BOOST_AUTO_TEST_CASE(test_getDNSPacketLength) {
 
   const DNSName name("powerdns.com.");
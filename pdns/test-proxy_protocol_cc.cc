@@ -130,6 +130,54 @@ BOOST_AUTO_TEST_CASE(test_tlv_values_length_signedness) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(test_tlv_values_without_copy) {
+  const std::vector<ProxyProtocolValue> values = { { "foo", 0 }, { "", 42 }, { "bar", 255 }};
+
+  const bool tcp = false;
+  const ComboAddress src("[2001:db8::1]:0");
+  const ComboAddress dest("[::1]:65535");
+  const auto payload = makeProxyHeader(tcp, src, dest, values);
+
+  bool proxy;
+  bool tcp2;
+  ComboAddress src2;
+  ComboAddress dest2;
+  size_t valuesOffset = 0;
+
+  BOOST_CHECK_EQUAL(parseProxyHeader(payload, proxy, src2, dest2, tcp2, valuesOffset), 16 + 36 + 6 + 3 + 6);
+  BOOST_CHECK_EQUAL(proxy, true);
+  BOOST_CHECK_EQUAL(tcp2, tcp);
+  BOOST_CHECK(src2 == src);
+  BOOST_CHECK(dest2 == dest);
+  BOOST_CHECK_EQUAL(valuesOffset, 16U + 36U);
+
+  std::vector<ProxyProtocolValue> parsedValues;
+  visitProxyProtocolValues(payload.data() + valuesOffset, payload.size() - valuesOffset, [&parsedValues](const ProxyProtocolValueView& value) {
+    parsedValues.push_back({std::string(value.content), value.type});
+    return true;
+  });
+  BOOST_CHECK(parsedValues == values);
+
+  /* stop after the first value */
+  size_t visited = 0;
+  visitProxyProtocolValues(payload.data() + valuesOffset, payload.size() - valuesOffset, [&visited](const ProxyProtocolValueView&) {
+    visited++;
+    return false;
+  });
+  BOOST_CHECK_EQUAL(visited, 1U);
+
+  /* forwarding the raw values with different addresses and transport should yield the same header as re-encoding them */
+  const ComboAddress src3("192.0.2.1:53");
+  const ComboAddress dest3("192.0.2.2:5300");
+  BOOST_CHECK_EQUAL(makeProxyHeaderWithRawValues(!tcp, src3, dest3, payload.substr(valuesOffset)), makeProxyHeader(!tcp, src3, dest3, values));
+  BOOST_CHECK_EQUAL(makeProxyHeaderWithRawValues(!tcp, src3, dest3, std::string()), makeProxyHeader(!tcp, src3, dest3, {}));
+
+  /* TLV advertised len gets out of bounds */
+  std::string invalid = payload;
+  invalid.at(16 + 36 + 6 + 3 + 2) += 1;
+  BOOST_CHECK_EQUAL(parseProxyHeader(invalid, proxy, src2, dest2, tcp2, valuesOffset), 0);
+}
+
 BOOST_AUTO_TEST_CASE(test_parsing_invalid_headers) {
   const std::vector<ProxyProtocolValue> noValues;
 
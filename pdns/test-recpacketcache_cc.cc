@@ -11,6 +11,8 @@
 #include "dns_random.hh"
 #include "iputils.hh"
 #include "recpacketcache.hh"
+#include <atomic>
+#include <thread>
 #include <utility>
 
 BOOST_AUTO_TEST_SUITE(test_recpacketcache_cc)
@@ -395,4 +397,98 @@ BOOST_AUTO_TEST_CASE(test_recPacketCache_TCP)
   BOOST_CHECK_EQUAL(fpacket, r1packet);
 }
 
+BOOST_AUTO_TEST_CASE(test_recPacketCache_Shards)
+{
+  /* a cache shared between threads, the entries for a given name end up in different shards */
+  RecursorPacketCache rpc(16);
+  const uint32_t ttd = 3600;
+  const size_t namesPerThread = 200;
+  const size_t threadsCount = 4;
+
+  ::arg().set("rng") = "auto";
+  ::arg().set("entropy-source") = "/dev/urandom";
+
+  auto makeQuery = [](const DNSName& qname, uint16_t qtype) {
+    vector<uint8_t> packet;
+    DNSPacketWriter pw(packet, qname, qtype);
+    pw.getHeader()->rd = true;
+    pw.getHeader()->id = dns_random_uint16();
+    return std::string(reinterpret_cast<const char*>(packet.data()), packet.size());
+  };
+
+  /* Boost.Test assertions are not thread-safe, so the workers only count the unexpected results */
+  std::atomic<size_t> errors{0};
+  auto worker = [&](size_t threadIdx) {
+    string fpacket;
+    uint32_t age = 0;
+    uint32_t qhash = 0;
+    for (size_t idx = 0; idx < namesPerThread; idx++) {
+      const DNSName qname(std::to_string(threadIdx) + "-" + std::to_string(idx) + ".powerdns.com.");
+      for (const auto qtype : {QType::A, QType::AAAA}) {
+        const auto qpacket = makeQuery(qname, qtype);
+        if (rpc.getResponsePacket(0, qpacket, qname, qtype, QClass::IN, time(nullptr), &fpacket, &age, &qhash)) {
+          ++errors;
+        }
+        string rpacket(qpacket);
+        reinterpret_cast<dnsheader*>(&rpacket.at(0))->qr = true;
+        rpc.insertResponsePacket(0, qhash, string(qpacket), qname, qtype, QClass::IN, std::move(rpacket), time(nullptr), ttd, vState::Indeterminate, boost::none, false);
+        if (!rpc.getResponsePacket(0, qpacket, qname, qtype, QClass::IN, time(nullptr), &fpacket, &age, &qhash)) {
+          ++errors;
+        }
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t idx = 0; idx < threadsCount; idx++) {
+    threads.emplace_back(worker, idx);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  BOOST_CHECK_EQUAL(errors.load(), 0U);
+  BOOST_CHECK_EQUAL(rpc.size(), threadsCount * namesPerThread * 2);
+  BOOST_CHECK_EQUAL(rpc.getHits(), threadsCount * namesPerThread * 2);
+  BOOST_CHECK_EQUAL(rpc.getMisses(), threadsCount * namesPerThread * 2);
+
+  /* removing a single name, then a single type, then a whole subtree, has to look into every shard */
+  BOOST_CHECK_EQUAL(rpc.doWipePacketCache(DNSName("0-0.powerdns.com.")), 2);
+  BOOST_CHECK_EQUAL(rpc.doWipePacketCache(DNSName("0-1.powerdns.com."), QType::AAAA), 1);
+  BOOST_CHECK_EQUAL(rpc.size(), threadsCount * namesPerThread * 2 - 3);
+  BOOST_CHECK_EQUAL(rpc.doWipePacketCache(DNSName("powerdns.com."), 0xffff, true), static_cast<int>(threadsCount * namesPerThread * 2 - 3));
+  BOOST_CHECK_EQUAL(rpc.size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_recPacketCache_PruneFewerEntriesThanShards)
+{
+  RecursorPacketCache rpc(16);
+  const uint32_t ttd = 3600;
+  const size_t namesCount = 1000;
+
+  string fpacket;
+  uint32_t age = 0;
+  uint32_t qhash = 0;
+  for (size_t idx = 0; idx < namesCount; idx++) {
+    const DNSName qname(std::to_string(idx) + ".powerdns.com.");
+    vector<uint8_t> packet;
+    DNSPacketWriter pw(packet, qname, QType::A);
+    pw.getHeader()->rd = true;
+    const string qpacket(reinterpret_cast<const char*>(packet.data()), packet.size());
+    BOOST_CHECK(!rpc.getResponsePacket(0, qpacket, qname, QType::A, QClass::IN, time(nullptr), &fpacket, &age, &qhash));
+    string rpacket(qpacket);
+    reinterpret_cast<dnsheader*>(&rpacket.at(0))->qr = true;
+    rpc.insertResponsePacket(0, qhash, string(qpacket), qname, QType::A, QClass::IN, std::move(rpacket), time(nullptr), ttd, vState::Indeterminate, boost::none, false);
+  }
+  BOOST_CHECK_EQUAL(rpc.size(), namesCount);
+
+  /* the limit is spread over the shards, including when it is lower than the number of shards */
+  rpc.doPruneTo(100);
+  BOOST_CHECK_EQUAL(rpc.size(), 100U);
+  rpc.doPruneTo(5);
+  BOOST_CHECK_EQUAL(rpc.size(), 5U);
+  rpc.doPruneTo(0);
+  BOOST_CHECK_EQUAL(rpc.size(), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -861,6 +861,9 @@ const std::map<std::string, MetricDefinition> MetricDefinitionStorage::d_metrics
   {"unexpected-packets",
    MetricDefinition(PrometheusMetricType::counter,
                     "Number of answers from remote servers that were unexpected (might point to spoofing)")},
+  {"udp-out-socket-reuses",
+   MetricDefinition(PrometheusMetricType::counter,
+                    "Number of outgoing UDP queries sent over an already open socket")},
   {"unreachables",
    MetricDefinition(PrometheusMetricType::counter,
                     "Number of times nameservers were unreachable since starting")},
@@ -1279,6 +1279,70 @@ class TestCachingStaleExpungePrevented(DNSDistTest):
 
         self.assertEqual(total, misses)
 
+class TestCachingStaleWhileRevalidate(DNSDistTest):
+
+    _staleCacheTTL = 60
+    _config_params = ['_staleCacheTTL', '_testServerPort']
+    _config_template = """
+    pc = newPacketCache(100, {maxTTL=86400, minTTL=1, temporaryFailureTTL=0, staleTTL=%d, staleWhileRevalidateTTL=600})
+    getPool(""):setCache(pc)
+    newServer{address="127.0.0.1:%d"}
+    """
+    def testCacheStaleWhileRevalidate(self):
+        """
+        Cache: Expired entry is served while being refreshed in the background
+        """
+        misses = 0
+        ttl = 2
+        name = 'stale-while-revalidate.cache.tests.powerdns.com.'
+        query = dns.message.make_query(name, 'A', 'IN')
+        response = dns.message.make_response(query)
+        rrset = dns.rrset.from_text(name,
+                                    ttl,
+                                    dns.rdataclass.IN,
+                                    dns.rdatatype.A,
+                                    '127.0.0.1')
+        response.answer.append(rrset)
+
+        # Miss
+        (receivedQuery, receivedResponse) = self.sendUDPQuery(query, response)
+        self.assertTrue(receivedQuery)
+        self.assertTrue(receivedResponse)
+        receivedQuery.id = query.id
+        self.assertEqual(query, receivedQuery)
+        self.assertEqual(response, receivedResponse)
+        misses += 1
+
+        # we wait for the entry to expire
+        time.sleep(ttl + 1)
+
+        # we should get the stale entry right away, while a refresh query is sent to the backend
+        self._toResponderQueue.put(response, True, self._queueTimeout)
+        (_, receivedResponse) = self.sendUDPQuery(query, response=None, useQueue=False)
+        self.assertEqual(receivedResponse, response)
+        for an in receivedResponse.answer:
+            self.assertEqual(an.ttl, self._staleCacheTTL)
+
+        receivedQuery = self._fromResponderQueue.get(True, self._queueTimeout)
+        receivedQuery.id = query.id
+        self.assertEqual(query, receivedQuery)
+        misses += 1
+
+        # give the response to the refresh query a bit of time to be inserted
+        time.sleep(0.5)
+
+        # the entry should have been refreshed
+        (_, receivedResponse) = self.sendUDPQuery(query, response=None, useQueue=False)
+        self.assertEqual(receivedResponse, response)
+        for an in receivedResponse.answer:
+            self.assertLessEqual(an.ttl, ttl)
+
+        total = 0
+        for key in self._responsesCounter:
+            total += self._responsesCounter[key]
+
+        self.assertEqual(total, misses)
+
 class TestCacheManagement(DNSDistTest):
 
     _consoleKey = DNSDistTest.generateConsoleKey()
@@ -2506,6 +2570,102 @@ class TestCachingScopeZero(DNSDistTest):
             self.checkMessageEDNSWithECS(expectedQuery2, receivedQuery)
             self.checkMessageNoEDNS(receivedResponse, response)
 
+class TestCachingECSScopeSharing(DNSDistTest):
+
+    _config_template = """
+    pc = newPacketCache(100, {maxTTL=86400, minTTL=1, numberOfShards=1, parseECS=true, ecsScopeSharing=true})
+    getPool(""):setCache(pc)
+    newServer{address="127.0.0.1:%d", useClientSubnet=true}
+    -- to simulate a second client coming from a different network,
+    -- we will force the ECS value added to the query if RD is set (note that we need
+    -- to unset it using rules before the first cache lookup)
+    addAction(RDRule(), SetECSAction("127.0.200.1/32"))
+    addAction(RDRule(), SetNoRecurseAction())
+    """
+
+    def testScopeSharedWithinScope(self):
+        """
+        Cache: The answer is shared between clients covered by the returned scope
+        """
+        ttl = 600
+        name = 'scope-sharing.cache.tests.powerdns.com.'
+        query = dns.message.make_query(name, 'AAAA', 'IN')
+        query.flags &= ~dns.flags.RD
+        ecso = clientsubnetoption.ClientSubnetOption('127.0.0.0', 24)
+        expectedQuery = dns.message.make_query(name, 'AAAA', 'IN', use_edns=True, options=[ecso], payload=512)
+        expectedQuery.flags &= ~dns.flags.RD
+        ecsoResponse = clientsubnetoption.ClientSubnetOption('127.0.0.0', 24, 16)
+        expectedResponse = dns.message.make_response(query)
+        scopedResponse = dns.message.make_response(query)
+        scopedResponse.use_edns(edns=True, payload=4096, options=[ecsoResponse])
+        rrset = dns.rrset.from_text(name,
+                                    ttl,
+                                    dns.rdataclass.IN,
+                                    dns.rdatatype.AAAA,
+                                    '::1')
+        scopedResponse.answer.append(rrset)
+        expectedResponse.answer.append(rrset)
+
+        (receivedQuery, receivedResponse) = self.sendUDPQuery(query, scopedResponse)
+        receivedQuery.id = expectedQuery.id
+        self.checkMessageEDNSWithECS(expectedQuery, receivedQuery)
+        self.checkMessageNoEDNS(receivedResponse, expectedResponse)
+
+        # same client, cache hit
+        (_, receivedResponse) = self.sendUDPQuery(query, response=None, useQueue=False)
+        self.checkMessageNoEDNS(receivedResponse, expectedResponse)
+
+        # a different client in 127.0.0.0/16 since RD is now set, should hit the cache as well
+        query = dns.message.make_query(name, 'AAAA', 'IN')
+        query.flags |= dns.flags.RD
+        (_, receivedResponse) = self.sendUDPQuery(query, response=None, useQueue=False)
+        receivedResponse.id = expectedResponse.id
+        self.checkMessageNoEDNS(receivedResponse, expectedResponse)
+
+    def testScopeNotSharedOutsideScope(self):
+        """
+        Cache: The answer is not shared with a client outside of the returned scope
+        """
+        ttl = 600
+        name = 'scope-sharing-narrow.cache.tests.powerdns.com.'
+        query = dns.message.make_query(name, 'AAAA', 'IN')
+        query.flags &= ~dns.flags.RD
+        ecso = clientsubnetoption.ClientSubnetOption('127.0.0.0', 24)
+        expectedQuery = dns.message.make_query(name, 'AAAA', 'IN', use_edns=True, options=[ecso], payload=512)
+        expectedQuery.flags &= ~dns.flags.RD
+        ecsoResponse = clientsubnetoption.ClientSubnetOption('127.0.0.0', 24, 24)
+        expectedResponse = dns.message.make_response(query)
+        scopedResponse = dns.message.make_response(query)
+        scopedResponse.use_edns(edns=True, payload=4096, options=[ecsoResponse])
+        rrset = dns.rrset.from_text(name,
+                                    ttl,
+                                    dns.rdataclass.IN,
+                                    dns.rdatatype.AAAA,
+                                    '::1')
+        scopedResponse.answer.append(rrset)
+        expectedResponse.answer.append(rrset)
+
+        (receivedQuery, receivedResponse) = self.sendUDPQuery(query, scopedResponse)
+        receivedQuery.id = expectedQuery.id
+        self.checkMessageEDNSWithECS(expectedQuery, receivedQuery)
+        self.checkMessageNoEDNS(receivedResponse, expectedResponse)
+
+        # a client in 127.0.200.0/24 is not covered by 127.0.0.0/24, the query should reach the backend
+        query = dns.message.make_query(name, 'AAAA', 'IN')
+        query.flags |= dns.flags.RD
+        ecso = clientsubnetoption.ClientSubnetOption('127.0.200.1', 32)
+        expectedQuery = dns.message.make_query(name, 'AAAA', 'IN', use_edns=True, options=[ecso], payload=512)
+        expectedQuery.flags &= ~dns.flags.RD
+        expectedResponse = dns.message.make_response(query)
+        expectedResponse.answer.append(rrset)
+        response = dns.message.make_response(query)
+        response.answer.append(rrset)
+        (receivedQuery, receivedResponse) = self.sendUDPQuery(query, response)
+        self.assertTrue(receivedQuery)
+        receivedQuery.id = expectedQuery.id
+        self.checkMessageEDNSWithECS(expectedQuery, receivedQuery)
+        self.checkMessageNoEDNS(receivedResponse, expectedResponse)
+
 class TestCachingScopeZeroButNoSubnetcheck(DNSDistTest):
 
     _config_template = """
@@ -298,3 +298,70 @@ class TestAdvancedLuaFFIPerThread(DNSDistTest):
             sender = getattr(self, method)
             (_, receivedResponse) = sender(query, response=None, useQueue=False)
             self.assertEqual(receivedResponse, response)
+
+class TestAdvancedLuaFFIBatch(DNSDistTest):
+
+    _config_template = """
+    setUDPMultipleMessagesVectorSize(16)
+    setUDPBatchFFIFunction([[
+      local ffi = require("ffi")
+      local C = ffi.C
+
+      return function(batch)
+        local count = tonumber(C.dnsdist_ffi_batch_get_count(batch))
+        local queries = C.dnsdist_ffi_batch_get_queries(batch)
+        local verdicts = C.dnsdist_ffi_batch_get_verdicts(batch)
+        for idx = 0, count - 1 do
+          local query = queries[idx]
+          if query.qname ~= nil and query.qtype == DNSQType.ANY and query.sourceSize == 4 then
+            verdicts[idx] = C.dnsdist_ffi_batch_verdict_refused
+          end
+        end
+      end
+    ]])
+    newServer{address="127.0.0.1:%s"}
+    """
+
+    def testAdvancedLuaFFIBatchRefused(self):
+        """
+        Lua FFI: Test the Lua FFI batch interface (refused)
+        """
+        name = 'refused.luaffibatch.advanced.tests.powerdns.com.'
+        query = dns.message.make_query(name, 'ANY', 'IN')
+        # dnsdist set RA = RD for spoofed responses
+        query.flags &= ~dns.flags.RD
+        expectedResponse = dns.message.make_response(query)
+        expectedResponse.set_rcode(dns.rcode.REFUSED)
+
+        (_, receivedResponse) = self.sendUDPQuery(query, response=None, useQueue=False)
+        self.assertEqual(receivedResponse, expectedResponse)
+
+        # the batch function is only called for queries received over UDP
+        response = dns.message.make_response(query)
+        (receivedQuery, receivedResponse) = self.sendTCPQuery(query, response)
+        self.assertTrue(receivedQuery)
+        receivedQuery.id = query.id
+        self.assertEqual(query, receivedQuery)
+        self.assertEqual(receivedResponse, response)
+
+    def testAdvancedLuaFFIBatchPassThrough(self):
+        """
+        Lua FFI: Test the Lua FFI batch interface (no verdict)
+        """
+        name = 'passthrough.luaffibatch.advanced.tests.powerdns.com.'
+        query = dns.message.make_query(name, 'A', 'IN')
+        response = dns.message.make_response(query)
+        rrset = dns.rrset.from_text(name,
+                                    60,
+                                    dns.rdataclass.IN,
+                                    dns.rdatatype.A,
+                                    '192.0.2.1')
+        response.answer.append(rrset)
+
+        for method in ("sendUDPQuery", "sendTCPQuery"):
+            sender = getattr(self, method)
+            (receivedQuery, receivedResponse) = sender(query, response)
+            self.assertTrue(receivedQuery)
+            receivedQuery.id = query.id
+            self.assertEqual(query, receivedQuery)
+            self.assertEqual(receivedResponse, response)
@@ -275,6 +275,30 @@ class TestOpenSSL(DNSDistTest, TLSTests):
     def testProvider(self):
         self.assertEquals(self.getTLSProvider(), "openssl")
 
+class TestOpenSSLKTLS(DNSDistTest, TLSTests):
+
+    _consoleKey = DNSDistTest.generateConsoleKey()
+    _consoleKeyB64 = base64.b64encode(_consoleKey).decode('ascii')
+    _serverKey = 'server.key'
+    _serverCert = 'server.chain'
+    _serverName = 'tls.tests.dnsdist.org'
+    _caCert = 'ca.pem'
+    _tlsServerPort = 8453
+    # kTLS might not be available on the system running the tests, in which case
+    # OpenSSL falls back to userspace encryption and everything should still work
+    _config_template = """
+    setKey("%s")
+    controlSocket("127.0.0.1:%s")
+
+    newServer{address="127.0.0.1:%s"}
+    addTLSLocal("127.0.0.1:%s", "%s", "%s", { provider="openssl", ktls=true })
+    addAction(SNIRule("powerdns.com"), SpoofAction("1.2.3.4"))
+    """
+    _config_params = ['_consoleKeyB64', '_consolePort', '_testServerPort', '_tlsServerPort', '_serverCert', '_serverKey']
+
+    def testProvider(self):
+        self.assertEquals(self.getTLSProvider(), "openssl")
+
 class TestGnuTLS(DNSDistTest, TLSTests):
 
     _consoleKey = DNSDistTest.generateConsoleKey()
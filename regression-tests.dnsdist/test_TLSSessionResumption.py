@@ -291,3 +291,48 @@ class TestTLSSessionResumptionDOT(DNSDistTLSSessionResumptionTest):
         # reload from file 2, the latest session should resume
         self.sendConsoleCommand("getTLSContext(0):loadTicketsKeys('/tmp/ticketKeys.2')")
         self.assertTrue(self.checkSessionResumed('127.0.0.1', self._tlsServerPort, self._serverName, self._caCert, '/tmp/session.dot.2', '/tmp/session.dot.2', allowNoTicket=True))
+
+class TestTLSSessionResumptionSharedKeysFileDOT(DNSDistTLSSessionResumptionTest):
+
+    _serverKey = 'server.key'
+    _serverCert = 'server.chain'
+    _serverName = 'tls.tests.dnsdist.org'
+    _caCert = 'ca.pem'
+    _tlsServerPort = 8443
+    _numberOfKeys = 5
+    _ticketKeysFile = '/tmp/ticketKeys.shared'
+    _config_template = """
+    setKey("%s")
+    controlSocket("127.0.0.1:%s")
+    newServer{address="127.0.0.1:%s"}
+
+    rotateTicketsKeyFile("%s", %d)
+    addTLSLocal("127.0.0.1:%s", "%s", "%s", { provider="openssl", numberOfTicketsKeys=%d, ticketKeyFile="%s", ticketKeyFileCheckInterval=1 })
+    """
+    _config_params = ['_consoleKeyB64', '_consolePort', '_testServerPort', '_ticketKeysFile', '_numberOfKeys', '_tlsServerPort', '_serverCert', '_serverKey', '_numberOfKeys', '_ticketKeysFile']
+
+    def testSessionResumption(self):
+        """
+        Session Resumption: DoT with a shared, externally rotated, keys file
+        """
+        self.assertFalse(self.checkSessionResumed('127.0.0.1', self._tlsServerPort, self._serverName, self._caCert, '/tmp/session.shared.dot', None))
+        self.assertTrue(self.checkSessionResumed('127.0.0.1', self._tlsServerPort, self._serverName, self._caCert, '/tmp/session.shared.dot', '/tmp/session.shared.dot', allowNoTicket=True))
+
+        # rotate the keys in the file several times, the previously active one is still there
+        for _ in range(self._numberOfKeys - 1):
+            self.sendConsoleCommand("rotateTicketsKeyFile('%s', %d)" % (self._ticketKeysFile, self._numberOfKeys))
+        # wait for the file to be checked again
+        time.sleep(1.5)
+
+        # the session should be resumed and a new ticket, encrypted with the newly active key, should be stored
+        self.assertTrue(self.checkSessionResumed('127.0.0.1', self._tlsServerPort, self._serverName, self._caCert, '/tmp/session.shared.dot', '/tmp/session.shared.dot'))
+
+        # rotate all the keys in the file
+        for _ in range(self._numberOfKeys):
+            self.sendConsoleCommand("rotateTicketsKeyFile('%s', %d)" % (self._ticketKeysFile, self._numberOfKeys))
+        time.sleep(1.5)
+
+        # we should not be able to resume
+        self.assertFalse(self.checkSessionResumed('127.0.0.1', self._tlsServerPort, self._serverName, self._caCert, '/tmp/session.shared.dot', '/tmp/session.shared.dot'))
+        # but now we can
+        self.assertTrue(self.checkSessionResumed('127.0.0.1', self._tlsServerPort, self._serverName, self._caCert, '/tmp/session.shared.dot', '/tmp/session.shared.dot', allowNoTicket=True))